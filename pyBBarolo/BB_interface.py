@@ -35,6 +35,7 @@ except OSError:
 
 # Type definitions
 array_1d_int    = ndpointer(dtype=np.int64, ndim=1,flags="CONTIGUOUS")
+array_1d_int32  = ndpointer(dtype=np.int32, ndim=1,flags="CONTIGUOUS")
 array_1d_float  = ndpointer(dtype=np.float32, ndim=1,flags="CONTIGUOUS")
 array_1d_double = ndpointer(dtype=np.double, ndim=1,flags="CONTIGUOUS")
 
@@ -121,9 +122,9 @@ libBB.Galfit_getModelSize.restype = None
 libBB.Galfit_getModelSize.argtypes = [c_void_p,c_void_p,POINTER(c_int),POINTER(c_int)]
 libBB.Galfit_setOutRings.restype = None
 libBB.Galfit_setOutRings.argtypes = [c_void_p,c_void_p]
-libBB.Galfit_writeModel.restype = None
+libBB.Galfit_writeModel.restype = c_bool
 libBB.Galfit_writeModel.argtypes = [c_void_p,c_char_p,c_bool]
-libBB.Galfit_writeOutputs.restype = None
+libBB.Galfit_writeOutputs.restype = c_bool
 libBB.Galfit_writeOutputs.argtypes = [c_void_p,c_void_p,c_void_p,c_bool]
 libBB.Galfit_plotModel.restype = c_int
 libBB.Galfit_plotModel.argtypes = [c_void_p]
@@ -166,6 +167,9 @@ libBB.Fit2D_compute.restype = None
 libBB.Fit2D_compute.argtypes = [c_void_p]
 libBB.Fit2D_write.restype = None
 libBB.Fit2D_write.argtypes = [c_void_p,c_void_p,c_char_p]
+libBB.Fit2D_batch.restype = c_long
+libBB.Fit2D_batch.argtypes = [c_int,array_1d_float,array_1d_int32,array_1d_int32,array_1d_float,\
+                              c_char_p,c_char_p,c_int,c_float,c_int,array_1d_float,c_int]
 ########################################################################################
 
 
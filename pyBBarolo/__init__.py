@@ -1,4 +1,4 @@
-__all__ = ['GalMod','GalWind','FitMod3D','Search','FitMod2D','Ellprof']
+__all__ = ['GalMod','GalWind','FitMod3D','Search','FitMod2D','fit2D_batch','Ellprof']
 
 from .pyBBarolo import *
 from ._version import __version__ as version
@@ -504,7 +504,8 @@ class BayesianBBarolo(FitMod3D):
         
         if self.useBBres:
             # Writing the model and plots to the output directory
-            libBB.Galfit_writeModel(self._galfit,"AZIM".encode('utf-8'),plots)
+            if not libBB.Galfit_writeModel(self._galfit,"AZIM".encode('utf-8'),plots):
+                raise IOError("ERROR: the best model could not be written.")
         
         else:
             
@@ -525,7 +526,8 @@ class BayesianBBarolo(FitMod3D):
                 libBB.Galmod_set_array(galmod,np.ravel(mod).astype('float32'))
             
             # Writing all the outputs
-            libBB.Galfit_writeOutputs(self._galfit,galmod,self._ellprof,plots)
+            if not libBB.Galfit_writeOutputs(self._galfit,galmod,self._ellprof,plots):
+                raise IOError("ERROR: the outputs of the best model could not be written.")
         
         vprint(verbose,"Done!")
 
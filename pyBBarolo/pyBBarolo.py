@@ -708,7 +708,8 @@ class FitMod3D(Model3D):
         if (self._opts['twostage'][0]): libBB.Galfit_secondStage(self._mod);
         
         # Write models
-        libBB.Galfit_writeModel(self._mod,self._opts['norm'][0].encode('utf-8'),False)
+        if not libBB.Galfit_writeModel(self._mod,self._opts['norm'][0].encode('utf-8'),False):
+            raise IOError("3DFIT ERROR: the model could not be written in %s."%self._opts['outfolder'][0])
         
         # Loading final rings
         try: self.bfit = np.genfromtxt(self._opts['outfolder'][0]+"/rings_final2.txt")
@@ -718,7 +719,7 @@ class FitMod3D(Model3D):
         for fname in os.listdir(self._opts['outfolder'][0]):
             if "mod_%s.fits"%(self._opts['norm'][0].lower()) in fname:
                 filefits = self._opts['outfolder'][0]+"/"+fname
-        self.outmodel = fits.open(filefits)[0]
+        self.outmodel = fits.open(filefits)[-1]
         
         return (self.bfit, self.outmodel)
         
@@ -926,6 +927,70 @@ class FitMod2D(Task):
 
 
 
+def fit2D_batch(vfields,rings,free='VROT',side='B',wfunc=2,freeangle=15.,nseeds=1,threads=1):
+    """Fit 2D tilted-ring models to many velocity fields in one call
+    
+    The velocity fields are fitted in parallel by the C++ code, without 
+    writing any file. As in FitMod2D, N radii define N-1 rings, ring i 
+    being at radii[i] with width radii[i+1]-radii[i].
+    
+    Args:
+      vfields (list):   Velocity fields in km/s (2D arrays, NaN for blank pixels)
+      rings (list):     For each velocity field, a dictionary with the initial rings:
+                        'radii' (array, in pixels), 'xpos', 'ypos', 'vsys', 'vrot', 
+                        'inc', 'phi' and, optionally, 'vrad' (float or array)
+      free (str):       Free parameters
+      side (str):       Which side of the galaxies to fit: 'A', 'R' or 'B'
+      wfunc (int):      Weighting function for major axis
+      freeangle (float):Angle around the minor axis to exclude (degrees)
+      nseeds (int):     Initial guesses to fit for each ring
+      threads (int):    Number of threads
+    
+    Returns:
+      dict: the best-fit rings of all velocity fields, by column. 'field' is the index 
+            of the velocity field of each ring, errors are in the '*_err' columns.
+    """
+    if len(vfields)!=len(rings):
+        raise ValueError("fit2D_batch ERROR: vfields and rings must have the same length.")
+    if str(side).upper() not in ['A','R','B']:
+        raise ValueError("fit2D_batch ERROR: side can only be 'A' (approaching),'R' (receding) or 'B' (both).")
+    
+    pnames = ['vsys','vrot','vrad','phi','inc','xpos','ypos']
+    npar = len(pnames)
+    
+    dims, nrings, cols = [], [], [[] for i in range(2+npar)]
+    for vf, ri in zip(vfields,rings):
+        if np.ndim(vf)!=2: raise ValueError("fit2D_batch ERROR: velocity fields must be 2D arrays.")
+        if not isIterable(ri['radii']): raise ValueError("fit2D_batch ERROR: radii must be an array.")
+        rad = np.asarray(ri['radii'],dtype=np.float32)
+        nr  = max(len(rad)-1,0)
+        dims += [vf.shape[1],vf.shape[0]]
+        nrings.append(nr)
+        cols[0].append(rad[:nr])
+        cols[1].append(np.diff(rad))
+        for i, p in enumerate(pnames):
+            val = ri.get(p,0.)
+            cols[2+i].append(np.resize(np.asarray(val,dtype=np.float32),len(rad))[:nr])
+    
+    ntot = sum(nrings)
+    vf  = np.concatenate([np.ravel(v).astype(np.float32) for v in vfields])
+    inr = np.concatenate([np.concatenate(c) for c in cols]).astype(np.float32)
+    out = np.zeros((2*npar+2)*ntot,dtype=np.float32)
+    
+    libBB.Fit2D_batch(len(vfields),vf,np.array(dims,dtype=np.int32),np.array(nrings,dtype=np.int32),inr,\
+                      free.encode('utf-8'),side.encode('utf-8'),int(wfunc),float(freeangle),int(nseeds),out,int(threads))
+    
+    out = out.reshape(2*npar+2,ntot)
+    res = {'field': np.repeat(np.arange(len(vfields)),nrings), 'rad': inr[:ntot]}
+    for i, p in enumerate(pnames):
+        res[p] = out[i]
+        res[p+'_err'] = out[npar+i]
+    res['npts'] = out[2*npar].astype(np.int64)
+    res['chisq'] = out[2*npar+1]
+    return res
+
+
+
 class Ellprof(Task):
     """Find statistics over rings
     
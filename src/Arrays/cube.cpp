@@ -26,22 +26,109 @@
 #include <sstream>
 #include <iomanip>
 #include <filesystem>
+#include <cstring>
+#include <cstdint>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <Arrays/cube.hh>
 #include <Arrays/image.hh>
 #include <Arrays/stats.hh>
 #include <Map/detection.hh>
 #include <Tasks/smooth3D.hh>
+#include <Tasks/reconstruct.hh>
 #include <Tasks/moment.hh>
 #include <Utilities/utils.hh>
 #include <Utilities/progressbar.hh>
 #include <Utilities/gnuplot.hh>
 #include <Utilities/lsqfit.hh>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+std::mutex fitsReadMutex;                   // Serializes CFITSIO reads when CFITSIO is not reentrant
+
+bool inParallel() {
+#ifdef _OPENMP
+    return omp_in_parallel();
+#else
+    return false;
+#endif
+}
+
+template <class T>
+bool readFitsBox(fitsfile *fptr, T *out, const long *origin, const long *blc, const long *trc) {
+
+    // Reads the box [blc,trc] (0-based, edges included, relative to the
+    // region starting at "origin") of an open FITS image into "out".
+    // All the axes beyond the spectral one are read at pixel 1.
+
+    int status=0, anynul, naxis;
+    char ctype3[FLEN_VALUE] = "";
+    fits_get_img_dim(fptr, &naxis, &status);
+    if (naxis>3) fits_read_key(fptr, TSTRING, "CTYPE3", ctype3, NULL, &status);
+    status = 0;
+
+    // Spectral axis of the FITS file: after a STOKES axis, as in readCube().
+    int zaxis = naxis>3 && makelower(std::string(ctype3)).find("stokes")!=std::string::npos ? 3 : 2;
+    std::vector<long> fpixel(std::max(naxis,3),1), lpixel(std::max(naxis,3),1), inc(std::max(naxis,3),1);
+    fpixel[0] = origin[0]+blc[0]+1; lpixel[0] = origin[0]+trc[0]+1;
+    fpixel[1] = origin[1]+blc[1]+1; lpixel[1] = origin[1]+trc[1]+1;
+    fpixel[zaxis] = origin[2]+blc[2]+1; lpixel[zaxis] = origin[2]+trc[2]+1;
+
+    if (fits_read_subset(fptr, selectDatatype<T>(), fpixel.data(), lpixel.data(), inc.data(),
+                         NULL, out, &anynul, &status)) {
+        fits_report_error(stderr, status);
+        return false;
+    }
+    return true;
+}
+
+// A FITS file kept open by a thread, to read the tiles of a cube on demand
+// without opening the file at every tile.
+struct FitsHandle {
+    std::string name;
+    fitsfile *fptr = nullptr;
+
+    fitsfile* get(const std::string &fname) {
+        if (fptr!=nullptr && name==fname) return fptr;
+        close();
+        int status = 0;
+        if (fits_open_image(&fptr, fname.c_str(), READONLY, &status)) {
+            fits_report_error(stderr, status);
+            fptr = nullptr;
+        }
+        name = fname;
+        return fptr;
+    }
+    void close() {
+        int status = 0;
+        if (fptr!=nullptr) fits_close_file(fptr, &status);
+        fptr = nullptr;
+    }
+    ~FitsHandle() {
+        std::unique_lock<std::mutex> lock(fitsReadMutex,std::defer_lock);
+        if (!fits_is_reentrant()) lock.lock();
+        close();
+    }
+};
+}
+
 template <class T>
 void Cube<T>::defaults() {
     
     numAxes = 3;
     arrayAllocated = false;
+    arrayMapped = false;
+    mapBase = nullptr;
+    mapData = nullptr;
+    lazyHeld = false;
+    boxRead = false;
+    origin[0] = origin[1] = origin[2] = 0;
     headDefined = false; 
     axisDimAllocated = false; 
     statsDefined = false;
@@ -54,8 +141,7 @@ void Cube<T>::defaults() {
 template <class T>
 Cube<T>::~Cube () {
     
-    if (arrayAllocated) delete [] array;
-    arrayAllocated=false;
+    freeArray();
     if (maskAllocated)  delete [] mask;
     maskAllocated=false;
     if (axisDimAllocated) delete [] axisDim;
@@ -116,7 +202,7 @@ Cube<T>& Cube<T>::operator=(const Cube<T> &c) {
     
     if(this==&c) return *this;
     
-    if(this->arrayAllocated) delete [] array;
+    this->freeArray();
     if(this->axisDimAllocated) delete [] axisDim;
     if(this->maskAllocated) delete [] mask;
     
@@ -124,13 +210,16 @@ Cube<T>& Cube<T>::operator=(const Cube<T> &c) {
     this->numAxes   = c.numAxes;
     this->par       = c.par;
     
+    this->boxRead   = c.boxRead;
+    for (int i=0; i<3; i++) this->origin[i] = c.origin[i];
+
     this->axisDimAllocated = c.axisDimAllocated;
     if (axisDimAllocated) {
         this->axisDim = new int [numAxes];
         for (short i=0; i<numAxes;  i++) this->axisDim[i] = c.axisDim[i];
     }
     
-    this->arrayAllocated = c.arrayAllocated;
+    this->arrayAllocated = c.arrayAllocated.load();
     if(this->arrayAllocated) {
         this->array = new T[this->numPix];
         for(size_t i=0; i<this->numPix; i++) this->array[i] = c.array[i];
@@ -146,6 +235,10 @@ Cube<T>& Cube<T>::operator=(const Cube<T> &c) {
     if (this->headDefined) this->head = c.head;
     this->statsDefined = c.statsDefined;
     if (this->statsDefined) this->stats = c.stats;
+    this->noise = c.noise;
+    this->packed = c.packed;
+    this->cache.clear();
+    if (c.cache.isDefined()) defineCache();
     this->isSearched = c.isSearched;
     if (this->isSearched)
         *this->sources = *c.sources;
@@ -198,7 +291,10 @@ void Cube<T>::checkBeam() {
 template <class T>
 void Cube<T>::setCube (T *input, int *dim) {
 
-    if (arrayAllocated) delete [] array;
+    freeArray();
+    packed.clear();
+    cache.clear();
+    lazyHeld = false;
     if (axisDimAllocated) delete [] axisDim;
     numAxes = 3;
     axisDim = new int [numAxes];
@@ -213,7 +309,7 @@ void Cube<T>::setCube (T *input, int *dim) {
 
 
 template <class T>
-bool Cube<T>::readCube (std::string fname, bool printInfo) {
+bool Cube<T>::readCube (std::string fname, bool printInfo, bool readArray) {
     
     par.setImageFile(fname);
     numAxes = 3;
@@ -253,6 +349,56 @@ bool Cube<T>::readCube (std::string fname, bool printInfo) {
         axisDim[2] = head.DimAx(2);
     }
 
+    // Only the sub-region given by BOX (0-based pixels, upper edges excluded)
+    // is read. Header is adjusted accordingly and BOX is reset. From now on,
+    // pixel coordinates refer to the region read: this includes the pixel
+    // positions in ring files and the pixel coordinates of all outputs
+    // (detections, rings, maps), while world coordinates are unchanged.
+    boxRead = false;
+    for (int i=0; i<3; i++) {
+        int lo = par.getBOX(2*i), hi = par.getBOX(2*i+1);
+        if (lo<0 || lo>=axisDim[i]) lo = 0;
+        if (hi<=lo || hi>axisDim[i]) hi = axisDim[i];
+        origin[i] = lo;
+        if (lo==0 && hi==axisDim[i]) continue;
+        boxRead = true;
+        axisDim[i] = hi-lo;
+        if (i<head.NumAx()) {
+            head.setCrpix(i,head.Crpix(i)-lo);
+            head.setDimAx(i,axisDim[i]);
+        }
+    }
+    if (boxRead) {
+        head.updateWCS();
+        for (int i=0; i<6; i++) par.setBOX(i,-1);
+
+        // Positions given in pixels refer to the whole FITS file, so they
+        // are moved to the region read. Positions in world coordinates are
+        // converted with the cropped header and need no change.
+        auto shiftPix = [](std::string s, long o) {
+            if (s=="-1" || s.find_first_of("dD:(")!=std::string::npos) return s;
+            return to_string(atof(s.c_str())-o);
+        };
+        GALFIT_PAR &gf = par.getParGF();
+        gf.XPOS = shiftPix(gf.XPOS,origin[0]);
+        gf.YPOS = shiftPix(gf.YPOS,origin[1]);
+        par.setXPOS_PV(shiftPix(par.getXPOS_PV(),origin[0]));
+        par.setYPOS_PV(shiftPix(par.getYPOS_PV(),origin[1]));
+        if (par.getP1_PV(0)>=0 && par.getP1_PV(1)>=0 && par.getP2_PV(0)>=0 && par.getP2_PV(1)>=0) {
+            for (int i=0; i<2; i++) {
+                par.setP1_PV(i,par.getP1_PV(i)-origin[i]);
+                par.setP2_PV(i,par.getP2_PV(i)-origin[i]);
+            }
+        }
+
+        if (printInfo) {
+            std::cout << "Reading only the region x=[" << origin[0] << "," << origin[0]+axisDim[0]-1
+                      << "], y=[" << origin[1] << "," << origin[1]+axisDim[1]-1 << "], z=["
+                      << origin[2] << "," << origin[2]+axisDim[2]-1 << "] of the cube. "
+                      << "Pixel coordinates of outputs refer to this region.\n";
+        }
+    }
+
     // I do not like the following lines, redshift, wave0 and veldef should not 
     // be stored in Header(). I should think something better
     head.setRedshift(par.getRedshift());
@@ -281,7 +427,7 @@ bool Cube<T>::readCube (std::string fname, bool printInfo) {
     
     // Reading in fits array
     numPix = size_t(axisDim[0])*size_t(axisDim[1])*size_t(axisDim[2]);
-    if (!fitsread_3d()) return false;
+    if (readArray && !fitsread_3d()) return false;
     
     if (printInfo) {
         // Giving some information on conversion factors that will be used
@@ -350,12 +496,52 @@ bool Cube<T>::fitsread_3d() {
                   << sizeof(T)*numPix/1048576. << " MB)... " << std::flush;
     }
 
+    if (par.getPackCube()!="NONE") {
+        if (!fitsread_packed()) return false;
+        if (par.isVerbose()) std::cout << "Done (" << packed.Type() << ", " << fixed << setprecision(1)
+                                       << packed.bytes()/1048576. << " MB). \n\n";
+        return true;
+    }
+
+    if (par.getMapCube()) {
+        if (fitsmap_3d()) {
+            if (par.isVerbose()) {
+                if (arrayMapped) std::cout << "Done (memory-mapped). \n\n";
+                else std::cout << "Done (memory-mapped, read on demand in tiles of " << cache.TileDim(0) << "x"
+                               << cache.TileDim(1) << "x" << cache.TileDim(2) << " pixels). \n\n";
+            }
+            return true;
+        }
+        else if (par.isVerbose()) std::cout << "cannot memory-map, reading... " << std::flush;
+    }
+
+    if (par.getCacheMB()>0) {
+        defineCache();
+        if (par.isVerbose()) std::cout << "Done (read on demand in tiles of " << cache.TileDim(0) << "x"
+                                       << cache.TileDim(1) << "x" << cache.TileDim(2) << " pixels). \n\n";
+        return true;
+    }
+
     // Open the FITS file
     status = 0;
-    if(fits_open_file(&fptr3, par.getImageFile().c_str(), READONLY, &status) ){
+    if(fits_open_image(&fptr3, par.getImageFile().c_str(), READONLY, &status) ){
       fits_report_error(stderr, status);
       return false;
     }
+    int compressed = fits_is_compressed_image(fptr3, &status);
+    status = 0;
+
+    if (boxRead || compressed) {
+        // Only the region given by BOX is read from the file. Tile-compressed
+        // cubes go the same way, so that tiles are decompressed in parallel.
+        fits_close_file(fptr3, &status);
+        if (!arrayAllocated) array = new T[numPix];
+        arrayAllocated = true;
+        long blc[3] = {0,0,0}, trc[3] = {axisDim[0]-1,axisDim[1]-1,axisDim[2]-1};
+        if (!fitsread_subset(array,blc,trc,compressed)) return false;
+        if (par.isVerbose()) std::cout << "Done. \n\n";
+        return true;
+    }
 
     // Read elements from the FITS data array    
     if (!arrayAllocated) array = new T[numPix];
@@ -385,13 +571,384 @@ bool Cube<T>::fitsread_3d() {
 
 
 template <class T>
-bool Cube<T>::fitswrite_3d(const char *outfile, bool fullHead) {
-    
+bool Cube<T>::fitsmap_3d() {
+
+    /// Maps in memory the channels of an uncompressed BITPIX=-32 FITS file
+    /// that are to be read (all, or those of BOX), instead of reading them
+    /// (float cubes only). The mapping is private, so the file is never
+    /// written, and its pages are read on demand and shared with other
+    /// processes until they are modified.
+    ///
+    /// FITS data are big-endian. On big-endian machines, if the whole planes
+    /// are read, the mapping is writable (copy-on-write) and is the array
+    /// itself: tasks that change the array only copy the pages they write.
+    /// NaNs are set to 0 in place, so only the pages holding them are copied.
+    /// Otherwise (little-endian machines, or a BOX smaller than the planes),
+    /// the mapping is read-only and the cube is read on demand through the
+    /// tile cache (see defineCache), whose tiles are byte-swapped from the
+    /// mapping, as are slabs and channels (see readSubset). The whole array
+    /// is decoded from the mapping only if a task asks for it.
+    /// Returns false if the file cannot be mapped.
+
+    const size_t mapCacheBytes = 1<<28;     // Tile cache, if CACHEMB is not given
+
+    if (selectDatatype<T>()!=TFLOAT || sizeof(T)!=sizeof(uint32_t)) return false;
+
+    fitsfile *fptr;
+    int status=0, keystat=0, bitpix=0, compressed=0, naxis=0;
+    long naxes[4] = {1,1,1,1};
+    LONGLONG headstart, datastart, dataend;
+    double bscale=1, bzero=0;
+    char ctype3[FLEN_VALUE] = "";
+
+    if (fits_open_file(&fptr, par.getImageFile().c_str(), READONLY, &status)) return false;
+    fits_get_img_type(fptr, &bitpix, &status);
+    fits_get_img_dim(fptr, &naxis, &status);
+    fits_get_img_size(fptr, std::min(naxis,4), naxes, &status);
+    compressed = fits_is_compressed_image(fptr, &status);
+    fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend, &status);
+    fits_read_key(fptr, TDOUBLE, "BSCALE", &bscale, NULL, &keystat);
+    keystat = 0;
+    fits_read_key(fptr, TDOUBLE, "BZERO", &bzero, NULL, &keystat);
+    keystat = 0;
+    if (naxis>3) fits_read_key(fptr, TSTRING, "CTYPE3", ctype3, NULL, &keystat);
+    fits_close_file(fptr, &keystat);
+
+    // Channels are whole planes of the file, unless they are interleaved
+    // with a STOKES axis.
+    bool stokes3 = naxis>3 && naxes[2]>1 && makelower(std::string(ctype3)).find("stokes")!=std::string::npos;
+    size_t plane = size_t(naxes[0])*naxes[1];
+    size_t first = datastart+origin[2]*plane*sizeof(T);
+    size_t nbytes = axisDim[2]*plane*sizeof(T);
+    if (status || bitpix!=FLOAT_IMG || compressed || bscale!=1 || bzero!=0 || stokes3 ||
+        size_t(dataend)<first+nbytes) return false;
+
+    // Only plain FITS files on disk can be mapped (e.g. not gzipped files
+    // or files opened with the CFITSIO extended syntax).
+    int fd = open(par.getImageFile().c_str(), O_RDONLY);
+    if (fd<0) return false;
+    char magic[6];
+    struct stat sb;
+    if (pread(fd,magic,6,0)!=6 || strncmp(magic,"SIMPLE",6)!=0 || fstat(fd,&sb)!=0 ||
+        size_t(sb.st_size)<first+nbytes) {
+        close(fd);
+        return false;
+    }
+
+    const uint16_t one = 1;
+    bool littleEndian = *reinterpret_cast<const char*>(&one)==1;
+    bool wholePlanes = origin[0]==0 && origin[1]==0 && axisDim[0]==naxes[0] && axisDim[1]==naxes[1];
+    bool asArray = !littleEndian && wholePlanes;
+
+    // Mappings must start on a page boundary
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t offset = first-first%page;
+    size_t size = first-offset+nbytes;
+    int prot = asArray ? PROT_READ|PROT_WRITE : PROT_READ;
+    void *base = mmap(NULL, size, prot, MAP_PRIVATE, fd, offset);
+    close(fd);
+    if (base==MAP_FAILED) return false;
+
+    freeArray();
+    mapBase = base;
+    mapSize = size;
+    mapData = static_cast<char*>(base)+(first-offset);
+    mapDim[0] = naxes[0];
+    mapDim[1] = naxes[1];
+    mapSwap = littleEndian;
+
+    if (!asArray) {
+        cache.define(axisDim[0],axisDim[1],axisDim[2],par.getCacheMB()>0 ? size_t(par.getCacheMB())<<20 : mapCacheBytes,
+                     [this](T *out, long *blc, long *trc) {return mapRead(out,blc,trc);});
+        return true;
+    }
+
+    // Big-endian host: the mapping is the array, only NaNs are written
+    array = reinterpret_cast<T*>(mapData);
+    arrayAllocated = arrayMapped = true;
+    int nthreads = par.getThreads();
+#pragma omp parallel for num_threads(nthreads)
+    for (size_t i=0; i<numPix; i++) {
+        uint32_t word;
+        memcpy(&word, array+i, sizeof(word));
+        if ((word&0x7f800000)==0x7f800000 && (word&0x007fffff)) array[i] = 0;
+    }
+
+    return true;
+}
+
+
+template <class T>
+bool Cube<T>::mapRead(T *out, long *blc, long *trc) {
+
+    /// Copies the box [blc,trc] (0-based, edges included) from the memory
+    /// mapping of the FITS file into "out", swapping the bytes on
+    /// little-endian machines and setting NaNs to 0.
+
+    const size_t minParallel = 1<<20;       // Pixels to copy before using several threads
+
+    size_t nx = trc[0]-blc[0]+1, ny = trc[1]-blc[1]+1, nz = trc[2]-blc[2]+1;
+    size_t plane = size_t(mapDim[0])*mapDim[1];
+    const uint32_t *data = reinterpret_cast<const uint32_t*>(mapData);
+    bool swap = mapSwap;
+
+#pragma omp parallel for num_threads(par.getThreads()) collapse(2) if(nx*ny*nz>minParallel)
+    for (size_t z=0; z<nz; z++) {
+        for (size_t y=0; y<ny; y++) {
+            const uint32_t *src = data+(blc[2]+z)*plane+(origin[1]+blc[1]+y)*mapDim[0]+origin[0]+blc[0];
+            T *dest = out+(y+z*ny)*nx;
+            for (size_t x=0; x<nx; x++) {
+                uint32_t word;
+                memcpy(&word, src+x, sizeof(word));
+                if (swap) word = __builtin_bswap32(word);
+                word *= !((word&0x7f800000)==0x7f800000 && (word&0x007fffff));
+                memcpy(dest+x, &word, sizeof(word));
+            }
+        }
+    }
+    return true;
+}
+
+
+template <class T>
+void Cube<T>::freeArray() {
+
+    if (arrayAllocated && !arrayMapped) delete [] array;
+    arrayAllocated = arrayMapped = false;
+    unmapFile();
+}
+
+
+template <class T>
+void Cube<T>::unmapFile() {
+
+    if (mapBase!=nullptr) munmap(mapBase, mapSize);
+    mapBase = nullptr;
+    mapData = nullptr;
+}
+
+
+template <class T>
+bool Cube<T>::fitsread_packed() {
+
+    /// Reads the cube into the packed array (see PackedArray), one slab
+    /// of about 64 MB at a time, so that the full array is never in memory.
+
+    const size_t slabBytes = 1<<26;         // Size of a slab
+    size_t chanSize = size_t(axisDim[0])*axisDim[1];
+    long nz = axisDim[2];
+    long nslab = std::min<long>(std::max<size_t>(1,slabBytes/(chanSize*sizeof(T))),nz);
+
+    freeArray();
+    if (!packed.define(axisDim[0],axisDim[1],nz,par.getPackCube())) return false;
+    std::vector<T> slab(chanSize*nslab);
+    for (long z0=0; z0<nz; z0+=nslab) {
+        long z1 = std::min(z0+nslab,nz);
+        long blc[3] = {0,0,z0}, trc[3] = {axisDim[0]-1,axisDim[1]-1,z1-1};
+        if (!fitsread_subset(slab.data(),blc,trc)) {
+            packed.clear();
+            return false;
+        }
+        packed.packChannels(z0,z1-z0,slab.data(),par.getThreads());
+    }
+    return true;
+}
+
+
+template <class T>
+bool Cube<T>::pack(std::string type) {
+
+    /// Packs the cube in memory and releases the full array. The array is
+    /// decoded again the first time a task asks for it with Array().
+
+    if (!arrayAllocated) return isPacked();
+    if (!packed.pack(array,axisDim[0],axisDim[1],axisDim[2],type,par.getThreads())) return false;
+    freeArray();
+    return true;
+}
+
+
+template <class T>
+void Cube<T>::defineCache() {
+
+    /// Sets up the tile cache, which reads the tiles from the FITS file.
+    /// Each thread keeps the file open, so that it is not opened again at
+    /// every tile.
+
+    cache.define(axisDim[0],axisDim[1],axisDim[2],size_t(par.getCacheMB())<<20,
+                 [this](T *out, long *blc, long *trc) {
+        thread_local FitsHandle file;
+        std::unique_lock<std::mutex> lock(fitsReadMutex,std::defer_lock);
+        if (!fits_is_reentrant()) lock.lock();
+        fitsfile *fptr = file.get(par.getImageFile());
+        if (fptr==nullptr || !readFitsBox(fptr,out,origin,blc,trc)) return false;
+        size_t size = size_t(trc[0]-blc[0]+1)*(trc[1]-blc[1]+1)*(trc[2]-blc[2]+1);
+        for (size_t i=0; i<size; i++)
+            if (isNaN(out[i])) out[i] = 0;
+        return true;
+    });
+}
+
+
+template <class T>
+void Cube<T>::loadArray() {
+
+    /// Decodes the packed array, or reads the whole cube if it is read on
+    /// demand, for the tasks that cannot use them directly. The packed
+    /// array or the cache are released.
+    /// Tasks may first ask for the array inside a parallel region, so only
+    /// one thread loads it. Other threads may still be reading the packed
+    /// array or the cache through Value(), so they are released only
+    /// outside parallel regions, at the next call of Array().
+
+    if (!isLazy() && inParallel()) return;
+
+#pragma omp critical (cube_load)
+{
+    if (isLazy()) {
+        if (par.isVerbose())
+            std::cout << " Loading the full cube in memory (" << fixed << setprecision(1)
+                      << sizeof(T)*numPix/1048576. << " MB)...\n" << std::flush;
+        T *full = new T[numPix];
+        if (isPacked()) packed.decode(0,numPix,full,par.getThreads());
+        else {
+            long blc[3] = {0,0,0}, trc[3] = {axisDim[0]-1,axisDim[1]-1,axisDim[2]-1};
+            if (!readSubset(full,blc,trc)) {
+                std::cerr << "CUBE error: cannot read " << par.getImageFile() << ".\n";
+                std::terminate();
+            }
+        }
+        array = full;
+        lazyHeld = true;
+        arrayAllocated = true;          // Atomic store: array is visible to Value() from now on
+    }
+    if (lazyHeld && !inParallel()) {
+        packed.clear();
+        cache.clear();
+        unmapFile();
+        lazyHeld = false;
+    }
+}
+}
+
+
+template <class T>
+void Cube<T>::readChannel(size_t z, T *out) {
+
+    /// Gets channel z into "out", decoding or reading only that channel
+    /// if the whole array is not in memory.
+
+    size_t xys = size_t(axisDim[0])*axisDim[1];
+    if (!isLazy()) {
+        std::copy(array+z*xys,array+(z+1)*xys,out);
+        return;
+    }
+    long blc[3] = {0,0,long(z)}, trc[3] = {axisDim[0]-1,axisDim[1]-1,long(z)};
+    if (!readSubset(out,blc,trc)) std::fill(out,out+xys,T(0));
+}
+
+
+template <class T>
+bool Cube<T>::readSubset(T *out, long *blc, long *trc) {
+
+    /// Gets a box of the cube from the packed array, if any, or from the
+    /// memory mapping or the FITS file.
+
+    if (isPacked()) {
+        packed.decodeBox(blc,trc,out,par.getThreads());
+        return true;
+    }
+    if (mapData!=nullptr) return mapRead(out,blc,trc);
+    return fitsread_subset(out,blc,trc);
+}
+
+
+template <class T>
+bool Cube<T>::fitsread_subset(T *out, long *blc, long *trc, bool compressed) {
+
+    /// Reads the box [blc,trc] (0-based, edges included) of the cube
+    /// in the FITS file into the "out" array, without reading the whole
+    /// cube. As in fitsread_3d(), NaNs are set to 0. Cubes with a fourth
+    /// spectral axis after a STOKES axis are handled as in readCube().
+    /// The box is relative to the region read by readCube() (see BOX).
+    ///
+    /// Large boxes and tile-compressed cubes are read in parallel, one
+    /// range of channels per thread, each with its own file handle, if
+    /// CFITSIO is reentrant. With one channel per tile (see fitswrite_3d),
+    /// each thread decompresses only its own tiles. Otherwise, calls from
+    /// different threads are serialized.
+
+    const size_t minParallel = 1<<26;       // Bytes to read before using several threads
+
+    long nx = trc[0]-blc[0]+1, ny = trc[1]-blc[1]+1, nz = trc[2]-blc[2]+1;
+    size_t size = size_t(nx)*size_t(ny)*size_t(nz);
+
+    auto readChannels = [&](long z0, long z1) {
+        fitsfile *fptr;
+        int status=0;
+        if (fits_open_image(&fptr, par.getImageFile().c_str(), READONLY, &status)) {
+            fits_report_error(stderr, status);
+            return false;
+        }
+        long b[3] = {blc[0],blc[1],z0}, t[3] = {trc[0],trc[1],z1};
+        bool ok = readFitsBox(fptr, out+size_t(z0-blc[2])*nx*ny, origin, b, t);
+        fits_close_file(fptr, &status);
+        return ok;
+    };
+
+    // Boxes may also be read by several threads at once (e.g. by the tile
+    // cache), which is safe only with a reentrant CFITSIO.
+    bool reentrant = fits_is_reentrant();
+    std::unique_lock<std::mutex> lock(fitsReadMutex,std::defer_lock);
+    if (!reentrant) lock.lock();
+
+    int nthreads = 1;
+    if ((size*sizeof(T)>=minParallel || compressed) && reentrant)
+        nthreads = std::max(1,int(std::min<long>(par.getThreads(),nz)));
+
+    bool ok = true;
+#pragma omp parallel for num_threads(nthreads) reduction(&&:ok)
+    for (int t=0; t<nthreads; t++) {
+        long z0 = blc[2]+t*nz/nthreads, z1 = blc[2]+(t+1)*nz/nthreads-1;
+        if (z1>=z0) ok = readChannels(z0,z1) && ok;
+    }
+    if (!ok) return false;
+
+#pragma omp parallel for num_threads(par.getThreads())
+    for (size_t i=0; i<size; i++)
+        if (isNaN(out[i])) out[i] = 0;
+
+    return true;
+}
+
+
+template <class T>
+bool Cube<T>::fitswrite_3d(const char *outfile, bool fullHead, bool async, std::string compress) {
+
+    /// Writes the cube in a FITS file. The header is written by CFITSIO.
+    /// If the FITS type has the size of T (short, float, double) and the
+    /// file is a plain FITS file (not compressed, no CFITSIO extended
+    /// syntax), the data are written in parallel by FitsWrite_data(),
+    /// in background if "async" is true (see FitsWrite_wait()).
+    ///
+    /// If "compress" is not NONE (see COMPRESSMASK/COMPRESSMODEL), the
+    /// cube is written as a tile-compressed image, one channel per tile.
+    /// Float data are quantized with QUANTIZE levels per noise sigma
+    /// (with subtractive dithering that keeps zeros exact).
+
+    if (isLazy()) loadArray();
+    std::string fname(outfile);
+    int comptype = selectCompression(compress);
+    bool direct = comptype==0 && size_t(abs(selectBitpix<T>())/8)==sizeof(T) &&
+                  fname.find_first_of("[!(") == std::string::npos &&
+                  !(fname.size()>3 && fname.substr(fname.size()-3)==".gz");
+
     fitsfile *fptr;
     long  fpixel = 1;
     long dnaxes[3] = {axisDim[0], axisDim[1], axisDim[2]};
     int status=0;
   
+    FitsWrite_wait(outfile);            // A previous version may still be written in background
     remove(outfile);
      
     if (fits_create_file(&fptr, outfile, &status)) {
@@ -399,6 +956,20 @@ bool Cube<T>::fitswrite_3d(const char *outfile, bool fullHead) {
         return false; 
     }       
     
+    if (comptype!=0) {
+        long tile[3] = {axisDim[0], axisDim[1], 1};
+        fits_set_compression_type(fptr, comptype, &status);
+        fits_set_tile_dim(fptr, 3, tile, &status);
+        if (selectBitpix<T>()<0) {
+            fits_set_quantize_level(fptr, par.getQuantize(), &status);
+            fits_set_quantize_method(fptr, SUBTRACTIVE_DITHER_2, &status);
+        }
+        if (status) {
+            fits_report_error(stderr, status);
+            return false;
+        }
+    }
+
     status=0; 
     if (fits_create_img(fptr, selectBitpix<T>(), 3, dnaxes, &status)) {
         fits_report_error(stderr, status); 
@@ -410,6 +981,15 @@ bool Cube<T>::fitswrite_3d(const char *outfile, bool fullHead) {
         else head.headwrite(fptr,3,fullHead);
     }
     
+    if (direct) {
+        status=0;
+        if (fits_close_file(fptr, &status)) {
+            fits_report_error(stderr, status);
+            return false;
+        }
+        return FitsWrite_data(outfile, array, numPix, par.getThreads(), async);
+    }
+
     status=0;
     if (fits_write_img(fptr, selectDatatype<T>(), fpixel, numPix, array, &status)) {
         fits_report_error(stderr, status);
@@ -434,13 +1014,27 @@ void Cube<T>::setCubeStats() {
 
     if(par.isVerbose()) std::cout << "Calculating statistics for the cube... " << std::flush;
     
-    // Here we find pixels that should not be used for statistics
-    bool *blanks = new bool[numPix];
-    for (size_t i=0; i<numPix; i++) blanks[i] = !isBlank(array[i]);
+    // Here we find pixels that should not be used for statistics. A packed
+    // or cached cube is read one channel at a time, and the iterations
+    // below are done on the subsample of the pixels kept by NoiseMaps.
+    T *data = array;
+    size_t size = numPix;
+    std::vector<T> sample;
+    if (isLazy()) {
+        noise.compute([this](size_t z, T *plane) {readChannel(z,plane);},DimX(),DimY(),DimZ(),
+                      par.getFlagRobustStats(),par.getNoiseBox(),par.getThreads(),par.getStatSample(),
+                      par.getParSE().iternoise ? &sample : nullptr);
+        data = sample.data();
+        size = sample.size();
+    }
+    bool *blanks = new bool[size];
+    for (size_t i=0; i<size; i++) blanks[i] = !isBlank(data[i]);
 
-    // Calculate statistics
-    stats.setRobust(par.getFlagRobustStats());
-    stats.calculate(array,numPix,blanks);
+    // Calculate statistics, together with the channel and local noise
+    if (!isLazy())
+        noise.compute(array,DimX(),DimY(),DimZ(),blanks,par.getFlagRobustStats(),par.getNoiseBox(),
+                      par.getThreads(),par.getStatSample());
+    stats = noise.stat();
     
     if (par.getParSE().iternoise) {
         // To refine the noise level estimate, we may iterate over the data, mask 
@@ -448,16 +1042,17 @@ void Cube<T>::setCubeStats() {
         // Here I set a maximum of 20 iteration (usually only few are needed)
         for (int i=0; i<20; i++) {
             // Masking pixels above the threshold
-            for (size_t j=0; j<numPix; j++) {
+            for (size_t j=0; j<size; j++) {
                 double thresh = stats.getMiddle()+3*stats.getSpread();
-                if (fabs(array[j])>thresh) blanks[j]=false;
+                if (fabs(data[j])>thresh) blanks[j]=false;
             }
             // Calculating new stats and check convergence
             double olds = stats.getSpread();
-            stats.calculate(array,numPix,blanks);
+            stats.calculate(data,size,blanks);
             double ftol = fabs(olds-stats.getSpread())/olds+stats.getSpread();
             if (ftol<0.001) break;
         }
+        if (isLazy()) stats.setNumSample(noise.stat().getNumSample());
     }
 
     // Setting threshold for source finder based on noise level
@@ -474,6 +1069,28 @@ void Cube<T>::setCubeStats() {
 }
 
 
+template <class T>
+NoiseMaps<T>& Cube<T>::noiseMaps() {
+
+    /// Returns the noise of the cube, computing it only the first time.
+    /// The cube statistics are not changed.
+
+    if (!noise.isDefined() && isLazy()) {
+        // One channel at a time, without decoding the whole cube
+        noise.compute([this](size_t z, T *plane) {readChannel(z,plane);},DimX(),DimY(),DimZ(),
+                      par.getFlagRobustStats(),par.getNoiseBox(),par.getThreads(),par.getStatSample());
+    }
+    if (!noise.isDefined()) {
+        bool *blanks = new bool[numPix];
+        for (size_t i=0; i<numPix; i++) blanks[i] = !isBlank(array[i]);
+        noise.compute(array,DimX(),DimY(),DimZ(),blanks,par.getFlagRobustStats(),par.getNoiseBox(),
+                      par.getThreads(),par.getStatSample());
+        delete [] blanks;
+    }
+    return noise;
+}
+
+
 template <class T>
 void Cube<T>::BlankCube (T *Array, size_t size) {
     
@@ -529,6 +1146,8 @@ void Cube<T>::BlankMask (float *channel_noise, bool onlyLargest){
 
     Statistics::Stats<T> *st = new Statistics::Stats<T>;
     st->setRobust(par.getFlagRobustStats());
+    st->setThreads(par.getThreads());
+    st->setMaxSample(par.getStatSample());
     
     double bmaj,bmin,bpa,nbmaj,nbmin,nbpa,factor;
     bmaj=bmin=bpa=nbmaj=nbmin=nbpa=factor=0;
@@ -566,20 +1185,12 @@ void Cube<T>::BlankMask (float *channel_noise, bool onlyLargest){
         
         if (onlyLargest || numObj==1) {
             Detection<T> *larg = smoothed->getSources()->LargestDetection();
-            std::vector<Voxel<T> > voxlist = larg->template getPixelSet<T>();
-            typename std::vector<Voxel<T> >::iterator vox;
-            for(vox=voxlist.begin();vox<voxlist.end();vox++) {
-                mask[nPix(vox->getX(),vox->getY(),vox->getZ())]=1;
-            }
+            larg->forEachVoxel([&](long x, long y, long z) {mask[nPix(x,y,z)]=1;});
         }
         else {
             for (size_t i=0; i<numObj; i++) {
                 Detection<T> *obj = smoothed->pObject(i);
-                std::vector<Voxel<T> > voxlist = obj->template getPixelSet<T>();
-                typename std::vector<Voxel<T> >::iterator vox;
-                for(vox=voxlist.begin();vox<voxlist.end();vox++) {
-                    mask[nPix(vox->getX(),vox->getY(),vox->getZ())]=1;
-                }
+                obj->forEachVoxel([&](long x, long y, long z) {mask[nPix(x,y,z)]=1;});
             }
             
         }
@@ -598,20 +1209,12 @@ void Cube<T>::BlankMask (float *channel_noise, bool onlyLargest){
         
         if (onlyLargest || numObj==1) {
             Detection<T> *larg = sources->LargestDetection();
-            std::vector<Voxel<T> > voxlist = larg->template getPixelSet<T>();
-            typename std::vector<Voxel<T> >::iterator vox;
-            for(vox=voxlist.begin();vox<voxlist.end();vox++) {
-                mask[nPix(vox->getX(),vox->getY(),vox->getZ())]=1;
-            }
+            larg->forEachVoxel([&](long x, long y, long z) {mask[nPix(x,y,z)]=1;});
         }
         else {
             for (size_t i=0; i<numObj; i++) {
                 Detection<T> *obj = pObject(i);
-                std::vector<Voxel<T> > voxlist = obj->template getPixelSet<T>();
-                typename std::vector<Voxel<T> >::iterator vox;
-                for(vox=voxlist.begin();vox<voxlist.end();vox++) {
-                    mask[nPix(vox->getX(),vox->getY(),vox->getZ())]=1;
-                }
+                obj->forEachVoxel([&](long x, long y, long z) {mask[nPix(x,y,z)]=1;});
             }
             
         }
@@ -669,29 +1272,38 @@ void Cube<T>::BlankMask (float *channel_noise, bool onlyLargest){
         delete [] blanks;
     }
     else if (par.getMASK()=="THRESHOLD") {
-        // Simple cut
+        // Simple cut, one channel at a time
         float thresh = par.getParSE().threshold;
-        for (uint i=numPix; i--;) {
-            if (array[i]>thresh) mask[i] = 1;
+        size_t xys = DimX()*DimY();
+#pragma omp parallel num_threads(par.getThreads())
+{
+        std::vector<T> plane(xys);
+#pragma omp for schedule(dynamic)
+        for (int z=0; z<DimZ(); z++) {
+            readChannel(z,plane.data());
+            for (size_t i=0; i<xys; i++)
+                if (plane[i]>thresh) mask[i+z*xys] = 1;
         }
+}
     }
     else if (par.getMASK()=="NEGATIVE") {
+        // The noise of the negative pixels, mirrored around zero, is
+        // taken from the cached noise maps.
+        NoiseMaps<T> &nm = noiseMaps();
+        size_t xys = DimX()*DimY();
+#pragma omp parallel num_threads(par.getThreads())
+{
+        std::vector<T> plane(xys);
+#pragma omp for schedule(dynamic)
         for (int z=0; z<DimZ(); z++) {
-            std::vector<T> onlyneg;
-            for (int i=0; i<DimX()*DimY(); i++)  {
-                if (array[i+z*DimX()*DimY()]<0) {
-                    onlyneg.push_back(array[i+z*DimX()*DimY()]);
-                    onlyneg.push_back(-array[i+z*DimX()*DimY()]);
-                }
+            T thresh = par.getBlankCut()*nm.ChanNegNoise(z);
+            readChannel(z,plane.data());
+            for (size_t i=0; i<xys; i++)  {
+                if (plane[i]>thresh) mask[i+z*xys]=1;
             }
-            st->calculate(&onlyneg[0], onlyneg.size());
-            st->setThresholdSNR(par.getBlankCut());
-
-            for (int i=0; i<DimX()*DimY(); i++)  {
-                if (array[i+z*DimX()*DimY()]>st->getThreshold()) mask[i+z*DimX()*DimY()]=1;
-            }
-            if (channel_noise!=NULL) channel_noise[z]=st->getSpread();
+            if (channel_noise!=NULL) channel_noise[z]=nm.ChanNegNoise(z);
         }
+}
     }
     else if (par.getMASK().find("FILE(")!=std::string::npos) {
         std::string str = par.getMASK();
@@ -704,6 +1316,14 @@ void Cube<T>::BlankMask (float *channel_noise, bool onlyLargest){
         std::string filename = str.substr (first+1,last-first-1);
         Cube<float> *ma = new Cube<float>;
 
+        // If only a sub-region of the data was read, the same region is read from the mask.
+        if (boxRead) {
+            for (int i=0; i<3; i++) {
+                ma->pars().setBOX(2*i,origin[i]);
+                ma->pars().setBOX(2*i+1,origin[i]+axisDim[i]);
+            }
+        }
+
         if (!fexists(filename) || !ma->readCube(filename,false)) {
             std::cerr << "\n ERROR: Mask " << filename
                       << " is not a readable FITS image! Exiting ...\n";
@@ -784,7 +1404,7 @@ void Cube<T>::BlankMask (float *channel_noise, bool onlyLargest){
      if (par.getMASK()=="THRESHOLD") s.push_back(sh+"THRESHOLD="+to_string(par.getParSE().threshold));
     
     for (size_t i=numPix; i--;) m->Array(i) = short(mask[i]);
-    m->fitswrite_3d((par.getOutfolder()+"mask.fits").c_str(),true);
+    m->fitswrite_3d((par.getOutfolder()+"mask.fits").c_str(),true,false,par.getCompressMask());
     delete m;
 
     if (verb) {
@@ -809,6 +1429,7 @@ Cube<T>* Cube<T>::Reduce (int fac, std::string rtype) {
     /// \param rtype    "spectral" or "spatial" averaging
     
     if (par.isVerbose()) std::cout << " Reducing..." << std::flush;
+    if (isLazy()) loadArray();
     
     // Defining dimensions of the output cube
     int dim[3];
@@ -906,6 +1527,7 @@ void Cube<T>::CheckCube (int type) {
     
     if (type<1 || type >5) 
         throw std::invalid_argument("CheckCube() ERROR: acceptable \'type\' values are 1-5");
+    if (isLazy()) loadArray();
     
     int xySize = axisDim[0]*axisDim[1];
     int zdim = axisDim[2];
@@ -1145,7 +1767,9 @@ template <class T>
 void Cube<T>::continuumSubtract() {
     
     /// Fit with a polynomial and subtract the continuum from the cube array
-        
+
+    if (isLazy()) loadArray();
+
     // Defining channels to exclude during the fit
     std::vector<T> toex(axisDim[2],false);
 
@@ -1171,39 +1795,49 @@ void Cube<T>::continuumSubtract() {
 
     // Number of coefficients for polynomial (= order + 1)
     int ncoeff = par.getContOrder() + 1;
-    T coeff[ncoeff], coefferr[ncoeff];
     bool mp[ncoeff];
     for (int i=0; i<ncoeff;i++) mp[i] = true;
-    
-    // Looping over spectra
-    for (auto x=0; x<axisDim[0]; x++) {
-        for (auto y=0; y<axisDim[1]; y++) {
-            
-            // Preparing the spectrum to fit (line window excluded)
-            std::vector<T> xx, yy;
-            for (auto z=0; z<axisDim[2]; z++) {
-                if (toex[z]) continue;
-                xx.push_back(z);
-                yy.push_back(Array(x,y,z));
-            }
-            
-            // Now least square fit the continuum
-            std::vector<T> ww(xx.size(),1);
-            Lsqfit<T> lsq(&xx[0],1,&yy[0],&ww[0],xx.size(),coeff,coefferr,mp,ncoeff,&polyn,&polynd);
-            if (lsq.fit()<0) {
-                if (par.isVerbose()) std::cerr << " WARNING: There was some problem during continuum subtraction. \n";
+
+    // Channels used for the fit (line window excluded)
+    std::vector<T> xx;
+    for (auto z=0; z<axisDim[2]; z++)
+        if (!toex[z]) xx.push_back(z);
+    const int nchan = xx.size();
+    std::vector<T> ww(nchan,1);
+
+    // The polynomial is linear in the coefficients, so that each spectrum is
+    // fitted in one step. Spectra are fitted in batches to limit the memory.
+    const size_t nspec = size_t(axisDim[0])*axisDim[1];
+    const size_t batch = 4096;
+    std::vector<T> yy(batch*nchan), coeff(batch*ncoeff), coefferr(batch*ncoeff);
+    std::vector<int> ret(batch);
+    size_t nfailed = 0;
+
+    for (size_t s0=0; s0<nspec; s0+=batch) {
+        const size_t ns = std::min(batch, nspec-s0);
+#pragma omp parallel for num_threads(par.getThreads())
+        for (size_t s=0; s<ns; s++)
+            for (int i=0; i<nchan; i++) yy[s*nchan+i] = array[s0+s+nspec*size_t(xx[i])];
+
+        lsqFitBatch(PolyModel<T>(),ns,xx.data(),1,yy.data(),ww.data(),nchan,coeff.data(),
+                    coefferr.data(),mp,ncoeff,ret.data(),1.E-03,1000,0.,par.getThreads());
+
+        // Subtract the continuum from the spectra
+#pragma omp parallel for num_threads(par.getThreads()) reduction(+:nfailed)
+        for (size_t s=0; s<ns; s++) {
+            if (ret[s]<0) {
+                nfailed++;
                 continue;
             }
-            
-            // Subtract the continuum from the spectrum
             for (auto z=0; z<axisDim[2]; z++) {
-                T yout = 0;
-                for (int j=0; j<ncoeff; j++)
-                    yout += coeff[j]*std::pow(double(z),j);
-                array[nPix(x,y,z)] -= yout;
+                T zz = z;
+                array[s0+s+nspec*z] -= PolyModel<T>().value(&zz,&coeff[s*ncoeff],ncoeff);
             }
         }
     }
+
+    if (nfailed>0 && par.isVerbose())
+        std::cerr << " WARNING: There was some problem during continuum subtraction of " << nfailed << " spectra. \n";
 }
 
 
@@ -1211,13 +1845,15 @@ void Cube<T>::continuumSubtract() {
 /// SOURCE-FINDING RELATED FUNCTIONS
 ///=====================================================================================
 template <class T>
-void Cube<T>::search() {
+SEARCH_PAR Cube<T>::searchParams() {
+
+    /// Returns the SEARCH parameters to be given to the source finder,
+    /// with sizes in pixels and defaults taken from the beam. Statistics
+    /// must be already defined.
 
     Header &h = Head();
     SEARCH_PAR p = par.getParSE();
 
-    if (!statsDefined) setCubeStats();
-    
     if(par.isVerbose()) {
         std::cout << "Using flux threshold of: ";
         T thresh;
@@ -1241,6 +1877,24 @@ void Cube<T>::search() {
     p.minVoxels = minvox;
     p.maxAngSize = p.maxAngSize/(head.PixScale()*arcsconv(head.Cunit(1))/60.);
 
+
+
+    return p;
+}
+
+
+template <class T>
+void Cube<T>::search() {
+
+    // A packed cube or a cube read on demand is searched slab by slab
+    if (isLazy() && par.getParSE().searchType!="spatialsmooth" && !par.getParSE().flagRecon) {
+        searchSlabs();
+        return;
+    }
+
+    if (!statsDefined) setCubeStats();
+    SEARCH_PAR p = searchParams();
+
     // Searching cube
     if (isSearched) delete sources;
     sources = new Search<T>(p);
@@ -1253,9 +1907,18 @@ void Cube<T>::search() {
                         par.getFlagRobustStats(),par.getThreads(),par.isVerbose(),par.getShowbar());
         delete sm;
     }
+    else if (p.flagRecon) {
+        // Searching the wavelet reconstruction. Its noise has been removed,
+        // so the threshold is set from the statistics of the original cube.
+        WaveletRecon<T> *rec = new WaveletRecon<T>;
+        rec->reconstruct(Array(),axisDim[0],axisDim[1],axisDim[2],p,par.getThreads(),par.isVerbose());
+        sources->search(rec->Array(),stats,axisDim[0],axisDim[1],axisDim[2],
+                        par.getFlagRobustStats(),par.getThreads(),par.isVerbose(),par.getShowbar());
+        delete rec;
+    }
     else {
         // Using original cube
-        sources->search(array,stats,axisDim[0],axisDim[1],axisDim[2],
+        sources->search(Array(),stats,axisDim[0],axisDim[1],axisDim[2],
                         par.getFlagRobustStats(),par.getThreads(),par.isVerbose(),par.getShowbar());
     }
     isSearched = true;
@@ -1263,7 +1926,155 @@ void Cube<T>::search() {
     // Calculating parameters for detections
     for (int i=0; i<getNumObj(); i++){
         Detection<T> *obj = sources->pObject(i);
-        obj->calcAllParams(array,axisDim,head,p.pbcorr,par.getFluxConvert());
+        obj->calcAllParams(Array(),axisDim,head,p.pbcorr,par.getFluxConvert());
+    }
+
+    // Sorting detections
+    SortDetections(sources->pObjectList(),p.sortsrcs);
+}
+
+
+template <class T>
+void Cube<T>::searchSlabs() {
+
+    /// Out-of-core version of search(), for cubes that do not fit in memory.
+    /// Only the header needs to be read, with readCube(name,info,false),
+    /// or the cube is read on demand (see CACHEMB), or it is kept packed
+    /// (see PACKCUBE) and slabs are decoded from the packed array instead
+    /// of being read from the FITS file.
+    /// The cube is read twice, in slabs of slabChannels channels (by
+    /// default, as many as fit in 64 MB):
+    ///
+    /// 1) Statistics are accumulated slab by slab. Mean and rms are exact,
+    ///    median and MADFM are calculated on a regular subsample.
+    /// 2) Each slab is searched together with the next threshVelocity
+    ///    channels. Objects starting in this overlap are left to the next
+    ///    slab, so that objects crossing a boundary are found in both slabs
+    ///    and merged at the end by Search::mergeSlabs(). Minimum sizes are
+    ///    only applied to merged objects, whatever RejectBeforeMerge.
+    ///
+    /// Parameters of each detection are then calculated on its bounding box,
+    /// read from the file. At most one slab and one box are kept in memory.
+
+    bool verbose = par.isVerbose();
+    long nx = axisDim[0], ny = axisDim[1], nz = axisDim[2];
+    size_t chanSize = nx*ny;
+    long nslab = par.getParSE().slabChannels;
+    if (nslab<=0) nslab = std::max<size_t>(1,(size_t(1)<<26)/(chanSize*sizeof(T)));
+    nslab = std::min(nslab,nz);
+    long overlap = std::max(par.getParSE().threshVelocity,1);
+    long numSlabs = (nz+nslab-1)/nslab;
+    std::vector<T> slab(chanSize*std::min(nslab+overlap,nz));
+
+    // First pass: statistics of the whole cube
+    if (verbose) std::cout << "Calculating statistics for the cube (" << numSlabs << " slabs)... " << std::flush;
+    const size_t maxSample = 1<<22;
+    size_t stride = std::max<size_t>(1,numPix/maxSample);
+    std::vector<T> sample;
+    sample.reserve(numPix/stride+1);
+    double sum = 0, sumsq = 0;
+    size_t count = 0;
+    T minval = 0, maxval = 0;
+
+    for (long z0=0; z0<nz; z0+=nslab) {
+        long z1 = std::min(z0+nslab,nz);
+        long blc[3] = {0,0,z0}, trc[3] = {nx-1,ny-1,z1-1};
+        if (!readSubset(slab.data(),blc,trc)) {
+            std::cerr << "SEARCH error: cannot read channels " << z0 << "-" << z1-1 << " of the cube.\n";
+            std::terminate();
+        }
+        size_t offset = z0*chanSize;
+        for (size_t i=0; i<(z1-z0)*chanSize; i++) {
+            T v = slab[i];
+            if (isBlank(v)) continue;
+            if (count==0) minval = maxval = v;
+            else if (v<minval) minval = v;
+            else if (v>maxval) maxval = v;
+            sum += v; sumsq += double(v)*v; count++;
+            if ((offset+i)%stride==0) sample.push_back(v);
+        }
+    }
+
+    double mean = count>0 ? sum/count : 0;
+    stats.setRobust(par.getFlagRobustStats());
+    stats.setMean(mean);
+    stats.setStddev(count>1 ? sqrt(std::max(sumsq/count-mean*mean,0.)*count/(count-1)) : 0);
+    stats.setMin(minval);
+    stats.setMax(maxval);
+    T median = sample.size()>0 ? findMedian<T>(sample.data(),sample.size(),true) : 0;
+    stats.setMedian(median);
+    stats.setMadfm(sample.size()>0 ? findMADFM<T>(sample.data(),sample.size(),median,true) : 0);
+    stats.setThresholdSNR(par.getParSE().snrCut);
+    statsDefined = true;
+    std::vector<T>().swap(sample);
+
+    if (verbose) {
+        std::cout << "Done." << std::scientific << std::setprecision(5);
+        std::cout << std::endl << stats << std::fixed << std::endl;
+    }
+
+    SEARCH_PAR p = searchParams();
+
+    // Second pass: searching each slab with relaxed rejection criteria
+    SEARCH_PAR ps = p;
+    ps.minPix = ps.minChannels = ps.minVoxels = 1;
+    ps.maxChannels = -1;
+    ps.maxAngSize = -1;
+    ps.RejectBeforeMerge = false;
+
+    if (verbose) std::cout << "\n\nStarting research for possible sources in " << numSlabs
+                           << " slabs of " << nslab << " channels... " << std::flush;
+    DetVec<T> objects;
+    for (long z0=0; z0<nz; z0+=nslab) {
+        long z1 = std::min(z0+nslab,nz), zend = std::min(z1+overlap,nz);
+        long blc[3] = {0,0,z0}, trc[3] = {nx-1,ny-1,zend-1};
+        if (!readSubset(slab.data(),blc,trc)) {
+            std::cerr << "SEARCH error: cannot read channels " << z0 << "-" << zend-1 << " of the cube.\n";
+            std::terminate();
+        }
+        Search<T> finder(ps);
+        finder.search(slab.data(),stats,nx,ny,zend-z0,par.getFlagRobustStats(),par.getThreads(),false,false);
+        for (auto &obj : finder.ObjectList()) {
+            if (obj.getZmin()+z0>=z1) continue;
+            obj.addOffsets(0,0,z0);
+            objects.push_back(obj);
+        }
+    }
+    std::vector<T>().swap(slab);
+    if (verbose) std::cout << "Done.\n";
+
+    if (isSearched) delete sources;
+    sources = new Search<T>(p);
+    sources->mergeSlabs(objects,nx,ny,nz,verbose);
+    isSearched = true;
+    objects.clear();
+
+    // Calculating parameters for detections on their bounding boxes
+    for (int i=0; i<getNumObj(); i++) {
+        Detection<T> *obj = sources->pObject(i);
+        long blc[3] = {obj->getXmin(),obj->getYmin(),obj->getZmin()};
+        long trc[3] = {obj->getXmax(),obj->getYmax(),obj->getZmax()};
+        int dim[3];
+        for (int j=0; j<3; j++) dim[j] = trc[j]-blc[j]+1;
+        std::vector<T> box(size_t(dim[0])*dim[1]*dim[2]);
+        if (!readSubset(box.data(),blc,trc)) {
+            std::cerr << "SEARCH error: cannot read the box of detection " << i+1 << ".\n";
+            std::terminate();
+        }
+
+        // The header of the box has the reference pixel shifted accordingly
+        Header boxhead(head);
+        for (int j=0; j<3; j++) {
+            boxhead.setCrpix(j,head.Crpix(j)-blc[j]);
+            boxhead.setDimAx(j,dim[j]);
+        }
+        boxhead.updateWCS();
+
+        obj->addOffsets(-blc[0],-blc[1],-blc[2]);
+        obj->calcAllParams(box.data(),dim,boxhead,p.pbcorr,par.getFluxConvert());
+        obj->setOffsets(blc[0],blc[1],blc[2]);
+        obj->addOffsets();
+        obj->setOffsets();
     }
 
     // Sorting detections
@@ -1472,13 +2283,13 @@ void Cube<T>::writeDetections() {
     bool *isObj = new bool[numPix];
     for (int j=0; j<numPix; j++) isObj[j]=false;
     for (int i=0; i<numObj; i++) {
-        for(auto &vox : sources->pObject(i)->getPixelSet(array, axisDim)){
-            long pos = vox.getX()+vox.getY()*axisDim[0]+vox.getZ()*axisDim[0]*axisDim[1];
-            isObj[pos] = true;
-        }
+        sources->pObject(i)->forEachVoxel([&](long x, long y, long z) {
+            isObj[x+y*axisDim[0]+z*axisDim[0]*axisDim[1]] = true;
+        });
     }
 
     // Writing a datacube with just the detected objects
+    if (isLazy()) loadArray();
     Cube<T> *det = new Cube<T>(axisDim);
     for (size_t i=0; i<det->NumPix(); i++) det->Array(i) = array[i]*isObj[i];
     det->saveHead(head);
@@ -1490,10 +2301,9 @@ void Cube<T>::writeDetections() {
     Cube<int> *detnum = new Cube<int>(axisDim);
     for (size_t i=0; i<det->NumPix(); i++) detnum->Array(i) = 0;
     for (int i=0; i<numObj; i++){
-        std::vector<Voxel<T> > vlist = sources->pObject(i)->template getPixelSet<T>();
-        typename std::vector<Voxel<T> >::iterator vox;
-        for(vox=vlist.begin(); vox<vlist.end(); vox++)
-            detnum->Array(vox->getX(),vox->getY(),vox->getZ()) = i+1;
+        sources->pObject(i)->forEachVoxel([&](long x, long y, long z) {
+            detnum->Array(x,y,z) = i+1;
+        });
     }
     detnum->saveHead(head);
     detnum->Head().setMinMax(0,0);
@@ -1613,10 +2423,9 @@ void Cube<T>::writeCubelets() {
         bool *isObj = new bool[c->NumPix()];
         for (int j=0; j<c->NumPix(); j++) isObj[j]=false;
 
-        for(auto &v : obj->getPixelSet(array, axisDim)){
-            long pos = c->nPix(v.getX()-starts[0],v.getY()-starts[1],v.getZ()-starts[2]);
-            isObj[pos] = true;
-        }
+        obj->forEachVoxel([&](long x, long y, long z) {
+            isObj[c->nPix(x-starts[0],y-starts[1],z-starts[2])] = true;
+        });
 
         // Writing sub-kinematic maps
         c->pars().setVerbosity(false);
@@ -25,8 +25,12 @@
 #define CUBE_HH_
 
 #include <string>
+#include <atomic>
 #include <Arrays/header.hh>
 #include <Arrays/stats.hh>
+#include <Arrays/noise.hh>
+#include <Arrays/packed.hh>
+#include <Arrays/tilecache.hh>
 #include <Arrays/param.hh>
 #include <Tasks/search.hh>
 #include <Map/detection.hh>
@@ -47,9 +51,9 @@ public:
     void defaults();
 
     // Overloadad () operator for easy access the main array. No controls on the index.
-    inline T& operator() (size_t x, size_t y, size_t z) {return *(array+nPix(x,y,z));}
-    inline T& operator() (size_t i) {return *(array+i);}
-    inline T& operator[] (size_t i) {return *(array+i);}
+    inline T& operator() (size_t x, size_t y, size_t z) {return *(Array()+nPix(x,y,z));}
+    inline T& operator() (size_t i) {return *(Array()+i);}
+    inline T& operator[] (size_t i) {return *(Array()+i);}
     
     /// Obvious inline functions to access a private member of class:
     int     NumAx () {return numAxes;}
@@ -60,7 +64,8 @@ public:
     int     DimY(){return axisDim[1];}
     int     DimZ(){return axisDim[2];}
     size_t  nPix  (size_t x,size_t y,size_t z) {return x+y*axisDim[0]+z*axisDim[0]*axisDim[1];}
-    T*      Array () {return array;}
+    T*      Array () {if (isLazy() || lazyHeld) loadArray(); return array;}
+    T       Value (size_t npix) {return arrayAllocated ? array[npix] : packed.isDefined() ? packed.value(npix) : cache.value(npix);}
     T&      Array (size_t npix) {return this->operator()(npix);}
     T&      Array (size_t x,size_t y,size_t z) {return this->operator()(x,y,z);}
     void    setArray (T *ar) {array = ar;}
@@ -105,16 +110,30 @@ public:
 
     /// Functions for Fitsfile I/O:
     void    setCube  (T *input, int *dim);
-    bool    readCube (std::string fname,bool printInfo=true);               /// Front-end to read array from Fits.
+    bool    readCube (std::string fname,bool printInfo=true,bool readArray=true); /// Front-end to read array from Fits.
     bool    fitsread_3d ();                                                 /// Read data array from Fits file.                                             
-    bool    fitswrite_3d (const char *outfile, bool fullHead=false);        /// Write a Fits cube.                                      
+    bool    fitsmap_3d ();                                                  /// Memory-map the data array of a Fits file.
+    bool    fitsread_packed ();                                             /// Read the Fits file into the packed array.
+    bool    fitsread_subset (T *out, long *blc, long *trc, bool compressed=false);  /// Read a box of the Fits file.
+    bool    fitswrite_3d (const char *outfile, bool fullHead=false, bool async=false,
+                          std::string compress="NONE");                    /// Write a Fits cube.
     
+    /// Packed storage (see PACKCUBE) and tiles read on demand (see CACHEMB):
+    bool    pack (std::string type);                     /// Keep the cube packed at 16 bits per pixel.
+    bool    isPacked () {return packed.isDefined() && !arrayAllocated;}
+    PackedArray<T>& Packed () {return packed;}
+    bool    isCached () {return cache.isDefined() && !arrayAllocated;}
+    TileCache<T>& Cache () {return cache;}
+    bool    isLazy () {return isPacked() || isCached();}  /// Is the full array not in memory?
+
     /// Statistics functions:
     void    setCubeStats();                              /// Calculate statistical parameters for cube. 
+    NoiseMaps<T>& noiseMaps();                           /// Global, per-channel and local noise, computed once.
     bool    isDetection(long x, long y, long z) {return stats.isDetection(Array(x,y,z));}         /// Can be a voxel considered a detection ?
 
     /// Searching functions, defined in search.cpp.
     void    search();                                    /// Front-end function to search in a 3-D cube.
+    void    searchSlabs();                               /// Search a cube on disk, slab by slab.
     void    search(std::string searchtype, float snrCut, float threshold, bool adjacent,
                    int threshSpatial, int threshVelocity, int minPixels, int minChannels,
                    int minVoxels, int maxChannels, float maxAngSize, bool flagGrowth,
@@ -137,7 +156,7 @@ public:
     
 protected:
     T           *array;                     ///< The cube data array.
-    bool        arrayAllocated;             ///< Is array allocated?
+    std::atomic<bool> arrayAllocated;       ///< Is array allocated? Atomic, since Array() and Value() may be called while another thread loads it.
     short       numAxes;                    ///< Number of axis.
     size_t      numPix;                     ///< Total number of pixel.
     int         *axisDim;                   ///< Array of axis dimensions of cube
@@ -146,7 +165,12 @@ protected:
     bool        headDefined;                ///< Has been an header defined?            
     Stats<T>    stats;                      ///< The statistics for the data array.
     bool        statsDefined;               ///< Have been statistics defined?
+    NoiseMaps<T> noise;                     ///< The cached noise of the data array.
+    PackedArray<T> packed;                  ///< The data array packed at 16 bits per pixel, if requested.
+    TileCache<T> cache;                     ///< Tiles of the data array read on demand, if requested.
     Param       par;                        ///< A parameter list.
+
+    SEARCH_PAR  searchParams();             ///< SEARCH parameters in pixels for the source finder.
     
 
 private:
@@ -154,6 +178,23 @@ private:
     int         datatype;                   ///< Data type when reading or writing data.
     bool        *mask;                      ///< A mask for blanked cube.
     bool        maskAllocated;              ///< Has mask been allocated?
+    bool        arrayMapped;                ///< Is array memory-mapped from the Fits file?
+    bool        boxRead;                    ///< Has only a sub-region (BOX) of the Fits file been read?
+    std::atomic<bool> lazyHeld;             ///< Array loaded, but packed array or cache not yet released.
+    long        origin[3];                  ///< Position of the first pixel in the Fits file.
+    void        *mapBase;                   ///< Start of the memory mapping.
+    size_t      mapSize;                    ///< Size in bytes of the memory mapping.
+    char        *mapData;                   ///< First mapped channel, in the memory mapping.
+    long        mapDim[2];                  ///< Size of the channels of the Fits file.
+    bool        mapSwap;                    ///< Are the bytes of the mapping to be swapped?
+
+    void        freeArray();                ///< Release array, allocated or mapped.
+    void        unmapFile();                ///< Release the memory mapping.
+    bool        mapRead(T *out, long *blc, long *trc);     ///< Box from the memory mapping.
+    void        loadArray();                ///< Decode the packed array or read the cached cube into array.
+    void        defineCache();              ///< Set up the tile cache on the FITS file.
+    bool        readSubset(T *out, long *blc, long *trc);  ///< Box from the packed array or from the Fits file.
+    void        readChannel(size_t z, T *out);  ///< A channel, without loading a packed or cached cube.
     Search<T>   *sources;                   ///< A pointer to the source-finder.
     bool        isSearched;                 ///< Already searched?
 
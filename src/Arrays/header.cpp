@@ -37,6 +37,22 @@
 #include <Arrays/header.hh>
 #include <Utilities/utils.hh>
 
+
+namespace {
+    // A shared handle to an array of n wcsprm structs, freed as those from wcspih.
+    std::shared_ptr<struct wcsprm> shareWCS(struct wcsprm *w, int n) {
+        return std::shared_ptr<struct wcsprm>(w, [n](struct wcsprm *p) mutable {wcsvfree(&n,&p);});
+    }
+
+    // A shared handle to a new uninitialized wcsprm struct.
+    std::shared_ptr<struct wcsprm> newWCS() {
+        struct wcsprm *w = (struct wcsprm *)calloc(1,sizeof(struct wcsprm));
+        w->flag = -1;
+        return shareWCS(w,1);
+    }
+}
+
+
 Header::Header () {
     
     bitpix = FLOAT_IMG;
@@ -48,10 +64,10 @@ Header::Header () {
     veldef = "auto";
     pointAllocated = false;
     warning = true;
-    wcs = new struct wcsprm;
-    wcs->flag=-1;
+    wcsHandle = newWCS();
+    wcs = wcsHandle.get();
+    keys = std::make_shared<std::vector<std::string> >();
     wcsIsGood=false;
-    nwcs=0;
     specConv=1;
 }
 
@@ -66,20 +82,24 @@ Header::~Header () {
         delete [] ctype;
         delete [] cunit;
     }
-    
-    keys.clear();
-    wcsvfree(&nwcs,&wcs);
 }
 
 
 Header::Header(const Header& h) {
     
+    pointAllocated = false;
     operator=(h);
 }
 
 
 Header& Header::operator=(const Header& h) {
     
+    /// The WCS struct and the list of keys are not copied but shared
+    /// with h, since they are rarely modified once read from a file.
+    /// A private copy is made only before modifying them (updateWCS(),
+    /// Keys(), ...), so that copying a Header in parallel, e.g. for
+    /// every model of a fit, needs no lock.
+
     if(this == &h) return *this;
     
     this->numAxes = h.numAxes;
@@ -140,22 +160,13 @@ Header& Header::operator=(const Header& h) {
     this->specUnits = h.specUnits;
     this->specConv  = h.specConv;
     
-    
-//    this->wcs = h.wcs;
-#pragma omp critical (wcs_header)
-{
-    wcsvfree(&nwcs,&wcs);
-    this->wcs = new struct wcsprm;
-    this->wcs->flag = -1;
-    wcsini(true, h.wcs->naxis, this->wcs);
-    wcscopy(true, h.wcs, this->wcs);
-    wcsset(this->wcs);
-    this->nwcs      = h.nwcs;
+    this->wcsHandle = h.wcsHandle;
+    this->wcs       = h.wcs;
     this->wcsIsGood = h.wcsIsGood;
-}
+    this->keys      = h.keys;
 
-    for (unsigned int i=0; i<h.keys.size(); i++)
-        this->keys.push_back(h.keys[i]); 
+    // A struct that has not been set would be set by wcslib at first use
+    if (wcs->flag!=-1 && wcs->flag!=WCSSET) detachWCS();
             
     calcArea();
     
@@ -182,10 +193,36 @@ void Header::setNumAx (int size){
     ctype   = new std::string[numAxes];
     pointAllocated = true;
 
+    wcsHandle = newWCS();
+    wcs = wcsHandle.get();
     wcsini(true, numAxes, wcs);
 }
 
 
+void Header::detachWCS() {
+
+    if (wcsHandle.use_count()<2) return;
+
+#pragma omp critical (wcs_header)
+{
+    std::shared_ptr<struct wcsprm> w = newWCS();
+    if (wcs->flag!=-1) {
+        wcsini(true, wcs->naxis, w.get());
+        wcscopy(true, wcs, w.get());
+        wcsset(w.get());
+    }
+    wcsHandle = w;
+    wcs = w.get();
+}
+}
+
+
+void Header::detachKeys() {
+
+    if (keys.use_count()>1) keys = std::make_shared<std::vector<std::string> >(*keys);
+}
+
+
 void Header::calcArea () {
     
     float AvPixScale = (fabs(cdelt[0])+fabs(cdelt[1]))/2.;
@@ -204,7 +241,7 @@ bool Header::header_read (std::string fname) {
     
     fitsname = fname;
  
-    if (fits_open_file(&fptr, fitsname.c_str(), READONLY, &status)) {
+    if (fits_open_image(&fptr, fitsname.c_str(), READONLY, &status)) {
         fits_report_error(stderr, status);
         return false;
     }
@@ -234,11 +271,29 @@ bool Header::header_read (std::string fname) {
       fits_report_error(stderr, status);
     }
 
+    // Tile-compressed images are stored in a binary table: their header
+    // is read as if they were uncompressed images.
+    status = 0;
+    bool compressed = fits_is_compressed_image(fptr, &status);
+    status = 0;
+
     int nkeys;
-    fits_get_hdrspace(fptr, &nkeys, NULL, &status);
-    for (int i=1; i<=nkeys; i++) {
-        fits_read_record(fptr,i,Keys,&status);
-        keys.push_back(Keys);
+    keys = std::make_shared<std::vector<std::string> >();
+    if (compressed) {
+        char *hstr = NULL;
+        fits_convert_hdr2str(fptr, 0, NULL, 0, &hstr, &nkeys, &status);
+        for (int i=0; i<nkeys && hstr!=NULL; i++) {
+            std::string rec(hstr+80*i,80);
+            keys->push_back(rec.substr(0,rec.find_last_not_of(' ')+1));
+        }
+        if (hstr!=NULL) fits_free_memory(hstr, &status);
+    }
+    else {
+        fits_get_hdrspace(fptr, &nkeys, NULL, &status);
+        for (int i=1; i<=nkeys; i++) {
+            fits_read_record(fptr,i,Keys,&status);
+            keys->push_back(Keys);
+        }
     }
     
     status=0;
@@ -536,22 +591,22 @@ bool Header::header_read (std::string fname) {
     }
     
     if (bmaj==0 && bmin==0 && bpa==0 && clbmaj==0 && clbmin==0) {
-        for (unsigned int i=0; i<keys.size(); i++) {
-            int found = keys[i].find("BMAJ=");
+        for (unsigned int i=0; i<keys->size(); i++) {
+            int found = (*keys)[i].find("BMAJ=");
             char *pEnd;
             if (found>=0) {
-                pEnd = &keys[i].at(found+5);
+                pEnd = &(*keys)[i].at(found+5);
                 bmaj = strtod(pEnd,NULL);
             }
-            found = keys[i].find("BMIN=");
+            found = (*keys)[i].find("BMIN=");
             if (found>=0) {
-                pEnd = &keys[i].at(found+5);
+                pEnd = &(*keys)[i].at(found+5);
                 bmin = strtod(pEnd,NULL);
 
             }
-            found = keys[i].find("BPA=");
+            found = (*keys)[i].find("BPA=");
             if (found>=0) {
-                pEnd = &keys[i].at(found+4);
+                pEnd = &(*keys)[i].at(found+4);
                 bpa = strtod(pEnd,NULL);
             }
         }
@@ -594,15 +649,22 @@ bool Header::header_read (std::string fname) {
     // Read in the entire PHU of the FITS file to a std::string.
     // This will be read by the wcslib functions to extract the WCS.
     status = 0;
-    fits_hdr2str(fptr, noComments, NULL, nExc, &hdr, &nkeys, &status);
-
-    status = wcsini(true, numAxes, wcs);
+    if (compressed) fits_convert_hdr2str(fptr, noComments, NULL, nExc, &hdr, &nkeys, &status);
+    else fits_hdr2str(fptr, noComments, NULL, nExc, &hdr, &nkeys, &status);
 
     int relax=1; // for wcspih -- admit all recognised informal WCS extensions
     int ctrl=2;  // for wcspih -- report each rejected card and its reason for rejection
-    int nreject;
+    int nreject, nwcs=0;
+    struct wcsprm *wcsarr = NULL;
     // Parse the FITS header to fill in the wcsprm structure
-    status=wcspih(hdr, nkeys, relax, ctrl, &nreject, &nwcs, &wcs);
+    status=wcspih(hdr, nkeys, relax, ctrl, &nreject, &nwcs, &wcsarr);
+    if (nwcs>0) wcsHandle = shareWCS(wcsarr,nwcs);
+    else {
+        if (wcsarr) free(wcsarr);
+        wcsHandle = newWCS();
+        wcsini(true, numAxes, wcsHandle.get());
+    }
+    wcs = wcsHandle.get();
 
     int stat[NWCSFIX];
     // Applies all necessary corrections to the wcsprm structure
@@ -692,24 +754,24 @@ void Header::headwrite (fitsfile *fptr, short numDim, bool fullHead) {
     //fits_update_key_flt(fptr, "BLANK", blank, 12, com, &status);
     
     if (fullHead) {
-        for (uint i=0; i<keys.size(); i++) {
+        for (uint i=0; i<keys->size(); i++) {
             status=0;
             bool towrite = false;
-            int hist = keys[i].find("HISTORY");
+            int hist = (*keys)[i].find("HISTORY");
             
             if(hist>=0) towrite=true;
             else {
-                int found = keys[i].find("="); 
+                int found = (*keys)[i].find("="); 
                 if (found>=0) {
                     char keyname [] = "                                                                                  ";
-                    strncpy(keyname, keys[i].c_str(),found);
+                    strncpy(keyname, (*keys)[i].c_str(),found);
                     char card[100];
                     if (fits_read_card(fptr, keyname, card, &status)) towrite=true;
                 }
             }
             if (towrite) {
                 status=0;
-                fits_write_record(fptr, keys[i].c_str(), &status);
+                fits_write_record(fptr, (*keys)[i].c_str(), &status);
             }
         }
         
@@ -724,9 +786,8 @@ void Header::updateWCS() {
 
     // Define the wcsprm structure given the entries in the Header
 
-    //wcsvfree(&nwcs,&wcs);
-    //wcsini(true,numAxes,wcs);
-    //wcs->flag = 0;
+    detachWCS();
+    if (wcs->flag==-1) wcsini(true,numAxes,wcs);
     for (short i=0; i<numAxes; i++) {
         wcs->crpix[i] = crpix[i];
         wcs->crval[i] = crval[i];
@@ -1024,7 +1085,7 @@ bool Header::read_keyword(std::string keyword, T &key, bool err) {
     int status=0;
     char comment[72];
 
-    if (fits_open_file(&fptr, fitsname.c_str(), READONLY, &status)) {
+    if (fits_open_image(&fptr, fitsname.c_str(), READONLY, &status)) {
         fits_report_error(stderr, status);
         return false;
     }
@@ -1052,7 +1113,7 @@ bool Header::read_keyword<std::string>(std::string keyword, std::string &key, bo
     int status=0;
     char comment[72];
         
-    if (fits_open_file(&fptr, fitsname.c_str(), READONLY, &status)) {
+    if (fits_open_image(&fptr, fitsname.c_str(), READONLY, &status)) {
         fits_report_error(stderr, status);
         return false;
     }
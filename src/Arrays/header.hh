@@ -28,6 +28,7 @@
 #include <string>
 #include <cmath>
 #include <vector>
+#include <memory>
 #include <fitsio.h> 
 #include <wcslib/wcs.h>
 
@@ -72,14 +73,14 @@ public:
     double Wave0 () {return wave0;}
     double Redshift () {return redshift;}
     
-    struct wcsprm *WCS () {return wcs;}
+    struct wcsprm *WCS () {return wcs;}                 /// Shared with copies: read only, see updateWCS().
     bool   isWCS () {return wcsIsGood;}
     bool   isSpecOK(){return (wcs->spec >= 0);}
     bool   canUseThirdAxis(){return ((wcs->spec >= 0)||(wcs->naxis>2));}
     std::string SpectralUnits(){return specUnits;}
     double SpectralConversion(){return specConv;}
 
-    std::vector<std::string>& Keys () {std::vector<std::string> &k=keys; return k;}
+    std::vector<std::string>& Keys () {detachKeys(); return *keys;}
     std::string Name () {return object;}
     std::string Bunit () {return bunit;}
     std::string Btype () {return btype;}
@@ -130,7 +131,7 @@ public:
     void setSpecSys(std::string s) {specsys=s;}
 
     void Warning(std::string s) {if (warning) std::cout << s << std::endl;}
-    void addKey(std::string s) {keys.push_back(s);}
+    void addKey(std::string s) {detachKeys(); keys->push_back(s);}
 
 
     /// Functions defined in header.cpp.
@@ -188,13 +189,16 @@ private:
     std::string specsys;            ///< System for spectral axes.
     std::string specUnits;          ///< The units of the spectral dimension
     double  specConv;               ///< Conversion factor betweeb spectralUnits and pixtoWCS output. 
-    std::vector<std::string> keys;  ///< Whole header as strings.
+    std::shared_ptr<std::vector<std::string> > keys;  ///< Whole header as strings.
 
+    std::shared_ptr<struct wcsprm> wcsHandle;   ///< The WCS struct, shared by copies until modified.
     struct wcsprm *wcs;             ///< The WCS parameters in a struct from the wcslib library.
-    int    nwcs;                    ///< The number of WCS parameters
     bool   wcsIsGood;               ///< A flag indicating whether there is a valid WCS
     
     bool    warning;                ///< Write warning on std::cout.
+
+    void    detachWCS();            ///< Get a private copy of the WCS struct before modifying it.
+    void    detachKeys();           ///< Get a private copy of the keys before modifying them.
 };
 
 #endif
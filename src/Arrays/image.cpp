@@ -161,7 +161,7 @@ bool Image2D<Type>::fitsread_2d () {
     char *filename = new char [100];
     strcpy(filename, (par.getImageFile()).c_str());
     status = 0;
-    if(fits_open_file(&fptr, filename, READONLY, &status) ){
+    if(fits_open_image(&fptr, filename, READONLY, &status) ){
       fits_report_error(stderr, status);
       return false;
     }
@@ -0,0 +1,321 @@
+//---------------------------------------------------------------
+// noise.cpp: Member functions of the NoiseMaps class.
+//---------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <Arrays/noise.hh>
+#include <Arrays/stats.hh>
+#include <Utilities/utils.hh>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+template <class T>
+void NoiseMaps<T>::compute(T *array, size_t xsize, size_t ysize, size_t zsize, bool *mask, bool robust,
+                           int boxSize, int Nthreads, size_t maxSample) {
+
+    /// Computes the global statistics, the noise of each channel and, if
+    /// boxSize>0, the local noise map of an array.
+    ///
+    /// \param array      The input array.
+    /// \param xsize      The x-dimension of the array.
+    /// \param ysize      The y-dimension of the array.
+    /// \param zsize      The z-dimension of the array.
+    /// \param mask       Pixels to be used (true). If NULL, all not-NaN pixels are used.
+    /// \param robust     Whether to use robust statistics.
+    /// \param boxSize    Size in pixels of the box for the local noise map.
+    /// \param Nthreads   Number of threads.
+    /// \param maxSample  Maximum number of values for the global median and MADFM.
+
+    setup(xsize,ysize,zsize,robust,boxSize,Nthreads);
+    size_t xys = xsize*ysize;
+
+    // Global statistics
+    stats.setRobust(robust);
+    stats.setThreads(nthreads);
+    stats.setMaxSample(maxSample);
+    if (mask!=nullptr) stats.calculate(array,xys*zsize,mask);
+    else stats.calculate(array,xys*zsize);
+
+    std::vector<float> nodeNoise;
+    sweep([array,xys](size_t z, std::vector<T> &) {return array+z*xys;},
+          [mask](size_t i, T v) {return mask!=nullptr ? mask[i] : !isNaN(v);}, nodeNoise, 0, nullptr);
+    localMap(nodeNoise);
+}
+
+
+template <class T>
+void NoiseMaps<T>::compute(std::function<void(size_t,T*)> readChannel, size_t xsize, size_t ysize, size_t zsize,
+                           bool robust, int boxSize, int Nthreads, size_t maxSample, std::vector<T> *sample) {
+
+    /// As above, for a cube that is not held in memory as a whole:
+    /// readChannel(z,plane) fills "plane" with channel z, and each channel
+    /// is read once. Blank pixels (0 or NaN) are not used. Mean, rms and
+    /// extremes are those of all the valid pixels, while the median and the
+    /// MADFM are taken on a regular subsample of at most maxSample values
+    /// (lazySample if maxSample is 0). The subsample is returned in
+    /// "sample", if given.
+
+    const size_t lazySample = 1<<24;        // Default size of the subsample
+
+    setup(xsize,ysize,zsize,robust,boxSize,Nthreads);
+    size_t xys = xsize*ysize, size = xys*zsize;
+    size_t nsample = maxSample>0 ? maxSample : lazySample;
+    size_t stride = std::max<size_t>((size+nsample-1)/nsample,1);
+
+    std::vector<float> nodeNoise;
+    std::vector<std::vector<T>> chanSample(zsize);
+    sweep([&readChannel](size_t z, std::vector<T> &buf) {readChannel(z,buf.data()); return buf.data();},
+          [](size_t, T v) {return !isBlank(v);}, nodeNoise, stride, &chanSample);
+
+    // Moments of all the valid pixels, summed channel by channel
+    size_t goodSize = 0;
+    double sumx = 0, sumxx = 0, dmin = 0, dmax = 0;
+    bool first = true;
+    for (size_t z=0; z<zsize; z++) {
+        if (chanMoments[z].n==0) continue;
+        goodSize += chanMoments[z].n;
+        sumx += chanMoments[z].sum;
+        sumxx += chanMoments[z].sumsq;
+        if (first || chanMoments[z].min<dmin) dmin = chanMoments[z].min;
+        if (first || chanMoments[z].max>dmax) dmax = chanMoments[z].max;
+        first = false;
+    }
+    std::vector<Moments>().swap(chanMoments);
+
+    std::vector<T> all;
+    for (auto &s : chanSample) {
+        all.insert(all.end(),s.begin(),s.end());
+        std::vector<T>().swap(s);
+    }
+    if (all.size()==0) {
+        std::cerr << "Error in NoiseMaps::compute: no good values!\n";
+        all.push_back(0);
+    }
+
+    stats.setRobust(robust);
+    stats.setThreads(nthreads);
+    stats.setMaxSample(0);
+    if (sample!=nullptr) *sample = all;
+    stats.calculate(all.data(),all.size());
+    stats.setNumSample(stride>1 ? all.size() : 0);
+    stats.setMin(T(dmin));
+    stats.setMax(T(dmax));
+    stats.setMean(T(sumx/goodSize));
+    stats.setStddev(T(sqrt(std::max(sumxx/goodSize-(sumx/goodSize)*(sumx/goodSize),0.))));
+
+    localMap(nodeNoise);
+}
+
+
+template <class T>
+void NoiseMaps<T>::setup(size_t xsize, size_t ysize, size_t zsize, bool robust, int boxSize, int Nthreads) {
+
+    dim[0] = xsize; dim[1] = ysize; dim[2] = zsize;
+    box = std::max(boxSize,0);
+    useRobust = robust;
+    nthreads = std::max(Nthreads,1);
+}
+
+
+template <class T>
+template <class Channel, class Valid>
+void NoiseMaps<T>::sweep(Channel channel, Valid valid, std::vector<float> &nodeNoise, size_t stride,
+                         std::vector<std::vector<T>> *sample) {
+
+    /// The parallel sweep over the channels. channel(z,buffer) returns
+    /// channel z, read into "buffer" if needed, and valid(i,v) tells whether
+    /// pixel i of the cube, of value v, is used. The noise in the box of
+    /// each node is returned in nodeNoise. If "sample" is given, the moments
+    /// of each channel and the pixels at multiples of "stride" are also kept.
+
+    const size_t minPix = 3;                // Minimum valid pixels to measure the noise in a box
+
+    size_t xsize = dim[0], ysize = dim[1], zsize = dim[2], xys = xsize*ysize;
+
+    // Grid of nodes for the local noise, half a box apart
+    size_t half = box/2, step = std::max<size_t>(half,1);
+    size_t nx = box>0 ? (xsize+step-2)/step+1 : 0;
+    size_t ny = box>0 ? (ysize+step-2)/step+1 : 0;
+    nodeNoise.assign(nx*ny*zsize,0);
+
+    chanNoise.assign(zsize,0);
+    chanNegNoise.assign(zsize,0);
+    if (sample!=nullptr) chanMoments.assign(zsize,Moments());
+
+#pragma omp parallel num_threads(nthreads)
+{
+    std::vector<T> vals, negs, win, buf(sample!=nullptr ? xys : 0);
+    std::vector<char> good(xys);
+    vals.reserve(xys);
+#pragma omp for schedule(dynamic)
+    for (size_t z=0; z<zsize; z++) {
+        const T *plane = channel(z,buf);
+        for (size_t i=0; i<xys; i++) good[i] = valid(i+z*xys,plane[i]);
+
+        // Noise of the channel and of its negative pixels
+        vals.clear();
+        negs.clear();
+        for (size_t i=0; i<xys; i++) {
+            if (!good[i]) continue;
+            vals.push_back(plane[i]);
+            if (plane[i]<0) negs.push_back(-plane[i]);
+        }
+        if (sample!=nullptr) {
+            Moments &m = chanMoments[z];
+            for (size_t i=0; i<xys; i++) {
+                if (!good[i]) continue;
+                double v = plane[i];
+                if (m.n==0) m.min = m.max = v;
+                else if (v<m.min) m.min = v;
+                else if (v>m.max) m.max = v;
+                m.sum += v;
+                m.sumsq += v*v;
+                m.n++;
+            }
+            size_t first = (stride-(z*xys)%stride)%stride;
+            for (size_t i=first; i<xys; i+=stride)
+                if (good[i]) (*sample)[z].push_back(plane[i]);
+        }
+        chanNoise[z] = noiseOf(vals.data(),vals.size());
+        if (negs.size()>0) {
+            if (useRobust) chanNegNoise[z] = Statistics::madfmToSigma(findMedian<T>(negs.data(),negs.size(),true));
+            else {
+                double sumsq = 0;
+                for (auto &v : negs) sumsq += double(v)*double(v);
+                chanNegNoise[z] = sqrt(sumsq/negs.size());
+            }
+        }
+
+        // Noise in the box around each node, one strip of rows at a time
+        for (size_t j=0; j<ny; j++) {
+            size_t cy = std::min(j*step,ysize-1);
+            size_t y0 = cy>half ? cy-half : 0, y1 = std::min(cy+half,ysize-1);
+            for (size_t i=0; i<nx; i++) {
+                size_t cx = std::min(i*step,xsize-1);
+                size_t x0 = cx>half ? cx-half : 0, x1 = std::min(cx+half,xsize-1);
+                win.clear();
+                for (size_t y=y0; y<=y1; y++)
+                    for (size_t x=x0; x<=x1; x++)
+                        if (good[x+y*xsize]) win.push_back(plane[x+y*xsize]);
+                nodeNoise[(i+j*nx)*zsize+z] = win.size()>=minPix ? noiseOf(win.data(),win.size()) : log(-1);
+            }
+        }
+    }
+}
+}
+
+
+template <class T>
+void NoiseMaps<T>::localMap(std::vector<float> &nodeNoise) {
+
+    /// Takes the local noise at each node as the median over the channels
+    /// of the noise in its box, and interpolates the map between nodes.
+
+    size_t zsize = dim[2], half = box/2, step = std::max<size_t>(half,1);
+    size_t nx = box>0 ? (dim[0]+step-2)/step+1 : 0;
+    size_t ny = box>0 ? (dim[1]+step-2)/step+1 : 0;
+
+    if (box>0) {
+        // Median over the channels of the noise at each node
+        std::vector<float> nodes(nx*ny);
+#pragma omp parallel num_threads(nthreads)
+{
+        std::vector<float> chans;
+#pragma omp for
+        for (size_t n=0; n<nx*ny; n++) {
+            chans.clear();
+            for (size_t z=0; z<zsize; z++)
+                if (!isNaN(nodeNoise[n*zsize+z])) chans.push_back(nodeNoise[n*zsize+z]);
+            nodes[n] = chans.size()>0 ? findMedian<float>(chans.data(),chans.size(),true) : log(-1);
+        }
+}
+        // Nodes with no valid boxes get the median of the other nodes
+        std::vector<float> good;
+        for (auto &v : nodes) if (!isNaN(v)) good.push_back(v);
+        float fill = good.size()>0 ? findMedian<float>(good.data(),good.size(),true) : stats.getSpread();
+        for (auto &v : nodes) if (isNaN(v)) v = fill;
+
+        interpolateNodes(nodes,nx,ny,step);
+    }
+    else std::vector<float>().swap(localNoise);
+
+    defined = true;
+}
+
+
+template <class T>
+float NoiseMaps<T>::noiseOf(T *values, size_t n) {
+
+    /// Returns the noise of n values, reordering them.
+
+    if (n==0) return 0;
+    if (useRobust) {
+        T median = findMedian<T>(values,n,true);
+        return Statistics::madfmToSigma(findMADFM<T>(values,n,median,true));
+    }
+    return findStddev<T>(values,n);
+}
+
+
+template <class T>
+void NoiseMaps<T>::interpolateNodes(std::vector<float> &nodes, size_t nx, size_t ny, size_t step) {
+
+    /// Fills the local noise map by bilinear interpolation between the
+    /// nodes, which are "step" pixels apart (the last node of each axis
+    /// lies on the last pixel).
+
+    size_t xsize = dim[0], ysize = dim[1];
+    localNoise.resize(xsize*ysize);
+
+    auto weights = [step](size_t p, size_t n, size_t size, size_t &i0, size_t &i1, float &t) {
+        i0 = std::min(p/step,n-1);
+        i1 = std::min(i0+1,n-1);
+        size_t c0 = std::min(i0*step,size-1), c1 = std::min(i1*step,size-1);
+        t = c1>c0 ? float(p-c0)/float(c1-c0) : 0;
+    };
+
+#pragma omp parallel for num_threads(nthreads)
+    for (size_t y=0; y<ysize; y++) {
+        size_t j0, j1, i0, i1;
+        float ty, tx;
+        weights(y,ny,ysize,j0,j1,ty);
+        for (size_t x=0; x<xsize; x++) {
+            weights(x,nx,xsize,i0,i1,tx);
+            localNoise[x+y*xsize] = (1-ty)*((1-tx)*nodes[i0+j0*nx]+tx*nodes[i1+j0*nx]) +
+                                    ty*((1-tx)*nodes[i0+j1*nx]+tx*nodes[i1+j1*nx]);
+        }
+    }
+}
+
+
+// Explicit instantiation of the class
+template class NoiseMaps<short>;
+template class NoiseMaps<int>;
+template class NoiseMaps<long>;
+template class NoiseMaps<float>;
+template class NoiseMaps<double>;
@@ -0,0 +1,100 @@
+// -----------------------------------------------------------------------
+// noise.hh: Definition of the NoiseMaps class, holding the noise
+//           statistics of a cube.
+// -----------------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#ifndef NOISE_HH_
+#define NOISE_HH_
+
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <Arrays/stats.hh>
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// A class holding the noise of a cube: the global statistics, the noise of
+/// each channel and a spatially varying noise map.
+/////////////////////////////////////////////////////////////////////////////////////
+template <class T>
+class NoiseMaps
+{
+/// The per-channel noise and the local noise map are filled in a single
+/// parallel sweep over the channels: each thread copies the valid pixels
+/// of one channel once, takes its noise and the noise in the boxes of a
+/// regular grid of nodes, reading the channel a strip of rows at a time.
+/// The local noise at a node is the median over the channels of the noise
+/// in its box, so that channels with line emission do not bias it. The
+/// map is then bilinearly interpolated between nodes, which are half a
+/// box apart. The global statistics are taken by Stats over the same data.
+/// Cubes not held in memory are read one channel at a time by the same
+/// sweep, which then also gathers the moments and a regular subsample of
+/// the pixels for the global statistics.
+///
+/// The noise is robust (MADFM converted to a std. deviation) or the std.
+/// deviation depending on the "robust" flag. The noise of the negative
+/// pixels of each channel, mirrored around zero, is also kept (MASK=NEGATIVE).
+///
+public:
+    NoiseMaps() {}
+    virtual ~NoiseMaps() {}
+
+    bool   isDefined() {return defined;}
+    int    getBox() {return box;}
+    Statistics::Stats<T>& stat() {return stats;}
+    float  ChanNoise (size_t z) {return chanNoise[z];}
+    float* ChanNoise () {return chanNoise.data();}
+    float  ChanNegNoise (size_t z) {return chanNegNoise[z];}
+    float* ChanNegNoise () {return chanNegNoise.data();}
+    float  LocalNoise (size_t x, size_t y) {return localNoise[x+y*dim[0]];}
+    float* LocalNoise () {return localNoise.data();}
+
+    void   compute(T *array, size_t xsize, size_t ysize, size_t zsize, bool *mask=nullptr, bool robust=true,
+                   int boxSize=0, int nthreads=1, size_t maxSample=0);
+    void   compute(std::function<void(size_t,T*)> readChannel, size_t xsize, size_t ysize, size_t zsize,
+                   bool robust=true, int boxSize=0, int nthreads=1, size_t maxSample=0,
+                   std::vector<T> *sample=nullptr);
+
+private:
+    bool   defined = false;                 //< Have the noise maps been computed?
+    size_t dim[3];                          //< Dimensions of the cube.
+    int    box = 0;                         //< Size of the box for the local noise (0 = no map).
+    bool   useRobust = true;                //< Robust (MADFM) or std. deviation noise?
+    int    nthreads = 1;                    //< Number of threads.
+    Statistics::Stats<T> stats;             //< Global statistics of the cube.
+    std::vector<float> chanNoise;           //< Noise of each channel.
+    std::vector<float> chanNegNoise;        //< Noise of the negative pixels of each channel.
+    std::vector<float> localNoise;          //< Local noise map (xsize*ysize), if box>0.
+
+    struct Moments {double sum=0, sumsq=0, min=0, max=0; size_t n=0;};
+    std::vector<Moments> chanMoments;       //< Moments of the valid pixels of each channel, while reading channels.
+
+    void   setup(size_t xsize, size_t ysize, size_t zsize, bool robust, int boxSize, int Nthreads);
+    template <class Channel, class Valid>
+    void   sweep(Channel channel, Valid valid, std::vector<float> &nodeNoise, size_t stride=0,
+                 std::vector<std::vector<T>> *sample=nullptr);
+    void   localMap(std::vector<float> &nodeNoise);
+    float  noiseOf(T *values, size_t n);
+    void   interpolateNodes(std::vector<float> &nodes, size_t nx, size_t ny, size_t step);
+};
+
+#endif
@@ -0,0 +1,267 @@
+//---------------------------------------------------------------
+// packed.cpp: Member functions of the PackedArray class.
+//---------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+#include <Arrays/packed.hh>
+#include <Utilities/utils.hh>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+namespace {
+
+const size_t blockSize = 1<<16;             // Pixels decoded by a thread at a time
+const int    intBlank  = 32768;             // Zero point of the INT16 codes (code 0 = blank)
+
+
+inline uint16_t floatToHalf (float f) {
+
+    // IEEE half precision, rounding to the nearest even.
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x>>16) & 0x8000, absx = x & 0x7fffffff;
+
+    if (absx>=0x7f800000) return sign | 0x7c00 | (absx>0x7f800000 ? 0x200 : 0);     // Inf and NaN
+    if (absx>=0x477ff000) return sign | 0x7c00;                                     // Overflow
+    if (absx<0x38800000) {                                                          // Subnormal
+        float a;
+        memcpy(&a, &absx, sizeof(a));
+        return sign | uint16_t(std::nearbyint(a*16777216.f));
+    }
+    absx += 0xc8000fff + ((absx>>13)&1);
+    return sign | uint16_t(absx>>13);
+}
+
+
+inline float halfToFloat (uint16_t h) {
+
+    // Written without branches on the value, so that loops are vectorized.
+    const uint32_t shiftedExp = 0x7c00<<13;
+    const float magic = 6.103515625e-05f;   // 2^-14
+    uint32_t o = uint32_t(h&0x7fff)<<13, exp = o & shiftedExp;
+    o += (127-15)<<23;
+    o += (exp==shiftedExp) * ((128-16)<<23);
+    uint32_t sub = (exp==0);
+    o += sub<<23;
+    float f;
+    memcpy(&f, &o, sizeof(f));
+    f -= sub*magic;
+    memcpy(&o, &f, sizeof(o));
+    o |= uint32_t(h&0x8000)<<16;
+    memcpy(&f, &o, sizeof(f));
+    return f;
+}
+
+}
+
+
+template <class T>
+bool PackedArray<T>::define(size_t xsize, size_t ysize, size_t zsize, std::string packtype) {
+
+    /// Allocates the packed array, to be filled with packChannels().
+
+    if (packtype!="FLOAT16" && packtype!="INT16") {
+        std::cerr << "PACKED ARRAY error: unknown type " << packtype << ". Use FLOAT16 or INT16.\n";
+        return false;
+    }
+
+    type = packtype;
+    isHalf = type=="FLOAT16";
+    dim[0] = xsize; dim[1] = ysize; dim[2] = zsize;
+    codes.assign(xsize*ysize*zsize,0);
+    scale.assign(zsize,1);
+    offset.assign(zsize,0);
+    zero.assign(zsize,intBlank);
+    defined = true;
+    return true;
+}
+
+
+template <class T>
+void PackedArray<T>::packChannels(size_t z0, size_t nz, T *data, int nthreads) {
+
+    /// Packs the channels from z0 to z0+nz-1, given in "data". Each channel
+    /// is packed independently, so a cube can be packed slab by slab.
+
+    size_t xys = dim[0]*dim[1];
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+    for (size_t z=z0; z<z0+nz; z++) {
+        T *plane = data+(z-z0)*xys;
+        uint16_t *code = codes.data()+z*xys;
+
+        double minval = 0, maxval = 0;
+        bool first = true;
+        for (size_t i=0; i<xys; i++) {
+            if (isBlank(plane[i])) continue;
+            double v = plane[i];
+            if (first) {minval = maxval = v; first = false;}
+            else if (v<minval) minval = v;
+            else if (v>maxval) maxval = v;
+        }
+
+        if (isHalf) {
+            // Scaling by a power of two is exact
+            double maxabs = std::max(fabs(minval),fabs(maxval));
+            int e = 0;
+            if (maxabs>0) frexp(maxabs,&e);
+            double s = ldexp(1.,e-15);
+            scale[z] = s;
+            for (size_t i=0; i<xys; i++) code[i] = floatToHalf(float(plane[i]/s));
+        }
+        else {
+            // When 0 is in the range of the channel, the codes are shifted
+            // by an integer so that 0 has a code of its own and decodes as
+            // s*0 = 0. The shift is at most half a level, so the levels are
+            // one fewer than 65535 to leave room for it.
+            double s = (maxval-minval)/(2*(intBlank-1)-1), mid = (maxval+minval)/2.;
+            bool hasZero = minval<=0 && maxval>=0;
+            long k = hasZero && s>0 ? lround(mid/s) : 0;
+            offset[z] = hasZero ? 0 : mid;
+            zero[z] = intBlank-k;
+            scale[z] = s;
+            for (size_t i=0; i<xys; i++) {
+                if (isBlank(plane[i])) {code[i] = 0; continue;}
+                long c = s>0 ? lround((plane[i]-offset[z])/s)-k : 0;
+                code[i] = uint16_t(std::min(std::max(c,-long(intBlank-1)),long(intBlank-1))+intBlank);
+            }
+        }
+    }
+}
+
+
+template <class T>
+bool PackedArray<T>::pack(T *array, size_t xsize, size_t ysize, size_t zsize, std::string packtype, int nthreads) {
+
+    /// Packs a whole array already in memory.
+
+    if (!define(xsize,ysize,zsize,packtype)) return false;
+    packChannels(0,zsize,array,nthreads);
+    return true;
+}
+
+
+template <class T>
+void PackedArray<T>::decodeRun(size_t start, size_t n, T *out) {
+
+    /// Decodes n pixels starting from pixel "start", one channel at a time.
+
+    size_t xys = dim[0]*dim[1];
+
+    while (n>0) {
+        size_t z = start/xys, len = std::min(n,(z+1)*xys-start);
+        const uint16_t *code = codes.data()+start;
+        float s = scale[z], off = offset[z], zc = zero[z];
+        if (isHalf) {
+            for (size_t i=0; i<len; i++) out[i] = T(halfToFloat(code[i])*s);
+        }
+        else {
+            for (size_t i=0; i<len; i++) out[i] = T((code[i]!=0)*(off+s*(float(code[i])-zc)));
+        }
+        start += len; out += len; n -= len;
+    }
+}
+
+
+template <class T>
+void PackedArray<T>::decode(size_t start, size_t n, T *out, int nthreads) {
+
+    /// Decodes n consecutive pixels from pixel "start" into "out".
+
+    size_t nblocks = (n+blockSize-1)/blockSize;
+#pragma omp parallel for num_threads(nthreads) if(nblocks>1)
+    for (size_t b=0; b<nblocks; b++) {
+        size_t first = b*blockSize;
+        decodeRun(start+first,std::min(blockSize,n-first),out+first);
+    }
+}
+
+
+template <class T>
+void PackedArray<T>::decodeBox(long *blc, long *trc, T *out, int nthreads) {
+
+    /// Decodes the box [blc,trc] (0-based, edges included) into "out",
+    /// in the same order as Cube::fitsread_subset().
+
+    size_t nx = trc[0]-blc[0]+1, ny = trc[1]-blc[1]+1, nz = trc[2]-blc[2]+1;
+
+#pragma omp parallel for num_threads(nthreads) collapse(2) if(nx*ny*nz>blockSize)
+    for (size_t z=0; z<nz; z++) {
+        for (size_t y=0; y<ny; y++) {
+            size_t start = blc[0]+(blc[1]+y)*dim[0]+(blc[2]+z)*dim[0]*dim[1];
+            decodeRun(start,nx,out+(y+z*ny)*nx);
+        }
+    }
+}
+
+
+template <class T>
+T PackedArray<T>::value(size_t i) {
+
+    /// Decodes a single pixel.
+
+    size_t z = i/(dim[0]*dim[1]);
+    uint16_t code = codes[i];
+    if (isHalf) return T(halfToFloat(code)*scale[z]);
+    return T((code!=0)*(offset[z]+scale[z]*(float(code)-zero[z])));
+}
+
+
+template <class T>
+double PackedArray<T>::maxError(size_t z) {
+
+    /// Upper bound of the absolute error of the values in channel z.
+
+    if (isHalf) return 16.*scale[z];    // |x|*2^-11, with |x| < 2^15*scale
+    // Half a level, plus the rounding of offset, scale and off+s*(code-zero)
+    // in single precision
+    return scale[z]/2.+2*(fabs(offset[z])+2*scale[z]*intBlank)*FLT_EPSILON;
+}
+
+
+template <class T>
+void PackedArray<T>::clear() {
+
+    std::vector<uint16_t>().swap(codes);
+    std::vector<float>().swap(scale);
+    std::vector<float>().swap(offset);
+    std::vector<float>().swap(zero);
+    type = "NONE";
+    isHalf = false;
+    defined = false;
+}
+
+
+// Explicit instantiation of the class
+template class PackedArray<short>;
+template class PackedArray<int>;
+template class PackedArray<long>;
+template class PackedArray<float>;
+template class PackedArray<double>;
@@ -0,0 +1,89 @@
+// -----------------------------------------------------------------------
+// packed.hh: Definition of the PackedArray class, a 16-bit in-memory
+//            representation of a cube.
+// -----------------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#ifndef PACKED_HH_
+#define PACKED_HH_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// A class storing a cube with 16 bits per pixel, with a scale (and an offset)
+/// for each channel. Values are decoded on the fly by the tasks that read it.
+/////////////////////////////////////////////////////////////////////////////////////
+template <class T>
+class PackedArray
+{
+/// Two representations are available (PACKCUBE parameter):
+///
+/// - FLOAT16: IEEE half precision of x/s, where s is a power of two such
+///   that the largest |x| of the channel, M, is scaled below 2^15. Scaling
+///   is exact, so the relative error is <= 2^-11 (0.05%) for all |x| down
+///   to M*2^-28, and the absolute error is <= M*2^-39 below that.
+/// - INT16: x = offset + scale*(code-zero), with 65533 levels between the
+///   minimum and the maximum of the channel. The absolute error is
+///   <= (max-min)/131066, plus the rounding of single precision. When the
+///   channel contains 0, offset is 0 and zero is the (integer) code of 0.
+///
+/// Zeros are kept exactly in both cases. NaNs are kept in FLOAT16, while
+/// in INT16 they decode as 0, as in cubes read by Cube::fitsread_3d.
+/// maxError(z) gives the bound on the absolute error for channel z.
+///
+/// The decoding loops have no branches and no tables, so that they are
+/// vectorized by the compiler.
+///
+public:
+    PackedArray() {}
+    virtual ~PackedArray() {}
+
+    bool   isDefined() {return defined;}
+    std::string Type() {return type;}
+    size_t bytes() {return codes.size()*sizeof(uint16_t)+(scale.size()+offset.size()+zero.size())*sizeof(float);}
+    double maxError(size_t z);
+
+    bool   define(size_t xsize, size_t ysize, size_t zsize, std::string packtype);
+    void   packChannels(size_t z0, size_t nz, T *data, int nthreads=1);
+    bool   pack(T *array, size_t xsize, size_t ysize, size_t zsize, std::string packtype, int nthreads=1);
+    void   decode(size_t start, size_t n, T *out, int nthreads=1);
+    void   decodeBox(long *blc, long *trc, T *out, int nthreads=1);
+    T      value(size_t i);
+    void   clear();
+
+private:
+    bool   defined = false;                 //< Has the array been defined?
+    std::string type = "NONE";              //< FLOAT16 or INT16.
+    bool   isHalf = false;                  //< Is the type FLOAT16?
+    size_t dim[3];                          //< Dimensions of the cube.
+    std::vector<uint16_t> codes;            //< The packed pixels.
+    std::vector<float> scale;               //< Scale of each channel.
+    std::vector<float> offset;              //< Offset of each channel (INT16 only).
+    std::vector<float> zero;                //< Code of the offset in each channel (INT16 only).
+
+    void   decodeRun(size_t start, size_t n, T *out);
+};
+
+#endif
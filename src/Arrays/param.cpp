@@ -88,8 +88,16 @@ void Param::defaultValues() {
     plots               = 1;
     beamFWHM            = -1;
     checkCube           = 0;
+    mapCube             = false;
+    compressMask        = "NONE";
+    compressModel       = "NONE";
+    quantize            = 16;
+    packCube            = "NONE";
+    cacheMB             = 0;
     flagStats           = false;
     flagRobustStats     = true;
+    statSample          = 0;
+    noiseBox            = 0;
     fluxConvert         = true;
     
     contsub             = false;
@@ -173,11 +181,19 @@ Param& Param::operator= (const Param& p) {
     this->logFile           = p.logFile;
     this->beamFWHM          = p.beamFWHM;
     this->checkCube         = p.checkCube;
+    this->mapCube           = p.mapCube;
+    this->compressMask      = p.compressMask;
+    this->compressModel     = p.compressModel;
+    this->quantize          = p.quantize;
+    this->packCube          = p.packCube;
+    this->cacheMB           = p.cacheMB;
     this->verbose           = p.verbose; 
     this->showbar           = p.showbar;
     this->plots             = p.plots;
     this->flagStats         = p.flagStats;
     this->flagRobustStats   = p.flagRobustStats;
+    this->statSample        = p.statSample;
+    this->noiseBox          = p.noiseBox;
     this->fluxConvert       = p.fluxConvert;
     
     this->contsub           = p.contsub;
@@ -491,6 +507,12 @@ void Param::setParam(string &parstr) {
     if(arg=="plots")            plots     = readFlagorInt(ss);
     if(arg=="beamfwhm")         beamFWHM  = readval<float>(ss);
     if(arg=="checkcube")        checkCube = readval<int>(ss);
+    if(arg=="mmap")             mapCube   = readFlag(ss);
+    if(arg=="compressmask")     compressMask = makeupper(readFilename(ss));
+    if(arg=="compressmodel")    compressModel = makeupper(readFilename(ss));
+    if(arg=="quantize")         quantize  = readval<float>(ss);
+    if(arg=="packcube")         packCube  = makeupper(readFilename(ss));
+    if(arg=="cachemb")          cacheMB   = readval<int>(ss);
     if(arg=="auto")             AUTO      = readFlag(ss);
     if(arg=="fluxconvert")      fluxConvert = readFlag(ss);
 
@@ -504,6 +526,8 @@ void Param::setParam(string &parstr) {
     
     if(arg=="stats")            flagStats = readFlag(ss); 
     if(arg=="flagrobuststats")  flagRobustStats = readFlag(ss);
+    if(arg=="statsample")       statSample = readval<int>(ss);
+    if(arg=="noisebox")         noiseBox = readval<int>(ss);
     
     // SEARCH ONLY PARAMETERS
     if(arg=="search")            parSE.flagSearch = readFlag(ss);
@@ -520,6 +544,13 @@ void Param::setParam(string &parstr) {
     if(arg=="maxangsize")        parSE.maxAngSize = readval<float>(ss);
     if(arg=="rejectbeforemerge") parSE.RejectBeforeMerge = readFlag(ss);
     if(arg=="twostagemerging")   parSE.TwoStageMerging = readFlag(ss);
+    if(arg=="labelling")         parSE.flagLabelling = readFlag(ss);
+    if(arg=="reconstruct")       parSE.flagRecon = readFlag(ss);
+    if(arg=="recondim")          parSE.reconDim = readval<int>(ss);
+    if(arg=="scalemin")          parSE.scaleMin = readval<int>(ss);
+    if(arg=="scalemax")          parSE.scaleMax = readval<int>(ss);
+    if(arg=="snrrecon")          parSE.snrRecon = readval<float>(ss);
+    if(arg=="slabchannels")      parSE.slabChannels = readval<int>(ss);
     if(arg=="snrcut")            parSE.snrCut = readval<float>(ss); 
     if(arg=="threshold"){
         parSE.threshold = readval<float>(ss);
@@ -544,6 +575,9 @@ void Param::setParam(string &parstr) {
     if(arg=="dispersionmap")    parMA.dispersionmap = readFlag(ss);
     if(arg=="rmsmap")           parMA.rmsmap = readFlag(ss);
     if(arg=="maptype")          parMA.maptype = makeupper(readFilename(ss));
+    if(arg=="maxcomp")          parMA.maxcomp = readval<int>(ss);
+    if(arg=="gausshermite")     parMA.gausshermite = readFlag(ss);
+    if(arg=="infocrit")         parMA.infocrit = makeupper(readFilename(ss));
     if(arg=="snmap")            parMA.SNmap = readFlag(ss);
     if(arg=="taper")            parMA.taper = makelower(readFilename(ss));
     if(arg=="contchans")        parMA.contChans = readVec<int>(ss);
@@ -617,6 +651,8 @@ void Param::setParam(string &parstr) {
     if(arg=="badout")    parGF.flagBADOUT = readFlag(ss);
     if(arg=="plotmask")  parGF.PLOTMASK   = readFlag(ss);
     if(arg=="plotmincon")parGF.PLOTMINCON = readval<float>(ss);
+    if(arg=="nseeds")    parGF.NSEEDS     = readval<int>(ss);
+    if(arg=="fastguess") parGF.FASTGUESS  = readFlag(ss);
 
 
     // GALWIND ONLY PARAMETERS
@@ -745,6 +781,34 @@ bool Param::checkPars() {
         checkCube = 0;
     } 
 
+    // Checking compression of output products
+    std::string *comps[2] = {&compressMask, &compressModel};
+    for (auto c : comps) {
+        if (*c!="NONE" && *c!="RICE" && *c!="GZIP" && *c!="GZIP2" && *c!="HCOMPRESS" && *c!="PLIO") {
+            cout << "COMPRESSMASK and COMPRESSMODEL can be NONE, RICE, GZIP, GZIP2, HCOMPRESS or PLIO. "
+                 << "Setting " << *c << " to NONE.\n";
+            *c = "NONE";
+        }
+    }
+    if (compressModel=="PLIO") {
+        cout << "PLIO compression is only for integer images. Setting COMPRESSMODEL to RICE.\n";
+        compressModel = "RICE";
+    }
+
+    // Checking packed storage of the cube
+    if (packCube!="NONE" && packCube!="FLOAT16" && packCube!="INT16") {
+        cout << "PACKCUBE can be NONE, FLOAT16 or INT16. Setting it to NONE.\n";
+        packCube = "NONE";
+    }
+    if (cacheMB<0) {
+        cout << "CACHEMB must be >= 0. Setting it to 0 (cube read in memory).\n";
+        cacheMB = 0;
+    }
+    if (cacheMB>0 && packCube!="NONE") {
+        cout << "CACHEMB is not used with PACKCUBE. Setting it to 0.\n";
+        cacheMB = 0;
+    }
+
     // Checking parameters for source finder
     if (parSE.flagSearch) {
         if(parSE.searchType != "spatial" && parSE.searchType != "spatialsmooth" && parSE.searchType != "spectral"){
@@ -752,7 +816,18 @@ bool Param::checkPars() {
                       << "Only \"spectral\", \"spatial\" and \"spatialsmooth\" are accepted. Setting to \"spatial\".\n";
             parSE.searchType = "spatial";
         }
-    
+
+        if(parSE.flagRecon && (parSE.reconDim<1 || parSE.reconDim>3)) {
+            cout << "RECONDIM must be 1 (spectral), 2 (spatial) or 3. Setting it to 3.\n";
+            parSE.reconDim = 3;
+        }
+
+        if(parSE.slabChannels>0 && (parSE.searchType=="spatialsmooth" || parSE.flagRecon)) {
+            cout << "SLABCHANNELS cannot be used with a smoothed or reconstructed cube. "
+                 << "The whole cube will be searched in memory.\n";
+            parSE.slabChannels = 0;
+        }
+
         if(parSE.flagGrowth){
             if(parSE.UserThreshold && ((parSE.threshold<parSE.growthThreshold)||
               (parSE.snrCut<parSE.growthCut))) {
@@ -1068,8 +1143,20 @@ bool Param::checkPars() {
     }
 
     if (getMaps()) {
-        if (parMA.maptype!="GAUSSIAN" && parMA.maptype!="MOMENT")
-            cout << "MAP warning: MAPTYPE is either MOMENT or GAUSSIAN. Reverting to MOMENT.\n";
+        if (parMA.maptype!="GAUSSIAN" && parMA.maptype!="MOMENT" && parMA.maptype!="MULTIGAUSS") {
+            cout << "MAP warning: MAPTYPE is either MOMENT, GAUSSIAN or MULTIGAUSS. Reverting to MOMENT.\n";
+            parMA.maptype = "MOMENT";
+        }
+        if (parMA.maptype=="MULTIGAUSS") {
+            if (parMA.maxcomp<1) {
+                cout << "MAP warning: MAXCOMP must be at least 1. Setting it to 1.\n";
+                parMA.maxcomp = 1;
+            }
+            if (parMA.infocrit!="BIC" && parMA.infocrit!="AIC") {
+                cout << "MAP warning: INFOCRIT is either BIC or AIC. Reverting to BIC.\n";
+                parMA.infocrit = "BIC";
+            }
+        }
     }
     
     if (parMA.veldef!="radio" && parMA.veldef!="optical" && \
@@ -1291,11 +1378,33 @@ void printParams(std::ostream& Str, Param &p, bool defaults, string whichtask) {
         recordParam(Str, "[OUTFOLDER]", "Directory where outputs are written", p.getOutfolder());
     recordParam(Str, "[LOGFILE]", "Redirect output messages to a file?", stringize(p.getLogFile()));
     recordParam(Str, "[flagRobustStats]", "Using robust statistics?", stringize(p.getFlagRobustStats()));    
+    if (p.getStatSample()>0 || defaults)
+        recordParam(Str, "[STATSAMPLE]", "Max pixels for median and MADFM (0 = all)", p.getStatSample());
+    if (p.getNoiseBox()>0 || defaults)
+        recordParam(Str, "[NOISEBOX]", "Box size for the local noise map (pixels)", p.getNoiseBox());
     recordParam(Str, "[FLUXCONVERT]", "Whether to convert flux to Jy?", stringize(p.getFluxConvert()));    
 
     // Print CHECKCUBE
     if (p.getCheckCube() || (defaults && isAll))
         recordParam(Str, "[checkCube]", "Check cube for bad channels/rows/columns?", p.getCheckCube());
+    if (p.getMapCube() || (defaults && isAll))
+        recordParam(Str, "[MMAP]", "Memory-mapping the FITS cube?", stringize(p.getMapCube()));
+    if (p.getCompressMask()!="NONE" || (defaults && isAll))
+        recordParam(Str, "[COMPRESSMASK]", "Tile compression of output masks", p.getCompressMask());
+    if (p.getCompressModel()!="NONE" || (defaults && isAll)) {
+        recordParam(Str, "[COMPRESSMODEL]", "Tile compression of output models", p.getCompressModel());
+        recordParam(Str, "[QUANTIZE]", "Quantization level of compressed models", p.getQuantize());
+    }
+    if (p.getPackCube()!="NONE" || (defaults && isAll))
+        recordParam(Str, "[PACKCUBE]", "Packed storage of the cube in memory", p.getPackCube());
+    if (p.getCacheMB()>0 || (defaults && isAll))
+        recordParam(Str, "[CACHEMB]", "Memory (MB) for tiles of a cube read on demand", p.getCacheMB());
+    std::string box;
+    for (int i=0;i<6;i++) if (p.getBOX(i)!=-1) box += to_string<int>(p.getBOX(i))+" ";
+    if (box!="" || (defaults && isAll)) {
+        if (box=="") box = "NONE";
+        recordParam(Str, "[BOX]", "Sub-region of the cube to be read", box);
+    }
 
     
     if (p.getFlagDebug()) recordParam(Str, "[DEBUG]", "Debugging mode?", stringize(p.getFlagDebug()));
@@ -1372,6 +1481,16 @@ void printParams(std::ostream& Str, Param &p, bool defaults, string whichtask) {
         recordParam(Str, "[threshVelocity]", "   Max. velocity separation for merging", p.getParSE().threshVelocity);
         recordParam(Str, "[RejectBeforeMerge]", "   Reject objects before merging?", stringize(p.getParSE().RejectBeforeMerge));
         recordParam(Str, "[TwoStageMerging]", "   Merge objects in two stages?", stringize(p.getParSE().TwoStageMerging));
+        recordParam(Str, "[LABELLING]", "   Labelling 3D connected components?", stringize(p.getParSE().flagLabelling));
+        recordParam(Str, "[RECONSTRUCT]", "   Wavelet reconstruction before searching?", stringize(p.getParSE().flagRecon));
+        if(p.getParSE().flagRecon || defaults) {
+            recordParam(Str, "[reconDim]", "     Dimensions of the reconstruction", p.getParSE().reconDim);
+            recordParam(Str, "[scaleMin]", "     Minimum wavelet scale", p.getParSE().scaleMin);
+            recordParam(Str, "[scaleMax]", "     Maximum wavelet scale", p.getParSE().scaleMax);
+            recordParam(Str, "[snrRecon]", "     SNR threshold for wavelet coefficients", p.getParSE().snrRecon);
+        }
+        if(p.getParSE().slabChannels>0 || defaults)
+            recordParam(Str, "[slabChannels]", "   Channels per slab (out-of-core search)", p.getParSE().slabChannels);
 
     }
     
@@ -1379,10 +1498,6 @@ void printParams(std::ostream& Str, Param &p, bool defaults, string whichtask) {
     toPrint = isAll || p.getflagSmooth() || (defaults && whichtask=="SMOOTH");
     if (toPrint) {
         recordParam(Str, "[SMOOTH]", "Smoothing the datacube?", stringize(p.getflagSmooth()));
-        std::string box;
-        for (int i=0;i<6;i++) if (p.getBOX(i)!=-1) box += to_string<int>(p.getBOX(i))+" ";
-        if (box=="") box = "NONE";
-        recordParam(Str, "[BOX]", "   Sub-region to be used?", box);
         if ((p.getOBmaj()!=-1 && p.getOBmin()!=-1) || defaults) {
             recordParam(Str, "[OBMAJ]", "   Old major beam (arcsec)", p.getOBmaj());
             recordParam(Str, "[OBMIN]", "   Old minor beam (arcsec)", p.getOBmin());
@@ -1536,6 +1651,7 @@ void printParams(std::ostream& Str, Param &p, bool defaults, string whichtask) {
             }
             recordParam(Str, "[REVERSE]", "   Using reverse-cumulative fitting?", p.getParGF().REVERSE);
             recordParam(Str, "[NORMALCUBE]", "   Normalizing cube to help convergence?", stringize(p.getParGF().NORMALCUBE));
+            recordParam(Str, "[FASTGUESS]", "   Stopping initial estimates once stable?", stringize(p.getParGF().FASTGUESS));
 	    recordParam(Str, "[BADOUT]", "   Write unconverged rings in output (with flag)?", stringize(p.getParGF().flagBADOUT));
         recordParam(Str, "[VELDEF]",   "   Definition for velocity conversion?", p.getParMA().veldef);
         recordParam(Str, "[PLOTMASK]", "   Overlaying mask to output plots?", stringize(p.getParGF().PLOTMASK));
@@ -1618,6 +1734,7 @@ void printParams(std::ostream& Str, Param &p, bool defaults, string whichtask) {
         else if (t==-2) typ = "sin(θ)^2";
         
         recordParam(Str, "[WFUNC]", "   Weighting function", typ);
+        recordParam(Str, "[NSEEDS]", "   Initial guesses for each ring", p.getParGF().NSEEDS);
     }
     
     // PARAMETERS FOR ELLPROF
@@ -1671,7 +1788,12 @@ void printParams(std::ostream& Str, Param &p, bool defaults, string whichtask) {
     if (p.getMaps() || (defaults && isAll)) 
         recordParam(Str, "[MASK]",          "   Mask used for maps and profile?", p.getMASK());
     if (p.getParMA().totalmap || p.getParMA().velocitymap || p.getParMA().dispersionmap || (defaults && isAll))
-        recordParam(Str, "[MAPTYPE]",       "   How to extract the map (gaussian or moment)?", p.getParMA().maptype);
+        recordParam(Str, "[MAPTYPE]",       "   How to extract the map (gaussian, moment or multigauss)?", p.getParMA().maptype);
+    if (p.getParMA().maptype=="MULTIGAUSS" || (defaults && isAll)) {
+        recordParam(Str, "[MAXCOMP]",       "     Maximum number of Gaussian components", p.getParMA().maxcomp);
+        recordParam(Str, "[GAUSSHERMITE]",  "     Trying also a Gauss-Hermite profile?", stringize(p.getParMA().gausshermite));
+        recordParam(Str, "[INFOCRIT]",      "     Criterion to select the components", p.getParMA().infocrit);
+    }
     
     // PARAMETERS FOR PV
     toPrint = isAll || p.getFlagPV() || (defaults && (whichtask=="PVSLICE" || whichtask=="PV"));
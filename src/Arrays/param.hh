@@ -73,6 +73,7 @@ struct GALFIT_PAR : GALMOD_PAR {
     float  MINVDISP   = 0.1;      ///< Minimum velocity dispersion.
     int    FTYPE      = 2;        ///< Type of function to be minimized;
     int    WFUNC      = 2;        ///< Weighting function.
+    int    NSEEDS     = 1;        ///< Initial guesses fitted for each ring in 2DFIT.
     double TOL        = 1E-03;    ///< Tolerance for minimization.
     string NORM       = "AZIM";  ///< Normalization type: LOCAL, AZIM or NONE.
     string FREE       = "VROT VDISP INC PA"; ///< Free parameters.
@@ -91,6 +92,7 @@ struct GALFIT_PAR : GALMOD_PAR {
     bool   flagBADOUT = false;    ///< Whether to write bad rings (with flag) in output.
     bool   PLOTMASK   = false;    ///< Whether to show the mask in output plots
     float  PLOTMINCON = -1;       ///< Whether to show the mask in output plots
+    bool   FASTGUESS  = false;    ///< Whether stopping the initial estimates once they are stable.
 };
 
 // Container for input parameters for GALWIND (generates a 3D biconical outflow)
@@ -124,6 +126,13 @@ struct SEARCH_PAR {
     int    minChannels       = 2;         ///< Minimum channels to make an object.
     bool   RejectBeforeMerge = true;      ///< Whether to reject sources before merging.
     bool   TwoStageMerging   = true;      ///< Whether to do a partial merge during search.
+    bool   flagLabelling     = true;      ///< Use 3D connected-component labelling instead of merging?
+    bool   flagRecon         = false;     ///< Reconstruct the cube with à trous wavelets before searching?
+    int    reconDim          = 3;         ///< Axes of the reconstruction: 1=spectral, 2=spatial, 3=both.
+    int    scaleMin          = 1;         ///< Minimum wavelet scale used in the reconstruction.
+    int    scaleMax          = -1;        ///< Maximum wavelet scale used (-1 = largest possible).
+    float  snrRecon          = 4.0;       ///< SNR threshold for the wavelet coefficients.
+    int    slabChannels      = 0;         ///< Channels per slab for an out-of-core search (0 = whole cube).
     int    minVoxels         = -1;        ///< Minimum voxels required in an object.
     int    minPix            = -1;        ///< Minimum pixels required in an object.
     int    maxChannels       = -1;        ///< Maximum channels to accept an object.
@@ -141,7 +150,10 @@ struct SEARCH_PAR {
 
 // Container for input parameters for maps
 struct MAPS_PAR {
-    string maptype        = "MOMENT";       ///< How to extract kinematic map: GAUSSIAN OR MOMENT
+    string maptype        = "MOMENT";       ///< How to extract kinematic map: GAUSSIAN, MOMENT OR MULTIGAUSS
+    int    maxcomp        = 3;              ///< Maximum number of Gaussian components with MULTIGAUSS.
+    bool   gausshermite   = false;          ///< Whether to try also a Gauss-Hermite profile with MULTIGAUSS.
+    string infocrit       = "BIC";          ///< Criterion to select the components: BIC or AIC.
     bool   globprof       = false;          ///< Whether to calculate the global profile.
     bool   massdensmap    = false;          ///< Whether to calculate the mass density HI map.
     bool   totalmap       = false;          ///< Whether to calculate the total map.
@@ -203,9 +215,25 @@ public:
     void    setBeamFWHM(float val) {beamFWHM=val;}
     int     getCheckCube () {return checkCube;}
     void    setCheckCube (bool a) {checkCube=a;}
+    bool    getMapCube () {return mapCube;}
+    void    setMapCube (bool a) {mapCube=a;}
+    string  getCompressMask () {return compressMask;}
+    void    setCompressMask (string s) {compressMask=s;}
+    string  getCompressModel () {return compressModel;}
+    void    setCompressModel (string s) {compressModel=s;}
+    float   getQuantize () {return quantize;}
+    void    setQuantize (float q) {quantize=q;}
+    string  getPackCube () {return packCube;}
+    void    setPackCube (string s) {packCube=s;}
+    int     getCacheMB () {return cacheMB;}
+    void    setCacheMB (int m) {cacheMB=m;}
     
     bool    getFlagRobustStats () {return flagRobustStats;}
     void    setFlagRobustStats (bool flag) {flagRobustStats=flag;}
+    int     getStatSample () {return statSample;}
+    void    setStatSample (int n) {statSample=n;}
+    int     getNoiseBox () {return noiseBox;}
+    void    setNoiseBox (int n) {noiseBox=n;}
     
     bool    getMaps() {return (parMA.globprof || parMA.totalmap || parMA.velocitymap || parMA.dispersionmap || parMA.massdensmap || parMA.rmsmap);}
     
@@ -213,6 +241,7 @@ public:
     void    setFlagRing (bool b) {flagRing = b;}
 
     int     getBOX  (int i) {return BOX[i];}
+    void    setBOX  (int i, int val) {BOX[i]=val;}
 
     bool    getflagSearch () {return parSE.flagSearch;}
     bool    getflagGalFit () {return parGF.flagGALFIT;}
@@ -265,9 +294,13 @@ public:
     bool    getFlagPV() {return flagPV;}
     string  getXPOS_PV() {return XPOS_PV;}
     string  getYPOS_PV() {return YPOS_PV;}
+    void    setXPOS_PV(string s) {XPOS_PV=s;}
+    void    setYPOS_PV(string s) {YPOS_PV=s;}
     float   getPA_PV() {return PA_PV;}
     float   getP1_PV (int i) {return P1_PV[i];}
     float   getP2_PV (int i) {return P2_PV[i];}
+    void    setP1_PV (int i, float f) {P1_PV[i]=f;}
+    void    setP2_PV (int i, float f) {P2_PV[i]=f;}
     float   getWIDTH_PV () {return WIDTH_PV;}
     float   getANTIALIAS () {return ANTIALIAS;}
     void    setANTIALIAS (float i) {ANTIALIAS=i;}
@@ -300,8 +333,16 @@ private:
     bool            verbose;            ///< Is verbosity activated?
     bool            showbar;            ///< Show progress bar?
     int             checkCube;          ///< Checking for bad channels/rows/cols in the cube?
+    bool            mapCube;            ///< Memory-mapping the FITS data instead of reading them?
+    string          compressMask;       ///< Tile compression of output masks (NONE, RICE, GZIP, ...).
+    string          compressModel;      ///< Tile compression of output models.
+    float           quantize;           ///< Quantization level for compressed float outputs.
+    string          packCube;           ///< Packed in-memory storage of the cube (NONE, FLOAT16, INT16).
+    int             cacheMB;            ///< Memory in MB for a cube read on demand in tiles (0 = read all).
     float           beamFWHM;           ///< Beam to adopt if any information in header.
     bool            flagRobustStats;    ///< Whether to use robust statistics.
+    int             statSample;         ///< Maximum number of pixels for median and MADFM (0 = all).
+    int             noiseBox;           ///< Size in pixels of the box for the local noise map (0 = none).
     int             plots;              ///< Whether producing output plots.
     bool            flagStats;          ///< Whether to calculate and return stats
     bool            fluxConvert;        ///< Whether to convert fluxes to Jy, when possible
@@ -316,7 +357,7 @@ private:
 
     bool            flagRing;           ///< Do you want to fit a tilted ring model?
 
-    int             BOX[6];             ///< A box in RA-DEC-VELO. Not used anymore!
+    int             BOX[6];             ///< Sub-region of the cube to read (xmin xmax ymin ymax zmin zmax).
 
     SEARCH_PAR      parSE;              ///< Input parameters for the SEARCH task
     GALMOD_PAR      parGM;              ///< Input parameters for the GALMOD task
@@ -0,0 +1,110 @@
+//---------------------------------------------------------------
+// ringindex.cpp: Member functions of the RingIndex class.
+//---------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <Arrays/ringindex.hh>
+
+
+template <class T>
+bool RingIndex<T>::define(Rings<T> *r, int *blo, int *bsize, double pixScale, int wpow, int nthreads) {
+
+    /// Builds the map for the annuli between the radii of r (in arcsec,
+    /// pixScale in arcsec/pixel). Returns true if the map was rebuilt,
+    /// false if the geometry was the same as in the previous call.
+
+    if (r->nr<1) {
+        clear();
+        return true;
+    }
+
+    std::vector<Annulus> ann(std::max(r->nr-1,1));
+    for (size_t i=0; i<ann.size(); i++) {
+        size_t j = std::min<size_t>(i+1,r->nr-1);
+        ann[i] = {double(r->xpos[j]), double(r->ypos[j]), double(r->phi[j]), double(r->inc[j]),
+                  r->radii[i]/pixScale, r->radii[j]/pixScale};
+    }
+    return define(ann,blo,bsize,wpow,nthreads);
+}
+
+
+template <class T>
+bool RingIndex<T>::define(const std::vector<Annulus> &ann, int *blo, int *bsize, int wpow, int nthreads) {
+
+    /// Builds the map for the given annuli. Returns true if the map was
+    /// rebuilt, false if the geometry was the same as in the previous call.
+
+    std::vector<double> newkey = {double(blo[0]), double(blo[1]), double(bsize[0]), double(bsize[1]), double(wpow)};
+    for (auto &a : ann) newkey.insert(newkey.end(), {a.x0, a.y0, a.phi, a.inc, a.rin, a.rout});
+    if (newkey==key) return false;
+    key = newkey;
+
+    const double F = M_PI/180.;
+    const size_t na = ann.size(), npix = size_t(bsize[0])*bsize[1];
+    std::vector<double> sinp(na), cosp(na), cosi(na);
+    for (size_t i=0; i<na; i++) {
+        sinp[i] = sin(F*ann[i].phi);
+        cosp[i] = cos(F*ann[i].phi);
+        cosi[i] = cos(F*ann[i].inc);
+    }
+
+    ring.resize(npix);
+    radius.resize(npix);
+    theta.resize(npix);
+    costh.resize(npix);
+    weight.resize(npix);
+
+    // Weighting function can be either a cos(theta)^n or a sin(theta)^n
+    double (*wfunc)(double) = cos;
+    if (wpow<0) wfunc = sin;
+
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (size_t p=0; p<npix; p++) {
+        double x = blo[0] + double(p%bsize[0]);
+        double y = blo[1] + double(p/bsize[0]);
+        double xr=0, yr=0, r=0;
+        ring[p] = -1;
+        for (size_t i=0; i<na; i++) {
+            xr =  -(x-ann[i].x0)*sinp[i]+(y-ann[i].y0)*cosp[i];
+            yr = (-(x-ann[i].x0)*cosp[i]-(y-ann[i].y0)*sinp[i])/cosi[i];
+            r  = sqrt(xr*xr+yr*yr);
+            if (r>=ann[i].rin && r<=ann[i].rout) {
+                ring[p] = i;
+                break;
+            }
+        }
+        radius[p] = r;
+        theta[p]  = r<0.1 ? 0. : atan2(yr, xr)/F;
+        costh[p]  = fabs(cos(F*theta[p]));
+        weight[p] = std::pow(fabs(wfunc(theta[p]*M_PI/180.)), fabs(wpow));
+    }
+
+    return true;
+}
+
+
+// Explicit instantiation of the class
+template class RingIndex<float>;
+template class RingIndex<double>;
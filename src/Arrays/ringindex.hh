@@ -0,0 +1,83 @@
+// -----------------------------------------------------------------------
+// ringindex.hh: Definition of the RingIndex class, a map of the ring and
+//               azimuth of the pixels of an image.
+// -----------------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#ifndef RINGINDEX_HH_
+#define RINGINDEX_HH_
+
+#include <iostream>
+#include <vector>
+#include <Arrays/rings.hh>
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// A class storing, for each pixel of a box, the ring it belongs to, its
+/// radius and azimuth in the plane of the ring and the azimuthal weight.
+/// The map is rebuilt only when the geometry changes, so that the tasks
+/// evaluating many times the same rings (3DFIT) do not recompute the
+/// deprojection of every pixel at every evaluation. 2DFIT changes the
+/// geometry of a ring at each iteration and only visits the pixels close
+/// to the ring, so it deprojects them directly (see Ringmodel::getdat).
+/////////////////////////////////////////////////////////////////////////////////////
+template <class T>
+class RingIndex
+{
+/// Annulus i lies between radii[i] and radii[i+1] of a Rings object, with
+/// the centre, position angle and inclination of ring i+1 (the outer edge),
+/// as for the rings fitted by Galfit. A pixel belongs to the first annulus
+/// with radii[i] <= R <= radii[i+1]. R and theta are calculated in the frame
+/// of that annulus, or of the last one for pixels outside all the annuli.
+///
+/// theta is in degrees, from -180 to 180, and 0 on the receding major axis
+/// (0 for R<0.1 pixels). The weight is |cos(theta)|^wpow, or |sin(theta)|^|wpow|
+/// for wpow<0.
+///
+/// Pixels are indexed as (x-blo[0])+(y-blo[1])*bsize[0].
+///
+public:
+    struct Annulus {double x0, y0, phi, inc, rin, rout;};   //< Centre and radii in pixels, angles in degrees.
+
+    RingIndex() {}
+    virtual ~RingIndex() {}
+
+    bool   define(Rings<T> *r, int *blo, int *bsize, double pixScale, int wpow=0, int nthreads=1);
+    bool   define(const std::vector<Annulus> &ann, int *blo, int *bsize, int wpow=0, int nthreads=1);
+    void   clear() {key.clear(); ring.clear(); radius.clear(); theta.clear(); costh.clear(); weight.clear();}
+
+    size_t NumPix() {return ring.size();}
+    int    Ring(size_t p) {return ring[p];}
+    double Radius(size_t p) {return radius[p];}
+    double Theta(size_t p) {return theta[p];}
+    double CosTheta(size_t p) {return costh[p];}
+    double Weight(size_t p) {return weight[p];}
+
+private:
+    std::vector<double> key;                //< Geometry of the current map.
+    std::vector<int>    ring;               //< Annulus of each pixel (-1 if outside).
+    std::vector<double> radius;             //< Deprojected radius in pixels.
+    std::vector<double> theta;              //< Azimuth in the plane of the ring.
+    std::vector<double> costh;              //< |cos(theta)|.
+    std::vector<double> weight;             //< Azimuthal weight.
+};
+
+#endif
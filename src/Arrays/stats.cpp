@@ -52,6 +52,9 @@ namespace Statistics
         this->pThreshold = s.pThreshold;
         this->useRobust  = s.useRobust;
         this->useFDR     = s.useFDR;
+        this->nthreads   = s.nthreads;
+        this->maxSample  = s.maxSample;
+        this->numSample  = s.numSample;
 
         return *this;
     }
@@ -171,7 +174,7 @@ namespace Statistics
     /// \param array    The input data array.
     /// \param size     The length of the input array
     
-        findAllStats(array,size,mean,stddev,median,madfm,max_val,min_val);      
+        numSample = findAllStats(array,size,(bool *)NULL,mean,stddev,median,madfm,max_val,min_val,nthreads,maxSample);
         defined = true;
     }
 
@@ -187,11 +190,32 @@ namespace Statistics
   /// \param mask       An array of the same length that says whether to
   ///                   include each member of the array in the calculations.
 
-        findAllStats(array,size,mask,mean,stddev,median,madfm,max_val,min_val);
+        numSample = findAllStats(array,size,mask,mean,stddev,median,madfm,max_val,min_val,nthreads,maxSample);
         defined = true;
     }
 
 
+    template <class Type> 
+    float Stats<Type>::getMedianError() {
+
+    /// For Gaussian noise, the standard error of the median of N values
+    /// is sqrt(pi/2)*sigma/sqrt(N), that of the MADFM converted to a
+    /// std.dev. is about 1.1664*sigma/sqrt(N). Both are zero if all values
+    /// were used.
+
+        if (numSample==0) return 0;
+        return 1.2533*madfmToSigma(madfm)/sqrt(double(numSample));
+    }
+
+
+    template <class Type> 
+    float Stats<Type>::getMadfmError() {
+
+        if (numSample==0) return 0;
+        return 1.1664*madfmToSigma(madfm)*correctionFactor/sqrt(double(numSample));
+    }
+
+
     template <class Type>
     void Stats<Type>::tofile(std::string filename) {
         
@@ -223,6 +247,9 @@ namespace Statistics
                   << " Median = "   << setw(12) << s.median  << "\t"
                   << " MADFM    = " << setw(12) << s.madfm   << " (= " 
                  << madfmToSigma(s.madfm) << " as std.dev.)\n";
+        if (s.numSample>0)
+            theStream << " Median and MADFM from " << s.numSample << " values, standard errors = "
+                      << s.getMedianError() << " and " << s.getMadfmError() << "\n";
         return theStream;
     }
     template std::ostream& operator<<<short> (std::ostream& theStream, Stats<short> &s);
@@ -50,7 +50,7 @@ namespace Statistics
     class Stats
     {
     public:
-        Stats() {useRobust=true; defined=false; useFDR=false;}                 /// Default constructor.
+        Stats() {useRobust=true; defined=false; useFDR=false; nthreads=1; maxSample=0; numSample=0;}  /// Default constructor.
         virtual ~Stats() {}                                                    /// Default destructor.
         Stats(const Stats<Type>& s);                                           /// Copy constructor.
         Stats<Type>& operator= (const Stats<Type>& s);                         /// Assignement operator.
@@ -78,6 +78,10 @@ namespace Statistics
         void  setRobust(bool b){useRobust=b;}
         bool  getUseFDR(){return useFDR;}
         void  setUseFDR(bool b){useFDR=b;}
+        void  setThreads(int n){nthreads=n;}
+        void  setMaxSample(size_t n){maxSample=n;}
+        size_t getNumSample(){return numSample;}
+        void  setNumSample(size_t n){numSample=n;}
 
         /// Specific functions.
         
@@ -94,6 +98,8 @@ namespace Statistics
         void  scaleNoise(Type scale);                           /// Scale the noise by a given factor. 
         Type  getPValue(Type value);                            /// Return the Gaussian probability of a value given the stats.  
         bool  isDetection(Type value);                          /// Is a value above the threshold? 
+        float getMedianError();                                 /// Standard error of the median from a subsample.
+        float getMadfmError();                                  /// Standard error of the MADFM from a subsample.
     
         void calculate(Type *array, long size);                 /// Calculate statistics for all elements of a data array.
         void calculate(Type *array, long size, bool *mask);     /// Calculate statistics for a subset of a data array. 
@@ -116,6 +122,9 @@ namespace Statistics
         Type   pThreshold;      ///< Threshold for the FDR case (upper limit of P values that detected pixels can have).
         bool   useRobust;       ///< Use robust statistics?
         bool   useFDR;          ///< Use FDR method?
+        int    nthreads;        ///< Number of threads for calculate (default 1, <=0 = OpenMP default).
+        size_t maxSample;       ///< Maximum number of values for median and MADFM (0 = all).
+        size_t numSample;       ///< Number of values used for median and MADFM (0 = all).
 
     };
 
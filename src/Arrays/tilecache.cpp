@@ -0,0 +1,179 @@
+//---------------------------------------------------------------
+// tilecache.cpp: Member functions of the TileCache class.
+//---------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+#include <Arrays/tilecache.hh>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+namespace {
+std::atomic<size_t> cacheCounter(0);        // Gives a different generation to each definition of any cache
+}
+
+
+template <class T>
+void TileCache<T>::define(size_t xsize, size_t ysize, size_t zsize, size_t budgetBytes, Loader load, size_t tileBytes) {
+
+    /// Sets up the cache. No data are read until they are needed.
+    ///
+    /// \param xsize,ysize,zsize  Dimensions of the cube.
+    /// \param budgetBytes        Maximum memory for the cached tiles.
+    /// \param load               Function reading a box of the cube.
+    /// \param tileBytes          Approximate size of a tile.
+
+    clear();
+    dim[0] = xsize; dim[1] = ysize; dim[2] = zsize;
+
+    // Tiles of npix pixels, elongated along the spectral axis: up to four
+    // times the side of a cubic tile in channels, over a square on the sky.
+    double npix = std::max(1.,double(tileBytes)/sizeof(T));
+    tdim[2] = std::min<size_t>(zsize,std::max(1.,4*cbrt(npix)));
+    size_t side = std::max<size_t>(1,sqrt(npix/tdim[2]));
+    tdim[0] = std::min(side,xsize);
+    tdim[1] = std::min(side,ysize);
+    for (int i=0; i<3; i++) ntiles[i] = (dim[i]+tdim[i]-1)/tdim[i];
+
+    std::lock_guard<std::mutex> lock(mtx);
+    budget = budgetBytes;
+    loader = load;
+    generation = ++cacheCounter;
+    defined = true;
+}
+
+
+template <class T>
+void TileCache<T>::clear() {
+
+    std::lock_guard<std::mutex> lock(mtx);
+    tiles.clear();
+    lru.clear();
+    used = hits = misses = 0;
+    loader = nullptr;
+    generation = ++cacheCounter;
+    defined = false;
+}
+
+
+template <class T>
+size_t TileCache<T>::tileIndex(size_t x, size_t y, size_t z) {
+
+    return x/tdim[0]+ntiles[0]*(y/tdim[1]+ntiles[1]*(z/tdim[2]));
+}
+
+
+template <class T>
+void TileCache<T>::tileBox(size_t n, long *blc, long *trc) {
+
+    /// Returns the box [blc,trc] (0-based, edges included) of tile n.
+
+    size_t t[3] = {n%ntiles[0], (n/ntiles[0])%ntiles[1], n/(ntiles[0]*ntiles[1])};
+    for (int i=0; i<3; i++) {
+        blc[i] = t[i]*tdim[i];
+        trc[i] = std::min((t[i]+1)*tdim[i],dim[i])-1;
+    }
+}
+
+
+template <class T>
+std::shared_ptr<std::vector<T>> TileCache<T>::getTile(size_t n) {
+
+    /// Returns tile n, reading it if not in the cache. The file is read
+    /// without holding the lock, so that threads can read different tiles
+    /// at the same time.
+
+    Loader load;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = tiles.find(n);
+        if (it!=tiles.end()) {
+            lru.splice(lru.begin(),lru,it->second.pos);
+            hits++;
+            return it->second.data;
+        }
+        misses++;
+        load = loader;
+    }
+
+    long blc[3], trc[3];
+    tileBox(n,blc,trc);
+    size_t size = (trc[0]-blc[0]+1)*(trc[1]-blc[1]+1)*(trc[2]-blc[2]+1);
+    TilePtr tile = std::make_shared<std::vector<T>>(size);
+    if (!load || !load(tile->data(),blc,trc)) {
+        std::cerr << "TILE CACHE error: cannot read the box [" << blc[0] << "," << blc[1] << "," << blc[2]
+                  << "]-[" << trc[0] << "," << trc[1] << "," << trc[2] << "] of the cube.\n";
+        std::terminate();
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = tiles.find(n);
+    if (it!=tiles.end()) return it->second.data;        // Read by another thread in the meantime
+    lru.push_front(n);
+    tiles[n] = {tile,lru.begin()};
+    used += size*sizeof(T);
+    while (used>budget && lru.size()>1) {
+        auto old = tiles.find(lru.back());
+        used -= old->second.data->size()*sizeof(T);
+        tiles.erase(old);
+        lru.pop_back();
+    }
+    return tile;
+}
+
+
+template <class T>
+T TileCache<T>::value(size_t x, size_t y, size_t z) {
+
+    /// Returns the value of pixel (x,y,z).
+
+    thread_local const TileCache<T> *lastCache = nullptr;
+    thread_local size_t lastGen = 0, lastTile = 0;
+    thread_local TilePtr last;
+
+    size_t n = tileIndex(x,y,z), gen = generation;
+    if (lastCache!=this || lastGen!=gen || lastTile!=n || !last) {
+        last.reset();
+        last = getTile(n);
+        lastCache = this;
+        lastGen = gen;
+        lastTile = n;
+    }
+
+    size_t tx = x%tdim[0], ty = y%tdim[1], tz = z%tdim[2];
+    size_t nx = std::min(tdim[0],dim[0]-(x-tx)), ny = std::min(tdim[1],dim[1]-(y-ty));
+    return (*last)[tx+nx*(ty+ny*tz)];
+}
+
+
+// Explicit instantiation of the class
+template class TileCache<short>;
+template class TileCache<int>;
+template class TileCache<long>;
+template class TileCache<float>;
+template class TileCache<double>;
@@ -0,0 +1,99 @@
+// -----------------------------------------------------------------------
+// tilecache.hh: Definition of the TileCache class, a cube read from
+//               disk one tile at a time.
+// -----------------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#ifndef TILECACHE_HH_
+#define TILECACHE_HH_
+
+#include <iostream>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// A class giving access to a cube that is not in memory. The cube is divided
+/// in tiles, which are loaded on first access and kept in a least-recently-used
+/// cache within a memory budget.
+/////////////////////////////////////////////////////////////////////////////////////
+template <class T>
+class TileCache
+{
+/// Tiles cover a square of pixels on the sky and a range of channels, which
+/// is longer than the side of the square, since most tasks read whole
+/// spectra (moment maps, PV slices). Tiles are read by a "loader" function, which gets the box [blc,trc] (0-based,
+/// edges included) and fills an array in the same order as the cube
+/// (see Cube::fitsread_subset).
+///
+/// value() can be called by several threads: each thread keeps a reference
+/// to the last tile it used, so that the cache (and its lock) is only
+/// queried when a thread moves to another tile. Tasks should therefore
+/// visit the cube one block of tiles at a time, with NumTiles() and
+/// tileBox(). A tile used by a thread is not released while the
+/// thread uses it, even if evicted from the cache. The reference is keyed
+/// on the cache and on its generation, which clear() changes, and is
+/// dropped at the next call to value() after the cache is cleared.
+///
+public:
+    typedef std::function<bool(T*,long*,long*)> Loader;
+
+    TileCache() {}
+    virtual ~TileCache() {}
+
+    bool   isDefined() const {return defined;}
+    size_t NumTiles() {return ntiles[0]*ntiles[1]*ntiles[2];}
+    size_t TileDim(int i) {return tdim[i];}
+    size_t Hits() {return hits;}
+    size_t Misses() {return misses;}
+
+    void   define(size_t xsize, size_t ysize, size_t zsize, size_t budgetBytes, Loader load, size_t tileBytes=1<<22);
+    void   clear();
+    T      value(size_t x, size_t y, size_t z);
+    T      value(size_t npix) {return value(npix%dim[0],(npix/dim[0])%dim[1],npix/(dim[0]*dim[1]));}
+    size_t tileIndex(size_t x, size_t y, size_t z);
+    void   tileBox(size_t n, long *blc, long *trc);
+    std::shared_ptr<std::vector<T>> getTile(size_t n);
+
+private:
+    typedef std::shared_ptr<std::vector<T>> TilePtr;
+    struct Entry {TilePtr data; std::list<size_t>::iterator pos;};
+
+    bool   defined = false;                 //< Has the cache been defined?
+    std::atomic<size_t> generation{0};      //< Identifier of this definition of the cache, changed by clear().
+    size_t dim[3];                          //< Dimensions of the cube.
+    size_t tdim[3];                         //< Dimensions of a tile.
+    size_t ntiles[3];                       //< Number of tiles along each axis.
+    size_t budget = 0;                      //< Maximum size in bytes of the cached tiles.
+    size_t used = 0;                        //< Size in bytes of the cached tiles.
+    size_t hits = 0, misses = 0;            //< Cache statistics.
+    Loader loader;                          //< Function reading a box of the cube.
+    std::mutex mtx;                         //< Lock for the cache.
+    std::list<size_t> lru;                  //< Cached tiles, most recently used first.
+    std::unordered_map<size_t,Entry> tiles; //< Cached tiles by index.
+};
+
+#endif
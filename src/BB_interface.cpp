@@ -84,8 +84,8 @@ float Galfit_calcresiduals(Galfit<float> *g, Rings<float> *r) {return g->calcula
 void Galfit_getModelSize(Galfit<float> *g, Rings<float> *r, int *bhi, int *blo) {g->getModelSize(r,blo,bhi);}
 Galmod<float>* Galfit_getModel(Galfit<float> *g, Rings<float> *r, int *bhi, int *blo) {signal(SIGINT, signalHandler); 
                                                                         return g->getModel(r,bhi,blo,nullptr,false);}
-void Galfit_writeModel(Galfit<float> *g, const char* norm, bool plots) {signal(SIGINT, signalHandler); g->writeModel(string(norm),plots);}
-void Galfit_writeOutputs(Galfit<float> *g, Galmod<float> *m, Ellprof<float> *e, bool plots) {signal(SIGINT, signalHandler); g->writeOutputs(m->Out(),e,plots);}
+bool Galfit_writeModel(Galfit<float> *g, const char* norm, bool plots) {signal(SIGINT, signalHandler); g->writeModel(string(norm),plots); return FitsWrite_wait();}
+bool Galfit_writeOutputs(Galfit<float> *g, Galmod<float> *m, Ellprof<float> *e, bool plots) {signal(SIGINT, signalHandler); g->writeOutputs(m->Out(),e,plots); return FitsWrite_wait();}
 void Galfit_setOutRings(Galfit<float> *g, Rings<float> *r) {g->setOutRings(r); g->writeRingFile("rings_final1.txt",r);}
 int Galfit_plotModel(Galfit<float> *g) {signal(SIGINT, signalHandler); return g->plotAll_Python();}
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -124,6 +124,11 @@ Ringmodel<float>* Fit2D_new(Cube<float> *c, Rings<float> *r, const char* mask, c
 void Fit2D_delete(Ringmodel<float> *rm) {delete rm;}
 void Fit2D_compute(Ringmodel<float> *rm) {signal(SIGINT, signalHandler); rm->ringfit();}
 void Fit2D_write(Ringmodel<float> *rm, Cube<float> *c, const char *fout) {std::ofstream fileo(fout); rm->printfinal(fileo, c->Head());}
+long Fit2D_batch(int nfields, float *vfields, int *dims, int *nrings, float *rings, const char* free, const char* side,
+                 int wfunc, float freeangle, int nseeds, float *out, int NTHREADS) {
+                 signal(SIGINT, signalHandler); bool mpar[::MAXPAR]; getFreeMask2D(string(free),mpar);
+                 return ringfitBatch(nfields,vfields,dims,nrings,rings,mpar,getSide2D(makeupper(string(side))),
+                                     wfunc,freeangle,nseeds,out,NTHREADS);}
 //////////////////////////////////////////////////////////////////////////////////////////
 
 
@@ -486,29 +486,28 @@ void Detection<T>::calcFluxes(T *fluxArray, long *dim) {
     totalFlux = peakFlux = 0;
     xCentroid = yCentroid = zCentroid = 0.;
 
-    std::vector<Voxel<T> > voxList = this->template getPixelSet<T>();
-    typename std::vector<Voxel<T> >::iterator vox=voxList.begin();
-    for(;vox<voxList.end();vox++) {
-        long x=vox->getX();
-        long y=vox->getY();
-        long z=vox->getZ();
-        long ind = vox->arrayIndex(dim);
-        float f = fluxArray[ind];
-        totalFlux += f;
-        xCentroid += x*f;
-        yCentroid += y*f;
-        zCentroid += z*f;
-        if( (vox==voxList.begin()) ||
-            (negSource&&(f<peakFlux)) || 
-            (!negSource&&(f>peakFlux)) ) {
-      
-            peakFlux = f;
-            xpeak = x;
-            ypeak = y;
-            zpeak = z;
+    // Streaming over the runs of the object, no list of voxels is built.
+    bool first = true;
+    this->forEachRun([&](long y, long z, long x1, long x2) {
+        T *row = fluxArray+y*dim[0]+z*dim[0]*dim[1];
+        for(long x=x1; x<=x2; x++) {
+            float f = row[x];
+            totalFlux += f;
+            xCentroid += x*f;
+            yCentroid += y*f;
+            zCentroid += z*f;
+            if( first ||
+                (negSource&&(f<peakFlux)) ||
+                (!negSource&&(f>peakFlux)) ) {
+
+                peakFlux = f;
+                xpeak = x;
+                ypeak = y;
+                zpeak = z;
+                first = false;
+            }
         }
- 
-    }
+    });
 
     xCentroid /= totalFlux;
     yCentroid /= totalFlux;
@@ -687,7 +686,7 @@ void Detection<T>::calcIntegFlux(long zdim, std::vector<Voxel<T> > voxelList,
   //--------------------------------------------------------------------
 
 template <class T>
-void Detection<T>::calcIntegFlux(T *fluxArray, long *dim, Header &head, int pbcorr, bool fluxconvert) {
+void Detection<T>::calcIntegFlux(T *fluxArray, long *dim, Header &head, int pbcorr, bool fluxconvert, bool spatialSpectra) {
     
     ///  @details
     ///  Uses the input WCS to calculate the velocity-integrated flux, 
@@ -700,57 +699,59 @@ void Detection<T>::calcIntegFlux(T *fluxArray, long *dim, Header &head, int pbco
     ///  multiplying the integrated flux by the number of spatial pixels,
     ///  and dividing by the beam size in pixels (e.g. Jy/beam * pix /
     ///  pix/beam --> Jy)
+    ///
+    ///  Fluxes are read while streaming over the runs of the object, so
+    ///  neither a list of voxels nor a local copy of the fluxes is built.
     /// 
     ///  \param fluxArray The array of flux values.
     ///  \param dim The dimensions of the flux array.
     ///  \param head FitsHeader object that contains the WCS information.
+    ///  \param spatialSpectra If true, velocity widths are calculated from the
+    ///                        full spectra of the spatial pixels of the object,
+    ///                        otherwise only from the voxels of the object.
 
     haveParams = true;
 
-    // include one pixel either side in each direction
-    long xsize = (this->xmax-this->xmin+3);
-    long ysize = (this->ymax-this->ymin+3);
-    long zsize = (this->zmax-this->zmin+3); 
-    long size = xsize*ysize*zsize;
-    std::vector <bool> isObj(size,false);
-    double *localFlux = new double[size];
-    for(int i=0;i<size;i++) localFlux[i]=0.;
-        
-    // work out which pixels are object pixels
-    std::vector<Voxel<T> > voxlist = this->template getPixelSet<T>();
-    for(typename std::vector<Voxel<T> >::iterator v=voxlist.begin();v<voxlist.end();v++){
-        long pos=(v->getX()-this->xmin+1)+(v->getY()-this->ymin+1)*xsize+(v->getZ()-this->zmin+1)*xsize*ysize;
-        Voxel<T> vox(v->getX(), v->getY(), v->getZ(), fluxArray[v->arrayIndex(dim)]);
-        localFlux[pos] = pbcorr ? Pbcor(vox,head,pbcorr) : vox.getF();
-        isObj[pos] = true;
-    }
-
-    // work out the WCS coords for each pixel
+    // Velocity width of each channel, including one channel either side
+    long zsize = (this->zmax-this->zmin+3);
     double *world  = new double[zsize];
     for(int z=0;z<zsize;z++){
         int zpt = lround(this->zmin-1+z);
         world[z] = AlltoVel(head.getZphys(zpt), head);
     }
-    
+    double *deltaVel = new double[zsize];
+    for(int z=1;z<zsize-1;z++) deltaVel[z] = fabs(world[z+1]-world[z-1])/2.;
+
+    T *intSpec = nullptr;
+    if (!spatialSpectra) {
+        intSpec = new T[dim[2]];
+        for(int i=0;i<dim[2];i++) intSpec[i]=0;
+    }
+
     double integrated = 0.;
-    for(int pix=0; pix<xsize*ysize; pix++){ // loop over each spatial pixel.
-        for(int z=0; z<zsize; z++){
-            int pos = z*xsize*ysize+pix;
-            if(isObj[pos]){ // if it's an object pixel...
-                double deltaVel;
-                if(z==0) deltaVel = (world[z+1]-world[z]);
-                else if(z==(zsize-1)) deltaVel = (world[z]-world[z-1]);
-                else deltaVel = (world[z+1]-world[z-1])/2.;
-                integrated += localFlux[pos]*fabs(deltaVel);
+    this->forEachRun([&](long y, long z, long x1, long x2) {
+        T *row = fluxArray+y*dim[0]+z*dim[0]*dim[1];
+        double dv = deltaVel[z-this->zmin+1];
+        for(long x=x1; x<=x2; x++) {
+            T f = row[x];
+            if (pbcorr) {
+                Voxel<T> vox(x,y,z,f);
+                integrated += Pbcor(vox,head,pbcorr)*dv;
             }
+            else integrated += f*dv;
+            if (intSpec) intSpec[z] += f;
         }
-    }
+    });
     intFlux = integrated;
 
     delete [] world;
-    delete [] localFlux;
-    
-    calcVelWidths(fluxArray, dim, head);
+    delete [] deltaVel;
+
+    if (spatialSpectra) calcVelWidths(fluxArray, dim, head);
+    else {
+        calcVelWidths(dim[2], intSpec, head);
+        delete [] intSpec;
+    }
 
     // correct for the beam size and convert to Jy
     if (fluxconvert) intFlux = FluxtoJy(intFlux, head);
@@ -877,9 +878,7 @@ void Detection<T>::calcVelWidths(T *fluxArray, long *dim, Header &head) {
 
     if(dim[2]>2){
         T *intSpec = new T[dim[2]];
-        long size=dim[0]*dim[1]*dim[2];
-        std::vector<bool> mask(size,true); 
-        getIntSpec(*this,fluxArray,dim,mask,float(1.),intSpec);
+        getIntSpec(*this,fluxArray,dim,std::vector<bool>(),float(1.),intSpec);
         calcVelWidths(dim[2],intSpec,head);
         delete [] intSpec;
     }
@@ -895,10 +894,10 @@ void Detection<T>::calcVelWidths(T *fluxArray, long *dim, Header &head) {
 template <class T>
 void Detection<T>::calcAllParams(T *fluxArray, int *dim, Header &head, int pbcorr, bool fluxconvert){
 
-    std::vector<Voxel<T> > voxlist = this->getPixelSet(fluxArray,dim);
-    calcFluxes(voxlist);
+    long ldim[3] = {dim[0], dim[1], dim[2]};
+    calcFluxes(fluxArray,ldim);
     calcWCSparams(head);
-    calcIntegFlux(dim[2],voxlist,head,pbcorr,fluxconvert);
+    calcIntegFlux(fluxArray,ldim,head,pbcorr,fluxconvert,false);
 }
 
 
@@ -926,14 +925,10 @@ std::vector<int> Detection<T>::getVertexSet() {
     int xsize = xmax - xmin + 1;
     int ysize = ymax - ymin + 1;
 
-    std::vector<Voxel<T> > voxlist = this->template getPixelSet<T>();
     std::vector<bool> isObj(xsize*ysize,false);
-    typename std::vector<Voxel<T> >::iterator vox;
-    for(vox=voxlist.begin();vox<voxlist.end();vox++){
-        int pos = (vox->getX()-xmin)+(vox->getY()-ymin)*xsize;
-        isObj[pos] = true;
-    }
-    voxlist.clear();
+    this->forEachRun([&](long y, long /*z*/, long x1, long x2) {
+        for(long x=x1; x<=x2; x++) isObj[(x-xmin)+(y-ymin)*xsize] = true;
+    });
     
     for(int x=xmin; x<=xmax; x++){
         for(int y=ymin+1;y<=ymax;y++){
@@ -967,7 +962,7 @@ std::vector<int> Detection<T>::getVertexSet() {
 
 
 template <class T> 
-void getIntSpec(Detection<T> &object, T *fluxArray, long *dimArray, std::vector<bool> mask, 
+void getIntSpec(Detection<T> &object, T *fluxArray, long *dimArray, const std::vector<bool> &mask, 
                 float beamCorrection, T *spec) {
                     
     /// @details
@@ -979,35 +974,32 @@ void getIntSpec(Detection<T> &object, T *fluxArray, long *dimArray, std::vector<
     ///   \param fluxArray The full array of pixel values.
     ///   \param dimArray The axis dimensions for the fluxArray
     ///   \param mask A mask array indicating whether given pixels are valid
+    ///                (if empty, all pixels are valid)
     ///   \param beamCorrection How much to divide the summed spectrum
     ///   by to return the integrated flux.
     ///   \param spec The integrated spectrum for the object -- must be allocated first.
 
     for(int i=0;i<dimArray[2];i++) spec[i] = 0.;
     long xySize = dimArray[0]*dimArray[1];
-    bool *done = new bool[xySize]; 
-    for(int i=0;i<xySize;i++) done[i]=false;
-    std::vector<Voxel<T> > voxlist = object.template getPixelSet<T>();
-    typename std::vector<Voxel<T> >::iterator vox;
-    for(vox=voxlist.begin();vox<voxlist.end();vox++){
-        long pos = vox->getX()+dimArray[0]*vox->getY();
-        if(!done[pos]){
-            done[pos] = true;
+    // Each spatial pixel appears once in the spatial map of the object
+    Object2D spatMap = object.getSpatialMap();
+    spatMap.forEachRun([&](long y, long x1, long x2) {
+        for(long x=x1; x<=x2; x++){
+            long pos = x+dimArray[0]*y;
             for(int z=0;z<dimArray[2];z++){
-                if(mask[pos+z*xySize]){
+                if(mask.empty() || mask[pos+z*xySize]){
                     spec[z] += fluxArray[pos + z*xySize] / beamCorrection;
-                }       
+                }
             }
         }
-    }
-    delete [] done;
+    });
 
 }
-template void getIntSpec(Detection<short>&,short*,long*,std::vector<bool>,float,short*); 
-template void getIntSpec(Detection<int>&,int*,long*,std::vector<bool>,float,int*); 
-template void getIntSpec(Detection<long>&,long*,long*,std::vector<bool>,float,long*); 
-template void getIntSpec(Detection<float>&,float*,long*,std::vector<bool>,float,float*); 
-template void getIntSpec(Detection<double>&,double*,long*,std::vector<bool>,float,double*); 
+template void getIntSpec(Detection<short>&,short*,long*,const std::vector<bool>&,float,short*); 
+template void getIntSpec(Detection<int>&,int*,long*,const std::vector<bool>&,float,int*); 
+template void getIntSpec(Detection<long>&,long*,long*,const std::vector<bool>&,float,long*); 
+template void getIntSpec(Detection<float>&,float*,long*,const std::vector<bool>&,float,float*); 
+template void getIntSpec(Detection<double>&,double*,long*,const std::vector<bool>&,float,double*); 
 
 //===================================================================================
  
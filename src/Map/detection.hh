@@ -102,7 +102,7 @@ public:
     void   calcWCSparams(Header &head);
 
     /// Calculate the integrated flux over the entire Detection. 
-    void   calcIntegFlux(T *fluxArray, long *dim, Header &head, int pbcorr=0, bool fluxconvert=true);
+    void   calcIntegFlux(T *fluxArray, long *dim, Header &head, int pbcorr=0, bool fluxconvert=true, bool spatialSpectra=true);
     /// Calculate the integrated flux over the entire Detection. 
     void   calcIntegFlux(long zdim, std::vector<PixelInfo::Voxel<T> > voxelList, \
                          Header &head, int pbcorr=0, bool fluxconvert=true);
@@ -292,7 +292,7 @@ void SortByVel(std::vector <Detection<T> > *inputList) {SortDetections(inputList
 
 /// Get integrated spectrum for a detection
 template <class T>
-void getIntSpec(Detection<T> &object, T *fluxArray, long *dimArray, std::vector<bool> mask,
+void getIntSpec(Detection<T> &object, T *fluxArray, long *dimArray, const std::vector<bool> &mask,
                 float beamCorrection, T *spec);
 
 
@@ -0,0 +1,153 @@
+// -----------------------------------------------------------------------
+// detectiongrid.cpp: Implementation of the DetectionGrid class
+// -----------------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <Map/detectiongrid.hh>
+#include <Map/detection.hh>
+
+
+template <class T>
+DetectionGrid<T>::DetectionGrid(long cellxy, long cellz, long padxy, long padz) {
+
+    itsCell[0] = itsCell[1] = std::max(cellxy,1L);
+    itsCell[2] = std::max(cellz,1L);
+    itsPad[0]  = itsPad[1] = std::max(padxy,0L);
+    itsPad[2]  = std::max(padz,0L);
+}
+
+
+template <class T>
+void DetectionGrid<T>::insert(size_t id, Detection<T> &obj) {
+
+    /// Records the Detection "id" in all the cells covered by its bounding
+    /// box. When an id is inserted again after its Detection has grown,
+    /// only the cells that were not already covered are updated.
+
+    if (id>=itsRanges.size()) {
+        itsRanges.resize(id+1);
+        itsInside.resize(id+1,false);
+        itsStamp.resize(id+1,0);
+    }
+
+    Range r = cellRange(obj,false);
+    Range &old = itsRanges[id];
+    bool had = itsInside[id];
+
+    for (long cz=r.c[4]; cz<=r.c[5]; cz++) {
+        for (long cy=r.c[2]; cy<=r.c[3]; cy++) {
+            for (long cx=r.c[0]; cx<=r.c[1]; cx++) {
+                if (had && cx>=old.c[0] && cx<=old.c[1] && cy>=old.c[2] &&
+                    cy<=old.c[3] && cz>=old.c[4] && cz<=old.c[5]) continue;
+                itsCells[cellKey(cx,cy,cz)].push_back(id);
+                itsNumEntries++;
+            }
+        }
+    }
+
+    // The box of a Detection never shrinks, so the new range covers the old one
+    if (had) for (int i=0; i<6; i++) r.c[i] = i%2==0 ? std::min(r.c[i],old.c[i]) : std::max(r.c[i],old.c[i]);
+    old = r;
+    itsInside[id] = true;
+}
+
+
+template <class T>
+void DetectionGrid<T>::query(Detection<T> &obj, std::vector<size_t> &ids) {
+
+    /// Returns in "ids" the recorded Detections sharing at least one cell
+    /// with the padded box of obj, sorted by id and with no repetitions.
+
+    ids.clear();
+    if (++itsQuery==0) {
+        std::fill(itsStamp.begin(),itsStamp.end(),0);
+        itsQuery = 1;
+    }
+
+    Range r = cellRange(obj,true);
+    for (long cz=r.c[4]; cz<=r.c[5]; cz++) {
+        for (long cy=r.c[2]; cy<=r.c[3]; cy++) {
+            for (long cx=r.c[0]; cx<=r.c[1]; cx++) {
+                auto it = itsCells.find(cellKey(cx,cy,cz));
+                if (it==itsCells.end()) continue;
+                for (size_t k=0; k<it->second.size(); k++) {
+                    size_t id = it->second[k];
+                    if (itsStamp[id]==itsQuery) continue;
+                    itsStamp[id] = itsQuery;
+                    ids.push_back(id);
+                }
+            }
+        }
+    }
+
+    std::sort(ids.begin(),ids.end());
+}
+
+
+template <class T>
+size_t DetectionGrid<T>::getMemory() {
+
+    /// The grid never shrinks, so this is also its peak memory usage.
+
+    size_t mem = itsNumEntries*sizeof(size_t);
+    mem += itsCells.size()*(sizeof(long long)+sizeof(std::vector<size_t>)+2*sizeof(void*));
+    mem += itsCells.bucket_count()*sizeof(void*);
+    mem += itsRanges.capacity()*sizeof(Range) + itsStamp.capacity()*sizeof(size_t);
+    mem += itsInside.capacity()/8;
+    return mem;
+}
+
+
+template <class T>
+typename DetectionGrid<T>::Range DetectionGrid<T>::cellRange(Detection<T> &obj, bool padded) {
+
+    long box[6] = {obj.getXmin(), obj.getXmax(), obj.getYmin(),
+                   obj.getYmax(), obj.getZmin(), obj.getZmax()};
+    Range r;
+    for (int i=0; i<3; i++) {
+        long lo = box[2*i], hi = box[2*i+1];
+        if (padded) {lo -= itsPad[i]; hi += itsPad[i];}
+        // Floor division, boxes can have negative coordinates once padded
+        r.c[2*i]   = lo>=0 ? lo/itsCell[i] : -((-lo+itsCell[i]-1)/itsCell[i]);
+        r.c[2*i+1] = hi>=0 ? hi/itsCell[i] : -((-hi+itsCell[i]-1)/itsCell[i]);
+    }
+    return r;
+}
+
+
+template <class T>
+long long DetectionGrid<T>::cellKey(long cx, long cy, long cz) {
+
+    // 21 bits for each cell index, shifted to be positive
+    const long long off = 1LL<<20, mask = (1LL<<21)-1;
+    return (((cz+off)&mask)<<42) | (((cy+off)&mask)<<21) | ((cx+off)&mask);
+}
+
+
+// Explicit instantiation of the class
+template class DetectionGrid<short>;
+template class DetectionGrid<int>;
+template class DetectionGrid<long>;
+template class DetectionGrid<float>;
+template class DetectionGrid<double>;
@@ -0,0 +1,71 @@
+// -----------------------------------------------------------------------
+// detectiongrid.hh: Definition of the DetectionGrid class
+// -----------------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#ifndef DETECTIONGRID_H
+#define DETECTIONGRID_H
+
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <Map/detection.hh>
+
+/// @brief A uniform spatial hash of the bounding boxes of a list of Detections
+/// @details The (x,y,z) space is divided in cells of fixed size and each
+/// Detection is recorded in all the cells touched by its bounding box. Only
+/// cells that contain at least one Detection are stored. A query returns the
+/// Detections whose box is touched by the query box padded by the merging
+/// gaps, i.e. the only candidates that can pass Detection::isNear().
+
+template <class T>
+class DetectionGrid
+{
+public:
+    /// Cell sizes along the spatial and spectral axes, and padding for queries
+    DetectionGrid(long cellxy, long cellz, long padxy, long padz);
+    virtual ~DetectionGrid() {}
+
+    /// Record a Detection. If "id" is already in the grid, its box is enlarged
+    void insert(size_t id, Detection<T> &obj);
+    /// Return the sorted ids of Detections close to the padded box of obj
+    void query(Detection<T> &obj, std::vector<size_t> &ids);
+    /// Approximate memory used by the grid, in bytes
+    size_t getMemory();
+    size_t getNumCells() {return itsCells.size();}
+
+protected:
+    struct Range {long c[6];};                                  ///< Cell range (x1,x2,y1,y2,z1,z2)
+
+    long    itsCell[3];                                         ///< Cell sizes in x, y and z
+    long    itsPad[3];                                          ///< Padding of query boxes
+    size_t  itsNumEntries = 0;                                  ///< Total ids stored in cells
+    std::unordered_map<long long, std::vector<size_t> > itsCells; ///< The non-empty cells
+    std::vector<Range>  itsRanges;                              ///< Cell range of each recorded id
+    std::vector<bool>   itsInside;                              ///< Whether an id has been recorded
+    std::vector<size_t> itsStamp;                               ///< Last query that returned an id
+    size_t  itsQuery = 0;                                       ///< Number of queries done
+
+    Range       cellRange(Detection<T> &obj, bool padded);
+    long long   cellKey(long cx, long cy, long cz);
+};
+
+#endif
@@ -0,0 +1,282 @@
+// -----------------------------------------------------------------------
+// labeller.cpp: Implementation of the connected-component labeller
+// -----------------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <Map/labeller.hh>
+#include <Map/detection.hh>
+#include <Map/object2D.hh>
+#include <Map/scan.hh>
+#include <Arrays/param.hh>
+#include <Arrays/stats.hh>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+template <class T>
+void ObjectLabeller<T>::define(Statistics::Stats<T> &stats, T *array, size_t xsize, size_t ysize, size_t zsize,
+                               SEARCH_PAR &p, int nthreads) {
+
+    itsStats    = stats;
+    itsArray    = array;
+    itsDim[0]   = xsize;
+    itsDim[1]   = ysize;
+    itsDim[2]   = zsize;
+    itsFlagAdj  = p.flagAdjacent;
+    itsThreshS  = p.threshSpatial;
+    itsThreshV  = std::max(p.threshVelocity,0);
+    itsSpectral = p.searchType=="spectral" && zsize>1;
+    itsGap      = itsFlagAdj ? 1 : std::max(1L,long(ceil(itsThreshS)));
+    // Touching pixels of a row can be joined in a single run only if they
+    // are always connected. It is not the case in a spectral search when
+    // the spatial threshold is too small to link neighbouring spectra.
+    itsLongRuns = !itsSpectral || itsFlagAdj || itsThreshS>1;
+    itsNthreads = std::max(nthreads,1);
+}
+
+
+template <class T>
+std::vector<Detection<T> > ObjectLabeller<T>::label() {
+
+    /// Labels the connected components of the thresholded array and
+    /// builds a Detection for each of them. Detections are ordered by
+    /// the position (channel, row, column) of their first voxel.
+    ///
+    /// \return     The vector of detected objects.
+
+    findRuns();
+
+    size_t nruns = itsRuns.size();
+    if (nruns==0) return std::vector<Detection<T> >();
+    itsParent.resize(nruns);
+    for (size_t i=0; i<nruns; i++) itsParent[i] = i;
+
+    // Labelling blocks of channels in parallel. Each block owns a contiguous
+    // range of run indices, so unions inside a block never touch other blocks.
+    // Links toward the following blocks are stored and resolved at the end.
+    int zsize = itsDim[2];
+    int nblocks = std::min(itsNthreads,zsize);
+    std::vector<std::vector<std::pair<size_t,size_t> > > boundary(nblocks);
+
+#pragma omp parallel for num_threads(nblocks) schedule(static,1)
+    for (int b=0; b<nblocks; b++) {
+        int zb = (long(b)*zsize)/nblocks;
+        int ze = (long(b+1)*zsize)/nblocks;
+        size_t first = itsRowStart[size_t(zb)*itsDim[1]];
+        size_t last  = itsRowStart[size_t(ze)*itsDim[1]];
+        for (size_t id=first; id<last; id++) {
+            forNeighbours(id, [&](size_t other) {
+                if (itsRuns[other].z<ze) unite(id,other);
+                else boundary[b].push_back(std::make_pair(id,other));
+            });
+        }
+    }
+
+    for (int b=0; b<nblocks; b++)
+        for (size_t i=0; i<boundary[b].size(); i++)
+            unite(boundary[b][i].first,boundary[b][i].second);
+    boundary.clear();
+
+    // Roots always have the smallest index of their tree, so a single forward
+    // pass flattens the forest. Then number the components and bucket the runs.
+    size_t ncomp = 0;
+    std::vector<size_t> &label = itsParent;
+    std::vector<size_t> compStart(1,0);
+    for (size_t i=0; i<nruns; i++) {
+        if (itsParent[i]==i) {
+            label[i] = ncomp++;
+            compStart.push_back(0);
+        }
+        else label[i] = label[itsParent[i]];
+        compStart[label[i]+1]++;
+    }
+    for (size_t c=0; c<ncomp; c++) compStart[c+1] += compStart[c];
+
+    std::vector<size_t> order(nruns), fill(compStart.begin(),compStart.end()-1);
+    for (size_t i=0; i<nruns; i++) order[fill[label[i]]++] = i;
+    fill.clear();
+
+    // Building the Detections. Runs of a component are already sorted by
+    // channel and row, and do not touch each other within a row.
+    std::vector<Detection<T> > objList(ncomp);
+#pragma omp parallel for num_threads(itsNthreads) schedule(dynamic)
+    for (size_t c=0; c<ncomp; c++) {
+        Detection<T> &obj = objList[c];
+        Object2D chanmap;
+        long zcurr = -1;
+        for (size_t k=compStart[c]; k<compStart[c+1]; k++) {
+            const Run &r = itsRuns[order[k]];
+            if (r.z!=zcurr) {
+                if (zcurr>=0) obj.addChannel(zcurr,chanmap);
+                chanmap.clear();
+                zcurr = r.z;
+            }
+            chanmap.appendScan(Scan(r.y,r.x1,r.x2-r.x1+1));
+        }
+        if (zcurr>=0) obj.addChannel(zcurr,chanmap);
+        obj.setOffsets();
+    }
+
+    return objList;
+}
+
+
+template <class T>
+void ObjectLabeller<T>::findRuns() {
+
+    /// Thresholds the array and encodes detected pixels as runs along x
+    /// (or as single pixels, if touching pixels are not always connected).
+    /// Channels are processed in parallel and then concatenated, together
+    /// with an index to the first run of every row.
+
+    size_t xsize = itsDim[0], ysize = itsDim[1], zsize = itsDim[2];
+    std::vector<std::vector<Run> > chanRuns(zsize);
+    std::vector<std::vector<size_t> > rowCount(zsize);
+
+#pragma omp parallel for num_threads(itsNthreads) schedule(dynamic)
+    for (size_t z=0; z<zsize; z++) {
+        Statistics::Stats<T> st = itsStats;
+        std::vector<Run> &runs = chanRuns[z];
+        rowCount[z].assign(ysize,0);
+        T *chan = itsArray+z*xsize*ysize;
+        for (size_t y=0; y<ysize; y++) {
+            T *row = chan+y*xsize;
+            size_t x = 0;
+            while (x<xsize) {
+                if (!st.isDetection(row[x])) {x++; continue;}
+                Run r = {int(z), int(y), int(x), int(x)};
+                while (itsLongRuns && x+1<xsize && st.isDetection(row[x+1])) x++;
+                r.x2 = x++;
+                runs.push_back(r);
+                rowCount[z][y]++;
+            }
+        }
+    }
+
+    itsRowStart.assign(zsize*ysize+1,0);
+    for (size_t z=0; z<zsize; z++)
+        for (size_t y=0; y<ysize; y++)
+            itsRowStart[z*ysize+y+1] = itsRowStart[z*ysize+y] + rowCount[z][y];
+    rowCount.clear();
+
+    itsRuns.resize(itsRowStart[zsize*ysize]);
+#pragma omp parallel for num_threads(itsNthreads)
+    for (size_t z=0; z<zsize; z++) {
+        std::copy(chanRuns[z].begin(),chanRuns[z].end(),itsRuns.begin()+itsRowStart[z*ysize]);
+        std::vector<Run>().swap(chanRuns[z]);
+    }
+}
+
+
+template <class T>
+bool ObjectLabeller<T>::areClose(const Run &a, const Run &b) {
+
+    /// Same criterion as Object2D::canMerge() applied to two runs. Pixels
+    /// touching in the same channel are always connected, as they would be
+    /// part of the same 2D object found by Search::imageDetect(). For a
+    /// spectral search, it is the consecutive pixels of a spectrum that
+    /// are always connected, as in Search::spectrumDetect().
+
+    long dy = labs(long(a.y)-long(b.y));
+    if (itsSpectral && dy==0 && b.z==a.z+1 && a.x1<=b.x2 && b.x1<=a.x2) return true;
+    if (b.z-a.z>itsThreshV) return false;
+    bool adjacent = dy<=1 && (a.x1-1)<=b.x2 && b.x1<=(a.x2+1);
+    if (itsSpectral && a.z==b.z && !itsFlagAdj) adjacent = false;
+    if (adjacent && (itsFlagAdj || a.z==b.z)) return true;
+    if (itsFlagAdj) return false;
+
+    float sep;
+    if (a.x1>b.x2) sep = hypot(a.x1-b.x2,dy);
+    else if (b.x1>a.x2) sep = hypot(b.x1-a.x2,dy);
+    else sep = dy;
+    return sep<itsThreshS;
+}
+
+
+template <class T>
+template <class F>
+void ObjectLabeller<T>::forNeighbours(size_t id, F f) {
+
+    /// Calls f(other) for every run "other" following run "id" (in channel,
+    /// row, column order) that is close to it. Each pair is visited once.
+
+    const Run &a = itsRuns[id];
+    size_t ysize = itsDim[1];
+    int zreach = itsSpectral ? std::max(itsThreshV,1) : itsThreshV;
+    int zlast = std::min<long>(long(a.z)+zreach,long(itsDim[2])-1);
+    long xlo = a.x1-itsGap, xhi = a.x2+itsGap;
+
+    for (int z=a.z; z<=zlast; z++) {
+        long ystart = z==a.z ? a.y : std::max(0L,long(a.y)-itsGap);
+        long yend   = std::min(long(a.y)+itsGap,long(ysize)-1);
+        for (long y=ystart; y<=yend; y++) {
+            size_t rfirst = itsRowStart[z*ysize+y];
+            size_t rlast  = itsRowStart[z*ysize+y+1];
+            if (z==a.z && y==a.y) rfirst = id+1;
+            if (rfirst>=rlast) continue;
+            // Runs in a row are sorted and disjoint: skip those ending before the reach
+            typename std::vector<Run>::iterator it;
+            it = std::lower_bound(itsRuns.begin()+rfirst,itsRuns.begin()+rlast,xlo,
+                                  [](const Run &r, long x){return r.x2<x;});
+            for (; it!=itsRuns.begin()+rlast && it->x1<=xhi; it++)
+                if (areClose(a,*it)) f(size_t(it-itsRuns.begin()));
+        }
+    }
+}
+
+
+template <class T>
+size_t ObjectLabeller<T>::findRoot(size_t i) {
+
+    while (itsParent[i]!=i) {
+        itsParent[i] = itsParent[itsParent[i]];
+        i = itsParent[i];
+    }
+    return i;
+}
+
+
+template <class T>
+void ObjectLabeller<T>::unite(size_t i, size_t j) {
+
+    /// Joins the trees of runs i and j. The root with the larger index is
+    /// linked to the other one, so that parents never exceed their children.
+
+    i = findRoot(i);
+    j = findRoot(j);
+    if (i==j) return;
+    if (i<j) itsParent[j] = i;
+    else itsParent[i] = j;
+}
+
+
+// Explicit instantiation of the class
+template class ObjectLabeller<short>;
+template class ObjectLabeller<int>;
+template class ObjectLabeller<long>;
+template class ObjectLabeller<float>;
+template class ObjectLabeller<double>;
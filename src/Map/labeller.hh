@@ -0,0 +1,87 @@
+// -----------------------------------------------------------------------
+// labeller.hh: Definition of the ObjectLabeller class
+// -----------------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#ifndef OBJECT_LABELLER_H
+#define OBJECT_LABELLER_H
+
+#include <iostream>
+#include <vector>
+#include <Map/detection.hh>
+#include <Arrays/param.hh>
+#include <Arrays/stats.hh>
+
+/// @brief A class to label 3D connected components in a thresholded array
+/// @details The array is thresholded and encoded as a list of runs
+/// (maximal sets of consecutive detected pixels along a row of a
+/// channel). Runs are then joined with a union-find structure: two
+/// runs belong to the same object if they are within threshVelocity
+/// channels and are adjacent (flagAdjacent) or closer than threshSpatial
+/// pixels, i.e. the same criterion used by Detection::canMerge(). The
+/// basic connectivity follows the search type: touching pixels of a
+/// channel map ("spatial") or consecutive pixels of a spectrum ("spectral").
+/// Channels are split in blocks, which are labelled in parallel; the
+/// few links crossing block boundaries are resolved at the end.
+/// The output is the final list of Detections, with no need for the
+/// pairwise merging of 2D objects.
+
+template <class T>
+class ObjectLabeller
+{
+public:
+    ObjectLabeller() {}
+    virtual ~ObjectLabeller() {}
+
+    /// Set up the class with the array, its statistics and the merging parameters
+    void define(Statistics::Stats<T> &stats, T *array, size_t xsize, size_t ysize, size_t zsize,
+                SEARCH_PAR &p, int nthreads=1);
+    /// Label the array and return the list of connected objects
+    std::vector<Detection<T> > label();
+    /// Number of runs found during the last labelling
+    size_t getNumRuns() {return itsRuns.size();}
+
+protected:
+    struct Run {int z, y, x1, x2;};                     ///< A run of detected pixels on a row.
+
+    Statistics::Stats<T> itsStats;                      ///< The statistics used to threshold the array
+    T*          itsArray;                               ///< The location of the pixel values
+    size_t      itsDim[3];                              ///< The dimensions of the array
+    bool        itsFlagAdj;                             ///< Whether to use the adjacent criterion
+    float       itsThreshS;                             ///< The spatial threshold for merging
+    int         itsThreshV;                             ///< The spectral threshold for merging
+    bool        itsSpectral;                            ///< Whether objects are built along spectra
+    long        itsGap;                                 ///< Spatial reach for neighbouring runs
+    bool        itsLongRuns;                            ///< Whether runs can be longer than one pixel
+    int         itsNthreads = 1;                        ///< Number of threads
+
+    std::vector<Run>    itsRuns;                        ///< All runs, ordered by channel, row and x.
+    std::vector<size_t> itsRowStart;                    ///< First run of each (y,z) row.
+    std::vector<size_t> itsParent;                      ///< Union-find forest over the runs.
+
+    void   findRuns();
+    bool   areClose(const Run &a, const Run &b);
+    size_t findRoot(size_t i);
+    void   unite(size_t i, size_t j);
+    template <class F> void forNeighbours(size_t id, F f);
+};
+
+#endif
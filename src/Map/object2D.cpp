@@ -151,6 +151,34 @@ namespace PixelInfo
   }
 
 
+  void Object2D::appendScan(const Scan &scan) {
+
+  /// A fast version of addScan() for callers that already know that
+  /// the new Scan is disjoint from, and not adjacent to, every Scan in
+  /// the list (e.g. maximal runs coming from a labelled image). The
+  /// Scan is pushed as it is and only the sums and extrema are updated.
+
+    long y = scan.itsY, x1 = scan.itsX, x2 = scan.itsX+scan.itsXLen-1;
+    if(scan.itsXLen<=0) return;
+    scanlist.push_back(scan);
+    float sx = 0.5*(x1+x2)*scan.itsXLen;
+    if(numPix==0){
+        xSum = sx; ySum = y*scan.itsXLen;
+        xmin = x1; xmax = x2;
+        ymin = ymax = y;
+    }
+    else{
+        xSum += sx;
+        ySum += y*scan.itsXLen;
+        if(x1<xmin) xmin = x1;
+        if(x2>xmax) xmax = x2;
+        if(y<ymin) ymin = y;
+        if(y>ymax) ymax = y;
+    }
+    numPix += scan.itsXLen;
+  }
+
+
   bool Object2D::isInObject(long x, long y) {
 
     std::vector<Scan>::iterator scn;
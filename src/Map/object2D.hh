@@ -63,6 +63,9 @@ namespace PixelInfo
     /// @brief Add a full Scan to the Object, making sure there are no overlapping scans afterwards. 
     void  addScan(Scan &scan);
 
+    /// @brief Append a Scan known not to touch any Scan already in the Object (no overlap checks).
+    void  appendScan(const Scan &scan);
+
     /// @brief Test whether a pixel (x,y) is in the Object. 
     bool  isInObject(long x, long y);
     /// @brief Test whether the (x,y) part of a Voxel is in the Object.
@@ -85,6 +88,10 @@ namespace PixelInfo
     /// @brief Return the number of Scans in the Object. 
     long  getNumScan(){return scanlist.size();}
 
+    /// @brief Call f(y,x1,x2) for each Scan of pixels from x1 to x2 in row y. 
+    template <class F>
+    void  forEachRun(F f) {for(auto &s : scanlist) f(s.getY(),s.getX(),s.getXmax());}
+
     /// @brief Order the Scans in the list, using the < operator for Scans. 
     void  order(){std::stable_sort(scanlist.begin(),scanlist.end());}
 
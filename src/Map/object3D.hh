@@ -94,6 +94,11 @@ namespace PixelInfo
     std::vector<Voxel<T> > getPixelSet();       /// Return a vector set of all voxels in the Object. 
     template <class T>
     std::vector<Voxel<T> > getPixelSet(T *array, int *dim);  /// Return set of voxel + flux of array. 
+
+    template <class F>
+    void forEachRun(F f);                   /// Call f(y,z,x1,x2) for each run of voxels along x.
+    template <class F>
+    void forEachVoxel(F f);                 /// Call f(x,y,z) for each voxel, no vector of Voxels built.
     
     virtual void addOffsets(long xoff, long yoff, long zoff);
 
@@ -108,6 +113,27 @@ namespace PixelInfo
     long                    zmin,zmax;      ///< min and max z-values of object
   }; 
 
+
+  template <class F>
+  void Object3D::forEachRun(F f) {
+
+    /// The Object is stored as runs of voxels (Scans) for each channel, so
+    /// it can be walked with no copies. Runs are visited in the same order
+    /// as the voxels returned by getPixelSet().
+
+    for(std::map<long, Object2D>::iterator it=chanlist.begin(); it!=chanlist.end(); it++)
+        it->second.forEachRun([&f,it](long y, long x1, long x2) {f(y,it->first,x1,x2);});
+  }
+
+
+  template <class F>
+  void Object3D::forEachVoxel(F f) {
+
+    forEachRun([&f](long y, long z, long x1, long x2) {
+        for(long x=x1; x<=x2; x++) f(x,y,z);
+    });
+  }
+
 }
 
 #endif
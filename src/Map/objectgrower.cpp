@@ -89,11 +89,9 @@ void ObjectGrower<T>::define(Cube<T> *theCube) {
     itsFlagArray = std::vector<STATE>(fullsize,AVAILABLE);
 
     for(int o=0;o<theCube->getNumObj();o++){
-        std::vector<Voxel<T> > voxlist = theCube->pObject(o)->template getPixelSet<T>();
-        for(size_t i=0; i<voxlist.size(); i++){
-            size_t pos=voxlist[i].getX()+voxlist[i].getY()*itsArrayDim[0]+voxlist[i].getZ()*spatsize;
-            itsFlagArray[pos] = DETECTED;
-        }
+        theCube->pObject(o)->forEachVoxel([&](long x, long y, long z) {
+            itsFlagArray[x+y*itsArrayDim[0]+z*spatsize] = DETECTED;
+        });
     }
 
 }
@@ -126,11 +124,9 @@ void ObjectGrower<T>::define(Statistics::Stats<T> stats, T *array, size_t xsize,
     itsFlagArray = std::vector<STATE>(fullsize,AVAILABLE);
 
     for(int o=0;o<objectList->size();o++){
-        std::vector<Voxel<T> > voxlist = objectList->at(o).template getPixelSet<T>();
-        for(size_t i=0; i<voxlist.size(); i++){
-            size_t pos=voxlist[i].getX()+voxlist[i].getY()*itsArrayDim[0]+voxlist[i].getZ()*spatsize;
-            itsFlagArray[pos] = DETECTED;
-        }
+        objectList->at(o).forEachVoxel([&](long x, long y, long z) {
+            itsFlagArray[x+y*itsArrayDim[0]+z*spatsize] = DETECTED;
+        });
     }
 
 }
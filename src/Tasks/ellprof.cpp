@@ -27,6 +27,7 @@
 #include <algorithm>
 #include <iomanip>
 #include <cstdlib>
+#include <vector>
 #include <Arrays/cube.hh>
 #include <Arrays/param.hh>
 #include <Tasks/ellprof.hh>
@@ -34,6 +35,54 @@
 #include <Utilities/utils.hh>
 #include <Utilities/progressbar.hh>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+namespace {
+
+// Accumulators of one thread for all rings/segments (see RadialProfile)
+struct CellStats {
+    std::vector<double> sum, sumsqr, dmin, dmax;
+    std::vector<long> num, nblanks, contrib;
+    std::vector<std::vector<std::pair<double,long>>> values;  // Values and multiplicities
+    CellStats(size_t n, bool keepValues) : sum(n,0), sumsqr(n,0), dmin(n,FLT_MAX), dmax(n,-FLT_MAX),
+                                           num(n,0), nblanks(n,0), contrib(n,0), values(keepValues ? n : 0) {}
+};
+
+
+double weightedMedian(std::vector<std::pair<double,long>> &v, long n) {
+
+    // Median of n values, given as pairs (value, multiplicity) in v.
+    // Same as findMedian() on the array with all the repeated values.
+
+    std::sort(v.begin(),v.end());
+    auto rank = [&v](long k) {
+        long cum = 0;
+        for (auto &e : v) if (k<(cum+=e.second)) return e.first;
+        return v.back().first;
+    };
+    double median = rank(n/2);
+    if (n%2==0) median = (median+rank(n/2-1))/2.;
+    return median;
+}
+
+
+double histRank(const long *hist, size_t nbins, double lo, double width, long k) {
+
+    // Value of rank k from a histogram, interpolating within the bin.
+
+    long cum = 0;
+    for (size_t b=0; b<nbins; b++) {
+        if (k<cum+hist[b]) return lo+width*(b+(k-cum+0.5)/hist[b]);
+        cum += hist[b];
+    }
+    return lo+width*nbins;
+}
+
+}
+
 
 namespace Tasks {
 
@@ -82,8 +131,6 @@ void Ellprof<T>::allocateArrays (size_t nrad, size_t nseg) {
     Surfdens = new double*[nrad];
     Surfdens_Bl = new double*[nrad];
 
-    medianArray = new std::vector<double>*[nrad];
-
     for (size_t i=0; i<nrad; i++) {
         Annuli[i] = new T[2];
         Sum[i] = new double[nseg];
@@ -101,7 +148,6 @@ void Ellprof<T>::allocateArrays (size_t nrad, size_t nseg) {
         Blankarea[i] = new double[nseg];
         Surfdens[i] = new double[nseg];
         Surfdens_Bl[i] = new double[nseg];
-        medianArray[i] = new std::vector<double>[nseg];
     }
 
     for (size_t i=0; i<nrad; i++) {
@@ -137,7 +183,6 @@ void Ellprof<T>::deallocateArrays () {
             delete [] Blankarea[i];
             delete [] Surfdens[i];
             delete [] Surfdens_Bl[i];
-            delete [] medianArray[i];
         }
 
         delete [] Radius;
@@ -167,8 +212,6 @@ void Ellprof<T>::deallocateArrays () {
         delete [] Blankarea;
         delete [] Surfdens;
         delete [] Surfdens_Bl;
-
-        delete [] medianArray;
     }
 }
 
@@ -360,6 +403,7 @@ void Ellprof<T>::update_rings(Rings<T> *rings, size_t nseg, float* segments) {
 
     stepxy[0] = fabs(Dx) / (float) subpix[0];
     stepxy[1] = fabs(Dy) / (float) subpix[1];
+    geomDefined = false;
 }
 
 
@@ -370,43 +414,99 @@ void Ellprof<T>::setOptions (bool overlap, float *range, float *subp) {
     Range[1] = range[1];
     subpix[0] = subp[0];
     subpix[1] = subp[1];
+    stepxy[0] = fabs(Dx) / (float) subpix[0];
+    stepxy[1] = fabs(Dy) / (float) subpix[1];
+    geomDefined = false;
 }
 
 
 template <class T>
 void Ellprof<T>::RadialProfile () {
 
+    ProgressBar bar(true,im->pars().isVerbose(),im->pars().getShowbar());
+    bar.init(" Computing radial profile... ",3);
+
+    if (!geomDefined) defineGeometry();
+    bar.update(1);
+
+    /* Sums over the pixels of the rings. Each thread has its own accumulators, */
+    /* which are added in the order of the threads at the end.                  */
+    const size_t ncell = Nrad*Nseg;
+    const size_t nx = Box[1]-Box[0]+1;
+    const size_t npix = pixStart.size()-1;
+    const int nthreads = std::max(1,im->pars().getThreads());
+    std::vector<CellStats> acc(nthreads, CellStats(ncell,exactMedian));
+
+#pragma omp parallel num_threads(nthreads)
+{
+    int tid = 0;
+#ifdef _OPENMP
+    tid = omp_get_thread_num();
+#endif
+    CellStats &a = acc[tid];
+#pragma omp for schedule(static)
+    for (size_t p=0; p<npix; p++) {
+        if (pixStart[p]==pixStart[p+1]) continue;
+        float imval = im->Array(Box[0]+p%nx, Box[2]+p/nx);
+        bool validpixel = IsInRange(imval, Range);
+        for (size_t h=pixStart[p]; h<pixStart[p+1]; h++) {
+            const size_t c = pixHits[h].cell;
+            const long n = pixHits[h].nsub;
+            /* If a pixel is not a blank, but its image value is not within */
+            /* the wanted range of values, it will be treated as a blank.   */
+            if (validpixel) {
+                a.sum[c]    += n*double(imval);
+                a.sumsqr[c] += n*double(imval)*double(imval);
+                a.num[c]    += n;
+                a.contrib[c]++;
+                if (imval>a.dmax[c]) a.dmax[c]=imval;
+                if (imval<a.dmin[c]) a.dmin[c]=imval;
+                if (exactMedian) a.values[c].push_back(std::make_pair(double(imval),n));
+            }
+            else a.nblanks[c] += n;
+        }
+    }
+}
+
     for (size_t i=0; i<Nrad; i++) {
-        for (size_t s=0; s< Nseg; s++) {
-             /* Reset the statistics variables */
-            Sum[i][s]=Mean[i][s]=Median[i][s]=0.0;
+        for (size_t s=0; s<Nseg; s++) {
+            size_t c = i*Nseg+s;
+            Sum[i][s]=Sumsqr[i][s]=Mean[i][s]=Median[i][s]=0.0;
             Var[i][s]=MAD[i][s]=Area[i][s]= 0.0;
             Num[i][s]=Numblanks[i][s]=Contrib[i][s]= 0;
             Datamin[i][s]=FLT_MAX;
             Datamax[i][s]=-FLT_MAX;
             Surfdens[i][s]=Surfdens_Bl[i][s]=0.;
+            for (int t=0; t<nthreads; t++) {
+                Sum[i][s]       += acc[t].sum[c];
+                Sumsqr[i][s]    += acc[t].sumsqr[c];
+                Num[i][s]       += acc[t].num[c];
+                Numblanks[i][s] += acc[t].nblanks[c];
+                Contrib[i][s]   += acc[t].contrib[c];
+                Datamin[i][s]    = std::min(Datamin[i][s],acc[t].dmin[c]);
+                Datamax[i][s]    = std::max(Datamax[i][s],acc[t].dmax[c]);
+            }
         }
     }
-
-
-    float Bgridlo[2], Bgridhi[2];
-    Bgridlo[0] = std::max(0, int(Position[0]-Rmax/fabs(Dx) - 1));
-    Bgridhi[0] = std::min(im->DimX()-1, int(Position[0]+Rmax/fabs(Dx)+1));
-    Bgridlo[1] = std::max(0, int(Position[1]-Rmax/fabs(Dy)-1));
-    Bgridhi[1] = std::min(im->DimY()-1, int(Position[1]+Rmax/fabs(Dy)+1));
-
-    /* Start looping over all pixels */
-    
-    ProgressBar bar(true,im->pars().isVerbose(),im->pars().getShowbar());
-    bar.init(" Computing radial profile... ",Bgridhi[0]-Bgridlo[0]);
-    
-    for (size_t x = Bgridlo[0]; x <= Bgridhi[0]; x++) {
-        bar.update(x-Bgridlo[0]+1);
-        for (size_t y = Bgridlo[1]; y <= Bgridhi[1]; y++) {
-            processpixel(x, y, im->Array(x,y));
+    bar.update(2);
+
+    /* Medians and median absolute deviations */
+    if (exactMedian) {
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+        for (size_t c=0; c<ncell; c++) {
+            size_t i = c/Nseg, s = c%Nseg;
+            if (Num[i][s]==0) continue;
+            std::vector<std::pair<double,long>> v;
+            v.reserve(Contrib[i][s]);
+            for (int t=0; t<nthreads; t++)
+                v.insert(v.end(), acc[t].values[c].begin(), acc[t].values[c].end());
+            Median[i][s] = weightedMedian(v, Num[i][s]);
+            for (auto &e : v) e.first = fabs(e.first-Median[i][s]);
+            MAD[i][s] = weightedMedian(v, Num[i][s]);
         }
     }
-    
+    else histMedians();
+
     bar.fillSpace("Done.\n");
 
 
@@ -452,7 +552,7 @@ void Ellprof<T>::RadialProfile () {
                 Area[i][m] = 0;
             }
             else {
-                /* The 'processpixel' function calculated too much FLUX. Each intensity has to    */
+                /* The sums over the subpixels give too much FLUX. Each intensity has to          */
                 /* be divided by the number of 'subpixels' in a pixel. In order to get the AREA   */
                 /* expressed in pixels, it will be divided by the same number.                    */
                 Area[i][m] = Num[i][m] / subpixtot;
@@ -461,8 +561,6 @@ void Ellprof<T>::RadialProfile () {
             }
 
             Blankarea[i][m] = Numblanks[i][m] / subpixtot;
-            Median[i][m]  = findMedian(&medianArray[i][m][0], Num[i][m]);
-            MAD[i][m]  = findMADFM(&medianArray[i][m][0], Num[i][m],Median[i][m],false);
             
             area = Area[i][m] * fabs(Dx*Dy);
             if (area == 0.0)  surfdens = 0.0;
@@ -488,11 +586,53 @@ void Ellprof<T>::RadialProfile () {
 
 
 template <class T>
-void Ellprof<T>::processpixel(int x, int y,float imval) {
+void Ellprof<T>::defineGeometry() {
+
+    /// Finds the rings and segments of the subpixels of all pixels in the
+    /// box enclosing the rings, which do not change from call to call of
+    /// RadialProfile() until the rings or the options are changed.
+
+    Box[0] = std::max(0, int(Position[0]-Rmax/fabs(Dx)-1));
+    Box[1] = std::min(im->DimX()-1, int(Position[0]+Rmax/fabs(Dx)+1));
+    Box[2] = std::max(0, int(Position[1]-Rmax/fabs(Dy)-1));
+    Box[3] = std::min(im->DimY()-1, int(Position[1]+Rmax/fabs(Dy)+1));
+
+    const size_t nx = Box[1]-Box[0]+1, ny = Box[3]-Box[2]+1;
+    std::vector<std::vector<Hit>> rowHits(ny);
+    std::vector<size_t> nhits(nx*ny);
+
+#pragma omp parallel num_threads(std::max(1,im->pars().getThreads()))
+{
+    std::vector<uint32_t> count(Nrad*Nseg,0);
+#pragma omp for schedule(dynamic)
+    for (size_t j=0; j<ny; j++) {
+        for (size_t i=0; i<nx; i++) {
+            size_t before = rowHits[j].size();
+            pixelHits(Box[0]+i, Box[2]+j, rowHits[j], count);
+            nhits[i+j*nx] = rowHits[j].size()-before;
+        }
+    }
+}
+
+    pixStart.assign(nx*ny+1,0);
+    for (size_t p=0; p<nx*ny; p++) pixStart[p+1] = pixStart[p]+nhits[p];
+    pixHits.clear();
+    pixHits.reserve(pixStart.back());
+    for (size_t j=0; j<ny; j++) pixHits.insert(pixHits.end(),rowHits[j].begin(),rowHits[j].end());
+
+    geomDefined = true;
+}
+
+
+template <class T>
+void Ellprof<T>::pixelHits(int x, int y, std::vector<Hit> &hits, std::vector<uint32_t> &count) {
 /*------------------------------------------------------------*/
 /* PURPOSE: Given the central position of a pixel, generate   */
 /*          positions in that pixel and check whether the are */
-/*          inside or outside a ring/segment.                 */
+/*          inside or outside a ring/segment. Appends to hits */
+/*          the rings/segments hit with the number of sub-    */
+/*          pixels in each. count is a work array of size     */
+/*          Nrad*Nseg, which must be zero (and is left zero). */
 /*                                                            */
 /* Example of subdivision of a pixel in y direction.          */
 /*                                                            */
@@ -511,76 +651,96 @@ void Ellprof<T>::processpixel(int x, int y,float imval) {
 /* that pixel.                                                */
 /*------------------------------------------------------------*/
 
-    bool validpixel = IsInRange(imval, Range);
-
-    bool inside[Nrad];
-
-    bool  Contribflag[Nrad][Nseg];  /* Did a pixel already contribute to ring? */
-    for (size_t rad=0; rad<Nrad; rad++)
-        for (size_t seg=0; seg<Nseg; seg++)
-            Contribflag[rad][seg] = false;
-
-
     /* The pixel position converted to arcsec wrt central position */
     double absdx = fabs(Dx);
     double absdy = fabs(Dy);
     float Xr = absdx*(x-Position[0]);
     float Yr = absdy*(y-Position[1]);
 
+    size_t first = hits.size();
     for (float posX = Xr + 0.5*(stepxy[0]-absdx); posX < Xr + 0.5*absdx; posX += stepxy[0]) {
         for (float posY = Yr + 0.5*(stepxy[1]-absdy); posY < Yr + 0.5*absdy; posY += stepxy[1]) {
-
-            int     overcount = 0;
-            float   imvaloverlap;
-
             for (size_t rad=0; rad<Nrad; rad++) {
-                if (IsInRing(posX, posY, rad)) {
-                    inside[rad] = true;
-                    overcount++;
+                if (!IsInRing(posX, posY, rad)) continue;
+                float theta = gettheta(posX, posY, Phi[rad], maprotation);
+                for (size_t seg=0; seg<Nseg; seg++) {
+                    if (IsInSegment(theta, Segments[2*seg], Segments[2*seg+1])) {
+                        uint32_t c = rad*Nseg+seg;
+                        if (count[c]++==0) hits.push_back({c,0});
+                    }
                 }
-                else inside[rad] = false;
             }
+        }
+    }
 
-            imvaloverlap = imval;
-            if (Overlap)
-                if (overcount != 0 && imval != imval) imvaloverlap = imval/float(overcount);
-
-            for (size_t rad=0; rad<Nrad; rad++){
-                if (inside[rad]) {
-                    float  theta = gettheta(posX, posY, Phi[rad], maprotation);
-                    for (size_t seg=0; seg < Nseg; seg++) {
-                        if (IsInSegment(theta, Segments[2*seg], Segments[2*seg+1]) ) {
-                            /* Now we have a pixel (in a ring, in a segment) that is either blank or not   */
-                            /* blank. If it is not a blank, but its image value is not within the wanted   */
-                            /* range of values, it will be treated as a blank.                             */
-
-                            if (validpixel) {
-                                Sum[rad][seg] += imvaloverlap;
-                                Sumsqr[rad][seg] += imvaloverlap*imvaloverlap;
-                                Num[rad][seg] += 1;
-                                Contribflag[rad][seg] = true;
+    for (size_t h=first; h<hits.size(); h++) {
+        hits[h].nsub = count[hits[h].cell];
+        count[hits[h].cell] = 0;
+    }
+}
 
-                                /* Overlapping or not, the data min, max are the real data min and max.  */
-                                /* not of  the weighted values.                                          */
-                                if (imval>Datamax[rad][seg]) Datamax[rad][seg]=imval;
-                                if (imval<Datamin[rad][seg]) Datamin[rad][seg]=imval;
 
+template <class T>
+void Ellprof<T>::histMedians() {
+
+    /// Approximate medians and MADs of all rings/segments, from histograms
+    /// of medianBins bins between the minimum and the maximum of each of
+    /// them. A first pass over the pixels gives the medians, a second pass
+    /// the MADs, with the absolute deviations between 0 and the largest one.
+
+    const size_t ncell = Nrad*Nseg, nb = medianBins;
+    const size_t nx = Box[1]-Box[0]+1;
+    const size_t npix = pixStart.size()-1;
+    const int nthreads = std::max(1,im->pars().getThreads());
+
+    std::vector<double> lo(ncell), width(ncell);
+    for (size_t c=0; c<ncell; c++) {
+        lo[c] = Datamin[c/Nseg][c%Nseg];
+        width[c] = (Datamax[c/Nseg][c%Nseg]-lo[c])/nb;
+    }
 
-                                medianArray[rad][seg].push_back(imvaloverlap);
+    for (int pass=0; pass<2; pass++) {
+        std::vector<std::vector<long>> hist(nthreads);
+#pragma omp parallel num_threads(nthreads)
+{
+        int tid = 0;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+#endif
+        std::vector<long> &hs = hist[tid];
+        hs.assign(ncell*nb,0);
+#pragma omp for schedule(static)
+        for (size_t p=0; p<npix; p++) {
+            if (pixStart[p]==pixStart[p+1]) continue;
+            float imval = im->Array(Box[0]+p%nx, Box[2]+p/nx);
+            if (!IsInRange(imval, Range)) continue;
+            for (size_t h=pixStart[p]; h<pixStart[p+1]; h++) {
+                const size_t c = pixHits[h].cell;
+                double v = pass==0 ? imval : fabs(imval-Median[c/Nseg][c%Nseg]);
+                size_t bin = width[c]>0 ? std::min<size_t>(nb-1,(v-lo[c])/width[c]) : 0;
+                hs[c*nb+bin] += pixHits[h].nsub;
+            }
+        }
+}
 
-                            }
-                            else Numblanks[rad][seg]+=1;
-                        }
-                    }
-                }
+#pragma omp parallel for num_threads(nthreads)
+        for (size_t c=0; c<ncell; c++) {
+            size_t i = c/Nseg, s = c%Nseg;
+            if (Num[i][s]==0) continue;
+            std::vector<long> hc(nb,0);
+            for (int t=0; t<nthreads; t++)
+                for (size_t b=0; b<nb; b++) hc[b] += hist[t][c*nb+b];
+            double m = histRank(hc.data(),nb,lo[c],width[c],Num[i][s]/2);
+            if (Num[i][s]%2==0) m = (m+histRank(hc.data(),nb,lo[c],width[c],Num[i][s]/2-1))/2.;
+            if (pass==0) {
+                Median[i][s] = m;
+                /* Limits for the absolute deviations */
+                lo[c] = 0;
+                width[c] = std::max(Datamax[i][s]-m, m-Datamin[i][s])/nb;
             }
+            else MAD[i][s] = m;
         }
     }
-
-    for (size_t rad=0; rad<Nrad; rad++)
-        for (size_t seg=0; seg<Nseg; seg++)
-            if (Contribflag[rad][seg]) Contrib[rad][seg] += 1;
-
 }
 
 
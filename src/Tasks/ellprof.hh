@@ -81,6 +81,10 @@
 //                          Make a better approximation of the true area in a
 //                          ring by dividing a pixel into subpixels.
 //
+//    and/or setMedian(bool exact, int nbins) to choose how medians and MADs
+//    are calculated: exactly (DEFAULT) or from a histogram of nbins bins per
+//    ring per segment, with an error smaller than (Datamax-Datamin)/nbins.
+//
 // 3) call RadialProfile()
 //
 // 4) Optional: call printProfile(std::ostream) to print output values on the
@@ -94,6 +98,7 @@
 
 #include <iostream>
 #include <vector>
+#include <cstdint>
 #include <Arrays/cube.hh>
 #include <Tasks/moment.hh>
 #include <Tasks/galmod.hh>
@@ -113,6 +118,7 @@ public:
     void   setFromCube(Cube<T> *c, Rings<T> *inR, bool mask=true);
     void   update_rings(Rings<T> *rings, size_t nseg=1, float* segments=nullptr);
     void   setOptions (bool overlap, float *range, float *subp);
+    void   setMedian (bool exact, int nbins=512) {exactMedian=exact; medianBins=nbins>0 ? nbins : 512;}
     void   RadialProfile ();
     void   printProfile (ostream& theStream=std::cout, int seg=0);
     void   writeMap (std::string fname) {im->fitswrite_2d(fname.c_str());}
@@ -188,14 +194,28 @@ private:
     float   stepxy[2];
     float   maprotation;
     long    **Contrib;            /* Number of different pixels in a ring/segment */
-    std::vector<double> **medianArray;
+    bool    exactMedian = true;   /* Exact medians or from histograms? */
+    int     medianBins = 512;     /* Number of bins of the histograms */
+
+    // Subpixels of each pixel falling in each ring/segment. They depend only
+    // on the geometry, so they are calculated once and used for all calls.
+    struct Hit {
+        uint32_t cell;            /* Ring/segment as rad*Nseg+seg */
+        uint32_t nsub;            /* Number of subpixels in the ring/segment */
+    };
+    bool    geomDefined = false;  /* Are pixStart and pixHits up to date? */
+    int     Box[4];               /* Pixels in the rings: xmin, xmax, ymin, ymax */
+    std::vector<size_t> pixStart; /* First hit of each pixel of the box in pixHits */
+    std::vector<Hit> pixHits;     /* Hits of all pixels of the box */
 
 
     void   defaults();
     void   init(MomentMap<T> *image, Rings<T> *rings, size_t nseg, float* segments);
     void   allocateArrays (size_t nrad, size_t nseg);
     void   deallocateArrays ();
-    void   processpixel(int x, int y, float imval);
+    void   defineGeometry();
+    void   pixelHits(int x, int y, std::vector<Hit> &hits, std::vector<uint32_t> &count);
+    void   histMedians();
     bool   IsInRange(float value, float *Range);
     bool   IsInRing( float  Xr, float  Yr, int radnr);
     float  gettheta(float X,float Y,float Phi,float Crota);
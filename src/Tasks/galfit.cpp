@@ -914,8 +914,8 @@ bool Galfit<T>::regularizeParams(std::vector<T> x, std::vector<T> y, std::vector
         std::vector<T> ww(n,1);
         T coeff[rtype], coefferr[rtype];
 
-        Lsqfit<T> lsq(&xx[0],1,&yy[0],&ww[0],xx.size(),coeff,coefferr,mp,rtype,&polyn,&polynd);
-        if (lsq.fit()<0) {
+        LsqSolver<T,PolyModel<T>> lsq(PolyModel<T>(),1.E-03,1000,0.);
+        if (lsq.fit(&xx[0],1,&yy[0],&ww[0],xx.size(),coeff,coefferr,mp,rtype)<0) {
             if (verb) std::cerr << "3DFIT ERROR: cannot least-square fit " << whichpar << ".\n";
             return false;
         }
@@ -1189,8 +1189,8 @@ bool Galfit<T>::AsymmetricDrift(T *rad, T *densprof, T *dispprof, T *rotcur, T *
         if (npar1>=nn) npar1 = nn-1;
         for (int i=0; i<npar1; i++) mp[i] = true;
         for (int i=0; i<nn; i++) ww[i] = 1;
-        Lsqfit<T> lsq1(rad,1,dispprof,ww,nn,cdisp,cdisperr,mp,npar1,&polyn,&polynd);
-        if (lsq1.fit()<0) {
+        LsqSolver<T,PolyModel<T>> lsq1(PolyModel<T>(),1.E-03,1000,0.);
+        if (lsq1.fit(rad,1,dispprof,ww,nn,cdisp,cdisperr,mp,npar1)<0) {
             if (in->pars().isVerbose()) std::cerr << "3DFIT ERROR: cannot least-square fit the dispersion for asymmetric drift.\n";
             par.flagADRIFT = false;
             return false;
@@ -1209,8 +1209,8 @@ bool Galfit<T>::AsymmetricDrift(T *rad, T *densprof, T *dispprof, T *rotcur, T *
         ww[i] = 1;
     }
     //Lsqfit<T> lsq2(rad,1,fun,ww,nn,cfun,cfunerr,mpp,npar2,&coreExp,&coreExpd);
-    Lsqfit<T> lsq2(rad,1,fun,ww,nn,cfun,cfunerr,mpp,npar2,&polyn,&polynd);
-    if (lsq2.fit()<0) {
+    LsqSolver<T,PolyModel<T>> lsq2(PolyModel<T>(),1.E-03,1000,0.);
+    if (lsq2.fit(rad,1,fun,ww,nn,cfun,cfunerr,mpp,npar2)<0) {
         if (in->pars().isVerbose()) std::cerr << "3DFIT ERROR: cannot least-square fit the fun for asymmetric drift.\n";
         par.flagADRIFT = false;
         return false;
@@ -29,6 +29,7 @@
 #include <Arrays/cube.hh>
 #include <Arrays/image.hh>
 #include <Arrays/rings.hh>
+#include <Arrays/ringindex.hh>
 #include <Tasks/galmod.hh>
 #include <Tasks/ellprof.hh>
 #include <Utilities/paramguess.hh>
@@ -141,6 +142,7 @@ protected:
 
     double slitfunc (Rings<T> *dring, T *array, int *bhi, int *blo);
     bool IsIn (int x, int y, int *blo, Rings<T> *dr, double &th);
+    RingIndex<T>& getRingIndex (Rings<T> *dr, int *blo, int *bsize);
     inline bool getSide (double theta);
     inline double getResValue(T obs, T mod, double weight, double noise_weight);
     std::vector<Pixel<T> >* getRingRegion (Rings<T> *dring, int *bhi, int *blo);
@@ -381,8 +381,8 @@ void Galfit<T>::getErrors (Rings<T> *dr, T **err, int ir, T minimum) {
         }
         mp[0]=mp[1]=false;
         
-        Lsqfit<T> lsq(&xx_bin[0],1,&yy_bin[0],ww,xx_bin.size(),coeff,coefferr,mp,order+1,&polyn,&polynd);
-        int nrt = lsq.fit();
+        LsqSolver<T,PolyModel<T>> lsq(PolyModel<T>(),1.E-03,1000,0.);
+        int nrt = lsq.fit(&xx_bin[0],1,&yy_bin[0],ww,xx_bin.size(),coeff,coefferr,mp,order+1);
 
         //cout << setprecision(20) <<coeff[3] << "  " << coeff[2] << endl;
         
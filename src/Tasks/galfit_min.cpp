@@ -533,8 +533,9 @@ void Galfit<T>::Convolve(T *array, int *bsize) {
     if (cfieldAllocated) {
         int ndx = (bsize[0]+NconX-1);
         int ndy = (bsize[1]+NconY-1);
-        T *beforeCON = new T[ndx*ndy];
-        T *afterCON  = new T[ndx*ndy];
+        ScratchScope scratch;
+        T *beforeCON = scratch.alloc<T>(ndx*ndy);
+        T *afterCON  = scratch.alloc<T>(ndx*ndy);
         for (int z=0; z<in->DimZ(); z++) {
             for (int x=0; x<ndx; x++) {
                 for (int y=0; y<ndy; y++) {
@@ -574,9 +575,6 @@ void Galfit<T>::Convolve(T *array, int *bsize) {
             }
 
         }
-
-        delete [] beforeCON;
-        delete [] afterCON;
     }
 
 }
@@ -619,14 +617,14 @@ double Galfit<T>::norm_local (Rings<T> *dring, T *array, int *bhi, int *blo) {
     int numPix_ring=0, numBlanks=0, numPix_tot=0;
     double minfunc = 0;
     
-    // Weighting function can be either a cos(theta)^n or a sin(theta)^n
-    double (*wfunc)(double) = cos;
-    if (wpow<0) wfunc = sin;
+    // Rings and azimuths of the pixels of the model
+    RingIndex<T> &rind = getRingIndex(dring,blo,bsize);
     
     for (uint y=bsize[1]; y--;) {
         for (uint x=bsize[0]; x--;) {
-            double theta;
-            if (!IsIn(x,y,blo,dring,theta)) continue;
+            size_t p = x+y*bsize[0];
+            if (rind.Ring(p)!=0) continue;
+            double theta = rind.Theta(p);
             if (!getSide(theta)) continue;
             numPix_ring++;
 
@@ -641,9 +639,7 @@ double Galfit<T>::norm_local (Rings<T> *dring, T *array, int *bhi, int *blo) {
             if (modSum!=0) factor = obsSum/modSum;
             else factor=0;
 
-            //double costh = fabs(cos(theta*M_PI/180.));
-            double wf = fabs(wfunc(theta*M_PI/180.));
-            double wi = std::pow(wf, fabs(wpow));
+            double wi = rind.Weight(p);
 
             // Normalizing and residuals.
             for (uint z=in->DimZ(); z--;) {
@@ -746,16 +742,16 @@ double Galfit<T>::norm_azim (Rings<T> *dring, T *array, int *bhi, int *blo) {
     int numPix_ring=0, numBlanks=0, numPix_tot=0;
     double minfunc = 0;
     
-    // Weighting function can be either a cos(theta)^n or a sin(theta)^n
-    double (*wfunc)(double) = cos;
-    if (wpow<0) wfunc = sin;
+    // Rings and azimuths of the pixels of the model
+    RingIndex<T> &rind = getRingIndex(dring,blo,bsize);
 
     //< Factor for normalization.
     T obsSum=0, modSum=0, factor=1;
     for (uint y=bsize[1]; y--;) {
         for (uint x=bsize[0]; x--;) {
-            double theta;
-            if (!IsIn(x,y,blo,dring,theta)) continue;
+            size_t p = x+y*bsize[0];
+            if (rind.Ring(p)!=0) continue;
+            double theta = rind.Theta(p);
             if (!getSide(theta)) continue;
 
             for (uint z=in->DimZ(); z--;) {
@@ -772,13 +768,12 @@ double Galfit<T>::norm_azim (Rings<T> *dring, T *array, int *bhi, int *blo) {
     
     for (uint y=bsize[1]; y--;) {
         for (uint x=bsize[0]; x--;) {
-            double theta;
-            if (!IsIn(x,y,blo,dring,theta)) continue;
+            size_t p = x+y*bsize[0];
+            if (rind.Ring(p)!=0) continue;
+            double theta = rind.Theta(p);
             if (!getSide(theta)) continue;
             numPix_ring++;
-            //double costh = fabs(cos(theta*M_PI/180.));
-            double wf = fabs(wfunc(theta*M_PI/180.));
-            double wi = std::pow(wf, fabs(wpow));
+            double wi = rind.Weight(p);
 
             // Normalizing and residuals.
             for (uint z=in->DimZ(); z--;) {
@@ -893,21 +888,19 @@ double Galfit<T>::norm_none (Rings<T> *dring, T *array, int *bhi, int *blo) {
     int numPix_ring=0, numBlanks=0, numPix_tot=0;
     double minfunc = 0;
 
-    // Weighting function can be either a cos(theta)^n or a sin(theta)^n
-    double (*wfunc)(double) = cos;
-    if (wpow<0) wfunc = sin;
+    // Rings and azimuths of the pixels of the model
+    RingIndex<T> &rind = getRingIndex(dring,blo,bsize);
     
     for (uint y=bsize[1]; y--;) {
         for (uint x=bsize[0]; x--;) {
-            double theta;
-            if (!IsIn(x,y,blo,dring,theta)) continue;
+            size_t p = x+y*bsize[0];
+            if (rind.Ring(p)!=0) continue;
+            double theta = rind.Theta(p);
             if (!getSide(theta)) continue;
 
             numPix_ring++;
 
-            //double costh = fabs(cos(theta*M_PI/180.));
-            double wf = fabs(wfunc(theta*M_PI/180.));
-            double wi = std::pow(wf, fabs(wpow));
+            double wi = rind.Weight(p);
             
             // Normalizing and residuals.
             for (uint z=in->DimZ(); z--;) {
@@ -982,6 +975,23 @@ template bool Galfit<float>::IsIn(int,int,int*,Rings<float>*,double&);
 template bool Galfit<double>::IsIn(int,int,int*,Rings<double>*,double&);
 
 
+template <class T>
+RingIndex<T>& Galfit<T>::getRingIndex (Rings<T> *dr, int *blo, int *bsize) {
+
+    // Returns the map of the pixels of the model box that are inside the
+    // rings, with their azimuths and weights, as given by IsIn(). The map is
+    // rebuilt only when the geometry of the rings changes. Rings are fitted
+    // in parallel, so that each thread has its own map.
+
+    thread_local RingIndex<T> rind;
+    double pixScale = ((fabs(in->Head().Cdelt(0))*arcconv)+(fabs(in->Head().Cdelt(1))*arcconv))/2.;
+    rind.define(dr,blo,bsize,pixScale,wpow);
+    return rind;
+}
+template RingIndex<float>& Galfit<float>::getRingIndex(Rings<float>*,int*,int*);
+template RingIndex<double>& Galfit<double>::getRingIndex(Rings<double>*,int*,int*);
+
+
 template <class T>
 inline bool Galfit<T>::getSide (double theta) {
 
@@ -163,7 +163,7 @@ void Galfit<T>::writeModel (std::string normtype, bool makeplots) {
 
         if (verb) std::cout << "    Writing " << randomAdjective(1) << " azimuthally-normalized model..." << std::flush;
         std::string mfile = outfold+object+"mod_azim.fits";
-        mod->Out()->fitswrite_3d(mfile.c_str());
+        mod->Out()->fitswrite_3d(mfile.c_str(),false,true,in->pars().getCompressModel());
 
         writePVs(mod->Out(),"_azim");
         if (verb) std::cout << " Done." << std::endl;
@@ -200,7 +200,7 @@ void Galfit<T>::writeModel (std::string normtype, bool makeplots) {
 
         if (verb) std::cout << "    Writing " << randomAdjective(1) << " locally-normalized model..." << std::flush;
         std::string mfile = outfold+object+"mod_local.fits";
-        mod->Out()->fitswrite_3d(mfile.c_str());
+        mod->Out()->fitswrite_3d(mfile.c_str(),false,true,in->pars().getCompressModel());
 
         writePVs(mod->Out(),"_local");
         if (verb) std::cout << " Done." << std::endl;
@@ -244,7 +244,7 @@ void Galfit<T>::writeModel (std::string normtype, bool makeplots) {
         
         if (verb) std::cout << "    Writing model..." << std::flush;
         std::string mfile = outfold+object+"mod_nonorm.fits";
-        mod->Out()->fitswrite_3d(mfile.c_str());
+        mod->Out()->fitswrite_3d(mfile.c_str(),false,true,in->pars().getCompressModel());
         writePVs(mod->Out(),"_nonorm");
         if (verb) std::cout << " Done." << std::endl;
 
@@ -276,7 +276,7 @@ void Galfit<T>::writeModel (std::string normtype, bool makeplots) {
         for (size_t i=nPix; i--;) mod->Out()->Array(i) += (noise[i]*fac);    
         // Writing to FITS file
         std::string mfile = outfold+object+"mod_noise.fits";
-        mod->Out()->fitswrite_3d(mfile.c_str());
+        mod->Out()->fitswrite_3d(mfile.c_str(),false,true,in->pars().getCompressModel());
         delete [] noise;
         if (verb) std::cout << " Done." << std::endl;
     }
@@ -298,6 +298,7 @@ void Galfit<T>::writeModel (std::string normtype, bool makeplots) {
     // Now plotting everything
     if (makeplots) {
         if (verb) std::cout << "    Producing " << randomAdjective(1) << " plots..." << std::flush;
+        if (!FitsWrite_wait()) std::cerr << "3DFIT ERROR: some output FITS files could not be written.\n";
         int ret = plotParam();
         if (verb) {
             if (ret==0) std::cout << " Done." << std::endl;
@@ -333,13 +334,16 @@ void Galfit<T>::writeOutputs (Cube<T> *mod, Tasks::Ellprof<T> *e, bool makeplots
     mod->Head().setMinMax(0.,0.);
     mod->Head().setName(object+"mod");
     std::string mfile = outfold+object+"mod"+suffix+".fits";
-    mod->fitswrite_3d(mfile.c_str());
+    mod->fitswrite_3d(mfile.c_str(),false,true,in->pars().getCompressModel());
 
     // Write P-V and kinematic maps
     writePVs(mod,suffix);
     writeKinematicMaps(mod,suffix);
 
-    if (makeplots) plotParam();
+    if (makeplots) {
+        if (!FitsWrite_wait()) std::cerr << "3DFIT ERROR: some output FITS files could not be written.\n";
+        plotParam();
+    }
 }
 template void Galfit<float>::writeOutputs(Cube<float>*, Tasks::Ellprof<float>*, bool);
 template void Galfit<double>::writeOutputs(Cube<double>*, Tasks::Ellprof<double>*, bool);
@@ -384,19 +388,20 @@ void Galfit<T>::writePVs(Cube<T> *mod, std::string suffix) {
     float meanYpos = findMedian(&outr->ypos[0], outr->nr);
     float meanPAp90= meanPA+90<360 ? meanPA+90 : meanPA-90;
     
-    // Extract pvs of data
-    PvSlice<T> *pv_max = PositionVelocity(in,meanXpos,meanYpos,meanPA);
+    // Extract pvs of data. Both slices are extracted in one pass over the cube.
+    std::vector<float> angles = {meanPA, meanPAp90};
+    std::vector<PvSlice<T>*> pvs = PositionVelocity(in,meanXpos,meanYpos,angles);
+    PvSlice<T> *pv_max = pvs[0], *pv_min = pvs[1];
     std::string mfile = outfold+object+"_pv_a.fits";
     pv_max->fitswrite_2d(mfile.c_str());
-    PvSlice<T> *pv_min = PositionVelocity(in,meanXpos,meanYpos,meanPAp90);
     mfile = outfold+object+"_pv_b.fits";
     pv_min->fitswrite_2d(mfile.c_str());
 
     // Extract pvs of model
-    PvSlice<T> *pv_max_m = PositionVelocity(mod,meanXpos,meanYpos,meanPA);
+    pvs = PositionVelocity(mod,meanXpos,meanYpos,angles);
+    PvSlice<T> *pv_max_m = pvs[0], *pv_min_m = pvs[1];
     mfile = outfold+object+"mod_pv_a"+suffix+".fits";
     pv_max_m->fitswrite_2d(mfile.c_str());
-    PvSlice<T> *pv_min_m = PositionVelocity(mod,meanXpos,meanYpos,meanPAp90);
     mfile = outfold+object+"mod_pv_b"+suffix+".fits";
     pv_min_m->fitswrite_2d(mfile.c_str());
 
@@ -408,10 +413,10 @@ void Galfit<T>::writePVs(Cube<T> *mod, std::string suffix) {
     m->Head().setMinMax(0.,0);
     for (size_t i=in->NumPix(); i--;) m->Array()[i] = short(mask[i]);
     
-    PvSlice<short> *pv_max_ma = PositionVelocity(m,meanXpos,meanYpos,meanPA);
+    std::vector<PvSlice<short>*> pvs_ma = PositionVelocity(m,meanXpos,meanYpos,angles);
+    PvSlice<short> *pv_max_ma = pvs_ma[0], *pv_min_ma = pvs_ma[1];
     mfile = outfold+object+"mask_pv_a.fits";
     pv_max_ma->fitswrite_2d(mfile.c_str());
-    PvSlice<short> *pv_min_ma = PositionVelocity(m,meanXpos,meanYpos,meanPAp90);
     mfile = outfold+object+"mask_pv_b.fits";
     pv_min_ma->fitswrite_2d(mfile.c_str());
     
@@ -1270,7 +1275,7 @@ std::vector<std::string> Galfit<T>::writeScripts_Python() {
     if (in->Head().NumAx()>3)
         for (int i=0; i<in->Head().NumAx()-3; i++) pyf << "0,";
     pyf << "zmin:zmax+1,ymin:ymax+1,xmin:xmax+1] \n"
-        << "data_mas = image_mas[0].data[zmin:zmax+1,ymin:ymax+1,xmin:xmax+1] \n"
+        << "data_mas = image_mas[-1].data[zmin:zmax+1,ymin:ymax+1,xmin:xmax+1] \n"
         << "head = image[0].header \n"
         << "zsize= data.shape[0] \n"
         << "cdeltsp=" << in->Head().PixScale()*arcconv << std::endl
@@ -1292,7 +1297,7 @@ std::vector<std::string> Galfit<T>::writeScripts_Python() {
     pyf << "# Beginning channel map plot \n"
         << "for k in range (len(files_mod)): \n"
         << "\timage_mod = fits.open(outfolder+files_mod[k]) \n"
-        << "\tdata_mod = image_mod[0].data[zmin:zmax+1,ymin:ymax+1,xmin:xmax+1] \n"
+        << "\tdata_mod = image_mod[-1].data[zmin:zmax+1,ymin:ymax+1,xmin:xmax+1] \n"
         << "\tfig = plt.figure(figsize=(8.27, 11.69), dpi=150) \n"
         << "\tgrid = [gridspec.GridSpec(2,5),gridspec.GridSpec(2,5),gridspec.GridSpec(2,5)] \n"
         << "\tgrid[0].update(top=0.90, bottom=0.645, left=0.05, right=0.95, wspace=0.0, hspace=0.0) \n"
@@ -1853,9 +1858,7 @@ void Galfit<T>::DensityProfile (T *surf_dens, int *count) {
 
     if (!in->getIsSearched()) in->search();
     Detection<T> *obj = in->pObject(0);
-    obj->calcFluxes(obj->getPixelSet(in->Array(), in->AxisDim()));
-    obj->calcWCSparams(in->Head());
-    obj->calcIntegFlux(in->DimZ(), obj->getPixelSet(in->Array(), in->AxisDim()), in->Head(), false, in->pars().getFluxConvert());
+    obj->calcAllParams(in->Array(), in->AxisDim(), in->Head(), false, in->pars().getFluxConvert());
     obj->setMass(2.365E5*obj->getIntegFlux()*distance*distance);
     T *surf_bright_faceon = new T[outr->nr];
     T *mass_surf_dens = new T[outr->nr];
@@ -37,6 +37,7 @@
 #include <Tasks/moment.hh>
 #include <Utilities/utils.hh>
 #include <Utilities/progressbar.hh>
+#include <Utilities/allocator.hpp>
 
 #include <sys/socket.h>
 #include <math.h>
@@ -587,20 +588,21 @@ void Galmod<T>::ringIO(Rings<T> *rings) {
     r = new Rings<T>;
 
     int nur = rings->nr;
-    T *uradii = new T[nur];
-    T *uvrot  = new T[nur];
-    T *uvdisp = new T[nur];
-    T *uvrad  = new T[nur];
-    T *uvvert = new T[nur];
-    T *udvdz  = new T[nur];
-    T *uzcyl  = new T[nur];
-    T *udens  = new T[nur];
-    T *uz0    = new T[nur];
-    T *uinc   = new T[nur];
-    T *uphi   = new T[nur];
-    T *uxpos  = new T[nur];
-    T *uypos  = new T[nur];
-    T *uvsys  = new T[nur];
+    ScratchScope scratch;
+    T *uradii = scratch.alloc<T>(nur);
+    T *uvrot  = scratch.alloc<T>(nur);
+    T *uvdisp = scratch.alloc<T>(nur);
+    T *uvrad  = scratch.alloc<T>(nur);
+    T *uvvert = scratch.alloc<T>(nur);
+    T *udvdz  = scratch.alloc<T>(nur);
+    T *uzcyl  = scratch.alloc<T>(nur);
+    T *udens  = scratch.alloc<T>(nur);
+    T *uz0    = scratch.alloc<T>(nur);
+    T *uinc   = scratch.alloc<T>(nur);
+    T *uphi   = scratch.alloc<T>(nur);
+    T *uxpos  = scratch.alloc<T>(nur);
+    T *uypos  = scratch.alloc<T>(nur);
+    T *uvsys  = scratch.alloc<T>(nur);
     
     r->radsep=0.75*min(pixsize[0],pixsize[1]);
     uradii[0]=rings->radii[0]/60.;
@@ -723,20 +725,6 @@ void Galmod<T>::ringIO(Rings<T> *rings) {
     
     ringDefined = true;
 
-    delete [] uradii;
-    delete [] uvrot;
-    delete [] uvrad;
-    delete [] uvvert;
-    delete [] uvdisp;
-    delete [] udens;
-    delete [] uz0;
-    delete [] udvdz;
-    delete [] uzcyl;
-    delete [] uinc;
-    delete [] uphi;
-    delete [] uxpos;
-    delete [] uypos;
-    delete [] uvsys;
 }
 
 /*
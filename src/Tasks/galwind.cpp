@@ -329,7 +329,7 @@ bool GalWind<T>::writeFITS(std::string fname, bool fullHead) {
         std::string fn = fname;
         if (fn=="") fn = in->pars().getOutfolder()+in->Head().Name()+"_wind.fits";
     
-        return out->fitswrite_3d(fn.c_str(),fullHead);
+        return out->fitswrite_3d(fn.c_str(),fullHead,false,in->pars().getCompressModel());
     }
     else return false;
 
@@ -23,13 +23,16 @@
 #include <iostream>
 #include <cfloat>
 #include <vector>
+#include <array>
+#include <algorithm>
 #include <fitsio.h>
 #include <Tasks/moment.hh>
 #include <Arrays/array.hpp>
 #include <Arrays/cube.hh>
 #include <Arrays/image.hh>
 #include <Utilities/utils.hh>
-#include <Utilities/lsqfit.hh>
+#include <Utilities/gaussfit.hh>
+#include <Utilities/allocator.hpp>
 #include <Utilities/progressbar.hh>
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -66,6 +69,7 @@ void MomentMap<T>::input (Cube<T> *c, int *Blo, int *Bhi, bool *m) {
     this->array = new T[this->numPix];
     this->arrayAllocated = true;
     this->par = c->pars();
+    defineAxis();
 }
 
 
@@ -142,6 +146,9 @@ void MomentMap<T>::storeMap(bool msk, int whichmap, std::string map_type) {
         std::cout << "Array not allocated. Call 'input' first!!\n";
         std::terminate();
     }
+    
+    // The velocity axis is defined again, in case the header has changed (see SumMap)
+    defineAxis();
         
     if (!(this->headDefined=setHead(whichmap)) && in->pars().isVerbose()) {
         std::cout<< "MOMENT MAPS warning: cannot create new header.\n";
@@ -160,29 +167,28 @@ void MomentMap<T>::storeMap(bool msk, int whichmap, std::string map_type) {
     else if (whichmap==2) barstring = " Extracting velocity dispersion map ";
     
     if (map_type=="GAUSSIAN") {
-        map_Type = &MomentMap<T>::fitSpectrum;
+        map_Type = &MomentMap<T>::fitRow;
         barstring += "(GAUSSIAN)... ";
     }
     else {
-        map_Type = &MomentMap<T>::calculateMoments;
+        map_Type = &MomentMap<T>::rowMoments;
         barstring += "(MOMENT)... ";
     }
     
     ProgressBar bar(true,in->pars().isVerbose(),in->pars().getShowbar());
 
+    // Maps are computed one row at a time
     int nthreads = in->pars().getThreads();    
+    size_t nx = this->axisDim[0];
 #pragma omp parallel num_threads(nthreads)
 {
-    bar.init(barstring,this->axisDim[0]);
-#pragma omp for
-    for (int x=0; x<this->axisDim[0]; x++) {
-        bar.update(x+1);
-        for (int y=0; y<this->axisDim[1]; y++) {
-            this->array[x+y*this->axisDim[0]]=log(-1);
-            double moms[3];
-            if((this->*map_Type)(x,y,msk,moms))
-                this->array[x+y*this->axisDim[0]] = moms[whichmap];
-        }
+    bar.init(barstring,this->axisDim[1]);
+    std::vector<double> moms(3*nx);
+#pragma omp for schedule(dynamic)
+    for (int y=0; y<this->axisDim[1]; y++) {
+        bar.update(y+1);
+        (this->*map_Type)(0,nx,y,msk,moms.data());
+        for (size_t x=0; x<nx; x++) this->array[x+y*nx] = moms[3*x+whichmap];
     }
 }
     
@@ -300,6 +306,7 @@ void MomentMap<T>::RMSMap (bool msk, float sncut, float level) {
     // If a mask is used, it calculates RMS outside the mask, 
     // otherwise it uses an iterative way: calculate rms, 
     // cut at sncut*rms, start again until convergence at level "level".
+    // If NOISEBOX is set, the local noise map of the cube is used instead.
 
     if (!this->arrayAllocated) {
         std::cout << "MOMENT MAPS error: ";
@@ -316,10 +323,21 @@ void MomentMap<T>::RMSMap (bool msk, float sncut, float level) {
     
     // Cube sizes
     size_t xs = in->DimX(), ys = in->DimY(), zs = in->DimZ();
-    
+
+    if (in->pars().getNoiseBox()>0) {
+        // Spatially varying noise in boxes of NOISEBOX pixels, taken from
+        // the noise maps of the cube instead of spectrum by spectrum.
+        NoiseMaps<T> &nm = in->noiseMaps();
+        for (int y=0; y<this->axisDim[1]; y++)
+            for (int x=0; x<this->axisDim[0]; x++)
+                this->array[x+y*this->axisDim[0]] = nm.LocalNoise(x+blo[0],y+blo[1]);
+        storedtype = 4;
+        return;
+    }
+
     // Progress bar
     ProgressBar bar(true,in->pars().isVerbose(),in->pars().getShowbar());
-    
+
     if(msk && !in->MaskAll()) in->BlankMask();
 
 #pragma omp parallel num_threads(nthreads)
@@ -427,114 +445,194 @@ bool MomentMap<T>::setHead(int type) {
 
 
 template <class T>
-bool MomentMap<T>::calculateMoments (size_t x, size_t y, bool msk, double *moments) {
-    
-    // An array to store the spectrum at (x,y) position
-    double *spectrum = new double[nsubs]; 
-    // Velocities in km/s
-    double *vels = new double[nsubs];
-    
-    T num=0, denom=0;
+void MomentMap<T>::defineAxis() {
+
+    /// Precomputes the velocity of each channel and the conversion factor
+    /// of the 0th moment, so that units are parsed once per map and not once
+    /// per pixel and channel.
+
+    // Channel z of the map is channel z+blo[2] of the cube, both with and
+    // without a header, so that maps of a spectral sub-range have the
+    // velocities of their own channels.
+    bool headdef = in->HeadDef();
+    velAxis.resize(nsubs);
+    relAxis.resize(nsubs);
+    for (int z=0; z<nsubs; z++)
+        velAxis[z] = headdef ? AlltoVel(in->getZphys(z+blo[2]),in->Head()) : z+blo[2];
+
+    // Sums are made with velocities relative to the central channel, which
+    // limits the cancellation in the one-pass 2nd moment.
+    vref = nsubs>0 ? velAxis[nsubs/2] : 0;
+    for (int z=0; z<nsubs; z++) relAxis[z] = velAxis[z]-vref;
+
+    // Without a header, the 0th moment is just the sum over the channels
+    fluxFactor = mom0Factor = 1;
+    if (headdef) {
+        if (in->pars().getFluxConvert()) fluxFactor = FluxtoJyBeam(1.,in->Head());
+        mom0Factor = fabs(DeltaVel(in->Head()))*fluxFactor;
+    }
+}
+
+
+template <class T>
+void MomentMap<T>::sumSpectra (size_t x0, size_t nx, size_t y, bool msk, double *sums) {
+
+    /// Sums f, f*v and f*v^2 over the channels for the nx pixels of row y
+    /// starting at x0, where f is the (masked) flux and v the velocity
+    /// relative to vref. Sums are written in sums[0:nx], sums[nx:2nx] and
+    /// sums[2nx:3nx]. The row is read one channel at a time, so that the
+    /// cube is read contiguously and the inner loops are vectorized.
+
+    double *s0 = sums, *s1 = sums+nx, *s2 = sums+2*nx;
+    for (size_t i=0; i<3*nx; i++) sums[i] = 0;
+
+    size_t xs = x0+blo[0], ys = y+blo[1];
+    bool lazy = in->isLazy();
+    const T *data = lazy ? nullptr : in->Array();
+
     for (int z=0; z<nsubs; z++) {
-        long npix = in->nPix(x+blo[0],y+blo[1],z+blo[2]);
-        vels[z] = z+blo[2];
-        if (in->HeadDef()) 
-            vels[z] = AlltoVel(in->getZphys(z),in->Head());
-                
-        if (msk) {
-            num   += in->Array(npix)*vels[z]*mask[npix];
-            denom += in->Array(npix)*mask[npix];
+        const double v = relAxis[z], v2 = v*v;
+        size_t start = in->nPix(xs,ys,z+blo[2]);
+        const bool *m = msk ? mask+start : nullptr;
+        if (lazy) {
+            for (size_t i=0; i<nx; i++) {
+                double f = in->Value(start+i);
+                if (msk) f *= m[i];
+                s0[i] += f; s1[i] += f*v; s2[i] += f*v2;
+            }
+        }
+        else if (msk) {
+            const T *d = data+start;
+#pragma omp simd
+            for (size_t i=0; i<nx; i++) {
+                double f = double(d[i])*m[i];
+                s0[i] += f; s1[i] += f*v; s2[i] += f*v2;
+            }
         }
         else {
-            num   += in->Array(npix)*vels[z];
-            denom += in->Array(npix);
+            const T *d = data+start;
+#pragma omp simd
+            for (size_t i=0; i<nx; i++) {
+                double f = d[i];
+                s0[i] += f; s1[i] += f*v; s2[i] += f*v2;
+            }
         }
     }
-    
+}
+
+
+template <class T>
+void MomentMap<T>::finishMoments (double s0, double s1, double s2, double *moments) {
+
+    /// Moments 0, 1 and 2 from the sums of sumSpectra().
+
     // If all pixels are masked return all NaNs
-    if (denom==0) {
+    if (s0==0) {
         moments[0] = moments[1] = moments[2] = log(-1);
-        delete [] spectrum;
-        delete [] vels;
-        return true;
+        return;
     }
-    
-    // Moment 0th
-    moments[0] = denom * fabs(DeltaVel(in->Head()));
-    if (in->HeadDef() && in->pars().getFluxConvert()) 
-        moments[0] = FluxtoJyBeam(denom, in->Head()) * fabs(DeltaVel(in->Head()));
-    
-    // Moment 1st
-    moments[1] = num/denom;
 
-    // Calculating 2nd moment
-    num = 0;
-    for (int z=0; z<nsubs; z++) {
-        long npix = in->nPix(x+blo[0],y+blo[1],z+blo[2]);
-        if (msk) num += in->Array(npix)*(vels[z]-moments[1])*(vels[z]-moments[1])*mask[npix];
-        else num += in->Array(npix)*(vels[z]-moments[1])*(vels[z]-moments[1]);
-    }
-    
-    // Moment 2nd
-    moments[2] = sqrt(num/denom);
-    
-    delete [] spectrum;
-    delete [] vels;
+    double mean = s1/s0;
+    moments[0] = s0*mom0Factor;
+    moments[1] = vref+mean;
+    moments[2] = sqrt(s2/s0-mean*mean);
+}
+
+
+template <class T>
+bool MomentMap<T>::calculateMoments (size_t x, size_t y, bool msk, double *moments) {
+
+    double sums[3];
+    sumSpectra(x,1,y,msk,sums);
+    finishMoments(sums[0],sums[1],sums[2],moments);
     return true;
 }
 
 
+template <class T>
+void MomentMap<T>::rowMoments (size_t x0, size_t nx, size_t y, bool msk, double *moments) {
+
+    /// Moments of nx pixels of row y from x0, in one pass over the cube.
+    /// Moments of pixel i are written in moments[3*i:3*i+3].
+
+    ScratchScope scratch;
+    double *sums = scratch.alloc<double>(3*nx);
+    sumSpectra(x0,nx,y,msk,sums);
+    for (size_t i=0; i<nx; i++)
+        finishMoments(sums[i],sums[nx+i],sums[2*nx+i],moments+3*i);
+}
+
+
 template <class T>
 bool MomentMap<T>::fitSpectrum (size_t x, size_t y, bool msk, double *bestfitpar) {
 
-    // An array to store the spectrum at (x,y) position
-    double *spectrum = new double[nsubs]; 
-    // Weights and velocities in km/s
-    double *ww = new double[nsubs];
-    double *vels = new double[nsubs];
-    // Parameters of the Gaussian fit and their errors
-    double c[3], cerr[3];
-    // Paramters to fit
-    bool mp[3] = {true,true,true};
-    
-    float smax = -FLT_MAX, vmax = 0;
+    /// Fits a Gaussian to the spectrum at (x,y). Returns false if the fit fails.
+
+    fitRow(x,1,y,msk,bestfitpar);
+    return !std::isnan(bestfitpar[1]);
+}
+
+
+template <class T>
+void MomentMap<T>::fitRow (size_t x0, size_t nx, size_t y, bool msk, double *moments) {
+
+    /// Fits a Gaussian to the spectra of nx pixels of row y from x0, all at
+    /// once with fitGaussians(). Integrated intensity, central velocity and
+    /// dispersion of pixel i are written in moments[3*i:3*i+3], or NaNs
+    /// where the fit fails.
+    ///
+    /// Initial guesses are the peak of the spectrum, and the 1st and 2nd
+    /// moments when they are meaningful (else the velocity of the peak and
+    /// 10 km/s, as before).
+
+    ScratchScope scratch;
+    double *spec = scratch.alloc<double>(nsubs*nx);
+    double *par  = scratch.alloc<double>(3*nx);
+    double *sums = scratch.alloc<double>(3*nx);
+    bool   *ok   = scratch.alloc<bool>(nx);
+
+    // Spectra stored by channel, as read from the cube
+    size_t xs = x0+blo[0], ys = y+blo[1];
     for (int z=0; z<nsubs; z++) {
-        ww[z] = 1;
-        spectrum[z] = in->Array(x,y,z);
-        if (msk) spectrum[z] *= mask[in->nPix(x,y,z)];
-        vels[z] = AlltoVel(in->getZphys(z),in->Head());
-        // Finding spectrum maximum value and corresponding position
-        if (spectrum[z]>smax) {
-            smax = spectrum[z];
-            vmax = vels[z];
+        size_t start = in->nPix(xs,ys,z+blo[2]);
+        double *sp = spec+z*nx;
+        for (size_t i=0; i<nx; i++) {
+            sp[i] = in->Value(start+i);
+            if (msk) sp[i] *= mask[start+i];
         }
     }
-    
-    // Initial guesses of the Gaussian fit
-    c[0] = smax;
-    c[1] = vmax;
-    c[2] = 10.;
-            
-    if (smax==0) return false;
-    
-    Lsqfit<double> lsq(vels,1,spectrum,ww,nsubs,c,cerr,mp,3,&func_gauss,&derv_gauss);
-    int ret;
-    ret = lsq.fit();
-    if(ret<0) return false;
-    
-    double integint = sqrt(2)*sqrt(M_PI)*fabs(c[2])*c[0];
-    if (in->pars().getFluxConvert())
-        integint = sqrt(2)*sqrt(M_PI)*fabs(c[2])*FluxtoJyBeam(c[0], in->Head());
-    
-    bestfitpar[0] = integint;        // Integrated intensity
-    bestfitpar[1] = c[1];            // Central velocity
-    bestfitpar[2] = c[2];            // Velocity dispersion
-    
-    delete [] spectrum;
-    delete [] ww;
-    delete [] vels;
-    
-    return true;
+    sumSpectra(x0,nx,y,msk,sums);
+
+    double vmin = *std::min_element(velAxis.begin(),velAxis.end());
+    double vmax = *std::max_element(velAxis.begin(),velAxis.end());
+    double dchan = nsubs>1 ? fabs(velAxis[1]-velAxis[0]) : 1;
+
+    for (size_t i=0; i<nx; i++) {
+        double smax = spec[i];
+        int zmax = 0;
+        for (int z=1; z<nsubs; z++) if (spec[z*nx+i]>smax) {smax = spec[z*nx+i]; zmax = z;}
+        ok[i] = smax>0;
+
+        double s0 = sums[i], mean = s0!=0 ? sums[nx+i]/s0 : 0;
+        double c = vref+mean, var = s0!=0 ? sums[2*nx+i]/s0-mean*mean : 0;
+        if (!(c>=vmin && c<=vmax)) c = velAxis[zmax];
+        double s = var>dchan*dchan ? sqrt(var) : 10.;
+
+        par[i] = smax; par[nx+i] = c; par[2*nx+i] = s;
+    }
+
+    fitGaussians(velAxis.data(),spec,nsubs,nx,par,ok);
+
+    for (size_t i=0; i<nx; i++) {
+        double *m = moments+3*i;
+        if (!ok[i]) {
+            m[0] = m[1] = m[2] = log(-1);
+            continue;
+        }
+        m[0] = sqrt(2*M_PI)*par[2*nx+i]*par[i]*fluxFactor;      // Integrated intensity
+        m[1] = par[nx+i];                                       // Central velocity
+        m[2] = par[2*nx+i];                                     // Velocity dispersion
+    }
 }
 
 
@@ -561,22 +659,38 @@ std::vector< MomentMap<T> > getAllMoments(Cube<T> *c, bool usemask, bool *mask,
         allmaps[i].storedtype = i;
     }
 
+    // Blocks of pixels: rows, or the tiles of a cube read on demand (see
+    // CACHEMB), so that each tile is read once.
+    std::vector<std::array<long,4>> blocks;
+    if (c->isCached()) {
+        for (size_t n=0; n<c->Cache().NumTiles(); n++) {
+            long blc[3], trc[3];
+            c->Cache().tileBox(n,blc,trc);
+            if (blc[2]==0) blocks.push_back({blc[0],trc[0],blc[1],trc[1]});
+        }
+    }
+    else for (long y=0; y<c->DimY(); y++) blocks.push_back({0,c->DimX()-1,y,y});
+
     ProgressBar bar(true,c->pars().isVerbose(),c->pars().getShowbar());
 
     int nthreads = c->pars().getThreads();
 #pragma omp parallel num_threads(nthreads)
 {
-    bar.init(" Deriving kinematic maps... ",c->DimY());
-#pragma omp for
-    for (int y=0; y<c->DimY(); y++) {
-        bar.update(y+1);
-        for (int x=0; x<c->DimX(); x++) {
-            double moms[3];
-            if (mtype=="GAUSSIAN") allmaps[0].fitSpectrum(x,y,usemask,moms);
-            else allmaps[0].calculateMoments(x,y,usemask,moms);
-            allmaps[0].Array(x,y) = moms[0];
-            allmaps[1].Array(x,y) = moms[1];
-            allmaps[2].Array(x,y) = moms[2];
+    bar.init(" Deriving kinematic maps... ",blocks.size());
+#pragma omp for schedule(dynamic)
+    for (size_t b=0; b<blocks.size(); b++) {
+        bar.update(b+1);
+        long x0 = blocks[b][0], nx = blocks[b][1]-blocks[b][0]+1;
+        ScratchScope scratch;
+        double *moms = scratch.alloc<double>(3*nx);
+        for (long y=blocks[b][2]; y<=blocks[b][3]; y++) {
+            if (mtype=="GAUSSIAN") allmaps[0].fitRow(x0,nx,y,usemask,moms);
+            else allmaps[0].rowMoments(x0,nx,y,usemask,moms);
+            for (long i=0; i<nx; i++) {
+                allmaps[0].Array(x0+i,y) = moms[3*i];
+                allmaps[1].Array(x0+i,y) = moms[3*i+1];
+                allmaps[2].Array(x0+i,y) = moms[3*i+2];
+            }
         }
     }
 }
@@ -591,6 +705,253 @@ template std::vector< MomentMap<long> > getAllMoments(Cube<long>*,bool,bool*,std
 template std::vector< MomentMap<float> > getAllMoments(Cube<float>*,bool,bool*,std::string);
 template std::vector< MomentMap<double> > getAllMoments(Cube<double>*,bool,bool*,std::string);
 
+
+int decomposeSpectrum(const double *vels, const double *spec, int nchan, int maxcomp, bool hermite, bool bic,
+                      const double *seed, int nseed, bool seedGH, double *best, bool &bestGH) {
+
+    /// Decomposes a spectrum in up to maxcomp Gaussian components, and
+    /// optionally in a Gauss-Hermite profile. The model with the lowest
+    /// information criterion (BIC or AIC) is written in "best" and the number
+    /// of its components is returned (0 if no model is better than no
+    /// emission). bestGH tells whether the best model is a Gauss-Hermite.
+    ///
+    /// Models with n components are seeded from the model with n-1
+    /// components, plus a component at the peak of the residuals. If a seed
+    /// with nseed components is given (the solution of a neighbouring pixel),
+    /// it is used for the model with nseed components.
+
+    bestGH = false;
+    double smax = spec[0];
+    int zmax = 0;
+    for (int z=1; z<nchan; z++) if (spec[z]>smax) {smax = spec[z]; zmax = z;}
+    if (smax<=0 || nchan<4) return 0;
+
+    ScratchScope scratch;
+    int npmax = std::max(3*maxcomp,5);
+    double *p     = scratch.alloc<double>(npmax);
+    double *prev  = scratch.alloc<double>(npmax);
+    double *one   = scratch.alloc<double>(3);
+
+    double vmin = *std::min_element(vels,vels+nchan), vmax = *std::max_element(vels,vels+nchan);
+    double dchan = fabs(vels[1]-vels[0]);
+
+    auto infoCrit = [&](double rss, int k) {
+        return nchan*log(rss/nchan) + k*(bic ? log(double(nchan)) : 2.);
+    };
+    auto isValid = [&](const double *q, int n) {
+        for (int k=0; k<n; k++) {
+            double a = q[3*k], c = q[3*k+1], s = fabs(q[3*k+2]);
+            if (!(a>0 && c>=vmin && c<=vmax && s>=dchan/2 && s<=vmax-vmin)) return false;
+        }
+        return true;
+    };
+
+    double rss = 0;
+    for (int z=0; z<nchan; z++) rss += spec[z]*spec[z];
+    double bestIC = infoCrit(rss,0);
+    int bestN = 0;
+
+    bool havePrev = false;
+    for (int n=1; n<=maxcomp; n++) {
+        bool fitted = false;
+        if (seed!=nullptr && nseed==n && !seedGH) {
+            std::copy_n(seed,3*n,p);
+            fitted = fitProfile(vels,spec,nchan,n,false,p,rss)>0 && isValid(p,n);
+        }
+        if (!fitted) {
+            if (n==1) {
+                // Width from the channels above half the peak
+                int z0 = zmax, z1 = zmax;
+                while (z0>0 && spec[z0-1]>smax/2) z0--;
+                while (z1<nchan-1 && spec[z1+1]>smax/2) z1++;
+                p[0] = smax;
+                p[1] = vels[zmax];
+                p[2] = std::max(dchan,(z1-z0+1)*dchan/2.355);
+            }
+            else {
+                if (!havePrev) break;
+                std::copy_n(prev,3*(n-1),p);
+                double rmax = 0;
+                int zr = 0;
+                for (int z=0; z<nchan; z++) {
+                    double r = spec[z]-profileValue(vels[z],n-1,false,prev);
+                    if (r>rmax) {rmax = r; zr = z;}
+                }
+                if (rmax<=0) break;
+                p[3*n-3] = rmax;
+                p[3*n-2] = vels[zr];
+                p[3*n-1] = 2*dchan;
+            }
+            fitted = fitProfile(vels,spec,nchan,n,false,p,rss)>0 && isValid(p,n);
+        }
+        if (!fitted) break;
+
+        for (int k=0; k<n; k++) p[3*k+2] = fabs(p[3*k+2]);
+        std::copy_n(p,3*n,prev);
+        if (n==1) std::copy_n(p,3,one);
+        havePrev = true;
+
+        double ic = infoCrit(rss,3*n);
+        if (ic<bestIC) {
+            bestIC = ic;
+            bestN = n;
+            std::copy_n(p,3*n,best);
+        }
+    }
+
+    if (hermite && (bestN>0 || (seed!=nullptr && seedGH))) {
+        if (seed!=nullptr && seedGH) std::copy_n(seed,5,p);
+        else {
+            std::copy_n(one,3,p);
+            p[3] = p[4] = 0;
+        }
+        if (fitProfile(vels,spec,nchan,1,true,p,rss)>0) {
+            p[2] = fabs(p[2]);
+            bool valid = isValid(p,1) && fabs(p[3])<0.5 && fabs(p[4])<0.5;
+            double ic = infoCrit(rss,5);
+            if (valid && ic<bestIC) {
+                bestN = 1;
+                bestGH = true;
+                std::copy_n(p,5,best);
+            }
+        }
+    }
+
+    return bestN;
+}
+
+
+template <class T>
+std::vector< MomentMap<T> > getComponentMaps(Cube<T> *c, bool usemask, bool *mask) {
+
+    /// This function decomposes the spectra in Gaussian components, with
+    /// decomposeSpectrum(). The number of components is selected with an
+    /// information criterion (MAXCOMP, GAUSSHERMITE and INFOCRIT parameters).
+    /// Maps are returned in a vector of MomentMap:
+    ///  - [0]:                  number of components,
+    ///  - [1+3k, 2+3k, 3+3k]:   intensity, velocity and dispersion of
+    ///                          component k, sorted by decreasing intensity,
+    ///  - [1+3*MAXCOMP, +1]:    h3 and h4, if GAUSSHERMITE is true.
+    /// With a Gauss-Hermite profile, the dispersion is its sigma parameter.
+    ///
+    /// Pixels are fitted one anti-diagonal at a time (wavefront order), so
+    /// that each pixel is seeded from a neighbour already fitted while all
+    /// pixels of a diagonal are fitted in parallel.
+
+    MAPS_PAR &pm = c->pars().getParMA();
+    int maxcomp = std::max(pm.maxcomp,1);
+    bool hermite = pm.gausshermite, bic = pm.infocrit!="AIC";
+
+    // Creating mask if it does not exist
+    if(mask==nullptr && usemask) {
+        if (!c->MaskAll()) c->BlankMask();
+        mask = c->Mask();
+    }
+
+    int nmaps = 1+3*maxcomp+(hermite ? 2 : 0);
+    std::vector< MomentMap<T> > maps(nmaps);
+    for (int i=0; i<nmaps; i++) {
+        int type = i==0 ? 0 : i<=3*maxcomp ? (i-1)%3 : 2;
+        maps[i].input(c,mask);
+        maps[i].setHeadDef(maps[i].setHead(type));
+        if (i>0 && i<=3*maxcomp) maps[i].storedtype = type;
+    }
+    maps[0].Head().setBtype("ncomponents");
+    maps[0].Head().setBunit("NONE");
+    if (hermite) {
+        for (int i=0; i<2; i++) {
+            maps[nmaps-2+i].Head().setBtype(i==0 ? "h3" : "h4");
+            maps[nmaps-2+i].Head().setBunit("NONE");
+        }
+    }
+
+    long nx = c->DimX(), ny = c->DimY(), nz = c->DimZ();
+    std::vector<double> vels = maps[0].VelocityAxis();
+    double fluxFactor = 1;
+    if (c->HeadDef() && c->pars().getFluxConvert()) fluxFactor = FluxtoJyBeam(1.,c->Head());
+
+    int npmax = std::max(3*maxcomp,5);
+    std::vector<double> sol(nx*ny*npmax);
+    std::vector<int> ncomp(nx*ny,0);
+    std::vector<char> isGH(nx*ny,0);
+
+    ProgressBar bar(true,c->pars().isVerbose(),c->pars().getShowbar());
+    bar.init(" Decomposing spectra in components... ",nx+ny-1);
+
+    int nthreads = c->pars().getThreads();
+    for (long d=0; d<nx+ny-1; d++) {
+        bar.update(d+1);
+        long xlo = std::max(0L,d-ny+1), xhi = std::min(d,nx-1);
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+        for (long x=xlo; x<=xhi; x++) {
+            long y = d-x, npix = x+y*nx;
+            ScratchScope scratch;
+            double *spec = scratch.alloc<double>(nz);
+            for (long z=0; z<nz; z++) {
+                long n = c->nPix(x,y,z);
+                spec[z] = c->Value(n);
+                if (usemask) spec[z] *= mask[n];
+            }
+
+            // Seed from the neighbour on the left or below
+            const double *seed = nullptr;
+            int nseed = 0;
+            bool seedGH = false;
+            long nbs[2] = {x>0 ? npix-1 : -1, y>0 ? npix-nx : -1};
+            for (long nb : nbs) {
+                if (nb>=0 && ncomp[nb]>0) {
+                    seed = &sol[nb*npmax];
+                    nseed = ncomp[nb];
+                    seedGH = isGH[nb];
+                    break;
+                }
+            }
+
+            bool gh = false;
+            ncomp[npix] = decomposeSpectrum(vels.data(),spec,nz,maxcomp,hermite,bic,seed,nseed,seedGH,&sol[npix*npmax],gh);
+            isGH[npix] = gh;
+        }
+    }
+
+    // Storing the components in the maps
+    for (long y=0; y<ny; y++) {
+        for (long x=0; x<nx; x++) {
+            long npix = x+y*nx;
+            const double *q = &sol[npix*npmax];
+            int n = ncomp[npix];
+            maps[0].Array(x,y) = n;
+            for (int i=1; i<nmaps; i++) maps[i].Array(x,y) = log(-1);
+
+            if (isGH[npix]) {
+                maps[1].Array(x,y) = sqrt(2*M_PI)*q[0]*q[2]*(1+sqrt(6.)/4.*q[4])*fluxFactor;
+                maps[2].Array(x,y) = q[1];
+                maps[3].Array(x,y) = q[2];
+                maps[nmaps-2].Array(x,y) = q[3];
+                maps[nmaps-1].Array(x,y) = q[4];
+                continue;
+            }
+
+            std::vector<std::pair<double,int>> flux(n);
+            for (int k=0; k<n; k++) flux[k] = {sqrt(2*M_PI)*q[3*k]*q[3*k+2]*fluxFactor,k};
+            std::sort(flux.begin(),flux.end(),[](const std::pair<double,int> &a, const std::pair<double,int> &b) {return a.first>b.first;});
+            for (int k=0; k<n; k++) {
+                maps[1+3*k].Array(x,y) = flux[k].first;
+                maps[2+3*k].Array(x,y) = q[3*flux[k].second+1];
+                maps[3+3*k].Array(x,y) = q[3*flux[k].second+2];
+            }
+        }
+    }
+
+    bar.fillSpace("Done.\n");
+
+    return maps;
+}
+template std::vector< MomentMap<short> > getComponentMaps(Cube<short>*,bool,bool*);
+template std::vector< MomentMap<int> > getComponentMaps(Cube<int>*,bool,bool*);
+template std::vector< MomentMap<long> > getComponentMaps(Cube<long>*,bool,bool*);
+template std::vector< MomentMap<float> > getComponentMaps(Cube<float>*,bool,bool*);
+template std::vector< MomentMap<double> > getComponentMaps(Cube<double>*,bool,bool*);
+
 ////////////////////////////////////////////////////////////////////////////////////////
 // Functions for PvSlice class
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -635,6 +996,17 @@ bool PvSlice<T>::slice() {
     // Front-end function to slice the cube and extract the position-velocity.
     // Slice is made through the data provided in the constructor.
     
+    if (!prepare()) return false;
+    std::vector<PvSlice<T>*> s = {this};
+    return extract(s);
+}
+
+
+template <class T>
+bool PvSlice<T>::prepare() {
+    
+    // Defines the slice (locus, taps and header) without extracting it.
+    
     nalias = in->pars().getANTIALIAS();
     if (std::floor(nalias)!=nalias && nalias!=0.5) nalias=0.5;
         
@@ -675,8 +1047,7 @@ bool PvSlice<T>::slice() {
         int dimen[2] = {num_points,zpix};
         this->setImage(dimen);
         
-        // Extract slice from cube 
-        if (!pvslice()) return false;
+        if (!define_taps()) return false;
         define_header();
     }
     
@@ -690,6 +1061,18 @@ bool PvSlice<T>::slice_old() {
     // This is my first function to extract PV. It is less polished than the newer function
     // I am still using this in 3DFIT, but I HAVE TO CHECK!
     
+    if (!prepare_old()) return false;
+    std::vector<PvSlice<T>*> s = {this};
+    return extract(s);
+}
+
+
+template <class T>
+bool PvSlice<T>::prepare_old() {
+    
+    // Defines the slice of slice_old() without extracting it. Each pixel
+    // of the slice is the nearest pixel of the cube.
+    
     float phi = angle;
     while(phi>=180) phi -= 180;
     while(phi<0) phi += 180;
@@ -707,16 +1090,16 @@ bool PvSlice<T>::slice_old() {
     Header &h = in->Head();
     float cdelt0;
     
+    std::vector<int> xx, yy; 
     if (phi==90) {
         dim[0] = xpix;
-        this->setImage(dim);
-        for (int x=0; x<dim[0]; x++)
-            for (int z=0; z<dim[1]; z++)
-                this->array[x+z*dim[0]] = in->Array(x,y0,z);
+        for (int x=0; x<dim[0]; x++) {
+            xx.push_back(x);
+            yy.push_back(size_t(y0));
+        }
         cdelt0 = fabs(h.Cdelt(0));
     }
     else {
-        std::vector<int> xx, yy; 
         double mx=0, my=0;
     
         if (phi<90) my = tan(P+M_PI_2);
@@ -769,18 +1152,22 @@ bool PvSlice<T>::slice_old() {
             dim[0]=nxdim;
         }
 
-        this->setImage(dim);
-        for (int i=0; i<dim[0]; i++) { 
-            for (int z=0; z<zpix; z++) {
-                this->array[i+z*dim[0]] = in->Array(xx[i],yy[i],z);
-            } 
-        }
-
         float xdom = xdim*h.Cdelt(0);
         float ydom = ydim*h.Cdelt(1);
         cdelt0 = sqrt(xdom*xdom+ydom*ydom)/dim[0];
     }
 
+    this->setImage(dim);
+    num_points = dim[0];
+    tapStart.resize(num_points+1);
+    tapPix.resize(num_points);
+    tapWeight.assign(num_points,1);
+    for (int i=0; i<num_points; i++) {
+        tapStart[i] = i;
+        tapPix[i] = xx[i]+yy[i]*size_t(xpix);
+    }
+    tapStart[num_points] = num_points;
+
     this->copyHeader(h);
     
     float crpix0 = xdim>ydim ? x0-xmin : y0-ymin;
@@ -982,17 +1369,18 @@ bool PvSlice<T>::check_bounds (double *blx, double *bly, double *Trx, double *Tr
 
 
 template <class T>
-bool PvSlice<T>::pvslice () {
+bool PvSlice<T>::define_taps () {
 
-    // Extract pixels from a cube, along an input locus and write the PV in 
-    // the main array. Result is antialiased.
+    // Defines the pixels of the cube and the weights to extract the slice
+    // along the locus. Result is antialiased.
     // 
     // The cube is assumed to have axes in x,y,v order.
     // The output array has the same spatial scale as input cube, ie
     // the scale is assumed to be the same for both spatial axes,
     // and velocity pixels are given the same width as the channel spacing.
     // Output is a weighted sum over all pixels nearby the point where the
-    // slice locus passes, to reduce aliasing effects.
+    // slice locus passes, to reduce aliasing effects, averaged over the 
+    // width of the slice.
 
     if (num_points<2) return false;
     
@@ -1000,17 +1388,21 @@ bool PvSlice<T>::pvslice () {
     double dmax = (nalias+1)*sqrt(2);           // Maximum distance of a pixel from centre
     
     int w = width;                              // Width of slice in pixels
-    
-    float3D wt(2*w+1,MAXNB,size_t(num_points)); // Weights for anti-aliasing
-    int3D nx(2*w+1,MAXNB,size_t(num_points));   // X coordinates of pixels for anti-aliasing 
-    int3D ny(2*w+1,MAXNB,size_t(num_points));   // Y coordinates of pixels for anti-aliasing
 
     double theta = atan2(y_locus[num_points-1]-y_locus[0],
                          x_locus[num_points-1]-x_locus[0]);
     
+    tapStart.assign(num_points+1,0);
+    tapPix.clear();
+    tapWeight.clear();
+    std::vector<size_t> pix(MAXNB);
+    std::vector<double> wt(MAXNB);
+    
     // Find the neighbour pixels & antialiasing weights.
     // This is done for one channel only, then list applied to all channels
     for (int i=0; i<num_points; i++) {
+        tapStart[i] = tapPix.size();
+        int n = 0;                              // Number of valid positions in the width window
         for (int k=-w; k<=w; k++) {
         
             double xc = x_locus[i]+k*sin(theta);
@@ -1018,48 +1410,95 @@ bool PvSlice<T>::pvslice () {
             int xp = lround(xc);
             int yp = lround(yc);
 
+            // Weighted average over antialiasing neighbours
+            int nb = 0;
+            double sw = 0;
             for (float ys=-nalias; ys<=nalias; ys++) {
                 for (float xs=-nalias; xs<=nalias; xs++) {
-                    size_t n = (xs+nalias)+(1+2*nalias)*(ys+nalias);
-                    // Determining (x,y) positions of anti-aliasing pixels
-                    nx(k+w,n,i) = int(xp+xs);
-                    ny(k+w,n,i) = int(yp+ys);
-                    // Determining the weights for anti-aliasing pixels
-                    wt(k+w,n,i) = 0.0;
-                    if ((nx(k+w,n,i)>=0) && (nx(k+w,n,i)<xpix) && 
-                        (ny(k+w,n,i)>=0) && (ny(k+w,n,i)<ypix)) {
-                        double d = sqrt((nx(k+w,n,i)-xc)*(nx(k+w,n,i)-xc)+(ny(k+w,n,i)-yc)*(ny(k+w,n,i)-yc));
-                        wt(k+w,n,i) = 1.-d/dmax;
-                    }
+                    int nx = int(xp+xs), ny = int(yp+ys);
+                    if (nx<0 || nx>=xpix || ny<0 || ny>=ypix) continue;
+                    double d = sqrt((nx-xc)*(nx-xc)+(ny-yc)*(ny-yc));
+                    if (1.-d/dmax<=0) continue;
+                    pix[nb] = nx+ny*size_t(xpix);
+                    wt[nb]  = 1.-d/dmax;
+                    sw += wt[nb++];
                 }
             }
+            if (sw<=0) continue;
+            for (int j=0; j<nb; j++) {
+                tapPix.push_back(pix[j]);
+                tapWeight.push_back(wt[j]/sw);
+            }
+            n++;
         }
+        // Average over the width window
+        for (size_t t=tapStart[i]; t<tapPix.size(); t++) tapWeight[t] /= n;
     }
+    tapStart[num_points] = tapPix.size();
     
+    return true;
+}
+
+
+template <class T>
+bool PvSlice<T>::extract (std::vector<PvSlice<T>*> &slices) {
+
+    // Extracts several slices of the same cube, defined with prepare() or
+    // prepare_old(), in one pass over the cube. Channels are shared among
+    // the threads and each channel is read once for all slices. A cube 
+    // read on demand (see CACHEMB) is instead read one spectrum at a time, 
+    // so that only the tiles along the slices are needed.
+
+    if (slices.size()==0) return true;
+    Cube<T> *in = slices[0]->in;
+    for (auto &s : slices) {
+        if (s->in!=in) {
+            std::cerr << "PvSlice ERROR: slices extracted together must belong to the same cube.\n";
+            return false;
+        }
+    }
+
+    size_t xysize = in->DimX()*in->DimY();
+    int zsize = in->DimZ();
+    int nthreads = in->pars().getThreads();
     
-    for (int z=0; z<zpix; z++) {            // Loop over channels
-        for (int i=0; i<num_points; i++) {  // Loop over slice
-            double val=0, n=0;
-            for (int k=-w; k<=w; k++) {     // Loop over width window
-                double f=0, sw=0;
-                // Weighted average over antialiasing neighbours
-                for (int j=0; j<MAXNB; j++) {
-                    if (wt(k+w,j,i)>0.) {
-                        sw += wt(k+w,j,i);
-                        f  += in->Array(nx(k+w,j,i),ny(k+w,j,i),z)*wt(k+w,j,i);
-                    }
-                } 
-                if (sw>0.0) {val += f/sw; n++;}
+    if (in->isLazy()) {
+        for (auto &s : slices) {
+            if (s->num_points<=0 || !s->arrayAllocated) continue;
+            int np = s->num_points;
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+            for (int i=0; i<np; i++) {
+                for (int z=0; z<zsize; z++) {
+                    double val = 0;
+                    for (size_t t=s->tapStart[i]; t<s->tapStart[i+1]; t++)
+                        val += in->Value(s->tapPix[t]+z*xysize)*s->tapWeight[t];
+                    s->array[i+z*np] = val;
+                }
+            }
+        }
+        return true;
+    }
+    
+    const T *data = in->Array();
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (int z=0; z<zsize; z++) {
+        const T *plane = data+z*xysize;
+        for (auto &s : slices) {
+            if (s->num_points<=0 || !s->arrayAllocated) continue;
+            int np = s->num_points;
+            const size_t *start = s->tapStart.data(), *pix = s->tapPix.data();
+            const float *wt = s->tapWeight.data();
+            T *out = s->array+size_t(z)*np;
+            for (int i=0; i<np; i++) {
+                double val = 0;
+                for (size_t t=start[i]; t<start[i+1]; t++) val += plane[pix[t]]*wt[t];
+                out[i] = val;
             }
-            
-            if (n>0) {this->array[i+z*num_points] = val / n;}
-            else this->array[i+z*num_points] = 0;
         }
     }
     
     return true;
 } 
-//*/
 
 /* Original slice function (no width and fixed antialiasing)
 template <class T>
@@ -1252,6 +1691,28 @@ template PvSlice<float>* PositionVelocity (Cube<float>*,float,float,float,bool);
 template PvSlice<double>* PositionVelocity (Cube<double>*,float,float,float,bool);
 
 
+template <class T>
+std::vector<PvSlice<T>*> PositionVelocity (Cube<T> *c, float x0, float y0, std::vector<float> Phi, bool oldmethod) {
+    
+    // Slices that cannot be defined are returned but not extracted, as in
+    // the single-slice version.
+    std::vector<PvSlice<T>*> pvs, batch;
+    for (auto phi : Phi) {
+        pvs.push_back(new PvSlice<T>(c,x0,y0,phi));
+        bool ok = oldmethod ? pvs.back()->prepare_old() : pvs.back()->prepare();
+        if (ok) batch.push_back(pvs.back());
+    }
+    PvSlice<T>::extract(batch);
+    return pvs;
+    
+}
+template std::vector<PvSlice<short>*> PositionVelocity (Cube<short>*,float,float,std::vector<float>,bool);
+template std::vector<PvSlice<int>*> PositionVelocity (Cube<int>*,float,float,std::vector<float>,bool);
+template std::vector<PvSlice<long>*> PositionVelocity (Cube<long>*,float,float,std::vector<float>,bool);
+template std::vector<PvSlice<float>*> PositionVelocity (Cube<float>*,float,float,std::vector<float>,bool);
+template std::vector<PvSlice<double>*> PositionVelocity (Cube<double>*,float,float,std::vector<float>,bool);
+
+
 
 // Explicit instantiation of the classes
 template class MomentMap<short>;
@@ -54,8 +54,12 @@ public:
     
     bool fitSpectrum (size_t x, size_t y, bool msk, double *bestfitpar);
     bool calculateMoments (size_t x, size_t y, bool msk, double *moments);
+    void rowMoments (size_t x0, size_t nx, size_t y, bool msk, double *moments);
+    void fitRow (size_t x0, size_t nx, size_t y, bool msk, double *moments);
     void storeMap(bool msk, int whichmap, std::string map_type);
 
+    std::vector<double>& VelocityAxis() {return velAxis;}
+
     int storedtype = -1;
 
 private:
@@ -63,9 +67,18 @@ private:
     int blo[3],bhi[3];
     int nsubs;
     bool *mask = nullptr;
+    std::vector<double> velAxis;    //< Velocity of each channel in km/s.
+    std::vector<double> relAxis;    //< Velocity of each channel relative to vref.
+    double vref = 0;                //< Reference velocity for the sums of the moments.
+    double fluxFactor = 1;          //< From flux to the units of the maps.
+    double mom0Factor = 1;          //< From sum of fluxes to units of the 0th moment.
+    
+    void defineAxis();
+    void sumSpectra (size_t x0, size_t nx, size_t y, bool msk, double *sums);
+    void finishMoments (double s0, double s1, double s2, double *moments);
     
-    typedef bool (MomentMap<T>::*funcPtr) (size_t, size_t, bool, double*);
-    funcPtr map_Type = &MomentMap<T>::calculateMoments;
+    typedef void (MomentMap<T>::*funcPtr) (size_t, size_t, size_t, bool, double*);
+    funcPtr map_Type = &MomentMap<T>::rowMoments;
     
 };
 
@@ -74,6 +87,10 @@ private:
 template <class T>
 std::vector< MomentMap<T> > getAllMoments(Cube<T> *c, bool usemask=true, bool *mask=nullptr, std::string mtype="MOMENT");
 
+// A function to decompose the spectra in Gaussian components (MAPTYPE=MULTIGAUSS)
+template <class T>
+std::vector< MomentMap<T> > getComponentMaps(Cube<T> *c, bool usemask=true, bool *mask=nullptr);
+
 
 /////////////////////////////////////////////////////////////////////////////////////
 /// A class to extract position-velocity slices
@@ -87,7 +104,14 @@ class PvSlice : public Image2D<T>
 ///
 /// In the first case, the slice can include just a part of the datacube,
 /// while in the second the entire cube is sliced.
-/// Usage: call one of the constructors and the slice().
+/// Usage: call one of the constructors and the slice(). Several slices of
+/// the same cube can be extracted in one pass over the cube by calling
+/// prepare() (or prepare_old()) for each of them and then extract().
+///
+/// Each pixel of the slice is a weighted sum of the pixels of the cube
+/// around the locus (anti-aliasing and width of the slice). The pixels and
+/// the weights ("taps") are computed once by prepare() and then applied
+/// to all channels.
 {
 public:
     PvSlice(Cube<T> *c);
@@ -98,6 +122,9 @@ public:
     ~PvSlice(){if (locusAllocated) {delete [] x_locus; delete [] y_locus;}}
     bool slice ();
     bool slice_old ();
+    bool prepare ();
+    bool prepare_old ();
+    static bool extract (std::vector<PvSlice<T>*> &slices);
     
 private:
     Cube<T> *in;                    //< A pointer to the input datacube
@@ -110,12 +137,15 @@ private:
     int   num_points;               //< Number of pixels along the slice
     int   width = 0;                //< Half width of the slice in pixels
     float nalias = 0.5;             //< Type of anti-aliasing.
+    std::vector<size_t> tapStart;   //< Taps of pixel i of the slice are tapStart[i] to tapStart[i+1]-1.
+    std::vector<size_t> tapPix;     //< Pixel (x+y*xpix) of the cube of each tap.
+    std::vector<float>  tapWeight;  //< Weight of each tap.
     
     double weight (double x, double y, double cx, double cy) {return fabs((1-(x-cx))*(1-(y-cy)));}
      
     bool  define_slice();
     bool  check_bounds (double *blx, double *bly, double *Trx, double *Try);
-    bool  pvslice ();
+    bool  define_taps ();
     void  define_header();
 };
 
@@ -123,4 +153,8 @@ private:
 template <class T>
 PvSlice<T>* PositionVelocity (Cube<T> *c, float x0, float y0, float Phi, bool oldmethod=true);
 
+// As above, for several angles at once. Slices are extracted in one pass over the cube.
+template <class T>
+std::vector<PvSlice<T>*> PositionVelocity (Cube<T> *c, float x0, float y0, std::vector<float> Phi, bool oldmethod=true);
+
 #endif
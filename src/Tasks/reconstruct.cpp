@@ -0,0 +1,348 @@
+//---------------------------------------------------------------
+// reconstruct.cpp: Member functions of the WaveletRecon class.
+//---------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <Tasks/reconstruct.hh>
+#include <Arrays/param.hh>
+#include <Arrays/stats.hh>
+#include <Utilities/utils.hh>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+namespace {
+const size_t maxSample = 1<<20;             // Values for the noise of each scale
+}
+
+
+template <class T>
+void WaveletRecon<T>::reconstruct(T *input, size_t xsize, size_t ysize, size_t zsize, SEARCH_PAR &p,
+                                  int Nthreads, bool verbose) {
+
+    /// Reconstructs the input array. For each iteration, the residuals
+    /// (input - reconstruction) are decomposed in wavelet scales, keeping
+    /// the running smoothed array in one working array and the detail
+    /// coefficients in the other. Significant coefficients of scales
+    /// [scaleMin,scaleMax] and the final smoothed array are added to the
+    /// reconstruction. Blank pixels are left blank.
+    ///
+    /// The working arrays hold one slab of the cube at a time (see
+    /// decomposeSlab). With more than one slab, each iteration takes two
+    /// sweeps over the slabs: the first gathers the sample for the noise
+    /// of each scale, the second applies the thresholds.
+    ///
+    /// \param input    The array to be reconstructed.
+    /// \param xsize    The x-dimension of the array.
+    /// \param ysize    The y-dimension of the array.
+    /// \param zsize    The z-dimension of the array.
+    /// \param p        The SEARCH parameters (reconDim, scaleMin, scaleMax, snrRecon).
+
+    const int    maxIter     = 10;          // Maximum number of iterations
+    const double convergence = 0.005;       // Relative change of residual noise to stop
+    const size_t slabPixels  = 1<<25;       // Pixels of a slab, halos included
+
+    dim[0] = xsize; dim[1] = ysize; dim[2] = zsize;
+    nthreads = std::max(Nthreads,1);
+    size_t size = xsize*ysize*zsize;
+
+    int reconDim = p.reconDim;
+    if (zsize==1 && reconDim!=2) reconDim = 2;
+    useAxis[0] = useAxis[1] = reconDim>=2;
+    useAxis[2] = reconDim!=2;
+
+    // Number of scales: the filter at the largest scale must fit the shortest axis.
+    long minDim = 0;
+    for (int i=0; i<3; i++)
+        if (useAxis[i] && dim[i]>1) minDim = minDim==0 ? dim[i] : std::min<long>(minDim,dim[i]);
+    numScales = 1;
+    while ((4L<<numScales)+1<=minDim) numScales++;
+    int scaleMin = std::max(p.scaleMin,1);
+    int scaleMax = p.scaleMax>0 ? std::min(p.scaleMax,numScales) : numScales;
+
+    // Slabs are taken along z, or along y if the filter is only spectral.
+    // Along a filtered axis, they have halos as wide as the reach of the
+    // filters of all scales, 2^(numScales+1)-2 pixels, so that their inner
+    // part is exact. The inner part is at least as thick as the halo.
+    slabAxis = useAxis[0] || !useAxis[2] ? 2 : 1;
+    halo = useAxis[slabAxis] && dim[slabAxis]>1 ? (2L<<numScales)-2 : 0;
+    size_t plane = size/dim[slabAxis];
+    size_t thick = slabPixels/plane>2*halo ? slabPixels/plane-2*halo : 1;
+    thick = std::min(std::max<size_t>(thick,std::max<size_t>(halo,1)),dim[slabAxis]);
+    size_t nslabs = (dim[slabAxis]+thick-1)/thick;
+
+    if (verbose) {
+        std::cout << "  Reconstructing the array with " << numScales << " wavelet scales ("
+                  << reconDim << "D";
+        if (nslabs>1) std::cout << ", " << nslabs << " slabs";
+        std::cout << ")... " << std::flush;
+    }
+
+    if (arrayAllocated) delete [] array;
+    array = new T[size];
+    arrayAllocated = true;
+
+    std::vector<float> recon(size,0.);
+    stride = std::max<size_t>(1,size/maxSample);
+    scaleThresh.assign(numScales+1,0);
+    scaleMedian.assign(numScales+1,0);
+
+    auto slabRange = [&](size_t k, size_t &in0, size_t &in1, size_t &lo, size_t &hi) {
+        in0 = k*thick; in1 = std::min(in0+thick,size_t(dim[slabAxis]));
+        lo = in0>size_t(halo) ? in0-halo : 0; hi = std::min(in1+halo,size_t(dim[slabAxis]));
+    };
+
+    float sigma, oldSigma = -1;
+    for (numIter=1; numIter<=maxIter; numIter++) {
+
+        if (nslabs==1) decomposeSlab(input,recon,0,dim[slabAxis],0,dim[slabAxis],scaleMin,scaleMax,p.snrRecon,ONEPASS);
+        else {
+            // Noise of each scale, from the sample of all slabs
+            std::vector<std::vector<float>>(numScales+1).swap(samples);
+            for (size_t k=0; k<nslabs; k++) {
+                size_t in0, in1, lo, hi;
+                slabRange(k,in0,in1,lo,hi);
+                decomposeSlab(input,recon,lo,hi,in0,in1,scaleMin,scaleMax,p.snrRecon,SAMPLE);
+            }
+            for (int scale=scaleMin; scale<=scaleMax; scale++)
+                scaleThresh[scale] = p.snrRecon*sampleSigma(samples[scale],scaleMedian[scale]);
+            std::vector<std::vector<float>>().swap(samples);
+
+            // Thresholding. The increments of a slab are added to the
+            // reconstruction once the next slab has read its halo.
+            for (size_t k=0; k<nslabs; k++) {
+                size_t in0, in1, lo, hi;
+                slabRange(k,in0,in1,lo,hi);
+                decomposeSlab(input,recon,lo,hi,in0,in1,scaleMin,scaleMax,p.snrRecon,APPLY);
+            }
+            flushPending(recon);
+        }
+
+        // Noise of the residuals
+        std::vector<float> res;
+        res.reserve(size/stride+1);
+        for (size_t i=0; i<size; i+=stride) res.push_back(isNaN(input[i]) ? 0 : input[i]-recon[i]);
+        float resMedian;
+        sigma = sampleSigma(res,resMedian);
+        if (oldSigma>0 && fabs(oldSigma-sigma)<=convergence*sigma) break;
+        oldSigma = sigma;
+    }
+    numIter = std::min(numIter,maxIter);
+
+#pragma omp parallel for num_threads(nthreads)
+    for (size_t i=0; i<size; i++)
+        array[i] = isNaN(input[i]) ? input[i] : T(recon[i]);
+
+    std::vector<float>().swap(work[0]);
+    std::vector<float>().swap(work[1]);
+    std::vector<float>().swap(pending);
+
+    if (verbose) std::cout << "Done (" << numIter << " iterations).\n";
+}
+
+
+template <class T>
+void WaveletRecon<T>::decomposeSlab(T *input, std::vector<float> &recon, size_t lo, size_t hi, size_t in0,
+                                    size_t in1, int scaleMin, int scaleMax, float snr, SlabMode mode) {
+
+    /// Decomposes the residuals of the slab [lo,hi) along slabAxis, whose
+    /// inner part is [in0,in1). In the SAMPLE mode, the coefficients of the
+    /// inner part at the pixels of the regular subsample are kept for each
+    /// scale. In the APPLY mode, the thresholds are applied and the
+    /// increments of the inner part are kept, to be added to "recon" by
+    /// flushPending(). In the ONEPASS mode (whole cube in one slab), the
+    /// noise of each scale is taken and applied at once, straight to "recon".
+
+    size_t dx = dim[0], len = hi-lo;
+    size_t ld[3] = {dim[0],dim[1],dim[2]};
+    ld[slabAxis] = len;
+    size_t n = ld[0]*ld[1]*ld[2], nrows = ld[1]*ld[2];
+
+    // First pixel in the cube of row r (along x) of the slab, and whether it is inner
+    auto rowStart = [&](size_t r) {
+        return slabAxis==2 ? (r+lo*dim[1])*dx : ((r%len)+lo+(r/len)*dim[1])*dx;
+    };
+    auto isInner = [&](size_t r) {
+        size_t a = slabAxis==2 ? r/dim[1]+lo : r%len+lo;
+        return a>=in0 && a<in1;
+    };
+
+    work[0].resize(n);
+    work[1].resize(n);
+    float *c = work[0].data(), *s = work[1].data();
+
+#pragma omp parallel for num_threads(nthreads)
+    for (size_t r=0; r<nrows; r++) {
+        size_t g = rowStart(r);
+        for (size_t x=0; x<dx; x++)
+            c[r*dx+x] = isNaN(input[g+x]) ? 0 : input[g+x]-recon[g+x];
+    }
+
+    // The residuals of this slab are read: the increments of the previous one can be added
+    if (mode==APPLY) {
+        flushPending(recon);
+        pending.assign(n,0);
+        pendingRange[0] = lo; pendingRange[1] = hi;
+        pendingRange[2] = in0; pendingRange[3] = in1;
+    }
+    float *inc = mode==APPLY ? pending.data() : nullptr;
+
+    for (int scale=1; scale<=numScales; scale++) {
+        // Smoothing at this scale, with holes of 2^(scale-1) pixels in the filter.
+        std::copy(c, c+n, s);
+        for (int axis=0; axis<3; axis++)
+            if (useAxis[axis] && ld[axis]>1) filterAxis(s,ld,axis,1L<<(scale-1));
+
+#pragma omp parallel for num_threads(nthreads)
+        for (size_t i=0; i<n; i++) c[i] -= s[i];
+
+        if (scale>=scaleMin && scale<=scaleMax) {
+            if (mode!=APPLY) {
+                // Coefficients at the pixels of the subsample
+                std::vector<float> &smp = mode==SAMPLE ? samples[scale] : oneSample;
+                if (mode==ONEPASS) smp.clear();
+                for (size_t r=0; r<nrows; r++) {
+                    if (!isInner(r)) continue;
+                    size_t g = rowStart(r);
+                    for (size_t x=(stride-g%stride)%stride; x<dx; x+=stride) smp.push_back(c[r*dx+x]);
+                }
+                if (mode==ONEPASS) scaleThresh[scale] = snr*sampleSigma(smp,scaleMedian[scale]);
+            }
+            if (mode!=SAMPLE) {
+                float th = scaleThresh[scale], med = scaleMedian[scale];
+#pragma omp parallel for num_threads(nthreads)
+                for (size_t r=0; r<nrows; r++) {
+                    if (!isInner(r)) continue;
+                    size_t g = rowStart(r);
+                    for (size_t x=0; x<dx; x++) {
+                        float v = c[r*dx+x];
+                        if (fabs(v-med)>th) {
+                            if (mode==APPLY) inc[r*dx+x] += v;
+                            else recon[g+x] += v;
+                        }
+                    }
+                }
+            }
+        }
+        std::swap(c,s);
+    }
+
+    // Adding the final smoothed array
+    if (mode!=SAMPLE) {
+#pragma omp parallel for num_threads(nthreads)
+        for (size_t r=0; r<nrows; r++) {
+            if (!isInner(r)) continue;
+            size_t g = rowStart(r);
+            for (size_t x=0; x<dx; x++) {
+                if (mode==APPLY) inc[r*dx+x] += c[r*dx+x];
+                else recon[g+x] += c[r*dx+x];
+            }
+        }
+    }
+}
+
+
+template <class T>
+void WaveletRecon<T>::flushPending(std::vector<float> &recon) {
+
+    /// Adds the increments kept by decomposeSlab() to the reconstruction.
+
+    if (pending.size()==0) return;
+    size_t dx = dim[0], lo = pendingRange[0], len = pendingRange[1]-lo;
+    size_t nrows = pending.size()/dx;
+
+#pragma omp parallel for num_threads(nthreads)
+    for (size_t r=0; r<nrows; r++) {
+        size_t a = slabAxis==2 ? r/dim[1]+lo : r%len+lo;
+        if (a<pendingRange[2] || a>=pendingRange[3]) continue;
+        size_t g = slabAxis==2 ? (r+lo*dim[1])*dx : ((r%len)+lo+(r/len)*dim[1])*dx;
+        for (size_t x=0; x<dx; x++) recon[g+x] += pending[r*dx+x];
+    }
+    std::vector<float>().swap(pending);
+}
+
+
+template <class T>
+void WaveletRecon<T>::filterAxis(float *data, const size_t *d, int axis, long step) {
+
+    /// Applies in place the B3-spline filter (1,4,6,4,1)/16 along one axis
+    /// of an array of dimensions "d", with taps separated by "step" pixels.
+    /// Edges are reflected.
+
+    const float filter[5] = {1./16., 1./4., 3./8., 1./4., 1./16.};
+
+    long n = d[axis];
+    size_t stride = axis==0 ? 1 : (axis==1 ? d[0] : d[0]*d[1]);
+    size_t nlines = (d[0]*d[1]*d[2])/n;
+
+#pragma omp parallel num_threads(nthreads)
+{
+    std::vector<float> line(n);
+#pragma omp for
+    for (size_t l=0; l<nlines; l++) {
+        // First pixel of line l: lines along y and z are interleaved with other axes
+        size_t start;
+        if (axis==0) start = l*n;
+        else if (axis==1) start = (l/d[0])*d[0]*d[1] + l%d[0];
+        else start = l;
+
+        for (long i=0; i<n; i++) line[i] = data[start+i*stride];
+        for (long i=0; i<n; i++) {
+            float sum = 0;
+            for (int k=-2; k<=2; k++) {
+                long j = i+k*step;
+                while (j<0 || j>=n) j = j<0 ? -j : 2*(n-1)-j;
+                sum += filter[k+2]*line[j];
+            }
+            data[start+i*stride] = sum;
+        }
+    }
+}
+}
+
+
+template <class T>
+float WaveletRecon<T>::sampleSigma(std::vector<float> &sample, float &median) {
+
+    /// Returns the noise from the MADFM of a sample of values, which are
+    /// reordered, and the median in "median". Samples are regular, of at
+    /// most maxSample pixels of the cube.
+
+    if (sample.size()==0) {median = 0; return 0;}
+    median = findMedian<float>(sample.data(),sample.size(),true);
+    float madfm = findMADFM<float>(sample.data(),sample.size(),median,true);
+    return Statistics::madfmToSigma(madfm);
+}
+
+
+// Explicit instantiation of the class
+template class WaveletRecon<short>;
+template class WaveletRecon<int>;
+template class WaveletRecon<long>;
+template class WaveletRecon<float>;
+template class WaveletRecon<double>;
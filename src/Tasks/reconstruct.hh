@@ -0,0 +1,94 @@
+// -----------------------------------------------------------------------
+// reconstruct.hh: Definition of the WaveletRecon class
+// -----------------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#ifndef RECONSTRUCT_HH_
+#define RECONSTRUCT_HH_
+
+#include <iostream>
+#include <vector>
+#include <Arrays/param.hh>
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// A class for the multi-resolution reconstruction of an array
+/////////////////////////////////////////////////////////////////////////////////////
+template <class T>
+class WaveletRecon
+{
+/// WaveletRecon denoises an array with the "à trous" wavelet transform
+/// (Starck & Murtagh 1994), using a B3-spline filter along the spectral
+/// axis, the spatial axes or both (reconDim = 1, 2, 3). At each scale,
+/// only the wavelet coefficients above snrRecon times the noise of the
+/// scale are kept. The procedure is iterated on the residuals until the
+/// noise of the residuals converges. The reconstructed array can be given
+/// to the source finder to detect both compact and diffuse emission.
+///
+/// The filter is separable and is applied in place, line by line and in
+/// parallel. The reconstruction is kept in a float array of the size of
+/// the input, on top of the output. The coefficients and the smoothed
+/// array are only computed for a slab of the cube at a time, with halos
+/// along the filtered slab axis as wide as the reach of the largest scale.
+/// For a 3D reconstruction of a cube with few channels, the halos can
+/// make a slab as large as the whole cube.
+///
+public:
+    WaveletRecon() {}
+    virtual ~WaveletRecon() {if (arrayAllocated) delete [] array;}
+
+    T*   Array () {return array;}
+    T    Array (size_t i) {return array[i];}
+    int  getNumScales () {return numScales;}
+    int  getNumIter () {return numIter;}
+
+    void reconstruct(T *input, size_t xsize, size_t ysize, size_t zsize, SEARCH_PAR &p,
+                     int nthreads=1, bool verbose=true);
+
+private:
+    T      *array = nullptr;                //< The reconstructed array.
+    bool   arrayAllocated = false;          //< Has the array been allocated?
+    size_t dim[3];                          //< Dimensions of the array.
+    bool   useAxis[3];                      //< Axes along which the filter is applied.
+    int    numScales = 0;                   //< Number of wavelet scales.
+    int    numIter = 0;                     //< Number of iterations done.
+    int    nthreads = 1;                    //< Number of threads.
+
+    enum SlabMode {ONEPASS, SAMPLE, APPLY}; //< See decomposeSlab().
+    int    slabAxis = 2;                    //< Axis along which the cube is split in slabs.
+    long   halo = 0;                        //< Halo of the slabs, in pixels.
+    size_t stride = 1;                      //< Stride of the regular sample for the noise.
+    std::vector<float> scaleThresh;         //< Threshold of each scale.
+    std::vector<float> scaleMedian;         //< Median of the coefficients of each scale.
+    std::vector<std::vector<float>> samples;//< Sample of the coefficients of each scale.
+    std::vector<float> oneSample;           //< Sample of the current scale (ONEPASS).
+    std::vector<float> work[2];             //< Coefficients and smoothed array of a slab.
+    std::vector<float> pending;             //< Increments of a slab not yet added.
+    size_t pendingRange[4];                 //< Slab and inner part of the pending increments.
+
+    void   decomposeSlab(T *input, std::vector<float> &recon, size_t lo, size_t hi, size_t in0, size_t in1,
+                         int scaleMin, int scaleMax, float snr, SlabMode mode);
+    void   flushPending(std::vector<float> &recon);
+    void   filterAxis(float *data, const size_t *d, int axis, long step);
+    float  sampleSigma(std::vector<float> &sample, float &median);
+};
+
+#endif
@@ -56,8 +56,12 @@ void Ringmodel<T>::defaults() {
     side = 3;
     wpow = 2;
     thetaf = 15;
+    nseeds = 1;
+    seedpa = 10;
+    seedinc = 5;
     
     allAllocated = false;
+    fieldAllocated = false;
 }
 
 
@@ -180,29 +184,9 @@ void Ringmodel<T>::setfromCube (Cube<T> *c, Rings<T> *r)  {
         &r->phi[0],&r->inc[0],r->xpos[0],r->ypos[0]);
     
     // Determining free parameters
-    std::string f = makelower(p.FREE);
     bool mpar[MAXPAR];
-
-    // Set everything to fixed
-    for (int i=0; i<MAXPAR; i++) mpar[i] = false;
-
-    // Detect requested free parameters
-    if (f.find("vrot")!=std::string::npos) mpar[VROT] = true;
-    if (f.find("inc")!=std::string::npos)  mpar[INC]  = true;
-    if (f.find("pa")!=std::string::npos)   mpar[PA]   = true;
-    if (f.find("phi")!=std::string::npos)  mpar[PA]   = true;
-    if (f.find("xpos")!=std::string::npos) mpar[X0]   = true;
-    if (f.find("ypos")!=std::string::npos) mpar[Y0]   = true;
-    if (f.find("vsys")!=std::string::npos) mpar[VSYS] = true;
-    if (f.find("vrad")!=std::string::npos) mpar[VEXP] = true;
-    if (f.find("vexp")!=std::string::npos) mpar[VEXP] = true;
-    if (f.find("all")!=std::string::npos)
-        for (int i=0; i<MAXPAR; i++) mpar[i] = true;
-
-    int hside;
-    if (p.SIDE=="R") hside=1;
-    else if (p.SIDE=="A") hside=2;
-    else hside = 3;
+    getFreeMask2D(p.FREE,mpar);
+    int hside = getSide2D(p.SIDE);
 
     int wfunc = p.WFUNC;
 
@@ -210,6 +194,7 @@ void Ringmodel<T>::setfromCube (Cube<T> *c, Rings<T> *r)  {
     float freeang = p.DVDZ=="-1" ? 15. : atof(p.DVDZ.c_str());
 
     setoption (mpar,hside,wfunc,freeang);
+    setSeeds(p.NSEEDS);
 
     // Calculating 1st moment map
     MomentMap<T> map;
@@ -290,6 +275,14 @@ void Ringmodel<T>::set (int nrings, T *radii, T *widths, T *vsys, T *vrot,
     chis  = new T [nrings];
     
     elp = allocate_2D<float>(nrings, 4);
+
+    // Rings are not fitted yet
+    for (int i=0; i<nrings; i++) {
+        vsysf[i]=vrotf[i]=vexpf[i]=posaf[i]=inclf[i]=xposf[i]=yposf[i]=log(-1);
+        vsyse[i]=vrote[i]=vexpe[i]=posae[i]=incle[i]=xpose[i]=ypose[i]=log(-1);
+        npts[i] = 0;
+        chis[i] = log(-1);
+    }
     
     allAllocated = true;
 
@@ -342,6 +335,14 @@ void Ringmodel<T>::set (int nrings, T *radii, T widths, T vsys, T vrot,
     chis  = new T [nrings];
     
     elp = allocate_2D<float>(nrings, 4);
+
+    // Rings are not fitted yet
+    for (int i=0; i<nrings; i++) {
+        vsysf[i]=vrotf[i]=vexpf[i]=posaf[i]=inclf[i]=xposf[i]=yposf[i]=log(-1);
+        vsyse[i]=vrote[i]=vexpe[i]=posae[i]=incle[i]=xpose[i]=ypose[i]=log(-1);
+        npts[i] = 0;
+        chis[i] = log(-1);
+    }
     
     allAllocated = true;
 
@@ -394,25 +395,33 @@ void Ringmodel<T>::setoption (bool *maskpar, int hside, int wfunc, float freeang
 
 template <class T>
 void Ringmodel<T>::setfield (T *Array, int xsize, int ysize, int *boxup, int *boxlow) {
-    
+
+  /// The velocity field is stored as a list of its valid (not NaN) pixels,
+  /// ordered by row, so that the rings have not to scan the blank regions
+  /// of the box at each iteration.
+
     for (int i=0; i<2; i++) {
         bup[i] = boxup[i];
         blo[i] = boxlow[i];
     }
-    
-    int npoints = (bup[1]-blo[1]+1)*(bup[0]-blo[0]+1);
-    
-    vfield = new T [npoints];
-    fieldAllocated = true;
-    
-    for (int i=blo[0]; i<=bup[0]; i++) {
-        for (int j=blo[1]; j<=bup[1]; j++) {
+
+    pixx.clear();
+    pixy.clear();
+    pixv.clear();
+    rowStart.assign(1,0);
+
+    for (int j=blo[1]; j<=bup[1]; j++) {
+        for (int i=blo[0]; i<=bup[0]; i++) {
             T v = Array[i+j*xsize];
-            int velpix = (i-blo[0]) + (j-blo[1])*(bup[0]-blo[0]+1);
-            vfield[velpix]= v;
+            if (v!=v) continue;
+            pixx.push_back(i);
+            pixy.push_back(j);
+            pixv.push_back(v);
         }
-        
+        rowStart.push_back(pixv.size());
     }
+
+    fieldAllocated = true;
 }
 
 
@@ -426,80 +435,134 @@ void Ringmodel<T>::setfield (T *Array, int xsize, int ysize) {
 
 
 template <class T>
-void Ringmodel<T>::ringfit(int nthreads, bool verbose, bool showbar) {
-    
-  /// This function makes a loop over all concentric rings 
+void Ringmodel<T>::seedGuess(int k, T *p) {
+
+  /// Moves the initial position angle and inclination in p to those of
+  /// the seed k. Seed 0 is the initial guess. If both angles are free, the
+  /// other seeds lie on an ellipse of semi-axes (seedpa,seedinc) around it,
+  /// otherwise on a line of half-length seedpa (or seedinc).
+
+    if (k==0 || nseeds<2) return;
+
+    if (mask[PA] && mask[INC]) {
+        double a = 2*M_PI*(k-1)/double(nseeds-1);
+        p[PA]  += seedpa*cos(a);
+        p[INC] += seedinc*sin(a);
+    }
+    else {
+        double f = ((k+1)/2)/double(nseeds/2);
+        if (k%2==0) f = -f;
+        if (mask[PA]) p[PA] += seedpa*f;
+        else p[INC] += seedinc*f;
+    }
+    p[INC] = std::max<T>(0.1, std::min<T>(89.9, p[INC]));
+}
+
+
+template <class T>
+void Ringmodel<T>::ringfit(int nthreads, bool verbose, bool showbar, int first, int last) {
+
+  /// This function makes a loop over all concentric rings
   /// and do the fit.
   /// It is the calling function for Ringmodel class.
-   
+  ///
+  /// Each ring can be fitted from several initial guesses (see setSeeds()).
+  /// All the (ring,seed) pairs are fitted in parallel and, for each ring,
+  /// the successful fit with the lowest chi-squared is kept.
+  ///
+  /// Only the rings from first to last-1 (all by default) are fitted.
 
     if (fieldAllocated && allAllocated) {
-        
+
+        // Seeds differ only in position angle and inclination
+        const int ns = (mask[PA] || mask[INC]) ? nseeds : 1;
+        if (last<0 || last>nrad) last = nrad;
+        first = std::max(first,0);
+        const int ntask = std::max(last-first,0)*ns;
+
+        struct RingFit {int ret, n; T p[MAXPAR], e[MAXPAR], q; float el[4];};
+        std::vector<RingFit> fits(ntask);
+
         ProgressBar bar(true,verbose,showbar);
 
 #pragma omp parallel num_threads(nthreads)
 {
-        bar.init(" Fitting 2D tilted-ring model... ",nrad);
-#pragma omp for 
-        for (int ir=0; ir<nrad; ir++) {
-            bar.update(ir+1);
-            
-            int n;
-            T   e[MAXPAR];
-            T       p[MAXPAR];
-            T  q = 0.0;
-
-            p[VSYS] = vsysi[ir];
-            p[VROT] = vroti[ir];
-            p[VEXP] = vexpi[ir];
-            p[PA]   = posai[ir];
-            p[INC]  = incli[ir];
-            p[X0]   = xposi;
-            p[Y0]   = yposi;
+        bar.init(" Fitting 2D tilted-ring model... ",ntask);
+#pragma omp for schedule(dynamic)
+        for (int it=0; it<ntask; it++) {
+            bar.update(it+1);
+
+            int ir = first + it/ns;
+            RingFit &f = fits[it];
+            f.n = 0;
+            f.q = 0.0;
+            for (int i=0; i<4; i++) f.el[i] = 0;
+
+            f.p[VSYS] = vsysi[ir];
+            f.p[VROT] = vroti[ir];
+            f.p[VEXP] = vexpi[ir];
+            f.p[PA]   = posai[ir];
+            f.p[INC]  = incli[ir];
+            f.p[X0]   = xposi;
+            f.p[Y0]   = yposi;
+            seedGuess(it%ns, f.p);
+
             T ri    = rads[ir] - 0.5 * wids[ir];
             T ro    = rads[ir] + 0.5 * wids[ir];
             if (ri<0.0) ri = 0.0;
-            
-            int ret = rotfit(ri, ro, p, e, n, q);
-            if (ret>0) {
-                
+
+            f.ret = rotfit(ri, ro, f.p, f.e, f.n, f.q, f.el);
+        }
+}
+
+        for (int ir=first; ir<last; ir++) {
+
+            // Best seed for this ring
+            RingFit *rf = &fits[(ir-first)*ns];
+            int best = -1;
+            for (int k=0; k<ns; k++) {
+                if (rf[k].ret>0 && (best<0 || rf[k].q<rf[best].q)) best = k;
+            }
+
+            if (best>=0) {
+                T *p = rf[best].p;
+                T *e = rf[best].e;
+
                 vsysf[ir] = p[VSYS];
                 if (e[VSYS] < 999.99) vsyse[ir] = e[VSYS];
                 else vsyse[ir] = 999.99;
-            
+
                 vrotf[ir] = p[VROT];
                 if (e[VROT] < 999.99) vrote[ir] = e[VROT];
                 else vrote[ir] = 999.99;
-            
+
                 vexpf[ir] = p[VEXP];
                 if (e[VEXP] < 999.99) vexpe[ir] = e[VEXP];
                 else vexpe[ir] = 999.99;
-            
+
                 posaf[ir] = p[PA];
                 if (e[PA] < 999.99) posae[ir] = e[PA];
                 else posae[ir] = 999.99;
-            
+
                 inclf[ir] = p[INC];
                 if (e[INC] < 999.99) incle[ir] = e[INC];
                 else incle[ir] = 999.99;
-            
+
                 xposf[ir] = p[X0];
                 if (e[X0] < 999.99) xpose[ir] = e[X0];
                 else xpose[ir] = 999.99;
-            
+
                 yposf[ir] = p[Y0];
                 if (e[Y0] < 999.99) ypose[ir] = e[Y0];
                 else ypose[ir] = 999.99;
-            
-                elp[ir][0] = elp4[0];
-                elp[ir][1] = elp4[1];
-                elp[ir][2] = elp4[2];
-                elp[ir][3] = elp4[3];
-                npts[ir] = n;
-                chis[ir] = q;
-            } 
+
+                for (int i=0; i<4; i++) elp[ir][i] = rf[best].el[i];
+                npts[ir] = rf[best].n;
+                chis[ir] = rf[best].q;
+            }
             else {
                 // Fit did not succeed
+                int ret = rf[0].ret;
                 vsysf[ir]=vrotf[ir]=vexpf[ir]=posaf[ir]=inclf[ir]=xposf[ir]=yposf[ir]=log(-1);
                 vsyse[ir]=vrote[ir]=vexpe[ir]=posae[ir]=incle[ir]=xpose[ir]=ypose[ir]=log(-1);
                 std::string errmsg;
@@ -512,22 +575,22 @@ void Ringmodel<T>::ringfit(int nthreads, bool verbose, bool showbar) {
                 else if (ret==-7) errmsg = "Error fitting ring model: Square root of negative number!";
                 if (verbose) std::cerr << errmsg << std::endl;
             }
-        }            
-}    
+        }
+
         bar.fillSpace("Done.\n");
-    
+
     }
     else {
         std::cout << "2DFIT ERROR: Arrays are not allocated!\n";
     }
-    
-    
+
+
 }
 
 
 template <class T>
-int Ringmodel<T>::rotfit (T ri, T ro, T *p, T *e, int &n, T &q) {
-    
+int Ringmodel<T>::rotfit (T ri, T ro, T *p, T *e, int &n, T &q, float *ellipse) {
+
   /// This function does a least squares fit to the radial velocity field.
   ///
   /// \param  ri        Inner radius of ring.
@@ -536,11 +599,12 @@ int Ringmodel<T>::rotfit (T ri, T ro, T *p, T *e, int &n, T &q) {
   /// \param  e         Errors in parameters.
   /// \param  n         Number of points in the fit.
   /// \param  q         Chi-squared.
+  /// \param  ellipse   If given, the coefficients of the correlation ellipse.
   ///
-  /// \return           Error or success.    
+  /// \return           Error or success.
 
     int     i, h=0;
-    int     ier = 0;            // Error return. 
+    int     ier = 0;            // Error return.
     int     nfr;                // Number of free parameters.
     int     nrt;                // Return code from lsqfit.
     int     t = 100;            // Max. number of iterations.
@@ -548,49 +612,52 @@ int Ringmodel<T>::rotfit (T ri, T ro, T *p, T *e, int &n, T &q) {
     double  chi;                // Old chi-squared.
     float   df[MAXPAR];         // Difference vector.
     float   eps = 0.1;          // Stop criterium.
-    float   lab = 0.001;        // Mixing parameter.        
-    
-    std::vector<T> x,y,w;       // (x,y) position, f(x,y) and w(x,y).
-    T *pf  = new T [MAXPAR];    // Intermediate results.
-    
+    float   lab = 0.001;        // Mixing parameter.
+    T       pf[MAXPAR];         // Intermediate results.
+
+    // (x,y) position, f(x,y) and w(x,y). They keep their capacity between
+    // calls, as the rings are fitted in parallel each thread has its own.
+    thread_local std::vector<T> x, y, w;
+
     for (nfr=0, i=0; i<MAXPAR; i++) nfr += mask[i];
-    
+
     n = getdat(x, y, w, p, ri, ro, q, nfr);
 
+    VelFieldModel<T> model;
     bool stop = false;
-    while (!stop && h++<t) {                    
+    while (!stop && h++<t) {
         int npar = MAXPAR;                              // Number of parameters.
         int xdim = 2;                                   // Function is two-dimensional.
         chi = q;                                        // Save chi-squared.
         for (i=0; i<MAXPAR; i++) pf[i] = p[i];          // Loop to save initial estimates.
-                
-        Lsqfit<T> lsqfit(&x[0], xdim, &y[0], &w[0], n, pf, e, mask, npar, &func, &derv, tol, t, lab);
-        nrt = lsqfit.fit();
+
+        LsqSolver<T,VelFieldModel<T>> lsqfit(model, tol, t, lab);
+        nrt = lsqfit.fit(x.data(), xdim, y.data(), w.data(), n, pf, e, mask, npar);
 
         if (nrt<0) break;                               // Stop because of error.
         for (i=0; i<MAXPAR; i++) df[i] = pf[i] - p[i];  // Calculate difference vector.
-        
+
         float flip = 1.0;                                // Factor for inner loop.
-        while (true) {                                   // Inner loop. 
-            
+        while (true) {                                   // Inner loop.
+
             for (i=0; i<MAXPAR; i++)                    // Calculate new parameters.
                 pf[i] = flip * df[i] + p[i];
-         
+
             if (pf[INC] > 90.0)  pf[INC] -= 180.0;      // In case inclination > 90.
-            
+
             n = getdat(x, y, w, pf, ri, ro, q, nfr);
-            
+
             if (q<chi) {                                // Better fit.
                 for (i=0; i<MAXPAR; i++)                // Save new parameters.
                     p[i] = pf[i];
-                break;  
-            } 
-            else {                
+                break;
+            }
+            else {
                 if ((2*h) > t) {
                     for (stop=true, i=0; i<MAXPAR; i++) {
                         stop = (stop && fabs(flip*df[i]) < eps);
                     }
-                } 
+                }
                 else {
                     if (q == chi && chi == 0.0) stop = true;
                     else stop = fabs(q-chi)/chi < tol;
@@ -601,49 +668,47 @@ int Ringmodel<T>::rotfit (T ri, T ro, T *p, T *e, int &n, T &q) {
                 }
             }
             if (flip > 0.0) flip *= -1.0;
-            else flip *= -0.5;      
+            else flip *= -0.5;
         }
 
-        
+
     }
-   
+
     // Find out why we quit fitting and printing errors
     if (stop)       ier = h;   // Good fit:  ier = number of big loops.
     else if (nrt<0) ier = nrt; // Error from lsqfit: ier = return code of lsqfit.
     else if (h==t)  ier = -4;  // Maximum number of iterations.
 
     // Calculate ellipse parameters.
-    if (ier==1 && cor[0]>-1 && cor[1]>-1 ) {
+    if (ellipse!=nullptr && ier==1 && cor[0]>-1 && cor[1]>-1 ) {
         T a11 = 0.0;
         T a12 = 0.0;
         T a22 = 0.0;
         T sigma2 = 0.0;
 
         for (i=0; i < n; i++) {
-            derv( &x[2*i], p, b, MAXPAR);
+            T v = model(&x[2*i], p, b, MAXPAR);
             a11 = a11 + w[i] * b[cor[0]] * b[cor[0]];
             a22 = a22 + w[i] * b[cor[1]] * b[cor[1]];
             a12 = a12 + w[i] * b[cor[0]] * b[cor[1]];
-            sigma2 = sigma2+w[i]*std::pow(double(y[i]-func(&x[2*i], p, MAXPAR)), double(2.0));
+            sigma2 = sigma2+w[i]*std::pow(double(y[i]-v), double(2.0));
         }
         sigma2 = sigma2 / (float) (n);
-        elp4[0] = a11;
-        elp4[1] = a12;
-        elp4[2] = a22;
-        elp4[3] = sigma2;
+        ellipse[0] = a11;
+        ellipse[1] = a12;
+        ellipse[2] = a22;
+        ellipse[3] = sigma2;
     }
-    
-    delete [] pf;
-    
+
     return ier;
 }
 
 
 template <class T>
-int Ringmodel<T>::getdat (std::vector<T> &x, std::vector<T> &y, std::vector<T> &w, 
-                          T *p, T ri, T ro, T &q, int nfr) 
+int Ringmodel<T>::getdat (std::vector<T> &x, std::vector<T> &y, std::vector<T> &w,
+                          T *p, T ri, T ro, T &q, int nfr)
 {
-    
+
   /// The function selects the data from velocity field
   /// and calculates differences.
   ///
@@ -657,27 +722,27 @@ int Ringmodel<T>::getdat (std::vector<T> &x, std::vector<T> &y, std::vector<T> &
   /// \param  nfr       Degrees of freedom.
   ///
   /// \return           Number of points in ring.
-  
+
     int     n=0;                        // Return value = number of points.
     const double F = M_PI/180.;
-    
+
     // Reset variables
     x.clear();
     y.clear();
     w.clear();
     q    = 0.0;
     // Definition of parameters.
-    T phi  = p[PA];       
-    T inc  = p[INC];              
-    T x0   = p[X0];           
-    T y0   = p[Y0];           
+    T phi  = p[PA];
+    T inc  = p[INC];
+    T x0   = p[X0];
+    T y0   = p[Y0];
     T free = fabs(sin(F*thetaf)); // Free angle.
-    T sinp = sin(F*phi);      
-    T cosp = cos(F*phi);  
-    T sini = sin(F*inc);      
-    T cosi = cos(F*inc);     
+    T sinp = sin(F*phi);
+    T cosp = cos(F*phi);
+    T sini = sin(F*inc);
+    T cosi = cos(F*inc);
     T a    = sqrt(1.0-cosp*cosp*sini*sini);
-    T b    = sqrt(1.0-sinp*sinp*sini*sini); 
+    T b    = sqrt(1.0-sinp*sinp*sini*sini);
     int llo    = std::max(blo[0], nint(x0-a*ro)-1);
     int lup    = std::min(bup[0], nint(x0+a*ro)+1);
     int mlo    = std::max(blo[1], nint(y0-b*ro)-1);
@@ -688,55 +753,53 @@ int Ringmodel<T>::getdat (std::vector<T> &x, std::vector<T> &y, std::vector<T> &
         q = FLT_MAX;
         return 0;
     }
-   
-    int nlt = bup[0]-blo[0]+1;                     // Number of pixels in X.
-    
-    double (*wfunc)(double) = cos;
-    if (wpow<0) wfunc = sin;
-   
-    for (int rx=llo; rx<lup; rx++) {
-        for (int ry=mlo; ry<mup; ry++) {
-            int   ip = (ry-blo[1])*nlt+ (rx-blo[0]);
-            T v  = vfield[ip];                 // Radial velocity at this position.
-            
-            if (v==v) {
-                T xr = (-(rx-x0)*sinp + (ry-y0)*cosp);
-                T yr = (-(rx-x0)*cosp - (ry-y0)*sinp)/cosi;
-                T r = sqrt(xr*xr+yr*yr);
-                T theta = 0.;
-                if (r>=0.1) theta = atan2(yr, xr)/F;   
-                T costh = fabs(cos(F*theta));
-                T wf    = fabs(wfunc(F*theta));
-                
-                if (r>ri && r<ro && costh>free) {      // If we are inside the ring.
-
-                    bool use = true;
-                    if (side==1) use = (fabs(theta)<=90.0);      //< Receding half.
-                    if (side==2) use = (fabs(theta)>=90.0);      //< Approaching half. 
-
-                    if (use) {                          // Load data point ? 
-                        n += 1;
-                        T xx[2] = {float(rx),float(ry)};
-                        T vz = func (xx, p, MAXPAR);
-                        T s = v - vz;          // Corrected difference
-                        T wi = std::pow(wf, fabs(wpow)); // Weight of this point.
-                        x.push_back(rx);           // Load X-coordinate.
-                        x.push_back(ry);           // Load Y-coordinate.
-                        y.push_back(v);            // Load LOS velocity.
-                        w.push_back(wi);           // Load weight.
-                        q += s*s*wi;               // Calculate chi-squared.
-                        
-                    }
-                }
-            }
-        }   
+
+    // Weighting function can be either a cos(theta)^n or a sin(theta)^n
+    int wexp = abs(wpow);
+
+    VelFieldModel<T> model;
+
+    for (int ry=mlo; ry<mup; ry++) {
+        // Valid pixels of this row between llo and lup
+        size_t k   = rowStart[ry-blo[1]];
+        size_t end = rowStart[ry-blo[1]+1];
+        k = std::lower_bound(pixx.begin()+k, pixx.begin()+end, llo)-pixx.begin();
+
+        for (; k<end && pixx[k]<lup; k++) {
+            double dx = pixx[k]-x0, dy = ry-y0;
+            double xr =  -dx*sinp+dy*cosp;
+            double yr = (-dx*cosp-dy*sinp)/cosi;
+            double r  = sqrt(xr*xr+yr*yr);
+            if (!(r>ri && r<ro)) continue;              // If we are inside the ring.
+
+            // |cos(theta)| and |sin(theta)|, with theta=0 at the centre.
+            double costh = r<0.1 ? 1. : fabs(xr)/r;
+            double sinth = r<0.1 ? 0. : fabs(yr)/r;
+            if (costh<=free) continue;
+
+            bool use = true;
+            if (side==1) use = (r<0.1 || xr>=0);        //< Receding half.
+            if (side==2) use = (r>=0.1 && xr<=0);       //< Approaching half.
+            if (!use) continue;
+
+            n += 1;                                     // Load data point.
+            T xx[2] = {T(pixx[k]),T(ry)};
+            T vz = model.value(xx, p, MAXPAR);
+            T s  = pixv[k] - vz;                        // Corrected difference
+            T wi = std::pow(wpow<0 ? sinth : costh, wexp); // Weight of this point.
+            x.push_back(xx[0]);                         // Load X-coordinate.
+            x.push_back(xx[1]);                         // Load Y-coordinate.
+            y.push_back(pixv[k]);                       // Load LOS velocity.
+            w.push_back(wi);                            // Load weight.
+            q += s*s*wi;                                // Calculate chi-squared.
+        }
     }
-    
-    if (n > nfr) q = sqrt(q/(T)(n-nfr));     // Enough data points ? 
-    else q = FLT_MAX;       
-    
+
+    if (n > nfr) q = sqrt(q/(T)(n-nfr));     // Enough data points ?
+    else q = FLT_MAX;
+
     return n;
-    
+
 }
 
 
@@ -911,6 +974,7 @@ void Ringmodel<T>::writeModel (std::string fname, Header &h) {
 
     const double F = M_PI/180.;
     T p[MAXPAR], e[MAXPAR];
+    VelFieldModel<T> vfmodel;
     float ot = thetaf;
     thetaf = 0;
     ///*
@@ -933,7 +997,7 @@ void Ringmodel<T>::writeModel (std::string fname, Header &h) {
         for (int j=1; j<=n; j++) {
             T xx[2] = {x[2*j-2],x[2*j-1]};
             if (xx[0]<model.DimX() && xx[1]<model.DimY()) {
-                T vv = func(xx,p,MAXPAR);
+                T vv = vfmodel.value(xx,p,MAXPAR);
                 size_t pp = xx[0]+xx[1]*model.DimX();
                 if (model[pp]!=model[pp]) model[pp] = vv;
                 else model[pp] = (model[pp]+vv)/2.;
@@ -980,7 +1044,7 @@ void Ringmodel<T>::writeModel (std::string fname, Header &h) {
                 p[VEXP] = vexpf[ind];
                 p[VROT] = vrotf[ind];
                 p[VSYS] = vsysf[ind];
-                model[pp] = func(xx, p, MAXPAR);
+                model[pp] = vfmodel.value(xx, p, MAXPAR);
             }
         }
     }
@@ -998,137 +1062,196 @@ std::ostream& operator<< (std::ostream& Stream, Ringmodel<T> &r) {
 }
 
 
+void getFreeMask2D (std::string free, bool *mpar) {
+
+    std::string f = makelower(free);
+
+    // Set everything to fixed
+    for (int i=0; i<MAXPAR; i++) mpar[i] = false;
+
+    // Detect requested free parameters
+    if (f.find("vrot")!=std::string::npos) mpar[VROT] = true;
+    if (f.find("inc")!=std::string::npos)  mpar[INC]  = true;
+    if (f.find("pa")!=std::string::npos)   mpar[PA]   = true;
+    if (f.find("phi")!=std::string::npos)  mpar[PA]   = true;
+    if (f.find("xpos")!=std::string::npos) mpar[X0]   = true;
+    if (f.find("ypos")!=std::string::npos) mpar[Y0]   = true;
+    if (f.find("vsys")!=std::string::npos) mpar[VSYS] = true;
+    if (f.find("vrad")!=std::string::npos) mpar[VEXP] = true;
+    if (f.find("vexp")!=std::string::npos) mpar[VEXP] = true;
+    if (f.find("all")!=std::string::npos)
+        for (int i=0; i<MAXPAR; i++) mpar[i] = true;
+}
+
+
+int getSide2D (std::string side) {
+
+    if (side=="R") return 1;
+    else if (side=="A") return 2;
+    else return 3;
+}
+
+
+template <class T>
+long ringfitBatch (int nfields, const T *vfields, const int *dims, const int *nrings, const T *rings,
+                   const bool *mask, int side, int wfunc, float freeangle, int nseeds, T *out, int nthreads) {
+
+    // Offsets of each field in vfields and of its rings in the columns
+    std::vector<size_t> foff(nfields+1,0), roff(nfields+1,0);
+    for (int f=0; f<nfields; f++) {
+        foff[f+1] = foff[f] + size_t(dims[2*f])*dims[2*f+1];
+        roff[f+1] = roff[f] + std::max(nrings[f],0);
+    }
+    const size_t ntot = roff[nfields];
+
+    // Largest fields first, so that the small ones fill the gaps at the end
+    std::vector<int> order(nfields);
+    for (int f=0; f<nfields; f++) order[f] = f;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+                     {return (foff[a+1]-foff[a])*nrings[a] > (foff[b+1]-foff[b])*nrings[b];});
+
+    long nok = 0;
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic,1) reduction(+:nok)
+    for (int j=0; j<nfields; j++) {
+        const int f = order[j], nr = nrings[f];
+        if (nr<1) continue;
+
+        const size_t k0 = roff[f];
+        T *in[2+MAXPAR];
+        for (int c=0; c<2+MAXPAR; c++) in[c] = const_cast<T*>(rings) + c*ntot + k0;
+
+        Ringmodel<T> rm(nr, in[0], in[1], in[2+VSYS], in[2+VROT], in[2+VEXP], in[2+PA], in[2+INC],
+                        in[2+X0][0], in[2+Y0][0]);
+        bool mpar[MAXPAR];
+        for (int i=0; i<MAXPAR; i++) mpar[i] = mask[i];
+        rm.setoption(mpar, side, wfunc, freeangle);
+        rm.setSeeds(nseeds);
+        rm.setfield(const_cast<T*>(vfields)+foff[f], dims[2*f], dims[2*f+1]);
+        rm.ringfit(1, false, false);
+
+        for (int i=0; i<nr; i++) {
+            const size_t k = k0 + i;
+            T val[MAXPAR] = {rm.getVsysf(i), rm.getVrotf(i), rm.getVexpf(i), rm.getPosaf(i),
+                             rm.getInclf(i), rm.getXposf(i), rm.getYposf(i)};
+            T err[MAXPAR] = {rm.getVsyse(i), rm.getVrote(i), rm.getVexpe(i), rm.getPosae(i),
+                             rm.getIncle(i), rm.getXpose(i), rm.getYpose(i)};
+            for (int p=0; p<MAXPAR; p++) {
+                out[p*ntot+k] = val[p];
+                out[(MAXPAR+p)*ntot+k] = err[p];
+            }
+            bool good = val[VROT]==val[VROT];
+            out[2*MAXPAR*ntot+k] = good ? rm.getNpts(i) : 0;
+            out[(2*MAXPAR+1)*ntot+k] = good ? rm.getChisq(i) : log(-1);
+            nok += good;
+        }
+    }
+
+    return nok;
+}
+template long ringfitBatch (int,const float*,const int*,const int*,const float*,const bool*,int,int,float,int,float*,int);
+template long ringfitBatch (int,const double*,const int*,const int*,const double*,const bool*,int,int,float,int,double*,int);
+
+
 template <class T>
-T func (T *c, T *p, int npar) {
-  
+void VelFieldModel<T>::angles (const T *p) const {
+
+    const double F = M_PI/180.;
+
+    if (p[PA] != phi) {                     // Position angle.
+        phi  = p[PA];
+        cosp = cos(F*phi);
+        sinp = sin(F*phi);
+    }
+
+    if (p[INC] != inc) {                    // Inclination.
+        inc  = p[INC];
+        cosi = cos(F*inc);
+        sini = sin(F*inc);
+    }
+}
+
+
+template <class T>
+T VelFieldModel<T>::value (const T *c, const T *p, int npar) const {
+
   /// The function calculates radial velocity from rotation curve.
-  /// 
+  ///
   /// \param  c     Grid position in plane of galaxy. Dimension = 2.
   /// \param  p     List of parameters of ring.
   /// \param  npar  Number of parameters.
   ///
   /// \return       The radial velocity in requested point.
-  
-
-    T   vs, vc, vr;                     // Parameters of velocity field. 
-    T   x, y;                           // Sky coordinates.
-    T   cost1, sint1; 
-    T   x1, y1, r;
-   
-    static double phi= 0.0, inc = 0.0;       // Saved parameters (static type).
-    static double cosp1 = 1.0;
-    static double sinp1 = 0.0;
-    static double cosi1 = 1.0;
-    static double sini1 = 0.0;
-#pragma omp threadprivate(phi,inc,cosp1,sinp1,cosi1,sini1)
-
-    vs = p[VSYS];                           // Systemic velocity.
-    vc = p[VROT];                           // Circular velocity.
-    vr = p[VEXP];                           // Expansion velocity.
-    
-    if (p[PA] != phi) {                     // Position angle.
-        phi = p[PA];                            
-        double factor = M_PI/180.;
-        cosp1 = cos(factor*phi);                        
-        sinp1 = sin (factor*phi);                           
-    }
-   
-    if (p[INC] != inc) {                    // Inclination.
-        inc = p[INC];   
-        double factor = M_PI/180.;
-        cosi1 = cos(factor*inc);
-        sini1 = sin (factor*inc);
-    }
-   
-    x = c[0] - p[X0];                       // Calculate X. 
-    y = c[1] - p[Y0];                       // Calculate Y.
-    x1 = (-x*sinp1 + y*cosp1);              // X in plane of galaxy.
-    y1 = (-x*cosp1 - y*sinp1)/cosi1;        // Y in plane of galaxy.
-    r = sqrt(x1*x1 + y1*y1);                // Distance from centre.
-  
-    cost1 = x1 / r;                         // Azimutal angle (theta).
-    sint1 = y1 / r;                         
-
-    T vrad = vs + (vc*cost1 + vr*sint1) * sini1;
-        
-    return vrad;    
+
+    angles(p);
+
+    double x  = c[0] - p[X0];               // Calculate X.
+    double y  = c[1] - p[Y0];               // Calculate Y.
+    double x1 = (-x*sinp + y*cosp);         // X in plane of galaxy.
+    double y1 = (-x*cosp - y*sinp)/cosi;    // Y in plane of galaxy.
+    double r  = sqrt(x1*x1 + y1*y1);        // Distance from centre.
+
+    double cost1 = x1 / r;                  // Azimutal angle (theta).
+    double sint1 = y1 / r;
+
+    return p[VSYS] + (p[VROT]*cost1 + p[VEXP]*sint1) * sini;
 }
-template float func (float*,float*,int);
-template double func (double*,double*,int);
-    
+
 
 template <class T>
-void derv (T *c, T *p, T *d, int npar) {
-    
-  /// The function derv calculates the partial derivatives 
-  /// with respect to the parameters.
+T VelFieldModel<T>::operator() (const T *c, const T *p, T *d, int npar) const {
+
+  /// The function calculates the radial velocity and the partial
+  /// derivatives with respect to the parameters.
   ///
   /// \param  c     Grid position in plane of galaxy. Dimension = 2.
   /// \param  p     List of parameters of ring.
   /// \param  d     Partial derivatives, returned to user.
   /// \param  npar  Number of parameters.
+  ///
+  /// \return       The radial velocity in requested point.
 
-    float   vc, vr;                         // Parameters of velocity field.
-    float   x, y;                           // Sky coordinates.
-    float   cost1, cost2, sint1, sint2;
-    float   x1, y1, r;
-    
-    static float phi= 0.0, inc = 0.0;       // Saved parameters (static type).
-    static float cosp1 = 1.0;
-    static float sinp1 = 0.0;
-    static float cosi1 = 1.0, cosi2 = 1.0;
-    static float sini1 = 0.0, sini2 = 0.0;
-#pragma omp threadprivate(phi,inc,cosp1,sinp1,cosi1,sini1,cosi2,sini2)
-    
     const double F = M_PI/180.;
 
-    vc = p[VROT];                           // Circular velocity.
-    vr = p[VEXP];                           // Expansion velocity.
-    
-    if (p[PA] != phi) {                     // Position angle.
-        phi = p[PA];                            
-        cosp1 = cos( F * phi );                 
-        sinp1 = sin ( F * phi );                
-    }
-    
-    if (p[INC] != inc) {                    // Inclination.
-        inc = p[INC];               
-        cosi1 = cos( F * inc );         
-        cosi2 = cosi1 * cosi1;          
-        sini1 = sin ( F * inc );            
-        sini2 = sini1 * sini1;          
-    }
-    x = c[0] - p[X0];                       // Calculate X.
-    y = c[1] - p[Y0];                       // Calculate Y
-    x1 = (-x*sinp1 + y*cosp1);              // X in plane of galaxy.
-    y1 = (-x*cosp1 - y*sinp1)/cosi1;        // Y in plane of galaxy.
-    r = sqrt(x1*x1 + y1*y1);                // Distance from centre.
-    
-    cost1 = x1 / r;                         // Azimutal angle (theta).
-    sint1 = y1 / r;             
-    cost2 = cost1 * cost1;          
-    sint2 = sint1 * sint1;          
+    angles(p);
+
+    double vc = p[VROT];                    // Circular velocity.
+    double vr = p[VEXP];                    // Expansion velocity.
+    double cosi2 = cosi * cosi;
+    double sini2 = sini * sini;
+
+    double x  = c[0] - p[X0];               // Calculate X.
+    double y  = c[1] - p[Y0];               // Calculate Y
+    double x1 = (-x*sinp + y*cosp);         // X in plane of galaxy.
+    double y1 = (-x*cosp - y*sinp)/cosi;    // Y in plane of galaxy.
+    double r  = sqrt(x1*x1 + y1*y1);        // Distance from centre.
+
+    double cost1 = x1 / r;                  // Azimutal angle (theta).
+    double sint1 = y1 / r;
+    double cost2 = cost1 * cost1;
+    double sint2 = sint1 * sint1;
 
     d[VSYS] = 1.0;                          // Now calculate derivatives.
-    d[VROT] = sini1 * cost1;            
-    d[VEXP] = sini1 * sint1;            
-                    
-    d[PA]   = F * vc * (1.0 - sini2 * sint2) * sint1 * sini1 / cosi1 -
-              F * vr * (1.0 - sini2 * cost2) * cost1 * sini1 / cosi1;
+    d[VROT] = sini * cost1;
+    d[VEXP] = sini * sint1;
 
-    d[INC]  = F * vc * (cosi2 - sini2 * sint2) * cost1 / cosi1 +
-              F * vr * (cosi2 + sini2 * cost2) * sint1 / cosi1;
+    d[PA]   = F * vc * (1.0 - sini2 * sint2) * sint1 * sini / cosi -
+              F * vr * (1.0 - sini2 * cost2) * cost1 * sini / cosi;
 
-    d[X0]   = vc * (sint1 * sinp1 - cost1 * cosp1 / cosi1) * sint1 * sini1 / r -
-              vr * (sint1 * sinp1 - cost1 * cosp1 / cosi1) * cost1 * sini1 / r;
-        
-    d[Y0]   = - vc * (sint1 * cosp1 + cost1 * sinp1 / cosi1) * sint1 * sini1 / r +
-                vr * (sint1 * cosp1 + cost1 * sinp1 / cosi1) * cost1 * sini1 / r;
+    d[INC]  = F * vc * (cosi2 - sini2 * sint2) * cost1 / cosi +
+              F * vr * (cosi2 + sini2 * cost2) * sint1 / cosi;
+
+    d[X0]   = vc * (sint1 * sinp - cost1 * cosp / cosi) * sint1 * sini / r -
+              vr * (sint1 * sinp - cost1 * cosp / cosi) * cost1 * sini / r;
+
+    d[Y0]   = - vc * (sint1 * cosp + cost1 * sinp / cosi) * sint1 * sini / r +
+                vr * (sint1 * cosp + cost1 * sinp / cosi) * cost1 * sini / r;
+
+    return p[VSYS] + (vc*cost1 + vr*sint1) * sini;
 }
-template void derv (float*,float*,float*,int);
-template void derv (double*,double*,double*,int);
 
 
 // Explicit instantiation of the classes
+template struct VelFieldModel<float>;
+template struct VelFieldModel<double>;
 template class Ringmodel<float>;
 template class Ringmodel<double>;
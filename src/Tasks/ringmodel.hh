@@ -25,7 +25,9 @@
 #define RINGMODEL_HH_
 
 #include <vector>
+#include <algorithm>
 #include <fstream>
+#include <string>
 #include <Arrays/cube.hh>
 #include <Arrays/rings.hh>
 
@@ -89,6 +91,7 @@ public:
     void hold(const int i) {mask[i]=false;}  /// Hold a parameter fixed
     void free(const int i) {mask[i]=true;}   /// Release a fixed parameter
     void setMask(const int i, bool v) {mask[i]=v;}   /// set a fixed/free parameter
+    void setSeeds(int n, float dpa=10, float dinc=5) {nseeds=std::max(n,1); seedpa=dpa; seedinc=dinc;}
 
     /// Fitting specific functions:
     
@@ -96,8 +99,8 @@ public:
     void setfield (T *Array, int xsize, int ysize);
     void setfield (T *Array, int xsize, int ysize, int *boxup, int *boxlow);
     
-    void ringfit(int nthreads=1, bool verbose=true, bool showbar=true);
-    int  rotfit (T ri, T ro, T *p, T *e, int &n, T &q);
+    void ringfit(int nthreads=1, bool verbose=true, bool showbar=true, int first=0, int last=-1);
+    int  rotfit (T ri, T ro, T *p, T *e, int &n, T &q, float *ellipse=nullptr);
     int  getdat (std::vector<T> &x, std::vector<T> &y, std::vector<T> &w, T *p, T ri, T ro, T &q, int nfr);
     
     void print (std::ostream& Stream);
@@ -146,7 +149,10 @@ protected:
     int  *npts;          ///< Number of points in each ring.
     T    *chis;          ///< Chi-squared for each ring.
     
-    T     *vfield;        ///< Velocity field array.
+    std::vector<int> pixx;       ///< X of the valid pixels of the velocity field.
+    std::vector<int> pixy;       ///< Y of the valid pixels of the velocity field.
+    std::vector<T>   pixv;       ///< Velocities of the valid pixels.
+    std::vector<size_t> rowStart;///< First valid pixel of each row of the box.
     float **elp;          ///< Matrices of coefficients.
     
     bool  allAllocated;   ///< Have all array been allocated?
@@ -159,8 +165,12 @@ private:
     int     wpow;           ///< Weighting power (uniform, cos, cos^2);
     float   thetaf;         ///< Free angle.
     float   tol;            ///< Tolerance of fit.
-    float   elp4[4];        ///< Matrix of coefficients.
     int     cor[2];         ///< Correlation ellipses.
+    int     nseeds;         ///< Number of initial guesses fitted for each ring.
+    float   seedpa;         ///< Offset of the position angle of the seeds.
+    float   seedinc;        ///< Offset of the inclination of the seeds.
+
+    void    seedGuess(int k, T *p);
 
 };
   
@@ -181,8 +191,48 @@ private:
   ///                                            r * cos(INCL)
   ///
     
-template <class T> T func (T *c, T *p, int npar);
-template <class T> void  derv (T *c, T *p, T *d, int npar);
+
+/// Free parameters of the FREE string (e.g. "VROT INC PA") in mpar[MAXPAR].
+void getFreeMask2D (std::string free, bool *mpar);
+
+/// Half of the galaxy of the SIDE string: 1 = receding, 2 = approaching, 3 = both.
+int  getSide2D (std::string side);
+
+
+/// Fits a 2D tilted-ring model to many velocity fields (e.g. of different
+/// galaxies) in one call, without any I/O. Fields are distributed dynamically
+/// among nthreads threads, largest first, each fitted by a single thread.
+///
+///  - vfields:  the velocity fields one after the other, field f having
+///              dims[2*f]*dims[2*f+1] pixels (NaN for blanks).
+///  - nrings:   number of rings of each field. Rings of all fields are stored
+///              one after the other, ntot in total.
+///  - rings:    initial rings by column, rings[c*ntot+k]: radius (c=0) and
+///              width (c=1) in pixels, then the parameters in ALLPARS order
+///              (c=2+VSYS,...). The centre of the first ring of a field is
+///              used as initial centre for all its rings.
+///  - out:      results by column, out[c*ntot+k]: fitted parameters in ALLPARS
+///              order (c<MAXPAR), their errors (c=MAXPAR+VSYS,...), number of
+///              points (c=2*MAXPAR) and chi-squared (c=2*MAXPAR+1).
+///
+/// Other arguments are as in Ringmodel::setoption() and setSeeds().
+/// Returns the number of rings fitted successfully.
+template <class T>
+long ringfitBatch (int nfields, const T *vfields, const int *dims, const int *nrings, const T *rings,
+                   const bool *mask, int side, int wfunc, float freeangle, int nseeds, T *out, int nthreads=1);
+
+
+/// Model functor of the fitting function above for LsqSolver. The sines and
+/// cosines of the position angle and inclination are recalculated only when
+/// these change, i.e. once per iteration rather than once per pixel.
+template <class T>
+struct VelFieldModel {
+    T operator() (const T *c, const T *p, T *d, int npar) const;
+    T value (const T *c, const T *p, int npar) const;
+private:
+    void angles (const T *p) const;
+    mutable double phi=0, inc=0, cosp=1, sinp=0, cosi=1, sini=0;
+};
 
 
 #endif
@@ -23,9 +23,13 @@
 
 #include <iostream>
 #include <iomanip>
+#include <numeric>
+#include <chrono>
 #include <Tasks/search.hh>
 #include <Arrays/stats.hh>
 #include <Map/objectgrower.hh>
+#include <Map/labeller.hh>
+#include <Map/detectiongrid.hh>
 #include <Map/detection.hh>
 #include <Utilities/progressbar.hh>
 #include <Utilities/utils.hh>
@@ -82,6 +86,9 @@ Search<T>& Search<T>::operator=(const Search<T> &s) {
     this->verbose   = s.verbose;
     this->showbar   = s.showbar;
     this->nthreads  = s.nthreads;
+    this->mergeInput  = s.mergeInput;
+    this->mergeTime   = s.mergeTime;
+    this->mergeMemory = s.mergeMemory;
 
     this->mapAllocated = s.mapAllocated;
     if(this->mapAllocated) {
@@ -143,6 +150,13 @@ void Search<T>::search(T *Array, Stats<T> &stat, size_t xsize, size_t ysize, siz
         ObjectMerger();
         if (verbose) std::cout << "Done.                      " << std::endl;
      }
+     if (verbose && mergeInput>0) {
+        std::streamsize prec = std::cout.precision(4);
+        std::cout << "  Merging throughput: " << mergeInput/std::max(mergeTime,1.E-06)
+                  << " objects/s (" << mergeInput << " objects in " << mergeTime << " s).\n"
+                  << "  Merging index peak memory: " << mergeMemory/1048576. << " MB.\n";
+        std::cout.precision(prec);
+     }
      if (verbose) std::cout << "  ... All done.\n\nFinal object count = " << getNumObj() << std::endl << std::endl;
 
 }
@@ -154,6 +168,7 @@ void Search<T>::search(T *Array, size_t xsize, size_t ysize, size_t zsize, bool
     // Computing statistics for the input array
     Stats<T> stat;
     stat.setRobust(useRobust);
+    stat.setThreads(Nthreads);
     size_t numPix = xsize*ysize*zsize;
     bool *blanks = new bool[numPix];
     for (size_t i=0; i<numPix; i++) blanks[i] = isBlank(Array[i]) ? false : true;
@@ -165,19 +180,54 @@ void Search<T>::search(T *Array, size_t xsize, size_t ysize, size_t zsize, bool
 }
 
 
+template <class T>
+void Search<T>::mergeSlabs(DetVec<T> &slabObjects, size_t xsize, size_t ysize, size_t zsize, bool Verbose) {
+
+    /// Builds the final list of detections from objects found in separate
+    /// slabs of the same array (see Cube::searchSlabs), when the array has
+    /// never been in memory. Pieces of an object cut by slab boundaries
+    /// share the voxels of the overlapping channels or are within the
+    /// merging thresholds, so they are merged here. The rejection criteria
+    /// are applied only to the merged objects.
+    ///
+    /// \param slabObjects  Objects of all slabs, in the coordinates of the full array.
+    /// \param xsize,ysize,zsize  Dimensions of the full array.
+
+    xSize = xsize;
+    ySize = ysize;
+    zSize = zsize;
+    verbose = Verbose;
+    showbar = false;
+
+    if (mapAllocated) delete [] detectMap;
+    detectMap = new short[xsize*ysize]();
+    mapAllocated = true;
+
+    *objectList = slabObjects;
+    if (verbose) std::cout << "  Merging and Rejecting " << getNumObj() << " objects from slabs... " << std::flush;
+    mergeList(*objectList);
+    finaliseList(*objectList);
+    if(par.maxChannels!=-1 || par.maxAngSize!=-1) rejectObjects(*objectList);
+    updateDetectMap();
+    if (verbose) std::cout << "Done.\n  ... All done.\n\nFinal object count = " << getNumObj() << std::endl << std::endl;
+}
+
+
 template <class T>
 DetVec<T> Search<T>::search3DArray() {
 
     /// A simple front end function to choose spatial
     /// or spectral research. If [searchType] parameter
     /// is not "spatial" or "spectral", return an empty
-    /// list of object detected.
+    /// list of object detected. If labelling is requested,
+    /// the connected components are labelled directly with
+    /// the connectivity of the chosen search type.
 
     std::string stype = par.searchType;
     if (stype.find("spatial")!=std::string::npos || zSize==1)
-        return search3DArraySpatial();
+        return par.flagLabelling ? search3DArrayLabel() : search3DArraySpatial();
     else if(stype=="spectral" )
-        return search3DArraySpectral();
+        return par.flagLabelling ? search3DArrayLabel() : search3DArraySpectral();
     else {
         std::cout << "Unknown search type : " << stype << std::endl;
         return DetVec<T>(0);
@@ -203,6 +253,7 @@ DetVec<T> Search<T>::search3DArraySpectral() {
         bar.init("Searching in progress... ",ySize);
 
         T *spectrum = new T[zSize];
+        DetectionGrid<T> grid = mergingGrid();
 
         for(int y=0; y<ySize; y++){
             bar.update(y+1);
@@ -220,7 +271,7 @@ DetVec<T> Search<T>::search3DArraySpectral() {
                         newObject.addPixel(x,y,z);
                     }
                     newObject.setOffsets();
-                    if(par.TwoStageMerging) mergeIntoList(newObject,outputList);
+                    if(par.TwoStageMerging) mergeIntoList(newObject,outputList,&grid);
                     else outputList.push_back(newObject);
                 }
             }
@@ -249,6 +300,7 @@ DetVec<T> Search<T>::search3DArraySpatial() {
     bool useBar = (zSize>1);
 
     ProgressBar bar(false,verbose,useBar&&showbar);
+    DetectionGrid<T> grid = mergingGrid();
 
 #pragma omp parallel num_threads(nthreads)
 {
@@ -267,7 +319,7 @@ DetVec<T> Search<T>::search3DArraySpatial() {
             newObject.setOffsets();
 #pragma omp critical
 {
-            if(par.TwoStageMerging) mergeIntoList(newObject,outputList);
+            if(par.TwoStageMerging) mergeIntoList(newObject,outputList,&grid);
             else outputList.push_back(newObject);
 }
         }
@@ -281,6 +333,30 @@ DetVec<T> Search<T>::search3DArraySpatial() {
 }
 
 
+template <class T>
+DetVec<T> Search<T>::search3DArrayLabel() {
+
+  ///  The function labels the 3D connected components of the
+  ///  thresholded array with ObjectLabeller. Detections are already
+  ///  merged according to threshSpatial and threshVelocity, so no
+  ///  further merging is needed.
+  ///
+  ///  \return A std::vector of detected objects.
+
+    ProgressBar bar(false,verbose,showbar);
+    bar.init("Searching in progress... ",1);
+
+    ObjectLabeller<T> labeller;
+    labeller.define(stats,array,xSize,ySize,zSize,par,nthreads);
+    DetVec<T> outputList = labeller.label();
+
+    bar.update(1);
+    bar.fillSpace("Found "+to_string(outputList.size())+" items.\n");
+
+    return outputList;
+}
+
+
 template <class T>
 ScanVec<T> Search<T>::findSources1D(T *spectrum, int minSize) {
 
@@ -534,7 +610,8 @@ void Search<T>::ObjectMerger() {
 
         if(par.RejectBeforeMerge) finaliseList(currentList);
 
-        mergeList(currentList);
+        // Labelled components cannot be merged any further
+        if(!par.flagLabelling) mergeList(currentList);
 
         // Do growth stuff
         if(par.flagGrowth) {
@@ -596,74 +673,88 @@ void Search<T>::mergeList(DetVec<T> &objList) {
     /// A function that merges any objects in the list of
     /// Detections that are within stated threshold distances.
     /// Determination of whether objects are close is done by
-    /// the function areClose.
+    /// the function canMerge.
+    ///
+    /// Candidate pairs are taken from a DetectionGrid, so that only
+    /// objects with overlapping padded boxes are compared. Since
+    /// canMerge of a merged object is true if it is true for any of
+    /// its parts, merged objects are the connected components of
+    /// the canMerge relation, found with a union-find structure.
+    /// Each component is merged into its first object and the
+    /// original order of the list is preserved.
 
     if(objList.size() > 0){
 
-        typename DetVec<T>::iterator iter;
-        std::vector<bool> isValid(objList.size(),true);
-        int numRemoved=0;
-        size_t counter=0, compCounter,goodCounter=0;
+        auto start = std::chrono::steady_clock::now();
+        size_t nobj = objList.size();
 
-        while(counter < (objList.size()-1)){
-            if(verbose && showbar){
+        // Cells sized as the mean extent of the objects
+        double meanxy = 0, meanz = 0;
+        for(size_t i=0; i<nobj; i++){
+            meanxy += std::max(objList[i].getXmax()-objList[i].getXmin(),
+                               objList[i].getYmax()-objList[i].getYmin()) + 1;
+            meanz  += objList[i].getZmax()-objList[i].getZmin() + 1;
+        }
+        DetectionGrid<T> grid = mergingGrid(lround(meanxy/nobj),lround(meanz/nobj));
+        for(size_t i=0; i<nobj; i++) grid.insert(i,objList[i]);
+
+        std::vector<size_t> parent(nobj), cand;
+        std::iota(parent.begin(),parent.end(),0);
+        auto findRoot = [&parent](size_t i) {
+            while(parent[i]!=i) i = parent[i] = parent[parent[i]];
+            return i;
+        };
+
+        int numRemoved=0;
+        for(size_t i=0; i<nobj; i++){
+            if(verbose && showbar && (i%100==0 || i==nobj-1)){
                 std::cout.setf(std::ios::right);
                 std::cout << "Merging objects: ";
-                std::cout << std::setw(6) << goodCounter+1 << "/" ;
+                std::cout << std::setw(6) << i+1 << "/" ;
                 std::cout.unsetf(std::ios::right);
                 std::cout.setf(std::ios::left);
-                std::cout << std::setw(6) << objList.size()-numRemoved;
+                std::cout << std::setw(6) << nobj-numRemoved;
                 printBackSpace(30);
                 std::cout << std::flush;
                 std::cout.unsetf(std::ios::left);
             }
-            if(isValid[counter]){
-                compCounter = counter + 1;
-                do {
-                    if(isValid[compCounter]){
-                        bool close = objList[counter].canMerge(objList[compCounter], par);
-                        if(close){
-                            objList[counter].addDetection(objList[compCounter]);
-                            isValid[compCounter]=false;
-                            numRemoved++;
-                            if(verbose && showbar){
-                                std::cout.setf(std::ios::right);
-                                std::cout << "Merging objects: ";
-                                std::cout << std::setw(6) << goodCounter+1 << "/";
-                                std::cout.unsetf(std::ios::right);
-                                std::cout.setf(std::ios::left);
-                                std::cout << std::setw(6) << objList.size()-numRemoved;
-                                printBackSpace(30);
-                                std::cout << std::flush;
-                                std::cout.unsetf(std::ios::left);
-
-                            }
-                            compCounter = counter + 1;
-                        }
-                        else compCounter++;
-                    }
-                    else compCounter++;
-
-                } while( (compCounter<objList.size()) );
+            grid.query(objList[i],cand);
+            for(size_t k=0; k<cand.size(); k++){
+                size_t j = cand[k];
+                if(j<=i) continue;
+                size_t ri = findRoot(i), rj = findRoot(j);
+                if(ri==rj) continue;
+                if(objList[i].canMerge(objList[j], par)){
+                    parent[std::max(ri,rj)] = std::min(ri,rj);
+                    numRemoved++;
+                }
             }
-            counter++;
-            if(isValid[counter]) goodCounter++;
         }
 
-        DetVec<T> newlist(objList.size()-numRemoved);
+        // Roots are the first objects of their components
+        for(size_t i=0; i<nobj; i++){
+            size_t r = findRoot(i);
+            if(r!=i) objList[r].addDetection(objList[i]);
+        }
+
+        DetVec<T> newlist(nobj-numRemoved);
         size_t ct=0;
-        for(size_t i=0;i<objList.size();i++){
-            if(isValid[i]) newlist[ct++]=objList[i];
+        for(size_t i=0;i<nobj;i++){
+            if(parent[i]==i) newlist[ct++]=objList[i];
         }
         objList.clear();
         objList=newlist;
 
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now()-start;
+        mergeTime   += elapsed.count();
+        mergeInput  += nobj;
+        mergeMemory  = std::max(mergeMemory,grid.getMemory());
     }
 }
 
 
 template <class T>
-void Search<T>::mergeIntoList(Detection<T> &object, DetVec<T> &objList) {
+void Search<T>::mergeIntoList(Detection<T> &object, DetVec<T> &objList, DetectionGrid<T> *grid) {
 
     /// A function to add a detection to a list of detections, checking
     /// first to see if it can be combined with existing members of the
@@ -674,20 +765,58 @@ void Search<T>::mergeIntoList(Detection<T> &object, DetVec<T> &objList) {
     ///
     /// \param object The Detection to be merged into the list.
     /// \param objList The vector list of Detections.
-    /// \param par The Param set, used for testing if merging needs to be done.
+    /// \param grid   An optional DetectionGrid indexing objList. If given,
+    ///               only the candidates returned by the grid are tested.
 
+    auto start = std::chrono::steady_clock::now();
     bool haveMerged = false;
-    typename DetVec<T>::iterator iter;
 
-    for(iter=objList.begin(); (!haveMerged && iter<objList.end()); iter++) {
-        if(iter->canMerge(object, par)){
-            iter->addDetection(object);
-            haveMerged = true;
+    if(grid==nullptr){
+        typename DetVec<T>::iterator iter;
+        for(iter=objList.begin(); (!haveMerged && iter<objList.end()); iter++) {
+            if(iter->canMerge(object, par)){
+                iter->addDetection(object);
+                haveMerged = true;
+            }
+        }
+        if(!haveMerged) objList.push_back(object);
+    }
+    else {
+        std::vector<size_t> cand;
+        grid->query(object,cand);
+        for(size_t k=0; !haveMerged && k<cand.size(); k++) {
+            Detection<T> &obj = objList[cand[k]];
+            if(obj.canMerge(object, par)){
+                obj.addDetection(object);
+                grid->insert(cand[k],obj);
+                haveMerged = true;
+            }
+        }
+        if(!haveMerged) {
+            objList.push_back(object);
+            grid->insert(objList.size()-1,objList.back());
         }
+        mergeMemory = std::max(mergeMemory,grid->getMemory());
     }
 
-    if(!haveMerged) objList.push_back(object);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now()-start;
+    mergeTime += elapsed.count();
+    mergeInput++;
+}
+
+
+template <class T>
+DetectionGrid<T> Search<T>::mergingGrid(long sizexy, long sizez) {
+
+    /// Returns an empty DetectionGrid, with query padding equal to the
+    /// gaps used by Detection::isNear(). If cell sizes are not given,
+    /// cells a few times larger than the gaps are used.
 
+    long gapxy = par.flagAdjacent ? 1 : long(ceil(par.threshSpatial));
+    long gapz  = long(ceil(par.threshVelocity));
+    if(sizexy<=0) sizexy = std::max(8L,2*gapxy+1);
+    if(sizez<=0)  sizez  = std::max(4L,2*gapz+1);
+    return DetectionGrid<T>(sizexy+gapxy,sizez+gapz,gapxy,gapz);
 }
 
 
@@ -797,7 +926,7 @@ void Search<T>::updateDetectMap() {
 
 
 template <class T>
-void Search<T>::updateDetectMap(Detection<T> obj) {
+void Search<T>::updateDetectMap(Detection<T> &obj) {
 
     ///  A function that, for the given object, increments the cube's
     ///  detection map by the required amount at each pixel.
@@ -805,10 +934,7 @@ void Search<T>::updateDetectMap(Detection<T> obj) {
     ///  \param obj     A Detection object that is being
     ///                 incorporated into the map.
 
-    std::vector<Voxel<T> > vlist = obj.template getPixelSet<T>();
-    typename std::vector<Voxel<T> >::iterator vox;
-    for(vox=vlist.begin();vox<vlist.end();vox++)
-        detectMap[vox->getX()+vox->getY()*xSize]++;
+    obj.forEachVoxel([&](long x, long y, long /*z*/) {detectMap[x+y*xSize]++;});
 
 }
 
@@ -30,6 +30,7 @@
 #include <Arrays/stats.hh>
 #include <Arrays/param.hh>
 #include <Map/detection.hh>
+#include <Map/detectiongrid.hh>
 
 using namespace Statistics;
 using namespace std;
@@ -92,6 +93,8 @@ public:
                 bool useRobust=true, int nthreads=1, bool Verbose=true, bool Showbar=true);
     void search(T *Array, size_t xsize, size_t ysize=1, size_t zsize=1,
                 bool useRobust=true, int nthreads=1, bool Verbose=true, bool Showbar=true);
+    // Front-end function to merge and reject detections found in separate slabs of an array.
+    void mergeSlabs(DetVec<T> &slabObjects, size_t xsize, size_t ysize, size_t zsize, bool Verbose=true);
     // A function to select the largest detection.
     Detection<T>* LargestDetection ();
 
@@ -108,11 +111,15 @@ private:
     bool      verbose = true;                 //< Whether to print output messages.
     bool      showbar = true;                 //< Whether to use a progressbar.
     int       nthreads = 1;                   //< Number of threads for searching.
+    size_t    mergeInput = 0;                 //< Number of objects processed by merging functions.
+    double    mergeTime = 0;                  //< Time spent in merging functions (s).
+    size_t    mergeMemory = 0;                //< Peak memory of merging indexes (bytes).
 
     // Functions to perform the search
     DetVec<T>   search3DArray();                                     // Switch functions for spectral or spatial.
     DetVec<T>   search3DArraySpectral();                             // Research objects along 1-D spectra.
     DetVec<T>   search3DArraySpatial();                              // Research objects along 2-D channels maps.
+    DetVec<T>   search3DArrayLabel();                                // Label 3-D connected components.
     ScanVec<T>  findSources1D(T *spectrum, int minSize);             // Front-end function to spectrumDetect.
     ScanVec<T>  spectrumDetect(vector<bool> &arraybool, int minSize);// Find sources in a 1-D spectrum.
     Obj2DVec<T> findSources2D(T *image, int minSize);                // Front-end function to imageDetect.
@@ -122,9 +129,11 @@ private:
     void    mergeList(DetVec<T> &objList);                           // Merge a list of pixel in a single object.
     void    finaliseList(DetVec<T> &objList);                        // Verify if a detection can be considered an object.
     void    rejectObjects(DetVec<T> &objList);                       // Verify if a detection can be considered an object.
-    void    mergeIntoList(Detection<T> &obj, DetVec<T> &objList);    // Add an object in a detection list.
+    void    mergeIntoList(Detection<T> &obj, DetVec<T> &objList,
+                          DetectionGrid<T> *grid=nullptr);           // Add an object in a detection list.
+    DetectionGrid<T> mergingGrid(long sizexy=0, long sizez=0);       // Empty grid index for merging.
     void    updateDetectMap();                                       // Update the map of detected pixels.
-    void    updateDetectMap(Detection<T> obj);                       // Update the map of detected pixels for a Detection.
+    void    updateDetectMap(Detection<T> &obj);                      // Update the map of detected pixels for a Detection.
 
 };
 
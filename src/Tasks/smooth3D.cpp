@@ -29,6 +29,7 @@
 #include <Utilities/utils.hh>
 #include <Utilities/progressbar.hh>
 #include <Utilities/conv2D.hh>
+#include <Utilities/allocator.hpp>
 
 #define BLANK 0xff800000    
 
@@ -975,12 +976,12 @@ void SpectralSmooth3D<T>::smooth(T *inarray, size_t xsize, size_t ysize, size_t
 
 #pragma omp parallel for num_threads(nthreads)
     for (size_t i=0; i<xsize*ysize; i++) {
-        T *spec = new T[zsize];
+        ScratchScope scratch;
+        T *spec = scratch.alloc<T>(zsize);
+        T *specsmooth = scratch.alloc<T>(zsize);
         for (size_t z=0; z<zsize; z++) spec[z] = inarray[i+z*ysize*xsize];
-        T* specsmooth = Smooth1D<T>(spec,zsize,windowtype,windowsize);
+        Smooth1D<T>(spec,specsmooth,zsize,windowtype,windowsize);
         for (size_t z=0; z<zsize; z++) array[i+z*ysize*xsize] = specsmooth[z];
-        delete [] specsmooth;
-        delete [] spec;
     }
 }
 
@@ -25,6 +25,12 @@
 #define ALLOCATOR_HPP_
 
 #include <iostream>
+#include <vector>
+#include <new>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
 
 
 template <class Type>
@@ -77,4 +83,95 @@ inline void deallocate_3D (Type ***array3d, int xdim, int ydim) {
     delete [] array3d;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////
+/// A per-thread arena for temporary arrays. Memory is taken from blocks that
+/// are kept for the whole run, so that functions called many times (once per
+/// spectrum, per pixel or per model) do not go through new/delete. Arrays are
+/// not freed one by one: they are released all together by a ScratchScope.
+/// Only types with a trivial destructor can be allocated.
+/////////////////////////////////////////////////////////////////////////////////////
+class ScratchArena
+{
+public:
+    struct Mark {size_t block, used;};
+
+    static ScratchArena& local() {thread_local ScratchArena arena; return arena;}
+
+    Mark mark() const {return {current, blocks.empty() ? 0 : blocks[current].used};}
+
+    void release(Mark m) {
+        // Everything allocated after the mark is released. Blocks are kept.
+        if (blocks.empty()) return;
+        for (size_t i=m.block+1; i<=current && i<blocks.size(); i++) blocks[i].used = 0;
+        current = m.block;
+        blocks[current].used = m.used;
+    }
+
+    template <class Type>
+    Type* allocate(size_t n) {
+        static_assert(std::is_trivially_destructible<Type>::value, "ScratchArena: type must be trivially destructible");
+        size_t bytes = std::max<size_t>(n*sizeof(Type),1);
+        while (true) {
+            if (current<blocks.size()) {
+                Block &b = blocks[current];
+                size_t start = (b.used+alignment-1)/alignment*alignment;
+                if (start+bytes<=b.size) {
+                    b.used = start+bytes;
+                    return reinterpret_cast<Type*>(b.data.get()+start);
+                }
+                if (current+1<blocks.size()) {current++; blocks[current].used = 0; continue;}
+            }
+            // A new block, at least twice the size of the last one
+            size_t size = std::max(blocks.empty() ? minBlock : 2*blocks.back().size, bytes);
+            char *data = static_cast<char*>(::operator new[](size, std::align_val_t(alignment)));
+            blocks.push_back({BlockPtr(data), size, 0});
+            current = blocks.size()-1;
+        }
+    }
+
+private:
+    static const size_t alignment = 64;     ///< Alignment of the blocks and arrays (a cache line).
+    static const size_t minBlock = 1<<16;   ///< Size of the first block.
+
+    struct Free {void operator()(char *p) const {::operator delete[](p, std::align_val_t(alignment));}};
+    typedef std::unique_ptr<char[],Free> BlockPtr;
+    struct Block {BlockPtr data; size_t size, used;};
+
+    std::vector<Block> blocks;              ///< Memory blocks, kept for the whole run.
+    size_t current = 0;                     ///< Block where the next array is taken.
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// Releases, when it goes out of scope, all the temporary arrays allocated
+/// with it (or with ScratchArena::local() of the same thread) since its
+/// creation. Scopes must be nested, as local variables are. Example:
+///
+///     ScratchScope scratch;
+///     double *spectrum = scratch.alloc<double>(nchan);
+///
+/////////////////////////////////////////////////////////////////////////////////////
+class ScratchScope
+{
+public:
+    ScratchScope() : arena(ScratchArena::local()), start(arena.mark()) {}
+    ~ScratchScope() {arena.release(start);}
+    ScratchScope(const ScratchScope&) = delete;
+    ScratchScope& operator=(const ScratchScope&) = delete;
+
+    template <class Type>
+    Type* alloc(size_t n) {return arena.allocate<Type>(n);}
+
+    template <class Type>
+    Type* alloc(size_t n, Type value) {
+        Type *a = arena.allocate<Type>(n);
+        std::fill_n(a, n, value);
+        return a;
+    }
+
+private:
+    ScratchArena &arena;
+    ScratchArena::Mark start;
+};
+
 #endif
@@ -23,6 +23,14 @@
 
 #include <iostream>
 #include <cstring>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <fcntl.h>
+#include <unistd.h>
 #include <fitsio.h>
 #include <Utilities/utils.hh>
 #include <Arrays/cube.hh>
@@ -39,6 +47,19 @@ template <> int selectDatatype<long>() {return TLONG;}
 template <> int selectDatatype<float>() {return TFLOAT;}
 template <> int selectDatatype<double>() {return TDOUBLE;}
 
+int selectCompression(std::string type) {
+
+    /// Returns the CFITSIO tile-compression code for a COMPRESS* parameter
+    /// (0 for no compression).
+
+    if (type=="RICE") return RICE_1;
+    else if (type=="GZIP") return GZIP_1;
+    else if (type=="GZIP2") return GZIP_2;
+    else if (type=="HCOMPRESS") return HCOMPRESS_1;
+    else if (type=="PLIO") return PLIO_1;
+    return 0;
+}
+
 
 void FitsWrite_2D (const char *filename, float *image, long xsize, long ysize) {
     
@@ -116,6 +137,7 @@ void FitsWrite_3D (const char *outfile, float *outcube, long *dimAxes) {
     long dnaxes[3] = {dimAxes[0], dimAxes[1], dimAxes[2]};
     long naxes[3] = {dimAxes[2], dimAxes[1], dimAxes[0]};
  
+    FitsWrite_wait(outfile);
     remove(outfile);             
     status = 0;   
     fits_create_file(&fptr, outfile, &status);  
@@ -139,6 +161,7 @@ void FitsWrite_3D (const char *outfile, short *outcube, long *dimAxes) {
     long dnaxes[3] = {dimAxes[0], dimAxes[1], dimAxes[2]};
     long naxes[3] = {dimAxes[2], dimAxes[1], dimAxes[0]};
  
+    FitsWrite_wait(outfile);
     remove(outfile);             
     status = 0;   
     fits_create_file(&fptr, outfile, &status);  
@@ -154,6 +177,138 @@ void FitsWrite_3D (const char *outfile, short *outcube, long *dimAxes) {
 }
 
 
+namespace {
+    std::mutex pendingMutex;
+    std::vector<std::pair<std::string,std::future<bool>>> pendingWrites;   // Data being written in background, by file
+    struct PendingWaiter {~PendingWaiter() {FitsWrite_wait();}} pendingWaiter;
+
+    long FitsDataStart (int fd) {
+
+        // Returns the byte offset of the data unit of the primary HDU of a
+        // FITS file, i.e. the end of the 2880-byte block with the END card.
+
+        char block[2880];
+        for (long off=0; pread(fd,block,2880,off)==2880; off+=2880) {
+            for (int c=0; c<2880; c+=80)
+                if (strncmp(block+c,"END     ",8)==0) return off+2880;
+        }
+        return -1;
+    }
+
+    void swapBytes (char *buf, size_t nbytes, size_t width) {
+
+        // Swaps the byte order of values of "width" bytes, in place.
+
+        if (width==2) {
+            uint16_t v;
+            for (size_t k=0; k<nbytes; k+=2) {memcpy(&v,buf+k,2); v=__builtin_bswap16(v); memcpy(buf+k,&v,2);}
+        }
+        else if (width==4) {
+            uint32_t v;
+            for (size_t k=0; k<nbytes; k+=4) {memcpy(&v,buf+k,4); v=__builtin_bswap32(v); memcpy(buf+k,&v,4);}
+        }
+        else if (width==8) {
+            uint64_t v;
+            for (size_t k=0; k<nbytes; k+=8) {memcpy(&v,buf+k,8); v=__builtin_bswap64(v); memcpy(buf+k,&v,8);}
+        }
+    }
+
+    bool writeDataUnit (std::string outfile, const char *data, size_t nbytes, size_t width, int nthreads) {
+
+        // Extends the file to its full size and writes the data in blocks,
+        // converted to big-endian, from several threads.
+
+        const size_t blockSize = 1<<22;             // Bytes per pwrite
+
+        int fd = open(outfile.c_str(), O_RDWR);
+        if (fd<0) {
+            std::cerr << "FITS ERROR: cannot open " << outfile << " for writing.\n";
+            return false;
+        }
+        long start = FitsDataStart(fd);
+        size_t fullsize = start+((nbytes+2879)/2880)*2880;
+        if (start<0 || ftruncate(fd,fullsize)!=0) {
+            std::cerr << "FITS ERROR: cannot write the data unit of " << outfile << ".\n";
+            close(fd);
+            return false;
+        }
+
+        const uint16_t one = 1;
+        bool swap = *reinterpret_cast<const char*>(&one)==1;
+        size_t nblocks = (nbytes+blockSize-1)/blockSize;
+        bool ok = true;
+#pragma omp parallel num_threads(std::max(nthreads,1)) reduction(&&:ok)
+{
+        std::vector<char> buf(blockSize);
+#pragma omp for schedule(dynamic)
+        for (size_t b=0; b<nblocks; b++) {
+            size_t first = b*blockSize, n = std::min(blockSize,nbytes-first);
+            memcpy(buf.data(),data+first,n);
+            if (swap) swapBytes(buf.data(),n,width);
+            for (size_t done=0; done<n;) {
+                ssize_t w = pwrite(fd,buf.data()+done,n-done,start+first+done);
+                if (w<=0) {ok = false; break;}
+                done += w;
+            }
+        }
+}
+        if (close(fd)!=0) ok = false;
+        if (!ok) std::cerr << "FITS ERROR: cannot write the data unit of " << outfile << ".\n";
+        return ok;
+    }
+}
+
+
+template <class T>
+bool FitsWrite_data (const char *outfile, T *data, size_t size, int nthreads, bool async) {
+
+    /// Writes an array in the data unit of a FITS file whose header has
+    /// already been written (e.g. a file closed after fits_create_img and
+    /// the header keywords). The FITS type must have the same size of T.
+    /// Blocks of data are written with pwrite by "nthreads" threads into
+    /// the file, which is first extended to its full size.
+    ///
+    /// If async is true, the array is copied and written in background,
+    /// and the function returns immediately. FitsWrite_wait() must be
+    /// called before the file is used.
+
+    size_t nbytes = size*sizeof(T);
+    if (!async) return writeDataUnit(outfile,reinterpret_cast<const char*>(data),nbytes,sizeof(T),nthreads);
+
+    auto copy = std::make_shared<std::vector<T>>(data,data+size);
+    std::string fname(outfile);
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    pendingWrites.emplace_back(fname, std::async(std::launch::async, [copy,fname,nbytes,nthreads]() {
+        return writeDataUnit(fname,reinterpret_cast<const char*>(copy->data()),nbytes,sizeof(T),nthreads);
+    }));
+    return true;
+}
+template bool FitsWrite_data(const char*, short*, size_t, int, bool);
+template bool FitsWrite_data(const char*, int*, size_t, int, bool);
+template bool FitsWrite_data(const char*, long*, size_t, int, bool);
+template bool FitsWrite_data(const char*, float*, size_t, int, bool);
+template bool FitsWrite_data(const char*, double*, size_t, int, bool);
+
+
+bool FitsWrite_wait (std::string outfile) {
+
+    /// Waits for the background writes started by FitsWrite_data() to
+    /// "outfile", or for all of them if "outfile" is empty. Returns false
+    /// if any of them failed.
+
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    bool ok = true;
+    auto last = std::remove_if(pendingWrites.begin(), pendingWrites.end(),
+                               [&](std::pair<std::string,std::future<bool>> &w) {
+        if (!outfile.empty() && w.first!=outfile) return false;
+        ok = w.second.get() && ok;
+        return true;
+    });
+    pendingWrites.erase(last, pendingWrites.end());
+    return ok;
+}
+
+
 int modhead(int argc, char *argv[]) {
     
     // This function is modified from "modhead" FITS utility from NASA
@@ -0,0 +1,391 @@
+//----------------------------------------------------------------
+// gaussfit.cpp: Fit of Gaussian functions to spectra.
+//----------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <Utilities/gaussfit.hh>
+#include <Utilities/allocator.hpp>
+
+#define LABSTART    1.0e-03         // Initial value for labda.
+#define LABMIN      1.0e-10         // Minimum value for labda.
+#define LABFAC      10.0            // Labda step factor.
+#define LABMAX      1.0e+10         // Maximum value for labda.
+
+
+namespace {
+
+// Working arrays of the fit. Slot j of each array is a spectrum being
+// fitted, slots are compacted as spectra converge. Arrays have stride "cap".
+struct GaussWork {
+    size_t cap, n;          // Number of allocated and used slots
+    int    *idx;            // Index of the spectrum in each slot
+    double *ys;             // Spectra, ys[z*cap+j]
+    double *p, *t;          // Parameters and trial parameters, p[k*cap+j]
+    double *A, *g;          // Normal matrix (6 elements) and gradient (3)
+    double *chi, *tchi;     // Chi-squared at p and at t
+    double *lab;            // Mixing parameter
+};
+
+
+void normalEquations (const double *vels, int nchan, GaussWork &w) {
+
+    // Builds the normal equations J^T J and J^T r, and the chi-squared at p.
+
+    const size_t n = w.n, cap = w.cap;
+    std::fill_n(w.A,6*cap,0.);
+    std::fill_n(w.g,3*cap,0.);
+    std::fill_n(w.chi,cap,0.);
+
+    const double *a = w.p, *c = w.p+cap, *s = w.p+2*cap;
+    double *A00 = w.A, *A01 = w.A+cap, *A02 = w.A+2*cap, *A11 = w.A+3*cap, *A12 = w.A+4*cap, *A22 = w.A+5*cap;
+    double *g0 = w.g, *g1 = w.g+cap, *g2 = w.g+2*cap, *chi = w.chi;
+
+    for (int z=0; z<nchan; z++) {
+        const double v = vels[z];
+        const double *y = w.ys+z*cap;
+#pragma omp simd
+        for (size_t j=0; j<n; j++) {
+            double is = 1./s[j], d = (v-c[j])*is;
+            double e = exp(-0.5*d*d), m = a[j]*e, r = y[j]-m;
+            double j0 = e, j1 = m*d*is, j2 = j1*d;
+            chi[j] += r*r;
+            g0[j]  += r*j0; g1[j]  += r*j1; g2[j]  += r*j2;
+            A00[j] += j0*j0; A01[j] += j0*j1; A02[j] += j0*j2;
+            A11[j] += j1*j1; A12[j] += j1*j2; A22[j] += j2*j2;
+        }
+    }
+}
+
+
+void chiSquared (const double *vels, int nchan, GaussWork &w) {
+
+    // Chi-squared at the trial parameters t.
+
+    const size_t n = w.n, cap = w.cap;
+    std::fill_n(w.tchi,cap,0.);
+    const double *a = w.t, *c = w.t+cap, *s = w.t+2*cap;
+    double *chi = w.tchi;
+
+    for (int z=0; z<nchan; z++) {
+        const double v = vels[z];
+        const double *y = w.ys+z*cap;
+#pragma omp simd
+        for (size_t j=0; j<n; j++) {
+            double d = (v-c[j])/s[j];
+            double r = y[j]-a[j]*exp(-0.5*d*d);
+            chi[j] += r*r;
+        }
+    }
+}
+
+
+bool trialStep (GaussWork &w, size_t j) {
+
+    // Solves (M + labda*I) x = g, where M is J^T J scaled to a unit diagonal
+    // as in Lsqfit, with the Cholesky decomposition. Returns false if J^T J
+    // has a null diagonal, as Lsqfit::getvec does.
+
+    const size_t cap = w.cap;
+    double A00 = w.A[j], A01 = w.A[cap+j], A02 = w.A[2*cap+j];
+    double A11 = w.A[3*cap+j], A12 = w.A[4*cap+j], A22 = w.A[5*cap+j];
+    if (!(A00>0 && A11>0 && A22>0)) return false;
+
+    double d0 = sqrt(A00), d1 = sqrt(A11), d2 = sqrt(A22), l = 1+w.lab[j];
+    double m01 = A01/(d0*d1), m02 = A02/(d0*d2), m12 = A12/(d1*d2);
+    double b0 = w.g[j]/d0, b1 = w.g[cap+j]/d1, b2 = w.g[2*cap+j]/d2;
+
+    double L00 = sqrt(l);
+    double L10 = m01/L00, L20 = m02/L00;
+    double L11 = sqrt(l-L10*L10);
+    double L21 = (m12-L20*L10)/L11;
+    double L22 = sqrt(l-L20*L20-L21*L21);
+
+    double y0 = b0/L00, y1 = (b1-L10*y0)/L11, y2 = (b2-L20*y0-L21*y1)/L22;
+    double x2 = y2/L22, x1 = (y1-L21*x2)/L11, x0 = (y0-L10*x1-L20*x2)/L00;
+
+    w.t[j]       = w.p[j]+x0/d0;
+    w.t[cap+j]   = w.p[cap+j]+x1/d1;
+    w.t[2*cap+j] = w.p[2*cap+j]+x2/d2;
+    return true;
+}
+
+
+template <class T>
+T profile (T v, int ncomp, bool hermite, const T *p, T *d) {
+
+    // Value at v of the model of fitProfile and, if d is not null, its
+    // derivatives with respect to the parameters.
+
+    if (hermite) {
+        const T c3 = 1/sqrt(3.), c4 = 1/sqrt(24.);
+        T s = p[2], w = (v-p[1])/s, w2 = w*w, g = exp(-0.5*w2);
+        T H3 = (2*w2-3)*w*c3, H4 = ((4*w2-12)*w2+3)*c4;
+        T P = 1+p[3]*H3+p[4]*H4;
+        if (d!=nullptr) {
+            T dH3 = (6*w2-3)*c3, dH4 = (16*w2-24)*w*c4;
+            T dw = p[0]*g*(-w*P+p[3]*dH3+p[4]*dH4);
+            d[0] = g*P;
+            d[1] = -dw/s;
+            d[2] = -dw*w/s;
+            d[3] = p[0]*g*H3;
+            d[4] = p[0]*g*H4;
+        }
+        return p[0]*g*P;
+    }
+
+    T y = 0;
+    for (int k=0; k<ncomp; k++) {
+        const T *q = p+3*k;
+        T w = (v-q[1])/q[2], e = exp(-0.5*w*w), m = q[0]*e;
+        y += m;
+        if (d!=nullptr) {
+            d[3*k]   = e;
+            d[3*k+1] = m*w/q[2];
+            d[3*k+2] = m*w*w/q[2];
+        }
+    }
+    return y;
+}
+
+
+void moveSlot (GaussWork &w, int nchan, size_t from, size_t to) {
+
+    const size_t cap = w.cap;
+    w.idx[to] = w.idx[from];
+    for (int z=0; z<nchan; z++) w.ys[z*cap+to] = w.ys[z*cap+from];
+    for (int k=0; k<3; k++) w.p[k*cap+to] = w.p[k*cap+from];
+    for (int k=0; k<6; k++) w.A[k*cap+to] = w.A[k*cap+from];
+    for (int k=0; k<3; k++) w.g[k*cap+to] = w.g[k*cap+from];
+    w.chi[to] = w.chi[from];
+    w.lab[to] = w.lab[from];
+}
+
+}
+
+
+template <class T>
+int fitGaussians (const T *vels, const T *spec, int nchan, int nspec, T *par, bool *ok, int maxiter, double tol) {
+
+    /// Fits a Gaussian to the spectra flagged in "ok" (see gaussfit.hh).
+    /// Each spectrum follows the same sequence of steps as with Lsqfit: a
+    /// step is accepted if it lowers the chi-squared and labda is decreased,
+    /// otherwise labda is increased. A fit has converged when the relative
+    /// change of chi-squared is below "tol" or labda exceeds its maximum.
+    /// Converged spectra are removed from the working arrays, so that the
+    /// last iterations only deal with the slowest spectra.
+
+    ScratchScope scratch;
+
+    int nfit = 0;
+    for (int i=0; i<nspec; i++) nfit += ok[i];
+    if (nfit==0) return 0;
+
+    double *v = scratch.alloc<double>(nchan);
+    for (int z=0; z<nchan; z++) v[z] = vels[z];
+
+    GaussWork w;
+    w.cap  = w.n = nfit;
+    w.idx  = scratch.alloc<int>(nfit);
+    w.ys   = scratch.alloc<double>(size_t(nchan)*nfit);
+    w.p    = scratch.alloc<double>(3*nfit);
+    w.t    = scratch.alloc<double>(3*nfit);
+    w.A    = scratch.alloc<double>(6*nfit);
+    w.g    = scratch.alloc<double>(3*nfit);
+    w.chi  = scratch.alloc<double>(nfit);
+    w.tchi = scratch.alloc<double>(nfit);
+    w.lab  = scratch.alloc<double>(nfit,LABSTART);
+
+    for (int i=0, j=0; i<nspec; i++) {
+        if (!ok[i]) continue;
+        w.idx[j] = i;
+        for (int k=0; k<3; k++) w.p[k*w.cap+j] = par[k*nspec+i];
+        j++;
+    }
+    for (int z=0; z<nchan; z++)
+        for (size_t j=0; j<w.cap; j++) w.ys[z*w.cap+j] = spec[size_t(z)*nspec+w.idx[j]];
+
+    // Stores the result of slot j
+    auto finish = [&](size_t j, bool converged) {
+        int i = w.idx[j];
+        double a = w.p[j], c = w.p[w.cap+j], s = fabs(w.p[2*w.cap+j]);
+        ok[i] = converged && std::isfinite(a) && std::isfinite(c) && std::isfinite(s) && s>0;
+        par[i] = a; par[nspec+i] = c; par[2*nspec+i] = s;
+    };
+
+    char *state = scratch.alloc<char>(nfit,0);      // 0 = fitting, 1 = converged, 2 = failed
+    int its = 0;
+    normalEquations(v,nchan,w);
+
+    while (w.n>0 && its<maxiter) {
+        its++;
+
+        for (size_t j=0; j<w.n; j++) {
+            if (state[j]) continue;
+            if (!trialStep(w,j)) {
+                state[j] = 2;
+                for (int k=0; k<3; k++) w.t[k*w.cap+j] = w.p[k*w.cap+j];
+            }
+        }
+
+        chiSquared(v,nchan,w);
+
+        size_t nactive = 0;
+        for (size_t j=0; j<w.n; j++) {
+            if (state[j]) continue;
+            if (w.tchi[j]<w.chi[j]) {
+                bool conv = w.chi[j]-w.tchi[j]<=tol*w.chi[j];
+                for (int k=0; k<3; k++) w.p[k*w.cap+j] = w.t[k*w.cap+j];
+                w.lab[j] = std::max(w.lab[j]/LABFAC,LABMIN);
+                if (conv) state[j] = 1;
+            }
+            else if ((w.lab[j]*=LABFAC)>LABMAX) state[j] = 1;
+            nactive += state[j]==0;
+        }
+
+        // Removing the spectra that are done, when they are many enough
+        if (nactive<=3*w.n/4) {
+            size_t m = 0;
+            for (size_t j=0; j<w.n; j++) {
+                if (state[j]) {finish(j,state[j]==1); continue;}
+                if (m!=j) moveSlot(w,nchan,j,m);
+                state[m++] = 0;
+            }
+            w.n = m;
+        }
+
+        if (w.n>0) normalEquations(v,nchan,w);
+    }
+
+    // Spectra still fitting have reached the maximum number of iterations
+    for (size_t j=0; j<w.n; j++) finish(j,state[j]==1);
+
+    return its;
+}
+template int fitGaussians (const float*,const float*,int,int,float*,bool*,int,double);
+template int fitGaussians (const double*,const double*,int,int,double*,bool*,int,double);
+
+
+template <class T>
+T profileValue (T v, int ncomp, bool hermite, const T *par) {
+    return profile<T>(v,ncomp,hermite,par,nullptr);
+}
+template float profileValue (float,int,bool,const float*);
+template double profileValue (double,int,bool,const double*);
+
+
+template <class T>
+int fitProfile (const T *vels, const T *spec, int nchan, int ncomp, bool hermite, T *par, double &rss, int maxiter, double tol) {
+
+    /// Levenberg-Marquardt fit with the same steps as Lsqfit, with analytic
+    /// derivatives. The scaled normal equations are solved with a Cholesky
+    /// decomposition.
+
+    const int npar = hermite ? 5 : 3*ncomp;
+    if (npar==0) return -2;
+    if (npar>=nchan) return -3;
+
+    ScratchScope scratch;
+    double *A = scratch.alloc<double>(npar*npar);       // J^T J
+    double *b = scratch.alloc<double>(npar);            // J^T r
+    double *L = scratch.alloc<double>(npar*npar);       // Cholesky factor
+    double *x = scratch.alloc<double>(npar);
+    double *dg = scratch.alloc<double>(npar);
+    T *d = scratch.alloc<T>(npar);
+    T *t = scratch.alloc<T>(npar);
+
+    // Normal equations and residual sum of squares at p
+    auto normal = [&](const T *p) {
+        std::fill_n(A,npar*npar,0.);
+        std::fill_n(b,npar,0.);
+        double chi = 0;
+        for (int z=0; z<nchan; z++) {
+            double r = spec[z]-profile<T>(vels[z],ncomp,hermite,p,d);
+            chi += r*r;
+            for (int j=0; j<npar; j++) {
+                b[j] += r*d[j];
+                for (int i=0; i<=j; i++) A[j*npar+i] += d[j]*d[i];
+            }
+        }
+        return chi;
+    };
+
+    auto chisq = [&](const T *p) {
+        double chi = 0;
+        for (int z=0; z<nchan; z++) {
+            double r = spec[z]-profile<T>(vels[z],ncomp,hermite,p,nullptr);
+            chi += r*r;
+        }
+        return chi;
+    };
+
+    double lab = LABSTART;
+    rss = normal(par);
+
+    for (int its=1; its<=maxiter; its++) {
+
+        for (int j=0; j<npar; j++) {
+            if (A[j*npar+j]<=0) return -5;
+            dg[j] = sqrt(A[j*npar+j]);
+        }
+
+        // Cholesky decomposition of the scaled matrix, with 1+labda on the diagonal
+        for (int j=0; j<npar; j++) {
+            for (int i=j; i<npar; i++) {
+                double sum = i==j ? 1+lab : A[i*npar+j]/(dg[i]*dg[j]);
+                for (int k=0; k<j; k++) sum -= L[i*npar+k]*L[j*npar+k];
+                if (i==j) {
+                    if (sum<=0) return -6;
+                    L[j*npar+j] = sqrt(sum);
+                }
+                else L[i*npar+j] = sum/L[j*npar+j];
+            }
+        }
+        for (int i=0; i<npar; i++) {
+            double sum = b[i]/dg[i];
+            for (int k=0; k<i; k++) sum -= L[i*npar+k]*x[k];
+            x[i] = sum/L[i*npar+i];
+        }
+        for (int i=npar-1; i>=0; i--) {
+            double sum = x[i];
+            for (int k=i+1; k<npar; k++) sum -= L[k*npar+i]*x[k];
+            x[i] = sum/L[i*npar+i];
+        }
+
+        for (int j=0; j<npar; j++) t[j] = par[j]+x[j]/dg[j];
+        double tchi = chisq(t);
+
+        if (tchi<rss) {
+            bool conv = rss-tchi<=tol*rss;
+            std::copy_n(t,npar,par);
+            lab = std::max(lab/LABFAC,LABMIN);
+            rss = normal(par);
+            if (conv) return its;
+        }
+        else if ((lab*=LABFAC)>LABMAX) return its;
+    }
+
+    return -4;
+}
+template int fitProfile (const float*,const float*,int,int,bool,float*,double&,int,double);
+template int fitProfile (const double*,const double*,int,int,bool,double*,double&,int,double);
@@ -0,0 +1,60 @@
+//----------------------------------------------------------------
+// gaussfit.hh: Fit of Gaussian functions to spectra.
+//----------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#ifndef GAUSSFIT_HH_
+#define GAUSSFIT_HH_
+
+/// Fits y = a*exp(-(v-c)^2/(2*s^2)) to many spectra sampled on the same
+/// velocity axis, with the Levenberg-Marquardt algorithm of Lsqfit and
+/// analytic derivatives.
+///
+/// Spectra and parameters are stored by channel and by parameter (structure
+/// of arrays), so that all the loops run over the spectra and are vectorized:
+///  - spec[z*nspec+i]:  channel z of spectrum i.
+///  - par[k*nspec+i]:   parameter k (a, c, s) of spectrum i. On input the
+///                      initial guesses, on output the best-fit values.
+///  - ok[i]:            on input whether spectrum i has to be fitted, on
+///                      output whether the fit has converged.
+///
+/// Returns the number of iterations made.
+template <class T>
+int fitGaussians (const T *vels, const T *spec, int nchan, int nspec, T *par, bool *ok,
+                  int maxiter=200, double tol=1.E-03);
+
+
+/// Fits a single spectrum with the sum of ncomp Gaussian functions, with
+/// parameters (a,c,s) for each component in par, or, if hermite is true,
+/// with a Gauss-Hermite series to 4th order (van der Marel & Franx 1993),
+/// with parameters (a,c,s,h3,h4). par holds the initial guesses on input,
+/// the best-fit values on output, and rss the residual sum of squares.
+///
+/// Returns the number of iterations (>0) or an error code as Lsqfit::fit.
+template <class T>
+int fitProfile (const T *vels, const T *spec, int nchan, int ncomp, bool hermite, T *par, double &rss,
+                int maxiter=200, double tol=1.E-03);
+
+/// Value of the model of fitProfile() at velocity v.
+template <class T>
+T profileValue (T v, int ncomp, bool hermite, const T *par);
+
+#endif
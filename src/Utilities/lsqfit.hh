@@ -24,6 +24,13 @@
 #ifndef LSQFIT_HH_
 #define LSQFIT_HH_
 
+#include <cmath>
+#include <Utilities/lsqsolver.hpp>
+
+/// Least-squares fit of a function given through pointers to the function
+/// and to its derivatives. The fit is made by LsqSolver (lsqsolver.hpp),
+/// which should be used directly with a model functor when the function is
+/// known at compile time.
 template <class T>
 class Lsqfit
 {
@@ -34,17 +41,13 @@ public:
             void (*deriv)(T*, T*, T*, int), double tol=1.E-03, 
             int numiter=1000, double lab=1.E-03);
     
-    ~Lsqfit ();
+    ~Lsqfit () {}
     
     double getChi(){return chi;}
     void hold(const int i, const T val) {mpar[i]=false; fpar[i]=val;}      /// Hold a parameter fixed
     void free(const int i) {mpar[i]=true;}                                 /// Release a fixed parameter
 
     int fit ();                                 /// Make the fit.
-    int getvec ();                              /// Get correction vector.
-    void getmat ();                             /// Calculates matrix of coefficients.
-    int invmat ();                              /// Invert the matrix of coefficients.  
-
 
 private:
     T       *xdat;                  ///< X values.
@@ -57,16 +60,9 @@ private:
     bool    *mpar;                  ///< Mask for fixed parameters.
     int      npar;                  ///< Number of parameters.
     int      its;                   ///< Number of iterations.
-    double   oldchi;                ///< Old reduced chi-squared.
-    double   chi;                   ///< New reduced chi-squared.
+    double   chi;                   ///< Reduced chi-squared.
     double   labda;                 ///< Mixing parameter.
     double   tolerance;             ///< Accuracy.
-    int      nfree;                 ///< Number of free parameters. 
-    int     *parptr;                ///< Parameter pointer.
-    double  *vector;                ///< Correction vector.
-    double  **matrix1;              ///< Matrix of coefficients.
-    double  **matrix2;              ///< Inverse of matrix1.
-    bool     allAllocated;          ///< Has memory been allocated?
     
     T       (*func)(T *c, T *p, int numpar);                ///< Function to fit.
     void    (*derv)(T *c, T *p, T *d, int numpar);      ///< Parameters derivatives.
@@ -74,6 +70,41 @@ private:
 };
 
 
+/// Model functor for LsqSolver calling a function and its derivatives
+/// through pointers, as in Lsqfit.
+template <class T>
+struct FuncModel {
+    T    (*func)(T*,T*,int);
+    void (*derv)(T*,T*,T*,int);
+    T operator() (const T *c, const T *p, T *d, int npar) const {
+        T v = func(const_cast<T*>(c),const_cast<T*>(p),npar);
+        derv(const_cast<T*>(c),const_cast<T*>(p),d,npar);
+        return v;
+    }
+    T value (const T *c, const T *p, int npar) const {return func(const_cast<T*>(c),const_cast<T*>(p),npar);}
+};
+
+
+/// Model functor for LsqSolver: polynomial of order npar-1, as polyn().
+template <class T>
+struct PolyModel {
+    T operator() (const T *c, const T *p, T *d, int npar) const {
+        double xp = 1, v = 0;
+        for (int i=0; i<npar; i++) {
+            d[i] = xp;
+            v += p[i]*xp;
+            xp *= c[0];
+        }
+        return v;
+    }
+    T value (const T *c, const T *p, int npar) const {
+        double v = 0;
+        for (int i=npar; i--;) v = v*c[0]+p[i];
+        return v;
+    }
+};
+
+
 // Some fitting functions
 template <class T>
 T coreExp (T *c, T *p, int npar) {
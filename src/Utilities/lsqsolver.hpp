@@ -0,0 +1,405 @@
+// -----------------------------------------------------------------------
+// lsqsolver.hpp: Levenberg-Marquardt least-squares fits of compile-time
+//                model functions.
+// -----------------------------------------------------------------------
+
+/*-----------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation; either version 2 of the License, or (at your
+ option) any later version.
+
+ BBarolo is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BBarolo; if not, write to the Free Software Foundation,
+ Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA
+
+ Correspondence concerning BBarolo may be directed to:
+    Internet email: enrico.diteodoro@gmail.com
+-----------------------------------------------------------------------*/
+
+#ifndef LSQSOLVER_HPP_
+#define LSQSOLVER_HPP_
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+
+
+/// Buffers of a fit. Each thread has its own workspace (see lsqWorkspace()),
+/// which grows to the largest fit made and is reused by all the next ones.
+template <class T>
+struct LsqWorkspace {
+    std::vector<int>    parptr;         //< Indexes of the free parameters.
+    std::vector<int>    used;           //< Data with a positive weight.
+    std::vector<T>      deriv;          //< Derivatives of the model at one point.
+    std::vector<T>      trial;          //< Parameters after a correction.
+    std::vector<double> wgt;            //< Weights of the used data.
+    std::vector<double> res;            //< Residuals of the used data.
+    std::vector<double> jac;            //< Derivatives of the free parameters, by parameter.
+    std::vector<double> mat;            //< Matrix of coefficients (lower triangle).
+    std::vector<double> vec;            //< Right-hand side of the normal equations.
+    std::vector<double> scale;          //< Square roots of the diagonal of mat.
+    std::vector<double> smat;           //< Scaled matrix.
+    std::vector<double> fac;            //< Cholesky factor of the scaled matrix.
+    std::vector<double> corr;           //< Scaled correction vector.
+    std::vector<double> qr;             //< Scaled Jacobian for the QR factorization.
+    std::vector<double> invdiag;        //< Diagonal of the inverse of the scaled matrix.
+};
+
+
+template <class T>
+inline LsqWorkspace<T>& lsqWorkspace() {thread_local LsqWorkspace<T> ws; return ws;}
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// Least-squares fit of a model with the Levenberg-Marquardt algorithm of
+/// Lsqfit. The model is a functor, so that its evaluation is inlined:
+///
+///   T operator() (const T *x, const T *p, T *d, int npar) const;
+///        returns the model at x with parameters p and writes the
+///        derivatives with respect to the parameters in d.
+///   T value (const T *x, const T *p, int npar) const;
+///        returns the model only.
+///
+/// The derivatives of the free parameters are stored by parameter, so that
+/// the normal equations are built with vectorized dot products. The scaled
+/// matrix is solved with a Cholesky factorization. If this fails because of
+/// round-off, the factor is obtained with a Householder QR factorization of
+/// the scaled Jacobian instead. With lab=0, the model is linear in the free
+/// parameters and the fit is made in one step.
+/////////////////////////////////////////////////////////////////////////////////////
+template <class T, class Model>
+class LsqSolver
+{
+public:
+    LsqSolver(const Model &m, double tol=1.E-03, int numiter=1000, double lab=1.E-03) :
+        model(m), its(numiter), lab0(lab) {tolerance = tol<(FLT_EPSILON*10.0) ? FLT_EPSILON*10.0 : tol;}
+
+    int    fit(const T *x, int xdim, const T *y, const T *w, int n, T *par, T *errpar, const bool *maskpar, int npar);
+    double getChi() {return chi;}
+
+private:
+    static constexpr double LABMIN = 1.0e-10;       //< Minimum value for labda.
+    static constexpr double LABFAC = 10.0;          //< Labda step factor.
+    static constexpr double LABMAX = 1.0e+10;       //< Maximum value for labda.
+    static constexpr int MAXPARAM  = 32;            //< Maximum number of parameters.
+
+    Model   model;
+    int     its;                    //< Maximum number of iterations.
+    double  lab0;                   //< Initial mixing parameter.
+    double  tolerance;              //< Accuracy.
+    double  labda;                  //< Mixing parameter.
+    double  chi, oldchi;            //< Chi-squared before and after a correction.
+    int     nfree, nuse, ntot;      //< Free parameters, used data and parameters.
+    const T *xdat, *ydat;
+    int     xdim;
+    LsqWorkspace<T> *ws;
+
+    void   getmat(const T *par);
+    int    getvec(const T *par);
+    bool   cholesky(int n, const double *a, double *l);
+    bool   qrfactor(const double *scale);
+};
+
+
+template <class T, class Model>
+int LsqSolver<T,Model>::fit(const T *x, int xd, const T *y, const T *w, int n, T *par, T *errpar,
+                            const bool *maskpar, int npar) {
+
+    /// Makes the fit. Parameters are the same as in Lsqfit.
+    ///
+    /// \return           The number of interation (>0) or an error code:
+    ///                   -1 = Too many free parameters.
+    ///                   -2 = No free parameters.
+    ///                   -3 = Not enough degrees of freedom.
+    ///                   -4 = Reached max number of iterations.
+    ///                   -5 = Diagonal of matrix contains zeroes.
+    ///                   -6 = Determinant of the coefficient matrix is zero.
+    ///                   -7 = Square root of negative number.
+
+    ws = &lsqWorkspace<T>();
+    xdat = x; ydat = y; xdim = xd; ntot = npar;
+
+    ws->parptr.resize(npar);
+    nfree = 0;
+    for (int i=0; i<npar; i++) {
+        if (maskpar[i]) {
+            if (nfree > MAXPARAM) return -1;
+            ws->parptr[nfree++] = i;
+        }
+    }
+    if (nfree==0) return -2;
+
+    ws->used.clear();
+    ws->wgt.clear();
+    for (int i=0; i<n; i++) {
+        if (w[i]>0.0) {                                 // Legal weight.
+            ws->used.push_back(i);
+            ws->wgt.push_back(w[i]);
+        }
+    }
+    nuse = ws->used.size();
+    if (nfree>=nuse) return -3;
+
+    ws->deriv.resize(npar);
+    ws->trial.resize(npar);
+    ws->res.resize(nuse);
+    ws->jac.resize(size_t(nfree)*nuse);
+    ws->mat.resize(nfree*nfree);
+    ws->vec.resize(nfree);
+    ws->scale.resize(nfree);
+    ws->smat.assign(nfree*nfree,0.0);
+    ws->fac.assign(nfree*nfree,0.0);
+    ws->corr.resize(nfree);
+    ws->invdiag.resize(nfree);
+
+    labda = fabs(lab0)*LABFAC;
+    int r, itc = 0;
+    const int *pp = ws->parptr.data();
+
+    if (labda==0.0) {                                   // Linear fit.
+        for (int i=0; i<nfree; i++) par[pp[i]] = 0.0;
+        getmat(par);
+        r = getvec(par);
+        if (r) return r;
+        for (int i=0; i<npar; i++) {
+            par[i] = ws->trial[i];                      // Save new parameters
+            errpar[i] = 0.0;                            // and set errors to zero.
+        }
+        chi = oldchi = sqrt(oldchi/(double)(nuse-nfree));
+        for (int i=0; i<nfree; i++) {
+            double mii = ws->mat[i*nfree+i];
+            if (mii<=0.0 || ws->invdiag[i]<=0.0) return -7;
+            errpar[pp[i]] = oldchi*sqrt(ws->invdiag[i])/sqrt(mii);
+        }
+        return itc;
+    }
+
+    while (true) {                                      // Non-linear fit.
+        if (itc++ == its) return -4;
+        getmat(par);
+        if (labda>LABMIN) labda /= LABFAC;
+        r = getvec(par);
+        if (r) return r;
+
+        while (oldchi>=chi) {
+            if (labda>LABMAX) break;
+            labda *= LABFAC;
+            r = getvec(par);
+            if (r) return r;
+        }
+        if (labda<=LABMAX) {
+            for (int i=0; i<npar; i++) par[i] = ws->trial[i];
+        }
+        if (fabs(chi-oldchi)<=(tolerance*oldchi) || (labda>LABMAX)) {
+            labda = 0.0;
+            getmat(par);
+            r = getvec(par);
+            if (r) return r;
+
+            for (int i=0; i<npar; i++) errpar[i] = 0.0;
+            chi = sqrt(chi/(double)(nuse-nfree));
+            for (int i=0; i<nfree; i++) {
+                double mii = ws->mat[i*nfree+i];
+                if (mii<=0.0 || ws->invdiag[i]<=0.0) return -7;
+                errpar[pp[i]] = chi*sqrt(ws->invdiag[i])/sqrt(mii);
+            }
+            break;
+        }
+    }
+
+    return itc;
+}
+
+
+template <class T, class Model>
+void LsqSolver<T,Model>::getmat(const T *par) {
+
+    /// Builds the matrix of coefficients and the right-hand side of the
+    /// normal equations, and the chi-squared for parameters par.
+
+    const int *pp = ws->parptr.data(), *used = ws->used.data();
+    const double *wgt = ws->wgt.data();
+    double *res = ws->res.data(), *jac = ws->jac.data();
+    T *d = ws->deriv.data();
+
+    chi = 0.0;
+    for (int m=0; m<nuse; m++) {
+        const int n = used[m];
+        res[m] = ydat[n] - model(&xdat[xdim*n], par, d, ntot);
+        chi += res[m]*res[m]*wgt[m];
+        for (int j=0; j<nfree; j++) jac[size_t(j)*nuse+m] = d[pp[j]];
+    }
+
+    for (int j=0; j<nfree; j++) {
+        const double *jj = &jac[size_t(j)*nuse];
+        double v = 0;
+#pragma omp simd reduction(+:v)
+        for (int m=0; m<nuse; m++) v += jj[m]*wgt[m]*res[m];
+        ws->vec[j] = v;
+        for (int i=0; i<=j; i++) {
+            const double *ji = &jac[size_t(i)*nuse];
+            double s = 0;
+#pragma omp simd reduction(+:s)
+            for (int m=0; m<nuse; m++) s += ji[m]*jj[m]*wgt[m];
+            ws->mat[j*nfree+i] = s;
+        }
+    }
+}
+
+
+template <class T, class Model>
+int LsqSolver<T,Model>::getvec(const T *par) {
+
+    /// Calculates the correction vector for the current value of labda and
+    /// the chi-squared (oldchi) of the corrected parameters (trial). The
+    /// matrix is scaled so that its diagonal is 1 + labda. With labda=0,
+    /// the diagonal of the inverse of the scaled matrix is also calculated
+    /// for the errors.
+
+    const int nf = nfree;
+    double *mat = ws->mat.data(), *fac = ws->fac.data();
+    double *scale = ws->scale.data(), *s = ws->smat.data(), *z = ws->corr.data();
+
+    for (int j=0; j<nf; j++) {
+        if (mat[j*nf+j]<=0.0) return -5;
+        scale[j] = sqrt(mat[j*nf+j]);
+    }
+    for (int j=0; j<nf; j++) {
+        for (int i=0; i<j; i++) s[j*nf+i] = mat[j*nf+i]/scale[j]/scale[i];
+        s[j*nf+j] = 1.0 + labda;
+    }
+
+    if (!cholesky(nf,s,fac) && !qrfactor(scale)) return -6;
+
+    // Solving L L^T z = g, with g the scaled right-hand side
+    for (int j=0; j<nf; j++) {
+        double v = ws->vec[j]/scale[j];
+        for (int k=0; k<j; k++) v -= fac[j*nf+k]*z[k];
+        z[j] = v/fac[j*nf+j];
+    }
+    for (int j=nf; j--;) {
+        double v = z[j];
+        for (int k=j+1; k<nf; k++) v -= fac[k*nf+j]*z[k];
+        z[j] = v/fac[j*nf+j];
+    }
+
+    T *trial = ws->trial.data();
+    for (int i=0; i<ntot; i++) trial[i] = par[i];
+    for (int j=0; j<nf; j++) trial[ws->parptr[j]] += z[j]/scale[j];
+
+    oldchi = 0.0;
+    for (int m=0; m<nuse; m++) {
+        const int n = ws->used[m];
+        double dy = ydat[n] - model.value(&xdat[xdim*n], trial, ntot);
+        oldchi += ws->wgt[m]*dy*dy;
+    }
+
+    if (labda==0.0) {
+        // Diagonal of (L L^T)^-1: element k is the squared norm of column k of L^-1
+        for (int k=0; k<nf; k++) {
+            double sum = 0;
+            for (int j=k; j<nf; j++) {
+                double v = j==k ? 1.0 : 0.0;
+                for (int i=k; i<j; i++) v -= fac[j*nf+i]*z[i];
+                z[j] = v/fac[j*nf+j];
+                sum += z[j]*z[j];
+            }
+            ws->invdiag[k] = sum;
+        }
+    }
+
+    return 0;
+}
+
+
+template <class T, class Model>
+bool LsqSolver<T,Model>::cholesky(int n, const double *a, double *l) {
+
+    /// Cholesky factor l (lower triangle) of the symmetric matrix a, of
+    /// which only the lower triangle is used. False if a is not positive
+    /// definite.
+
+    for (int j=0; j<n; j++) {
+        double d = a[j*n+j];
+        for (int k=0; k<j; k++) d -= l[j*n+k]*l[j*n+k];
+        if (!(d>0.0)) return false;
+        l[j*n+j] = sqrt(d);
+        for (int i=j+1; i<n; i++) {
+            double v = a[i*n+j];
+            for (int k=0; k<j; k++) v -= l[i*n+k]*l[j*n+k];
+            l[i*n+j] = v/l[j*n+j];
+        }
+    }
+    return true;
+}
+
+
+template <class T, class Model>
+bool LsqSolver<T,Model>::qrfactor(const double *scale) {
+
+    /// Factor of the scaled matrix from the Householder QR factorization of
+    /// the scaled Jacobian, with sqrt(labda) rows for the diagonal term:
+    /// if A = QR, A^T A = R^T R, and L = R^T. False if R is singular.
+
+    const int nf = nfree, nr = nuse+nf;
+    std::vector<double> &a = ws->qr;               // Column-major, nr x nf
+    a.assign(size_t(nr)*nf, 0.0);
+    double sl = sqrt(labda);
+    for (int j=0; j<nf; j++) {
+        double *aj = &a[size_t(j)*nr];
+        const double *jj = &ws->jac[size_t(j)*nuse];
+        for (int m=0; m<nuse; m++) aj[m] = jj[m]*sqrt(ws->wgt[m])/scale[j];
+        aj[nuse+j] = sl;
+    }
+
+    double *fac = ws->fac.data();
+    for (int j=0; j<nf; j++) {
+        double *aj = &a[size_t(j)*nr];
+        double norm = 0;
+        for (int m=j; m<nr; m++) norm += aj[m]*aj[m];
+        norm = sqrt(norm);
+        if (norm==0.0) return false;
+        double alpha = aj[j]>0 ? -norm : norm;
+        aj[j] -= alpha;
+        double vnorm = 0;
+        for (int m=j; m<nr; m++) vnorm += aj[m]*aj[m];
+        for (int k=j+1; k<nf; k++) {
+            double *ak = &a[size_t(k)*nr];
+            double dot = 0;
+            for (int m=j; m<nr; m++) dot += aj[m]*ak[m];
+            dot *= 2.0/vnorm;
+            for (int m=j; m<nr; m++) ak[m] -= dot*aj[m];
+        }
+        // Row j of R is column j of L, with a positive diagonal
+        double sign = alpha<0 ? -1.0 : 1.0;
+        fac[j*nf+j] = sign*alpha;
+        for (int k=j+1; k<nf; k++) fac[k*nf+j] = sign*a[size_t(k)*nr+j];
+    }
+    return true;
+}
+
+
+/// Makes nfit independent fits of the same model to data sampled at the same
+/// points x, with the same weights w. The data of fit f are y[f*n+i], its
+/// parameters and errors par[f*npar+k] and errpar[f*npar+k], and ret[f] is
+/// the return value of LsqSolver::fit. The fits are shared among nthreads
+/// threads, each with its own workspace.
+template <class T, class Model>
+void lsqFitBatch(const Model &model, int nfit, const T *x, int xdim, const T *y, const T *w, int n,
+                 T *par, T *errpar, const bool *maskpar, int npar, int *ret,
+                 double tol=1.E-03, int numiter=1000, double lab=1.E-03, int nthreads=1) {
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic,16)
+    for (int f=0; f<nfit; f++) {
+        LsqSolver<T,Model> lsq(model,tol,numiter,lab);
+        ret[f] = lsq.fit(x,xdim,&y[size_t(f)*n],w,n,&par[size_t(f)*npar],&errpar[size_t(f)*npar],maskpar,npar);
+    }
+}
+
+#endif
@@ -49,20 +49,16 @@ ParamGuess<T>::ParamGuess(Cube<T> *c, Detection<T> *object) {
     /// Extracting intensity and velocity field
     Vemap = new T[in->DimX()*in->DimY()];
     Intmap = new T[in->DimX()*in->DimY()];
-    std::vector<Voxel<T> > voxelList = obj->getPixelSet(in->Array(), in->AxisDim());
     float *fluxint = new float[in->DimX()*in->DimY()];
     float *fluxsum = new float[in->DimX()*in->DimY()];
     for (int i=0; i<in->DimX()*in->DimY();i++) fluxint[i] = fluxsum[i] = Intmap[i]= 0;
     
-    for(auto &vox : voxelList) {
-        int x = vox.getX();
-        int y = vox.getY();
-        int z = vox.getZ();
+    obj->forEachVoxel([&](long x, long y, long z) {
         float flux = in->Array(x,y,z);
         fluxsum[x+y*in->DimX()] += flux;
         fluxint[x+y*in->DimX()] += flux*in->getZphys(z);
         Intmap[x+y*in->DimX()] += flux;
-    }
+    });
     
     totflux_obs=0;
     for (int i=0; i<in->DimX()*in->DimY();i++) {
@@ -154,11 +150,18 @@ void ParamGuess<T>::findPositionAngle(int algorithm) {
         // position angle. The PA that returns the highest median value is the 
         // best kinematical PA.
         
-        double maxdev=0, bestpa=0, p=0, vl=0, vr=0;
-        // Loop over PA with step 0.5 degrees
-        while (p<180) {
+        // The velocity field is sampled along the line through the centre
+        // at each PA, with step 0.5 degrees. Angles are independent, so
+        // that they are scanned in parallel.
+        const int nang = 360;
+        std::vector<double> meddev(nang,0), sumleft(nang,0), sumright(nang,0);
+        std::vector<bool> valid(nang,false);
+
+#pragma omp parallel for num_threads(in->pars().getThreads()) schedule(dynamic)
+        for (int a=0; a<nang; a++) {
+            double p = 0.5*a;
             std::vector<T> vdev;
-            double sumleft=0, sumright=0;
+            vdev.reserve(std::max(Xmax-Xmin,Ymax-Ymin)+1);
             if (p>45 && p<135) {
                 // If 45 < PA < 135 it is better to loop over y
                 for (int y=Ymin; y<=Ymax; y++) {
@@ -173,12 +176,12 @@ void ParamGuess<T>::findPositionAngle(int algorithm) {
                     vdev.push_back(fabs(Vemap[npix]-vsystem));
                     // Getting info on which side we have the highest velocity
                     if (p<=90) {
-                        if (y<ycentre) sumleft += Vemap[npix]-vsystem;
-                        else sumright += Vemap[npix]-vsystem;
+                        if (y<ycentre) sumleft[a] += Vemap[npix]-vsystem;
+                        else sumright[a] += Vemap[npix]-vsystem;
                     }
                     else {
-                        if (x<xcentre) sumleft += Vemap[npix]-vsystem;
-                        else sumright += Vemap[npix]-vsystem;
+                        if (x<xcentre) sumleft[a] += Vemap[npix]-vsystem;
+                        else sumright[a] += Vemap[npix]-vsystem;
                     }
                 }
             }
@@ -194,22 +197,26 @@ void ParamGuess<T>::findPositionAngle(int algorithm) {
                     // Collecting the absolute difference from the VSYS
                     vdev.push_back(fabs(Vemap[npix]-vsystem));
                     // Getting info on which side we have the highest velocity
-                    if (x<xcentre) sumleft += Vemap[npix]-vsystem;
-                    else sumright += Vemap[npix]-vsystem;
+                    if (x<xcentre) sumleft[a] += Vemap[npix]-vsystem;
+                    else sumright[a] += Vemap[npix]-vsystem;
                 }
             }
 
             // Calculating the median deviation from VSYS
-            T median = findMedian<T>(&vdev[0], vdev.size());
-            // If the median is so far the highest, assign best pa
-            if (median>maxdev && fabs(median)<1E16) {
-                maxdev = median;
-                bestpa = p;
-                vl = sumleft;
-                vr = sumright;
-            }
+            if (vdev.size()==0) continue;
+            meddev[a] = findMedian<T>(&vdev[0], vdev.size(), true);
+            valid[a]  = true;
+        }
 
-            p+=0.5;
+        // The PA with the highest median (the first one, in case of ties)
+        double maxdev=0, bestpa=0, vl=0, vr=0;
+        for (int a=0; a<nang; a++) {
+            if (valid[a] && meddev[a]>maxdev && fabs(meddev[a])<1E16) {
+                maxdev = meddev[a];
+                bestpa = 0.5*a;
+                vl = sumleft[a];
+                vr = sumright[a];
+            }
         }
 
         // Rotate the PA to conform to BBarolo's definition.
@@ -237,27 +244,50 @@ void ParamGuess<T>::findPositionAngle(int algorithm) {
         int xsize = fabs(obj->getXmax()-obj->getXmin())+1;
         int ysize = fabs(obj->getYmax()-obj->getYmin())+1;
         
+        // Rows are scanned in parallel. Each row keeps its own extremes,
+        // which are then merged in order, as in a sequential scan.
+        const int nrows = std::max(ysize-2*range,0);
+        std::vector<float> row_low(nrows,vel_low), row_high(nrows,vel_high);
+        std::vector<int> xrow_low(nrows,-1), xrow_high(nrows,-1);
+
+#pragma omp parallel num_threads(in->pars().getThreads())
+{
+        std::vector<T> vec((2*range+1)*(2*range+1));
+#pragma omp for schedule(dynamic)
         for (int y=range; y<ysize-range; y++) {
+            int r = y-range;
             for (int x=range; x<xsize-range; x++) {
                 long npix = (y+Ymin)*in->DimX()+x+Xmin;
                 if (isNaN<T>(Vemap[npix])) continue;
-                std::vector<T> vec;
+                size_t nv = 0;
                 for (int yi=y-range; yi<=y+range; yi++) 
                     for (int xi=x-range; xi<=x+range; xi++) 
-                        vec.push_back(Vemap[(yi+Ymin)*in->DimX()+xi+Xmin]);
-                T median = findMedian<T>(&vec[0], vec.size());
-                if (median<vel_low && median>=velmin) {
-                    vel_low = median;
-                    coord_low[0] = x+Xmin;
-                    coord_low[1] = y+Ymin;
+                        vec[nv++] = Vemap[(yi+Ymin)*in->DimX()+xi+Xmin];
+                T median = findMedian<T>(&vec[0], nv, true);
+                if (median<row_low[r] && median>=velmin) {
+                    row_low[r] = median;
+                    xrow_low[r] = x;
                 }
-                if (median>vel_high && median<=velmax) {
-                    vel_high = median;
-                    coord_high[0] = x+Xmin;
-                    coord_high[1] = y+Ymin;
+                if (median>row_high[r] && median<=velmax) {
+                    row_high[r] = median;
+                    xrow_high[r] = x;
                 }
             }
         }
+}
+
+        for (int r=0; r<nrows; r++) {
+            if (xrow_low[r]>=0 && row_low[r]<vel_low) {
+                vel_low = row_low[r];
+                coord_low[0] = xrow_low[r]+Xmin;
+                coord_low[1] = r+range+Ymin;
+            }
+            if (xrow_high[r]>=0 && row_high[r]>vel_high) {
+                vel_high = row_high[r];
+                coord_high[0] = xrow_high[r]+Xmin;
+                coord_high[1] = r+range+Ymin;
+            }
+        }
 
         std::vector<int> xx(3), yy(3);
         xx[0]=coord_low[0]; xx[1]=coord_high[0]; xx[2]=lround(xcentre);
@@ -350,7 +380,6 @@ void ParamGuess<T>::findInclination(int algorithm) {
         }
 
         // Deciding what function to pass to the optimizer, depending on chosen algorithm.
-        auto func2 = std::bind(funcEllipse<T>, std::placeholders::_1, in, posang, xcentre, ycentre, Vemap);
         auto func3 = std::bind(funcIncfromMap<T>, std::placeholders::_1, in, radsep, Rmax, posang, xcentre, ycentre, vsystem, Intmap, totflux_obs);
 
         NelderMead optimizer;
@@ -358,7 +387,10 @@ void ParamGuess<T>::findInclination(int algorithm) {
         double *mymin;
         try {
             if (algorithm==3) mymin = optimizer.minimize(point,dels,func3);
-            else mymin = optimizer.minimize(point,dels,func2);
+            else {
+                EllipseCount<T> func2(in, posang, xcentre, ycentre, Vemap);
+                mymin = optimizer.minimize(point,dels,func2);
+            }
         }
         catch (...) {
             std::cerr << "PARAMGUESS ERROR: Error while estimating inclination." << std::endl;
@@ -523,33 +555,54 @@ void ParamGuess<T>::tuneWithTiltedRing() {
     mpar[INC]  = false;
 
     tr.setoption(mpar,3,2,15.);
-    // Fitting a tilted-ring model
-    tr.ringfit(in->pars().getThreads(),false,false);
-    //tr.printfinal(std::cout,in->Head());
-    std::ofstream fileo(in->pars().getOutfolder()+in->Head().Name()+"_2drings.txt");
-    tr.printfinal(fileo,in->Head());
 
-    //tr.set(nr,radii,rwidth,tr.getVsysf(0),tr.getVrotf(0),0,tr.getPosaf(0),tr.getInclf(0),tr.getXposf(0),tr.getYposf(0));
-    //mpar[PA] = false;
-    //tr.setoption(mpar,3,2,15.);
-    //tr.ringfit(in->pars().getThreads(),false,false);
-    //tr.printfinal(std::cout,in->Head());
+    // Fitting a tilted-ring model. Rings are fitted from the centre outwards
+    // in blocks. If stopEarly, the fit stops as soon as a new block changes
+    // the median centre by less than 0.25 pixels, the median systemic
+    // velocity by less than 1/4 of channel and the median PA by less than
+    // 0.5 degrees.
+    const int nthreads = in->pars().getThreads();
+    const int block = stopEarly ? std::max(16,4*nthreads) : nr;
+    const double dvel = 0.25*fabs(DeltaVel(in->Head()));
 
     std::vector<T> xcen,ycen,vsys,posa,incl;
-    for (int i=1; i<nr; i++) {  // Skipping first ring
-        if (!isNaN(tr.getXposf(i))) xcen.push_back(tr.getXposf(i));
-        if (!isNaN(tr.getYposf(i))) ycen.push_back(tr.getYposf(i));
-        if (!isNaN(tr.getVsysf(i))) vsys.push_back(tr.getVsysf(i));
-        if (!isNaN(tr.getInclf(i))) incl.push_back(tr.getInclf(i));
-        if (!isNaN(tr.getPosaf(i))) posa.push_back(tr.getPosaf(i));
+    T med[5], prev[5];
+    for (int j=0; j<5; j++) med[j] = prev[j] = log(-1);
+
+    for (int nfit=0; nfit<nr;) {
+        int last = std::min(nr,nfit+block);
+        tr.ringfit(nthreads,false,false,nfit,last);
+
+        for (int i=std::max(nfit,1); i<last; i++) {  // Skipping first ring
+            if (!isNaN(tr.getXposf(i))) xcen.push_back(tr.getXposf(i));
+            if (!isNaN(tr.getYposf(i))) ycen.push_back(tr.getYposf(i));
+            if (!isNaN(tr.getVsysf(i))) vsys.push_back(tr.getVsysf(i));
+            if (!isNaN(tr.getInclf(i))) incl.push_back(tr.getInclf(i));
+            if (!isNaN(tr.getPosaf(i))) posa.push_back(tr.getPosaf(i));
+        }
+        nfit = last;
+
+        // Medians of the rings fitted so far
+        std::vector<T> *par[5] = {&xcen,&ycen,&vsys,&incl,&posa};
+        for (int j=0; j<5; j++) {
+            prev[j] = med[j];
+            if (par[j]->size()>1) med[j] = findMedian(&(*par[j])[0],par[j]->size());
+        }
+
+        bool stable = fabs(med[0]-prev[0])<0.25 && fabs(med[1]-prev[1])<0.25 &&
+                      fabs(med[2]-prev[2])<dvel && fabs(med[4]-prev[4])<0.5;
+        if (stopEarly && stable) break;
     }
 
+    std::ofstream fileo(in->pars().getOutfolder()+in->Head().Name()+"_2drings.txt");
+    tr.printfinal(fileo,in->Head());
+
     // Setting initial estimates to the median of the tilted-ring model
-    if (xcen.size()>1) xcentre = findMedian(&xcen[0],xcen.size());
-    if (ycen.size()>1) ycentre = findMedian(&ycen[0],ycen.size());
-    if (vsys.size()>1) vsystem = findMedian(&vsys[0],vsys.size());
-    if (incl.size()>1) inclin  = findMedian(&incl[0],incl.size());
-    if (posa.size()>1) posang  = findMedian(&posa[0],posa.size());
+    if (xcen.size()>1) xcentre = med[0];
+    if (ycen.size()>1) ycentre = med[1];
+    if (vsys.size()>1) vsystem = med[2];
+    if (incl.size()>1) inclin  = med[3];
+    if (posa.size()>1) posang  = med[4];
 
     // Re-estimating inclination angle with the latest parameters
     findInclination(2);
@@ -770,28 +823,44 @@ int ParamGuess<T>::plotGuess(std::string outfile) {
 
 
 template <class T>
-double funcEllipse(std::vector<double> &mypar, Cube<T> *c, double pa, double xcen, double ycen, T* Vf) {
+EllipseCount<T>::EllipseCount(Cube<T> *c, double pa, double xcen, double ycen, T* Vf) {
+
+    pixscale = c->Head().PixScale()*arcsconv(c->Head().Cunit(0));
+    nthreads = c->pars().getThreads();
+    pa *= M_PI/180.;
+
+    const size_t npix = size_t(c->DimX())*c->DimY();
+    xr.resize(npix);
+    yr.resize(npix);
+    blank.resize(npix);
+
+#pragma omp parallel for num_threads(nthreads)
+    for (size_t i=0; i<npix; i++) {
+        int x = i%c->DimX(), y = i/c->DimX();
+        xr[i] =  -(x-xcen)*sin(pa)+(y-ycen)*cos(pa);
+        yr[i] = (-(x-xcen)*cos(pa)-(y-ycen)*sin(pa));
+        blank[i] = isNaN(Vf[i]) ? 1 : -1;
+    }
+}
+
+
+template <class T>
+double EllipseCount<T>::operator() (std::vector<double> &mypar) {
 
     if (mypar[0]<0)  mypar[0]= fabs(mypar[0]);
     if (mypar[1]>90) mypar[1]= 180 - mypar[1];
 
-    T R   = mypar[0]/(c->Head().PixScale()*arcsconv(c->Head().Cunit(0)));
+    T R   = mypar[0]/pixscale;
     T inc = mypar[1]*M_PI/180.;
-    pa   *= M_PI/180.;//mypar[2];
-    //T x0  = mypar[3];
-    //T y0  = mypar[4];
-
-    double func = 0;
-    for (int x=0; x<c->DimX(); x++) {
-        for (int y=0; y<c->DimY(); y++) {
-            T xr =  -(x-xcen)*sin(pa)+(y-ycen)*cos(pa);
-            T yr = (-(x-xcen)*cos(pa)-(y-ycen)*sin(pa))/cos(inc);
-            T r = sqrt(xr*xr+yr*yr);
-            bool isIn = r<=R;
-            if (!isIn) continue;
-            if (isNaN(Vf[x+y*c->DimX()])) func++;
-            else func--;
-        }
+    T cosi = cos(inc);
+
+    long func = 0;
+    const size_t npix = xr.size();
+#pragma omp parallel for num_threads(nthreads) reduction(+:func)
+    for (size_t i=0; i<npix; i++) {
+        T yi = yr[i]/cosi;
+        T r  = sqrt(xr[i]*xr[i]+yi*yi);
+        if (r<=R) func += blank[i];
     }
     return func;
 }
@@ -894,6 +963,7 @@ ParamGuess<T>* EstimateInitial(Cube<T> *c, GALFIT_PAR *p){
     }
 
     ParamGuess<T> *ip = new ParamGuess<T>(c,largest);
+    ip->stopEarly = p->FASTGUESS;
 
     // Estimating systemic velocity if not given
     if (p->VSYS!="-1") ip->vsystem = atof(p->VSYS.c_str());
@@ -943,3 +1013,5 @@ template ParamGuess<double>* EstimateInitial(Cube<double> *, GALFIT_PAR *);
 // Explicit instantiation of the class
 template class ParamGuess<float>;
 template class ParamGuess<double>;
+template class EllipseCount<float>;
+template class EllipseCount<double>;
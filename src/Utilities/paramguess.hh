@@ -25,6 +25,7 @@
 #define PARAMGUESS_HH_
 
 #include <iostream>
+#include <cstdint>
 #include <Arrays/param.hh>
 #include <Arrays/cube.hh>
 #include <Map/detection.hh>
@@ -57,6 +58,7 @@ public:
     T   radsep  = 0;        //< Ring width
     T*  Intmap;             //< Intensity map
     T*  Vemap;              //< Velocity field
+    bool stopEarly = false; //< Whether tuneWithTiltedRing() stops once the estimates are stable
 
     // Constructor and destructor
     ParamGuess(Cube<T> *c, Detection<T> *object);
@@ -92,9 +94,24 @@ private:
     
 };
 
-// Function to minimize to find inclination with algorithm 2
+// Function to minimize to find inclination with algorithm 2: number of blank
+// minus number of valid pixels of the velocity field within the ellipse of
+// radius mypar[0] (arcsec) and inclination mypar[1]. The pixels are projected
+// on the axes of the galaxy once, so that an evaluation is a plain reduction.
 template <class T>
-double funcEllipse(std::vector<double> &mypar, Cube<T> *c, double pa, double xcen, double ycen, T* Vf);
+class EllipseCount
+{
+public:
+    EllipseCount(Cube<T> *c, double pa, double xcen, double ycen, T* Vf);
+    double operator() (std::vector<double> &mypar);
+
+private:
+    std::vector<T>      xr;         //< Coordinate along the major axis.
+    std::vector<T>      yr;         //< Coordinate along the minor axis (projected).
+    std::vector<int8_t> blank;      //< +1 for blank pixels, -1 for valid pixels.
+    double pixscale;                //< Pixel size in arcsec.
+    int    nthreads;                //< Number of threads.
+};
 
 // Function to minimize to find inclination with algorithm 3
 template <class T>
@@ -1052,8 +1052,22 @@ template double* SimulateNoise(double,size_t);
 
 template <class T>
 T* Smooth1D(T *inarray,size_t npts,std::string windowType,size_t windowSize) {
+
+    // Performs smoothing on a single 1D array and returns a new array.
+
+    T *newarray = new T[npts];
+    Smooth1D(inarray,newarray,npts,windowType,windowSize);
+    return newarray;
+}
+template float* Smooth1D(float*,size_t,std::string,size_t);
+template double* Smooth1D(double*,size_t,std::string,size_t);
+
+
+template <class T>
+void Smooth1D(T *inarray, T *outarray, size_t npts, std::string windowType, size_t windowSize) {
     
-    // Performs smoothing on a single 1D array. Accepted windows are below 
+    // Performs smoothing on a single 1D array, writing in outarray.
+    // Accepted windows are below 
     
     bool known_window = windowType=="HANNING" || windowType=="HANNING2" ||
                         windowType=="BOXCAR"  || windowType=="TOPHAT"   || 
@@ -1072,7 +1086,8 @@ T* Smooth1D(T *inarray,size_t npts,std::string windowType,size_t windowSize) {
     }
    
     // Defining coefficients for smoothing
-    double *coeff = new double[windowSize];
+    ScratchScope scratch;
+    double *coeff = scratch.alloc<double>(windowSize);
     float scale = (windowSize+1.)/2.;
     float N = windowSize-1;
     float sum = 0;
@@ -1096,18 +1111,15 @@ T* Smooth1D(T *inarray,size_t npts,std::string windowType,size_t windowSize) {
     }
     
     // Smooth
-    T *newarray = new T[npts];
     for(size_t i=0; i<npts; i++){
-        newarray[i] = 0.;
+        outarray[i] = 0.;
         for(size_t j=0; j<windowSize; j++){
             float x = j-(windowSize-1)/2.;
-            if((i+x>0)&&(i+x<npts)) newarray[i] += coeff[j]/sum*inarray[i+int(x)];
+            if((i+x>0)&&(i+x<npts)) outarray[i] += coeff[j]/sum*inarray[i+int(x)];
         }
     }
-    delete [] coeff;
-    return newarray;
 }
-template float* Smooth1D(float*,size_t,std::string,size_t);
-template double* Smooth1D(double*,size_t,std::string,size_t);
+template void Smooth1D(float*,float*,size_t,std::string,size_t);
+template void Smooth1D(double*,double*,size_t,std::string,size_t);
 
 
@@ -53,6 +53,8 @@ template <class T> void findMinMax(const T *array, const size_t size, T &min, T
 template <class T> void findAllStats(T *array, size_t size, T &mean, T &stddev, T &median, T &madfm);
 template <class T> void findAllStats(T *array, size_t size, T &mean, T &stddev, T &median, T &madfm, T &maxx, T &minn);
 template <class T> void findAllStats(T *array, size_t size, bool *mask, T &mean, T &stddev, T &median, T &madfm, T &maxx, T &minn);
+template <class T> size_t findAllStats(T *array, size_t size, bool *mask, T &mean, T &stddev, T &median, T &madfm,
+                                       T &maxx, T &minn, int nthreads, size_t maxSample=0);
 template <class T> T findMean(T *array, size_t size); 
 template <class T> T findMean(T *array, bool *mask, size_t size);
 template <class T> T findStddev(T *array, size_t size);
@@ -113,10 +115,13 @@ template <class T> bool bezier_interp(std::vector<T> x_in,  std::vector<T> y_in,
 /// FITS-related functions. Defined in fitsUtils.cpp
 template <class T> int selectBitpix();
 template <class T> int selectDatatype();
+int  selectCompression(std::string type);
 void FitsWrite_2D (const char *filename, float *image, long xsize, long ysize);
 void FitsWrite_2D (const char *filename, double *image, long xsize, long ysize);
 void FitsWrite_3D (const char *outfile, float *outcube, long *dimAxes);
 void FitsWrite_3D (const char *outfile, short *outcube, long *dimAxes);
+template <class T> bool FitsWrite_data (const char *outfile, T *data, size_t size, int nthreads=1, bool async=false);
+bool FitsWrite_wait (std::string outfile="");
 int  modhead(int argc, char *argv[]);
 int  remhead(int argc, char *argv[]);
 int  listhead(int argc, char *argv[]);
@@ -177,6 +182,7 @@ double* getCenterCoordinates(std::string *pos, Header &h);
 template <class T> T* RingRegion (Rings<T> *r, Header &h);
 template <class T> T* SimulateNoise(double stddev, size_t size);
 template <class T> T* Smooth1D(T *inarray, size_t npts, std::string windowType, size_t windowSize);
+template <class T> void Smooth1D(T *inarray, T *outarray, size_t npts, std::string windowType, size_t windowSize);
 
 
 #endif
@@ -171,13 +171,27 @@ bool BBcore (Param *par) {
         c->pars().setShowbar(false);
     }
 
-    // Reading in FITS file
-    if (!c->readCube(par->getImageFile())) {
+    // Reading in FITS file. For an out-of-core search, only the header is read.
+    bool slabSearch = par->getflagSearch() && par->getParSE().slabChannels>0;
+    if (!c->readCube(par->getImageFile(),true,!slabSearch)) {
         std::cout << par->getImageFile() << " is not a readable FITS file!\n";
         delete c;
         return false;
     }
 
+    // Out-of-core source finding: the cube is never in memory, so no other task can run.
+    if (slabSearch) {
+        if (par->getflagGalFit() || par->getflagGalMod() || par->getflagSmooth() || par->getMakeMask() ||
+            par->getFlagStats() || par->getFlatContsub() || par->getParSE().cubelets)
+            std::cout << "\nBBAROLO WARNING: only SEARCH is run when SLABCHANNELS is set.\n";
+        c->searchSlabs();
+        std::ofstream detout((outfolder+"detections.txt").c_str());
+        c->printDetections(detout);
+        delete c;
+        outf.close();
+        return true;
+    }
+
     // Fully automated run
     if (par->getFlagAuto()) {
         //return BBauto(c);
@@ -332,6 +346,20 @@ bool BBcore (Param *par) {
             map.RMSMap(masking);
             map.fitswrite_2d((s+"map_RMS.fits").c_str());
         }
+        if (par->getParMA().maptype=="MULTIGAUSS") {
+            std::vector< MomentMap<BBreal> > cmaps = getComponentMaps<BBreal>(c,masking);
+            cmaps[0].fitswrite_2d((s+"map_ncomp.fits").c_str());
+            for (int k=0; k<par->getParMA().maxcomp; k++) {
+                std::string cs = "_c"+to_string<int>(k+1,0)+".fits";
+                cmaps[1+3*k].fitswrite_2d((s+"map_0th"+cs).c_str());
+                cmaps[2+3*k].fitswrite_2d((s+"map_1st"+cs).c_str());
+                cmaps[3+3*k].fitswrite_2d((s+"map_2nd"+cs).c_str());
+            }
+            if (par->getParMA().gausshermite) {
+                cmaps[cmaps.size()-2].fitswrite_2d((s+"map_h3.fits").c_str());
+                cmaps[cmaps.size()-1].fitswrite_2d((s+"map_h4.fits").c_str());
+            }
+        }
         if (par->getParMA().globprof) {
             Image2D<BBreal> spectrum;
             spectrum.extractGlobalSpectrum(c);
@@ -403,11 +431,15 @@ bool BBcore (Param *par) {
     }
     //-----------------------------------------------------------------
 
+    // Model cubes may still be written in background
+    bool written = FitsWrite_wait();
+    if (!written) std::cerr << "BBAROLO ERROR: some output FITS files could not be written.\n";
+
     delete c;
 
     outf.close();
 
-    return true;
+    return written;
 }
 
 bool BBauto (Cube<BBreal> *c) {
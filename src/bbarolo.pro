@@ -11,6 +11,8 @@ SOURCES += \
     Map/object2D.cpp \
     Map/object3D.cpp \
     Map/objectgrower.cpp \
+    Map/labeller.cpp \
+    Map/detectiongrid.cpp \
     Map/scan.cpp \
     Map/voxel.cpp \
     Arrays/cube.cpp \
@@ -18,6 +20,10 @@ SOURCES += \
     Arrays/image.cpp \
     Arrays/param.cpp \
     Arrays/stats.cpp \
+    Arrays/noise.cpp \
+    Arrays/packed.cpp \
+    Arrays/tilecache.cpp \
+    Arrays/ringindex.cpp \
     Tasks/ellprof.cpp \
     Tasks/galfit_errors.cpp \
     Tasks/galfit_min.cpp \
@@ -30,11 +36,13 @@ SOURCES += \
     Tasks/search.cpp \
     Tasks/slitfit.cpp \
     Tasks/smooth3D.cpp \
+    Tasks/reconstruct.cpp \
     Tasks/spacepar.cpp \
     Utilities/conv2D.cpp \
     Utilities/converter.cpp \
     Utilities/fitsUtils.cpp \
     Utilities/interpolation.cpp \
+    Utilities/gaussfit.cpp \
     Utilities/lsqfit.cpp \
     Utilities/paramguess.cpp \
     Utilities/progressbar.cpp \
@@ -51,6 +59,8 @@ HEADERS += \
     Map/object2D.hh \
     Map/object3D.hh \
     Map/objectgrower.hh \
+    Map/labeller.hh \
+    Map/detectiongrid.hh \
     Map/scan.hh \
     Map/voxel.hh \
     Arrays/cube.hh \
@@ -59,6 +69,10 @@ HEADERS += \
     Arrays/param.hh \
     Arrays/rings.hh \
     Arrays/stats.hh \
+    Arrays/noise.hh \
+    Arrays/packed.hh \
+    Arrays/tilecache.hh \
+    Arrays/ringindex.hh \
     Tasks/ellprof.hh \
     Tasks/galfit.hh \
     Tasks/galmod.hh \
@@ -67,12 +81,15 @@ HEADERS += \
     Tasks/ringmodel.hh \
     Tasks/search.hh \
     Tasks/smooth3D.hh \
+    Tasks/reconstruct.hh \
     Tasks/spacepar.hh \
     Utilities/allocator.hpp \
     Utilities/conv2D.hh \
     Utilities/converter.hh \
     Utilities/gnuplot.hh \
+    Utilities/gaussfit.hh \
     Utilities/lsqfit.hh \
+    Utilities/lsqsolver.hpp \
     Utilities/optimization.hh \
     Utilities/paramguess.hh \
     Utilities/progressbar.hh \